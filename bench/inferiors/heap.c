@@ -0,0 +1,27 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "inferiors.h"
+
+// called once the buffer is filled, with its address and size in rdi and rsi
+__attribute__((noinline)) void ready(unsigned char* buffer, size_t size)
+{
+    __asm__ volatile("" : : "r"(buffer), "r"(size) : "memory");
+}
+
+int main(void)
+{
+    unsigned char* buffer = malloc(BENCH_HEAP_SIZE);
+    if (buffer == NULL) {
+        return 1;
+    }
+
+    for (size_t i = 0; i < BENCH_HEAP_SIZE; i++) {
+        buffer[i] = (unsigned char)(i * 31);
+    }
+
+    ready(buffer, BENCH_HEAP_SIZE);
+
+    free(buffer);
+    return 0;
+}
@@ -0,0 +1,18 @@
+#include "inferiors.h"
+
+// the breakpoint target, called once per iteration
+__attribute__((noinline)) int tick(int value)
+{
+    __asm__ volatile("");
+    return value + 1;
+}
+
+int main(void)
+{
+    int value = 0;
+    for (int i = 0; i < BENCH_HOT_LOOP_CALLS; i++) {
+        value = tick(value);
+    }
+
+    return value == BENCH_HOT_LOOP_CALLS ? 0 : 1;
+}
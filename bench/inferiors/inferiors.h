@@ -0,0 +1,10 @@
+#pragma once
+
+// Shared between the benchmark inferiors and tdb_bench, which launches them without
+// arguments.
+
+#define BENCH_HOT_LOOP_CALLS 200000
+#define BENCH_RECURSION_DEPTH 1000
+#define BENCH_THREAD_COUNT 16
+#define BENCH_THREAD_CALLS 2000
+#define BENCH_HEAP_SIZE (64u << 20)
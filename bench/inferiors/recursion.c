@@ -0,0 +1,23 @@
+#include "inferiors.h"
+
+// where the stack is deepest
+__attribute__((noinline)) int bottom(int depth)
+{
+    __asm__ volatile("");
+    return depth;
+}
+
+__attribute__((noinline)) int recurse(int depth)
+{
+    if (depth == BENCH_RECURSION_DEPTH) {
+        return bottom(depth);
+    }
+
+    // not a tail call, so every level keeps its frame
+    return recurse(depth + 1) + 1;
+}
+
+int main(void)
+{
+    return recurse(0) == 2 * BENCH_RECURSION_DEPTH ? 0 : 1;
+}
@@ -0,0 +1,46 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "inferiors.h"
+
+static atomic_bool g_done;
+
+__attribute__((noinline)) int tick(int value)
+{
+    __asm__ volatile("");
+    return value + 1;
+}
+
+// busy threads that every all-stop has to interrupt and resume
+static void* spin(void* argument)
+{
+    (void)argument;
+
+    unsigned long count = 0;
+    while (!atomic_load_explicit(&g_done, memory_order_relaxed)) {
+        count++;
+    }
+
+    return (void*)count;
+}
+
+int main(void)
+{
+    pthread_t threads[BENCH_THREAD_COUNT];
+    for (int i = 0; i < BENCH_THREAD_COUNT; i++) {
+        pthread_create(&threads[i], NULL, spin, NULL);
+    }
+
+    int value = 0;
+    for (int i = 0; i < BENCH_THREAD_CALLS; i++) {
+        value = tick(value);
+    }
+
+    atomic_store(&g_done, true);
+    for (int i = 0; i < BENCH_THREAD_COUNT; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    return value == BENCH_THREAD_CALLS ? 0 : 1;
+}
@@ -0,0 +1,480 @@
+#include <elf.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <linux/limits.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "inferiors/inferiors.h"
+#include "tdb/breakpoint_batch.h"
+#include "tdb/execution.h"
+#include "tdb/launch.h"
+#include "tdb/tdb.h"
+#include "tdb/trace.h"
+#include "tdb/unwind.h"
+#include "tdb/utility.h"
+
+// Micro-benchmarks of tdb's hot paths, run against the inferiors in bench/inferiors.
+// Results are printed as one JSON object per line, so runs can be compared by a script:
+//
+//     {"benchmark": "breakpoint_hit", "iterations": 20000, "seconds": 0.1, "ns_per_op": 5000.0}
+//
+// tdb itself prints as it goes, so its stdout and stderr are sent to /dev/null and the
+// results go to the original stdout.
+
+static FILE* g_results;
+static char g_inferior_directory[PATH_MAX];
+
+static uint64_t bench_now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+static void bench_report(const char* name, uint64_t iterations, uint64_t elapsed_ns, const char* extra)
+{
+    const double seconds = (double)elapsed_ns / 1e9;
+    fprintf(g_results, "{\"benchmark\": \"%s\", \"iterations\": %lu, \"seconds\": %.6f, \"ns_per_op\": %.1f%s}\n",
+            name, iterations, seconds, iterations > 0 ? (double)elapsed_ns / (double)iterations : 0.0,
+            extra != NULL ? extra : "");
+    fflush(g_results);
+}
+
+// Launches an inferior and runs it up to its first instruction.
+static bool bench_launch(struct tdb_context* context, const char* name)
+{
+    char path[PATH_MAX];
+    if (snprintf(path, sizeof(path), "%s/bench_%s", g_inferior_directory, name) >= (int)sizeof(path)) {
+        return false;
+    }
+
+    pid_t pid = tdb_launch(path, NULL);
+    if (pid == -1) {
+        fprintf(g_results, "{\"error\": \"failed to launch %s\"}\n", path);
+        return false;
+    }
+
+    tdb_context_init(context, pid, path);
+    if (tdb_wait_for_stop(context) == NULL) {
+        tdb_context_free(context);
+        return false;
+    }
+
+    tdb_handle_exec(context);
+    return true;
+}
+
+static void bench_command(struct tdb_context* context, const char* line)
+{
+    tdb_handle_command(context, line);
+}
+
+// Kills the inferior if it is still running and reaps it.
+static void bench_finish(struct tdb_context* context)
+{
+    if (context->threads.count > 0) {
+        kill(context->pid, SIGKILL);
+        while (tdb_wait_for_stop(context) != NULL) {
+        }
+    }
+
+    tdb_context_free(context);
+}
+
+// Launches the inferior and continues it to the first hit of a breakpoint on function.
+static bool bench_launch_to(struct tdb_context* context, const char* name, const char* function)
+{
+    if (!bench_launch(context, name)) {
+        return false;
+    }
+
+    char line[128];
+    snprintf(line, sizeof(line), "break %s", function);
+    bench_command(context, line);
+    tdb_continue(context);
+
+    if (context->threads.count == 0) {
+        tdb_context_free(context);
+        return false;
+    }
+
+    return true;
+}
+
+// Round trip from resuming the inferior to being back at the prompt after the next hit.
+static void bench_breakpoint_hit(const char* name, const char* inferior, uint64_t iterations)
+{
+    struct tdb_context context;
+    if (!bench_launch_to(&context, inferior, "tick")) {
+        return;
+    }
+
+    uint64_t hits = 0;
+    const uint64_t start = bench_now_ns();
+    while (hits < iterations && context.threads.count > 0) {
+        tdb_continue(&context);
+        hits++;
+    }
+    const uint64_t elapsed = bench_now_ns() - start;
+
+    char extra[64];
+    snprintf(extra, sizeof(extra), ", \"threads\": %zu", context.threads.count);
+    bench_report(name, hits, elapsed, extra);
+    bench_finish(&context);
+}
+
+// Hits of a breakpoint whose condition never holds, so the inferior runs to completion
+// without reaching the prompt.
+static void bench_conditional_breakpoint(void)
+{
+    struct tdb_context context;
+    if (!bench_launch(&context, "hot_loop")) {
+        return;
+    }
+
+    bench_command(&context, "break tick if rdi == 0xffffffff");
+
+    const uint64_t start = bench_now_ns();
+    tdb_continue(&context);
+    const uint64_t elapsed = bench_now_ns() - start;
+
+    bench_report("conditional_breakpoint", BENCH_HOT_LOOP_CALLS, elapsed, NULL);
+    bench_finish(&context);
+}
+
+static void bench_single_step(const char* name, bool record_registers, uint64_t iterations)
+{
+    struct tdb_context context;
+    if (!bench_launch_to(&context, "hot_loop", "tick")) {
+        return;
+    }
+
+    struct tdb_trace_writer writer;
+    if (tdb_trace_writer_start(&writer, "/dev/null", record_registers, 0)) {
+        const uint64_t start = bench_now_ns();
+        const uint64_t steps = tdb_trace_thread(&context, &writer, iterations, 0);
+        const uint64_t elapsed = bench_now_ns() - start;
+        tdb_trace_writer_finish(&writer);
+
+        bench_report(name, steps, elapsed, NULL);
+    }
+
+    bench_finish(&context);
+}
+
+static void bench_memory_read(void)
+{
+    struct tdb_context context;
+    if (!bench_launch_to(&context, "heap", "ready")) {
+        return;
+    }
+
+    struct tdb_thread* thread = tdb_current_thread(&context);
+    bool success;
+    const uint64_t address = tdb_get_register_value(&thread->registers, x86_64_rdi, &success);
+    const uint64_t size = tdb_get_register_value(&thread->registers, x86_64_rsi, &success);
+
+    const size_t chunk_size = 1 << 20;
+    uint8_t* buffer = malloc(chunk_size);
+    if (buffer != NULL && size == BENCH_HEAP_SIZE) {
+        const int passes = 8;
+        uint64_t bytes = 0;
+        const uint64_t start = bench_now_ns();
+        for (int pass = 0; pass < passes; pass++) {
+            for (uint64_t offset = 0; offset < size; offset += chunk_size) {
+                bytes += tdb_read_memory_range(context.pid, address + offset, buffer, chunk_size);
+            }
+        }
+        const uint64_t elapsed = bench_now_ns() - start;
+
+        char extra[64];
+        snprintf(extra, sizeof(extra), ", \"mb_per_s\": %.1f", (double)bytes / (1 << 20) / ((double)elapsed / 1e9));
+        bench_report("memory_read_range", bytes / chunk_size, elapsed, extra);
+
+        // the word-at-a-time path that everything used to go through
+        const uint64_t words = 100000;
+        const uint64_t word_start = bench_now_ns();
+        for (uint64_t i = 0; i < words; i++) {
+            tdb_read_memory(context.pid, address + 8 * i, &success);
+        }
+        const uint64_t word_elapsed = bench_now_ns() - word_start;
+
+        snprintf(extra, sizeof(extra), ", \"mb_per_s\": %.1f",
+                 (double)(8 * words) / (1 << 20) / ((double)word_elapsed / 1e9));
+        bench_report("memory_read_word", words, word_elapsed, extra);
+    }
+
+    free(buffer);
+    bench_finish(&context);
+}
+
+static void bench_register_access(void)
+{
+    struct tdb_context context;
+    if (!bench_launch_to(&context, "hot_loop", "tick")) {
+        return;
+    }
+
+    struct tdb_thread* thread = tdb_current_thread(&context);
+    const uint64_t iterations = 100000;
+    volatile uint64_t sink = 0;
+    bool success;
+
+    uint64_t start = bench_now_ns();
+    for (uint64_t i = 0; i < iterations; i++) {
+        sink += tdb_get_register_value(&thread->registers, (enum x86_64_register)(i % x86_64_gs_base), &success);
+    }
+    bench_report("register_read_cached", iterations, bench_now_ns() - start, NULL);
+
+    // every read goes back to the kernel
+    start = bench_now_ns();
+    for (uint64_t i = 0; i < iterations; i++) {
+        tdb_register_cache_invalidate(&thread->registers);
+        sink += tdb_get_register_value(&thread->registers, x86_64_rip, &success);
+    }
+    bench_report("register_read_uncached", iterations, bench_now_ns() - start, NULL);
+
+    (void)sink;
+    bench_finish(&context);
+}
+
+// Lookups in the biggest symbol table at hand, the C library's.
+static void bench_symbol_lookup(void)
+{
+    struct tdb_context context;
+    if (!bench_launch_to(&context, "hot_loop", "tick")) {
+        return;
+    }
+
+    const struct tdb_mapped_object* libc = NULL;
+    for (size_t i = 0; i < context.maps.object_count; i++) {
+        if (strstr(context.maps.objects[i].path, "libc.so") != NULL) {
+            libc = &context.maps.objects[i];
+        }
+    }
+
+    struct tdb_symbol_table table;
+    if (libc != NULL && tdb_symbol_table_load(&table, libc->path) && table.symbol_count > 0) {
+        const uint64_t iterations = 1000000;
+        uint64_t found = 0;
+
+        // a cheap LCG keeps the lookups from walking the table in order
+        uint64_t state = 1;
+        uint64_t start = bench_now_ns();
+        for (uint64_t i = 0; i < iterations; i++) {
+            state = state * 6364136223846793005ull + 1442695040888963407ull;
+            const struct tdb_symbol* symbol = &table.symbols[(state >> 33) % table.symbol_count];
+            found += tdb_symbol_lookup_address(&table, symbol->address + symbol->size / 2) != NULL;
+        }
+
+        char extra[64];
+        snprintf(extra, sizeof(extra), ", \"symbols\": %zu, \"found\": %lu", table.symbol_count, found);
+        bench_report("symbol_lookup_address", iterations, bench_now_ns() - start, extra);
+
+        found = 0;
+        start = bench_now_ns();
+        for (uint64_t i = 0; i < iterations; i++) {
+            state = state * 6364136223846793005ull + 1442695040888963407ull;
+            const struct tdb_symbol* symbol = &table.symbols[(state >> 33) % table.symbol_count];
+            found += tdb_symbol_lookup_name(&table, tdb_symbol_name(&table, symbol)) != NULL;
+        }
+
+        snprintf(extra, sizeof(extra), ", \"symbols\": %zu, \"found\": %lu", table.symbol_count, found);
+        bench_report("symbol_lookup_name", iterations, bench_now_ns() - start, extra);
+
+        tdb_symbol_table_free(&table);
+    }
+
+    bench_finish(&context);
+}
+
+// Arming and disarming a breakpoint on every function of the C library, a batch at a
+// time and one at a time, reported per breakpoint.
+static void bench_breakpoint_arm(void)
+{
+    struct tdb_context context;
+    if (!bench_launch_to(&context, "hot_loop", "tick")) {
+        return;
+    }
+
+    const struct tdb_mapped_object* libc = NULL;
+    for (size_t i = 0; i < context.maps.object_count; i++) {
+        if (strstr(context.maps.objects[i].path, "libc.so") != NULL) {
+            libc = &context.maps.objects[i];
+        }
+    }
+
+    struct tdb_symbol_table table;
+    if (libc == NULL || !tdb_symbol_table_load(&table, libc->path)) {
+        bench_finish(&context);
+        return;
+    }
+
+    struct tdb_breakpoint_batch batch;
+    tdb_breakpoint_batch_init(&batch, context.pid);
+
+    for (size_t i = 0; i < table.symbol_count; i++) {
+        const struct tdb_symbol* symbol = &table.symbols[i];
+        const uint64_t address = libc->load_bias + symbol->address;
+        if (symbol->type != STT_FUNC || symbol->size == 0 ||
+            tdb_breakpoint_table_find(&context.breakpoints, context.pid, address) != NULL) {
+            continue;
+        }
+
+        struct tdb_breakpoint bp;
+        tdb_breakpoint_init(&bp, context.pid, address);
+        if (tdb_breakpoint_table_insert(&context.breakpoints, &bp) != NULL) {
+            tdb_breakpoint_batch_add(&batch, address, true);
+        }
+    }
+
+    const uint64_t count = batch.change_count;
+    char extra[64];
+    snprintf(extra, sizeof(extra), ", \"breakpoints\": %lu", count);
+
+    uint64_t start = bench_now_ns();
+    tdb_breakpoint_batch_apply(&batch, &context.breakpoints);
+    size_t cursor = 0;
+    struct tdb_breakpoint* bp;
+    while ((bp = tdb_breakpoint_table_next(&context.breakpoints, &cursor)) != NULL) {
+        if (bp->id == 0) {
+            tdb_breakpoint_batch_add(&batch, bp->address, false);
+        }
+    }
+    tdb_breakpoint_batch_apply(&batch, &context.breakpoints);
+    bench_report("breakpoint_arm_batch", 2 * count, bench_now_ns() - start, extra);
+
+    start = bench_now_ns();
+    cursor = 0;
+    while ((bp = tdb_breakpoint_table_next(&context.breakpoints, &cursor)) != NULL) {
+        if (bp->id == 0) {
+            tdb_breakpoint_enable(bp);
+        }
+    }
+    cursor = 0;
+    while ((bp = tdb_breakpoint_table_next(&context.breakpoints, &cursor)) != NULL) {
+        if (bp->id == 0) {
+            tdb_breakpoint_disable(bp);
+        }
+    }
+    bench_report("breakpoint_arm_single", 2 * count, bench_now_ns() - start, extra);
+
+    tdb_breakpoint_batch_free(&batch);
+    tdb_symbol_table_free(&table);
+    bench_finish(&context);
+}
+
+// Unwinding the deepest stack of the recursion inferior, reported per frame.
+static void bench_backtrace(void)
+{
+    struct tdb_context context;
+    if (!bench_launch_to(&context, "recursion", "bottom")) {
+        return;
+    }
+
+    enum { max_frames = 2 * BENCH_RECURSION_DEPTH };
+    struct tdb_frame* frames = malloc(max_frames * sizeof(struct tdb_frame));
+    struct tdb_thread* thread = tdb_current_thread(&context);
+
+    if (frames != NULL) {
+        const int repeats = 100;
+        uint64_t frame_count = 0;
+        const uint64_t start = bench_now_ns();
+        for (int i = 0; i < repeats; i++) {
+            frame_count += tdb_unwind(&context.unwinder, &context.maps, context.pid, &thread->registers, frames,
+                                      max_frames);
+        }
+
+        char extra[64];
+        snprintf(extra, sizeof(extra), ", \"depth\": %lu", frame_count / repeats);
+        bench_report("backtrace_frame", frame_count, bench_now_ns() - start, extra);
+    }
+
+    free(frames);
+    bench_finish(&context);
+}
+
+struct bench {
+    const char* name;
+    void (*run)(void);
+};
+
+static void bench_breakpoint_hit_one_thread(void)
+{
+    bench_breakpoint_hit("breakpoint_hit", "hot_loop", 20000);
+}
+
+static void bench_breakpoint_hit_many_threads(void)
+{
+    bench_breakpoint_hit("breakpoint_hit_threads", "threads", 500);
+}
+
+static void bench_single_step_pc(void)
+{
+    bench_single_step("single_step", false, 200000);
+}
+
+static void bench_single_step_registers(void)
+{
+    bench_single_step("single_step_registers", true, 200000);
+}
+
+static const struct bench g_benches[] = {
+    {"breakpoint_hit", bench_breakpoint_hit_one_thread},
+    {"breakpoint_hit_threads", bench_breakpoint_hit_many_threads},
+    {"conditional_breakpoint", bench_conditional_breakpoint},
+    {"single_step", bench_single_step_pc},
+    {"single_step_registers", bench_single_step_registers},
+    {"memory_read", bench_memory_read},
+    {"register_access", bench_register_access},
+    {"symbol_lookup", bench_symbol_lookup},
+    {"backtrace", bench_backtrace},
+    {"breakpoint_arm", bench_breakpoint_arm},
+};
+
+// usage: tdb_bench [<name>...], running every benchmark whose name starts with one of
+// the arguments, or all of them
+int main(int argc, char** argv)
+{
+    char self[PATH_MAX];
+    ssize_t length = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (length <= 0) {
+        fprintf(stderr, "Failed to find the benchmark inferiors.\n");
+        return EXIT_FAILURE;
+    }
+    self[length] = '\0';
+    snprintf(g_inferior_directory, sizeof(g_inferior_directory), "%s", dirname(self));
+
+    // results keep the original stdout, tdb's own output goes nowhere
+    g_results = fdopen(dup(STDOUT_FILENO), "w");
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (g_results == NULL || null_fd == -1) {
+        fprintf(stderr, "Failed to redirect output.\n");
+        return EXIT_FAILURE;
+    }
+    fflush(stdout);
+    dup2(null_fd, STDOUT_FILENO);
+    dup2(null_fd, STDERR_FILENO);
+    close(null_fd);
+
+    for (size_t i = 0; i < sizeof(g_benches) / sizeof(g_benches[0]); i++) {
+        bool selected = argc == 1;
+        for (int j = 1; j < argc && !selected; j++) {
+            selected = strncmp(g_benches[i].name, argv[j], strlen(argv[j])) == 0;
+        }
+
+        if (selected) {
+            g_benches[i].run();
+        }
+    }
+
+    fclose(g_results);
+    return 0;
+}
@@ -1,45 +1,184 @@
-#include <errno.h>
+#include <getopt.h>
+#include <linux/limits.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/ptrace.h>
+#include <unistd.h>
 
+#include "tdb/core.h"
+#include "tdb/launch.h"
+#include "tdb/profile.h"
+#include "tdb/stats.h"
 #include "tdb/tdb.h"
 
+static void print_usage(const char* program)
+{
+    fprintf(stderr,
+            "usage: %s [--profile[=<seconds>]] [--hz=<frequency>] [--strace=<syscalls>] [--stats[=json]] <executable>\n"
+            "       %s [--profile[=<seconds>]] [--hz=<frequency>] [--stats[=json]] -p <pid>\n"
+            "       %s [--stats[=json]] <executable> --core <core>\n",
+            program, program, program);
+}
+
 int main(int argc, char** argv)
 {
-    if (argc < 2) {
+    bool profile = false;
+    double profile_seconds = 0;
+    unsigned long profile_frequency = TDB_PROFILE_DEFAULT_FREQUENCY;
+
+    bool strace = false;
+    struct tdb_syscall_set traced_syscalls;
+    tdb_syscall_set_clear(&traced_syscalls);
+
+    pid_t attach_pid = 0;
+    const char* core_path = NULL;
+
+    // print the counters on the way out
+    bool stats = false;
+    bool stats_json = false;
+
+    const struct option options[] = {
+        {"profile", optional_argument, NULL, 'P'},
+        {"hz", required_argument, NULL, 'H'},
+        {"strace", required_argument, NULL, 'S'},
+        {"pid", required_argument, NULL, 'p'},
+        {"stats", optional_argument, NULL, 's'},
+        {"core", required_argument, NULL, 'c'},
+        {NULL, 0, NULL, 0},
+    };
+
+    // '+' stops at the executable, so options after it are left alone
+    int option;
+    while ((option = getopt_long(argc, argv, "+p:", options, NULL)) != -1) {
+        switch (option) {
+        case 'P':
+            profile = true;
+            profile_seconds = optarg != NULL ? strtod(optarg, NULL) : 0;
+            break;
+        case 'H':
+            profile_frequency = strtoul(optarg, NULL, 10);
+            break;
+        case 'S':
+            strace = true;
+            if (!tdb_syscall_set_parse(&traced_syscalls, optarg)) {
+                return EXIT_FAILURE;
+            }
+            break;
+        case 's':
+            stats = true;
+            stats_json = optarg != NULL && strcmp(optarg, "json") == 0;
+            break;
+        case 'c':
+            core_path = optarg;
+            break;
+        case 'p':
+            attach_pid = (pid_t)strtol(optarg, NULL, 10);
+            if (attach_pid <= 0) {
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            break;
+        default:
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // the core is usually given after the executable, where getopt doesn't look
+    if (core_path == NULL && argc - optind == 3 && strcmp(argv[optind + 1], "--core") == 0) {
+        core_path = argv[optind + 2];
+    }
+
+    if (attach_pid == 0 && optind >= argc) {
         fprintf(stderr, "Executable name not specified.\n");
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (profile_seconds < 0 || profile_frequency == 0) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (attach_pid != 0 && strace) {
+        // the seccomp filter can only be installed by the process itself
+        fprintf(stderr, "--strace needs tdb to launch the program.\n");
+        return EXIT_FAILURE;
+    }
+
+    if (core_path != NULL && (attach_pid != 0 || strace || profile)) {
+        fprintf(stderr, "--core can't be combined with -p, --strace or --profile.\n");
         return EXIT_FAILURE;
     }
 
-    pid_t pid = fork();
+    tdb_stats_reset();
+
+    struct tdb_context context;
+
+    if (core_path != NULL) {
+        struct tdb_core_image core;
+        if (!tdb_core_image_open(&core, core_path)) {
+            return EXIT_FAILURE;
+        }
 
-    char* target_path = argv[1];
+        tdb_context_init(&context, core.pid, argv[optind]);
 
-    if (pid == 0) {  // in child process, execute program to be debugged
-        int64_t ret = ptrace(PTRACE_TRACEME, 0, NULL, NULL);
-        if (ret == -1) {
-            fprintf(stderr, "Failed to initiate ptrace on debugee.\n");
+        if (!tdb_load_core(&context, &core)) {
+            tdb_context_free(&context);
             return EXIT_FAILURE;
         }
+    }
+    else if (attach_pid != 0) {
+        char exe_link[64];
+        snprintf(exe_link, sizeof(exe_link), "/proc/%d/exe", attach_pid);
 
-        // TODO: use execve?
-        execl(target_path, target_path, NULL);
+        char target_path[PATH_MAX];
+        ssize_t length = readlink(exe_link, target_path, sizeof(target_path) - 1);
+        if (length <= 0) {
+            fprintf(stderr, "Failed to find the executable of process %d.\n", attach_pid);
+            return EXIT_FAILURE;
+        }
+        target_path[length] = '\0';
+
+        // the debug info is loaded while the process still runs, it is only stopped by
+        // tdb_run once everything is ready
+        tdb_context_init(&context, attach_pid, target_path);
+
+        if (!tdb_attach(attach_pid, &context.threads)) {
+            tdb_context_free(&context);
+            return EXIT_FAILURE;
+        }
+        context.attached = true;
     }
-    else if (pid >= 1) {  // in parent process, execute debugger
+    else {
+        char* target_path = argv[optind];
+
+        pid_t pid = tdb_launch(target_path, strace ? &traced_syscalls : NULL);
+        if (pid == -1) {
+            return EXIT_FAILURE;
+        }
+
         printf("pid = %d\n", pid);
-        struct tdb_context context;
         tdb_context_init(&context, pid, target_path);
-        tdb_run(&context);
-        tdb_context_free(&context);
+        context.traced_syscalls = traced_syscalls;
+        context.filtered_syscalls = traced_syscalls;
     }
-    else {  // fork() failed
-        fprintf(stderr, "Failed to fork process to begin debugging: %s\n", strerror(errno));
-        return EXIT_FAILURE;
+
+    if (profile) {
+        tdb_run_profile(&context, profile_seconds, (unsigned)profile_frequency);
+    }
+    else {
+        tdb_run(&context, strace);
     }
 
+    tdb_context_free(&context);
+
     printf("\n");
 
+    if (stats) {
+        tdb_stats_print(stdout, stats_json);
+    }
+
     return 0;
 }
@@ -4,11 +4,14 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/ptrace.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "tdb/calltrace.h"
+#include "tdb/condition.h"
 #include "tdb/utility.h"
 
 static const uint64_t BOTTOM_BYTE = 0xffULL;
@@ -20,6 +23,13 @@ void tdb_breakpoint_init(struct tdb_breakpoint* bp, pid_t pid, uintptr_t address
     bp->address = address;
     bp->enabled = false;
     bp->saved_data = 0;
+    bp->id = 0;
+    bp->internal = false;
+    bp->traced_function = TDB_NO_TRACED_FUNCTION;
+    bp->call_return = false;
+    bp->hit_count = 0;
+    bp->ignore_count = 0;
+    bp->condition = NULL;
 }
 
 bool tdb_breakpoint_enable(struct tdb_breakpoint* bp)
@@ -71,3 +81,12 @@ void tdb_breakpoint_disable(struct tdb_breakpoint* bp)
         bp->enabled = false;
     }
 }
+
+void tdb_breakpoint_free(struct tdb_breakpoint* bp)
+{
+    if (bp->condition != NULL) {
+        tdb_condition_free(bp->condition);
+        free(bp->condition);
+        bp->condition = NULL;
+    }
+}
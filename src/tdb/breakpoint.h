@@ -5,14 +5,29 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+struct tdb_condition;
+
 struct tdb_breakpoint {
     pid_t pid;
     uintptr_t address;
     bool enabled;
     uint8_t saved_data;
+
+    uint32_t id;    // 0 if the user didn't ask for this breakpoint
+    bool internal;  // set by tdb itself (e.g. in the dynamic loader) and hidden from the user
+
+    // calltrace: the function this is the entry of (TDB_NO_TRACED_FUNCTION if none),
+    // and whether traced calls return here
+    uint32_t traced_function;
+    bool call_return;
+
+    uint64_t hit_count;
+    uint64_t ignore_count;
+    struct tdb_condition* condition;  // owned, may be NULL
 };
 
 void tdb_breakpoint_init(struct tdb_breakpoint* bp, pid_t pid, uintptr_t address);
 bool tdb_breakpoint_enable(struct tdb_breakpoint* bp);
 void tdb_breakpoint_disable(struct tdb_breakpoint* bp);
+void tdb_breakpoint_free(struct tdb_breakpoint* bp);
 
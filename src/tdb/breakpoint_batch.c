@@ -0,0 +1,176 @@
+#include "breakpoint_batch.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tdb/stats.h"
+
+#define TDB_BATCH_PAGE_SIZE 4096
+
+void tdb_breakpoint_batch_init(struct tdb_breakpoint_batch* batch, pid_t pid)
+{
+    memset(batch, 0, sizeof(*batch));
+    batch->pid = pid;
+}
+
+void tdb_breakpoint_batch_free(struct tdb_breakpoint_batch* batch)
+{
+    free(batch->changes);
+    tdb_breakpoint_batch_init(batch, batch->pid);
+}
+
+bool tdb_breakpoint_batch_add(struct tdb_breakpoint_batch* batch, uintptr_t address, bool enable)
+{
+    if (batch->change_count == batch->change_capacity) {
+        size_t new_capacity = batch->change_capacity == 0 ? 64 : 2 * batch->change_capacity;
+
+        struct tdb_breakpoint_change* changes =
+            realloc(batch->changes, new_capacity * sizeof(struct tdb_breakpoint_change));
+        if (changes == NULL) {
+            fprintf(stderr, "Failed to allocate breakpoint batch\n");
+            return false;
+        }
+        batch->changes = changes;
+        batch->change_capacity = new_capacity;
+    }
+
+    batch->changes[batch->change_count].address = address;
+    batch->changes[batch->change_count].enable = enable;
+    batch->change_count++;
+    return true;
+}
+
+static int tdb_compare_changes(const void* a, const void* b)
+{
+    const uintptr_t left = ((const struct tdb_breakpoint_change*)a)->address;
+    const uintptr_t right = ((const struct tdb_breakpoint_change*)b)->address;
+    return left < right ? -1 : (left > right ? 1 : 0);
+}
+
+// The breakpoint change i of a page starting at change first has to be made to, or NULL
+// if there is nothing to do: it is a repeat, or the breakpoint is already that way.
+static struct tdb_breakpoint* tdb_breakpoint_batch_pending(struct tdb_breakpoint_batch* batch,
+                                                           struct tdb_breakpoint_table* table, size_t first, size_t i)
+{
+    const struct tdb_breakpoint_change* change = &batch->changes[i];
+    if (i > first && change->address == batch->changes[i - 1].address) {
+        return NULL;
+    }
+
+    struct tdb_breakpoint* bp = tdb_breakpoint_table_find(table, batch->pid, change->address);
+    return bp != NULL && bp->enabled != change->enable ? bp : NULL;
+}
+
+// Patches the changes [first, last], which are all in one page, into a copy of their
+// bytes and writes it back. Returns the index of the first change that wasn't made,
+// last + 1 if they all were.
+static size_t tdb_breakpoint_batch_apply_page(struct tdb_breakpoint_batch* batch, struct tdb_breakpoint_table* table,
+                                              int fd, size_t first, size_t last)
+{
+    const uintptr_t low = batch->changes[first].address;
+    const size_t length = batch->changes[last].address + 1 - low;
+    uint8_t buffer[TDB_BATCH_PAGE_SIZE];
+
+    uint64_t start = tdb_stats_start();
+    const ssize_t read_count = pread(fd, buffer, length, (off_t)low);
+    tdb_stats_record(TDB_STAT_PROC_MEM, start);
+    if (read_count != (ssize_t)length) {
+        return first;
+    }
+
+    bool changed = false;
+    for (size_t i = first; i <= last; i++) {
+        const struct tdb_breakpoint_change* change = &batch->changes[i];
+        struct tdb_breakpoint* bp = tdb_breakpoint_batch_pending(batch, table, first, i);
+        if (bp == NULL) {
+            continue;
+        }
+
+        const size_t offset = change->address - low;
+        if (change->enable) {
+            bp->saved_data = buffer[offset];
+            buffer[offset] = 0xcc;
+        }
+        else {
+            buffer[offset] = bp->saved_data;
+        }
+        changed = true;
+    }
+
+    if (!changed) {
+        return last + 1;
+    }
+
+    start = tdb_stats_start();
+    const ssize_t write_count = pwrite(fd, buffer, length, (off_t)low);
+    tdb_stats_record(TDB_STAT_PROC_MEM, start);
+
+    // a short write has still made the changes before where it stopped, and the bytes
+    // they saved are the ones read above
+    const size_t written = write_count > 0 ? (size_t)write_count : 0;
+
+    size_t i = first;
+    for (; i <= last && batch->changes[i].address - low < written; i++) {
+        struct tdb_breakpoint* bp = tdb_breakpoint_table_find(table, batch->pid, batch->changes[i].address);
+        if (bp != NULL && (i == first || batch->changes[i].address != batch->changes[i - 1].address)) {
+            bp->enabled = batch->changes[i].enable;
+        }
+    }
+
+    return i;
+}
+
+size_t tdb_breakpoint_batch_apply(struct tdb_breakpoint_batch* batch, struct tdb_breakpoint_table* table)
+{
+    qsort(batch->changes, batch->change_count, sizeof(struct tdb_breakpoint_change), tdb_compare_changes);
+
+    char mem_path[64];
+    snprintf(mem_path, sizeof(mem_path), "/proc/%d/mem", batch->pid);
+
+    const uint64_t start = tdb_stats_start();
+    const int fd = open(mem_path, O_RDWR);
+    tdb_stats_record(TDB_STAT_PROC_MEM, start);
+
+    size_t failed = 0;
+    size_t first = 0;
+
+    while (first < batch->change_count) {
+        const uintptr_t page = batch->changes[first].address & ~(uintptr_t)(TDB_BATCH_PAGE_SIZE - 1);
+
+        size_t last = first;
+        while (last + 1 < batch->change_count &&
+               (batch->changes[last + 1].address & ~(uintptr_t)(TDB_BATCH_PAGE_SIZE - 1)) == page) {
+            last++;
+        }
+
+        // the rest one at a time, the way that works wherever ptrace does, which only
+        // reads memory the batch hasn't written to
+        const size_t done = fd == -1 ? first : tdb_breakpoint_batch_apply_page(batch, table, fd, first, last);
+        for (size_t i = done; i <= last; i++) {
+            struct tdb_breakpoint* bp = tdb_breakpoint_batch_pending(batch, table, done, i);
+            if (bp == NULL) {
+                continue;
+            }
+
+            if (batch->changes[i].enable) {
+                tdb_breakpoint_enable(bp);
+            }
+            else {
+                tdb_breakpoint_disable(bp);
+            }
+            failed += bp->enabled != batch->changes[i].enable;
+        }
+
+        first = last + 1;
+    }
+
+    if (fd != -1) {
+        close(fd);
+    }
+
+    batch->change_count = 0;
+    return failed;
+}
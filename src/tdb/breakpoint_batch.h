@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "tdb/breakpoint_table.h"
+
+// Enabling or disabling breakpoints one at a time costs a PEEKDATA and a POKEDATA each.
+// A batch collects the changes to many of them and applies them a page at a time: the
+// bytes of a page between its first and last breakpoint are read once from
+// /proc/pid/mem, every int3 is patched in (or taken out) locally, and they are written
+// back with a single write.
+
+struct tdb_breakpoint_change {
+    uintptr_t address;
+    bool enable;
+};
+
+struct tdb_breakpoint_batch {
+    pid_t pid;
+    struct tdb_breakpoint_change* changes;
+    size_t change_count;
+    size_t change_capacity;
+};
+
+void tdb_breakpoint_batch_init(struct tdb_breakpoint_batch* batch, pid_t pid);
+void tdb_breakpoint_batch_free(struct tdb_breakpoint_batch* batch);
+
+// Queues enabling or disabling the breakpoint at address, which has to be in the table
+// the batch is applied to by then. Each breakpoint should be queued at most once.
+bool tdb_breakpoint_batch_add(struct tdb_breakpoint_batch* batch, uintptr_t address, bool enable);
+
+// Applies and forgets the queued changes. Breakpoints that are already enabled or
+// disabled are left alone. Returns the number of breakpoints that couldn't be changed.
+size_t tdb_breakpoint_batch_apply(struct tdb_breakpoint_batch* batch, struct tdb_breakpoint_table* table);
@@ -0,0 +1,189 @@
+#include "breakpoint_table.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum tdb_slot_state { TDB_SLOT_EMPTY = 0, TDB_SLOT_OCCUPIED, TDB_SLOT_DELETED };
+
+static const size_t TDB_BREAKPOINT_TABLE_INITIAL_CAPACITY = 64;
+
+static uint64_t tdb_breakpoint_hash(pid_t pid, uintptr_t address)
+{
+    // splitmix64 finalizer, breakpoints tend to be clustered in a few pages of text
+    uint64_t x = (uint64_t)address ^ ((uint64_t)pid << 48);
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+static bool tdb_breakpoint_table_allocate(struct tdb_breakpoint_table* table, size_t capacity)
+{
+    struct tdb_breakpoint* slots = calloc(capacity, sizeof(struct tdb_breakpoint));
+    uint8_t* slot_states = calloc(capacity, sizeof(uint8_t));
+
+    if (slots == NULL || slot_states == NULL) {
+        fprintf(stderr, "Failed to allocate breakpoint table with capacity %zu\n", capacity);
+        free(slots);
+        free(slot_states);
+        return false;
+    }
+
+    table->slots = slots;
+    table->slot_states = slot_states;
+    table->capacity = capacity;
+    table->count = 0;
+    table->tombstone_count = 0;
+    return true;
+}
+
+void tdb_breakpoint_table_init(struct tdb_breakpoint_table* table)
+{
+    table->slots = NULL;
+    table->slot_states = NULL;
+    table->capacity = 0;
+    table->count = 0;
+    table->tombstone_count = 0;
+}
+
+void tdb_breakpoint_table_free(struct tdb_breakpoint_table* table)
+{
+    free(table->slots);
+    free(table->slot_states);
+    tdb_breakpoint_table_init(table);
+}
+
+// Returns the slot holding the key, or if absent, the slot where it should be inserted.
+static size_t tdb_breakpoint_table_probe(const struct tdb_breakpoint_table* table, pid_t pid, uintptr_t address,
+                                         bool* found)
+{
+    const size_t mask = table->capacity - 1;
+    size_t index = tdb_breakpoint_hash(pid, address) & mask;
+    size_t first_tombstone = table->capacity;
+
+    while (true) {
+        const uint8_t state = table->slot_states[index];
+
+        if (state == TDB_SLOT_EMPTY) {
+            *found = false;
+            return first_tombstone != table->capacity ? first_tombstone : index;
+        }
+
+        if (state == TDB_SLOT_DELETED) {
+            if (first_tombstone == table->capacity) {
+                first_tombstone = index;
+            }
+        }
+        else {
+            const struct tdb_breakpoint* bp = &table->slots[index];
+            if (bp->address == address && bp->pid == pid) {
+                *found = true;
+                return index;
+            }
+        }
+
+        index = (index + 1) & mask;
+    }
+}
+
+static bool tdb_breakpoint_table_rehash(struct tdb_breakpoint_table* table, size_t new_capacity)
+{
+    struct tdb_breakpoint_table old_table = *table;
+
+    if (!tdb_breakpoint_table_allocate(table, new_capacity)) {
+        *table = old_table;
+        return false;
+    }
+
+    for (size_t i = 0; i < old_table.capacity; i++) {
+        if (old_table.slot_states[i] == TDB_SLOT_OCCUPIED) {
+            const struct tdb_breakpoint* bp = &old_table.slots[i];
+            bool found;
+            size_t index = tdb_breakpoint_table_probe(table, bp->pid, bp->address, &found);
+            table->slots[index] = *bp;
+            table->slot_states[index] = TDB_SLOT_OCCUPIED;
+            table->count++;
+        }
+    }
+
+    tdb_breakpoint_table_free(&old_table);
+    return true;
+}
+
+struct tdb_breakpoint* tdb_breakpoint_table_find(struct tdb_breakpoint_table* table, pid_t pid, uintptr_t address)
+{
+    if (table->count == 0) {
+        return NULL;
+    }
+
+    bool found;
+    size_t index = tdb_breakpoint_table_probe(table, pid, address, &found);
+    return found ? &table->slots[index] : NULL;
+}
+
+struct tdb_breakpoint* tdb_breakpoint_table_insert(struct tdb_breakpoint_table* table,
+                                                   const struct tdb_breakpoint* bp)
+{
+    // keep the load factor (including tombstones) at or below one half
+    if (2 * (table->count + table->tombstone_count + 1) > table->capacity) {
+        // rehashing drops tombstones, so only grow if the live entries need the room
+        size_t new_capacity = TDB_BREAKPOINT_TABLE_INITIAL_CAPACITY;
+        while (4 * (table->count + 1) > new_capacity) {
+            new_capacity *= 2;
+        }
+
+        if (!tdb_breakpoint_table_rehash(table, new_capacity)) {
+            return NULL;
+        }
+    }
+
+    bool found;
+    size_t index = tdb_breakpoint_table_probe(table, bp->pid, bp->address, &found);
+    if (found) {
+        return NULL;
+    }
+
+    if (table->slot_states[index] == TDB_SLOT_DELETED) {
+        table->tombstone_count--;
+    }
+
+    table->slots[index] = *bp;
+    table->slot_states[index] = TDB_SLOT_OCCUPIED;
+    table->count++;
+
+    return &table->slots[index];
+}
+
+bool tdb_breakpoint_table_remove(struct tdb_breakpoint_table* table, pid_t pid, uintptr_t address)
+{
+    if (table->count == 0) {
+        return false;
+    }
+
+    bool found;
+    size_t index = tdb_breakpoint_table_probe(table, pid, address, &found);
+    if (!found) {
+        return false;
+    }
+
+    table->slot_states[index] = TDB_SLOT_DELETED;
+    table->count--;
+    table->tombstone_count++;
+
+    return true;
+}
+
+struct tdb_breakpoint* tdb_breakpoint_table_next(struct tdb_breakpoint_table* table, size_t* cursor)
+{
+    while (*cursor < table->capacity) {
+        const size_t index = (*cursor)++;
+        if (table->slot_states[index] == TDB_SLOT_OCCUPIED) {
+            return &table->slots[index];
+        }
+    }
+
+    return NULL;
+}
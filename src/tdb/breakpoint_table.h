@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "tdb/breakpoint.h"
+
+// Open-addressing (linear probing) hash table of breakpoints keyed by (pid, address).
+// The table grows without bound, so pointers returned by find/insert are only valid
+// until the next insert.
+struct tdb_breakpoint_table {
+    struct tdb_breakpoint* slots;
+    uint8_t* slot_states;
+    size_t capacity;
+    size_t count;
+    size_t tombstone_count;
+};
+
+void tdb_breakpoint_table_init(struct tdb_breakpoint_table* table);
+void tdb_breakpoint_table_free(struct tdb_breakpoint_table* table);
+
+struct tdb_breakpoint* tdb_breakpoint_table_find(struct tdb_breakpoint_table* table, pid_t pid, uintptr_t address);
+struct tdb_breakpoint* tdb_breakpoint_table_insert(struct tdb_breakpoint_table* table,
+                                                   const struct tdb_breakpoint* bp);
+bool tdb_breakpoint_table_remove(struct tdb_breakpoint_table* table, pid_t pid, uintptr_t address);
+
+// Iterate over all breakpoints, starting with *cursor = 0. Returns NULL when done.
+struct tdb_breakpoint* tdb_breakpoint_table_next(struct tdb_breakpoint_table* table, size_t* cursor);
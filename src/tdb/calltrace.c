@@ -0,0 +1,197 @@
+#include "calltrace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void tdb_calltrace_init(struct tdb_calltrace* calltrace)
+{
+    memset(calltrace, 0, sizeof(*calltrace));
+}
+
+void tdb_calltrace_free(struct tdb_calltrace* calltrace)
+{
+    for (size_t i = 0; i < calltrace->function_count; i++) {
+        free(calltrace->functions[i].name);
+    }
+    free(calltrace->functions);
+
+    for (size_t i = 0; i < calltrace->stack_count; i++) {
+        free(calltrace->stacks[i].calls);
+    }
+    free(calltrace->stacks);
+
+    tdb_calltrace_init(calltrace);
+}
+
+uint32_t tdb_calltrace_add_function(struct tdb_calltrace* calltrace, uint64_t address, const char* name)
+{
+    if (calltrace->function_count == calltrace->function_capacity) {
+        size_t new_capacity = calltrace->function_capacity == 0 ? 16 : 2 * calltrace->function_capacity;
+
+        struct tdb_traced_function* functions =
+            realloc(calltrace->functions, new_capacity * sizeof(struct tdb_traced_function));
+        if (functions == NULL) {
+            return TDB_NO_TRACED_FUNCTION;
+        }
+        calltrace->functions = functions;
+        calltrace->function_capacity = new_capacity;
+    }
+
+    struct tdb_traced_function* function = &calltrace->functions[calltrace->function_count];
+    function->address = address;
+    function->calls = 0;
+    tdb_histogram_init(&function->latency);
+
+    if ((function->name = strdup(name)) == NULL) {
+        return TDB_NO_TRACED_FUNCTION;
+    }
+
+    return (uint32_t)calltrace->function_count++;
+}
+
+static struct tdb_call_stack* tdb_calltrace_get_stack(struct tdb_calltrace* calltrace, pid_t tid)
+{
+    for (size_t i = 0; i < calltrace->stack_count; i++) {
+        if (calltrace->stacks[i].tid == tid) {
+            return &calltrace->stacks[i];
+        }
+    }
+
+    if (calltrace->stack_count == calltrace->stack_capacity) {
+        size_t new_capacity = calltrace->stack_capacity == 0 ? 8 : 2 * calltrace->stack_capacity;
+
+        struct tdb_call_stack* stacks = realloc(calltrace->stacks, new_capacity * sizeof(struct tdb_call_stack));
+        if (stacks == NULL) {
+            return NULL;
+        }
+        calltrace->stacks = stacks;
+        calltrace->stack_capacity = new_capacity;
+    }
+
+    struct tdb_call_stack* stack = &calltrace->stacks[calltrace->stack_count++];
+    memset(stack, 0, sizeof(*stack));
+    stack->tid = tid;
+
+    return stack;
+}
+
+void tdb_calltrace_enter(struct tdb_calltrace* calltrace, pid_t tid, uint32_t function, uint64_t return_address,
+                         uint64_t stack_pointer, uint64_t now_ns)
+{
+    calltrace->functions[function].calls++;
+
+    struct tdb_call_stack* stack = tdb_calltrace_get_stack(calltrace, tid);
+    if (stack == NULL) {
+        return;
+    }
+
+    if (stack->count == stack->capacity) {
+        size_t new_capacity = stack->capacity == 0 ? 64 : 2 * stack->capacity;
+
+        struct tdb_pending_call* calls = realloc(stack->calls, new_capacity * sizeof(struct tdb_pending_call));
+        if (calls == NULL) {
+            return;
+        }
+        stack->calls = calls;
+        stack->capacity = new_capacity;
+    }
+
+    struct tdb_pending_call* call = &stack->calls[stack->count++];
+    call->function = function;
+    call->return_address = return_address;
+    call->stack_pointer = stack_pointer;
+    call->start_ns = now_ns;
+}
+
+void tdb_calltrace_return(struct tdb_calltrace* calltrace, pid_t tid, uint64_t address, uint64_t stack_pointer,
+                          uint64_t now_ns)
+{
+    struct tdb_call_stack* stack = tdb_calltrace_get_stack(calltrace, tid);
+    if (stack == NULL) {
+        return;
+    }
+
+    // every call made further down the stack than the return lands is finished; only the
+    // one that popped its return address here returned normally
+    while (stack->count > 0 && stack->calls[stack->count - 1].stack_pointer < stack_pointer) {
+        const struct tdb_pending_call* call = &stack->calls[--stack->count];
+
+        if (call->return_address == address && call->stack_pointer + sizeof(uint64_t) == stack_pointer) {
+            tdb_histogram_record(&calltrace->functions[call->function].latency, now_ns - call->start_ns);
+        }
+        else {
+            calltrace->abandoned_calls++;
+        }
+    }
+}
+
+static void tdb_format_duration(uint64_t ns, char* buffer, size_t buffer_size)
+{
+    if (ns < 1000) {
+        snprintf(buffer, buffer_size, "%zuns", ns);
+    }
+    else if (ns < 1000 * 1000) {
+        snprintf(buffer, buffer_size, "%.1fus", (double)ns / 1e3);
+    }
+    else if (ns < 1000 * 1000 * 1000) {
+        snprintf(buffer, buffer_size, "%.1fms", (double)ns / 1e6);
+    }
+    else {
+        snprintf(buffer, buffer_size, "%.2fs", (double)ns / 1e9);
+    }
+}
+
+static int tdb_compare_functions_by_total(const void* a, const void* b)
+{
+    const struct tdb_traced_function* x = *(const struct tdb_traced_function* const*)a;
+    const struct tdb_traced_function* y = *(const struct tdb_traced_function* const*)b;
+
+    if (x->latency.sum != y->latency.sum) {
+        return x->latency.sum < y->latency.sum ? 1 : -1;
+    }
+
+    return x->calls < y->calls ? 1 : (x->calls > y->calls ? -1 : 0);
+}
+
+void tdb_calltrace_report(const struct tdb_calltrace* calltrace)
+{
+    const struct tdb_traced_function** sorted = malloc(calltrace->function_count * sizeof(*sorted) + 1);
+    if (sorted == NULL) {
+        return;
+    }
+
+    size_t called_count = 0;
+    for (size_t i = 0; i < calltrace->function_count; i++) {
+        if (calltrace->functions[i].calls > 0) {
+            sorted[called_count++] = &calltrace->functions[i];
+        }
+    }
+
+    qsort(sorted, called_count, sizeof(*sorted), tdb_compare_functions_by_total);
+
+    printf("%10s %10s %10s %10s %10s %10s  %s\n", "calls", "total", "mean", "p50", "p99", "max", "function");
+
+    for (size_t i = 0; i < called_count; i++) {
+        const struct tdb_histogram* latency = &sorted[i]->latency;
+
+        char total[32], mean[32], p50[32], p99[32], max[32];
+        tdb_format_duration(latency->sum, total, sizeof(total));
+        tdb_format_duration(latency->count > 0 ? latency->sum / latency->count : 0, mean, sizeof(mean));
+        tdb_format_duration(tdb_histogram_percentile(latency, 50), p50, sizeof(p50));
+        tdb_format_duration(tdb_histogram_percentile(latency, 99), p99, sizeof(p99));
+        tdb_format_duration(latency->max, max, sizeof(max));
+
+        printf("%10zu %10s %10s %10s %10s %10s  %s\n", sorted[i]->calls, total, mean, p50, p99, max, sorted[i]->name);
+    }
+
+    if (called_count == 0) {
+        printf("no traced function was called\n");
+    }
+
+    if (calltrace->abandoned_calls > 0) {
+        printf("%zu calls never returned normally\n", calltrace->abandoned_calls);
+    }
+
+    free(sorted);
+}
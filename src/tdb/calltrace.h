@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "tdb/histogram.h"
+
+// Call counts and latencies of traced functions. An entry breakpoint on each traced
+// function pushes a pending call onto the stack of the calling thread, and a return
+// breakpoint on its return address pops it again. Timestamps are taken when tdb handles
+// the stops, so latencies include the cost of two breakpoint round trips.
+
+#define TDB_NO_TRACED_FUNCTION UINT32_MAX
+
+struct tdb_traced_function {
+    uint64_t address;
+    char* name;
+    uint64_t calls;
+    struct tdb_histogram latency;  // in nanoseconds, of the calls that returned
+};
+
+struct tdb_pending_call {
+    uint32_t function;
+    uint64_t return_address;
+    uint64_t stack_pointer;  // at entry, pointing at the return address
+    uint64_t start_ns;
+};
+
+struct tdb_call_stack {
+    pid_t tid;
+    struct tdb_pending_call* calls;
+    size_t count;
+    size_t capacity;
+};
+
+struct tdb_calltrace {
+    struct tdb_traced_function* functions;
+    size_t function_count;
+    size_t function_capacity;
+
+    struct tdb_call_stack* stacks;  // one per thread that made a traced call
+    size_t stack_count;
+    size_t stack_capacity;
+
+    uint64_t abandoned_calls;  // unwound without returning, e.g. by longjmp or exceptions
+};
+
+void tdb_calltrace_init(struct tdb_calltrace* calltrace);
+void tdb_calltrace_free(struct tdb_calltrace* calltrace);
+
+// Returns the index of the new function, or TDB_NO_TRACED_FUNCTION.
+uint32_t tdb_calltrace_add_function(struct tdb_calltrace* calltrace, uint64_t address, const char* name);
+
+void tdb_calltrace_enter(struct tdb_calltrace* calltrace, pid_t tid, uint32_t function, uint64_t return_address,
+                         uint64_t stack_pointer, uint64_t now_ns);
+
+// Called when a thread reaches a return breakpoint with the given stack pointer.
+void tdb_calltrace_return(struct tdb_calltrace* calltrace, pid_t tid, uint64_t address, uint64_t stack_pointer,
+                          uint64_t now_ns);
+
+// Prints the functions that were called, the slowest in total first.
+void tdb_calltrace_report(const struct tdb_calltrace* calltrace);
@@ -0,0 +1,488 @@
+#include "condition.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tdb/utility.h"
+
+#define TDB_CONDITION_MAX_STACK 64
+
+struct tdb_condition_parser {
+    const char* source;
+    size_t position;
+    size_t stack_depth;
+    bool failed;
+    struct tdb_condition* condition;
+};
+
+static void tdb_parse_error(struct tdb_condition_parser* parser, const char* message)
+{
+    if (!parser->failed) {
+        fprintf(stderr, "condition error at column %zu: %s\n", parser->position + 1, message);
+        fprintf(stderr, "    %s\n    %*s^\n", parser->source, (int)parser->position, "");
+    }
+
+    parser->failed = true;
+}
+
+static int tdb_stack_effect(enum tdb_condition_opcode opcode)
+{
+    switch (opcode) {
+        case TDB_OP_PUSH:
+        case TDB_OP_REGISTER:
+            return 1;
+        case TDB_OP_LOAD:
+        case TDB_OP_NEGATE:
+        case TDB_OP_LOGICAL_NOT:
+        case TDB_OP_BITWISE_NOT:
+        case TDB_OP_TO_BOOL:
+        case TDB_OP_JUMP_IF_ZERO:
+        case TDB_OP_JUMP_IF_NOT_ZERO:
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+static size_t tdb_emit(struct tdb_condition_parser* parser, enum tdb_condition_opcode opcode, uint64_t operand)
+{
+    struct tdb_condition* condition = parser->condition;
+
+    if (condition->length == condition->capacity) {
+        size_t new_capacity = condition->capacity == 0 ? 16 : 2 * condition->capacity;
+        struct tdb_condition_instruction* code =
+            realloc(condition->code, new_capacity * sizeof(struct tdb_condition_instruction));
+        if (code == NULL) {
+            tdb_parse_error(parser, "out of memory");
+            return 0;
+        }
+
+        condition->code = code;
+        condition->capacity = new_capacity;
+    }
+
+    struct tdb_condition_instruction* instruction = &condition->code[condition->length];
+    instruction->opcode = (uint8_t)opcode;
+    instruction->load_size = 0;
+    instruction->load_signed = false;
+    instruction->operand = operand;
+
+    parser->stack_depth += tdb_stack_effect(opcode);
+    if (parser->stack_depth > condition->max_stack_depth) {
+        condition->max_stack_depth = parser->stack_depth;
+    }
+
+    return condition->length++;
+}
+
+static void tdb_skip_whitespace(struct tdb_condition_parser* parser)
+{
+    while (isspace((unsigned char)parser->source[parser->position])) {
+        parser->position++;
+    }
+}
+
+static bool tdb_accept(struct tdb_condition_parser* parser, const char* op)
+{
+    static const char* TWO_CHAR_OPERATORS[] = {"||", "&&", "==", "!=", "<=", ">=", "<<", ">>"};
+
+    tdb_skip_whitespace(parser);
+
+    const char* here = parser->source + parser->position;
+    const size_t op_length = strlen(op);
+    if (strncmp(here, op, op_length) != 0) {
+        return false;
+    }
+
+    // don't let '<' match the start of '<=' and so on
+    if (op_length == 1) {
+        for (size_t i = 0; i < sizeof(TWO_CHAR_OPERATORS) / sizeof(char*); i++) {
+            if (here[0] == TWO_CHAR_OPERATORS[i][0] && here[1] == TWO_CHAR_OPERATORS[i][1]) {
+                return false;
+            }
+        }
+    }
+
+    parser->position += op_length;
+    return true;
+}
+
+static void tdb_expect(struct tdb_condition_parser* parser, const char* op)
+{
+    if (!tdb_accept(parser, op)) {
+        char message[64];
+        snprintf(message, sizeof(message), "expected '%s'", op);
+        tdb_parse_error(parser, message);
+    }
+}
+
+static void tdb_parse_expression(struct tdb_condition_parser* parser);
+static void tdb_parse_unary(struct tdb_condition_parser* parser);
+
+static bool tdb_load_width(const char* name, size_t length, uint8_t* size, bool* is_signed)
+{
+    static const struct {
+        const char* name;
+        uint8_t size;
+        bool is_signed;
+    } LOAD_TYPES[] = {
+        {"u8", 1, false}, {"u16", 2, false}, {"u32", 4, false}, {"u64", 8, false},
+        {"i8", 1, true},  {"i16", 2, true},  {"i32", 4, true},  {"i64", 8, true},
+    };
+
+    for (size_t i = 0; i < sizeof(LOAD_TYPES) / sizeof(LOAD_TYPES[0]); i++) {
+        if (strlen(LOAD_TYPES[i].name) == length && !strncmp(name, LOAD_TYPES[i].name, length)) {
+            *size = LOAD_TYPES[i].size;
+            *is_signed = LOAD_TYPES[i].is_signed;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void tdb_emit_load(struct tdb_condition_parser* parser, uint8_t size, bool is_signed)
+{
+    size_t index = tdb_emit(parser, TDB_OP_LOAD, 0);
+    if (!parser->failed) {
+        parser->condition->code[index].load_size = size;
+        parser->condition->code[index].load_signed = is_signed;
+    }
+}
+
+static void tdb_parse_primary(struct tdb_condition_parser* parser)
+{
+    tdb_skip_whitespace(parser);
+
+    const char* here = parser->source + parser->position;
+
+    if (tdb_accept(parser, "(")) {
+        tdb_parse_expression(parser);
+        tdb_expect(parser, ")");
+    }
+    else if (isdigit((unsigned char)here[0])) {
+        char* end;
+        uint64_t value = strtoull(here, &end, 0);
+        parser->position += (size_t)(end - here);
+        tdb_emit(parser, TDB_OP_PUSH, value);
+    }
+    else if (isalpha((unsigned char)here[0]) || here[0] == '_' || here[0] == '$') {
+        size_t start = here[0] == '$' ? 1 : 0;
+        size_t length = start;
+        while (isalnum((unsigned char)here[length]) || here[length] == '_') {
+            length++;
+        }
+
+        uint8_t load_size;
+        bool load_signed;
+        char name[32];
+
+        if (length - start >= sizeof(name)) {
+            tdb_parse_error(parser, "identifier too long");
+            return;
+        }
+
+        memcpy(name, here + start, length - start);
+        name[length - start] = '\0';
+        parser->position += length;
+
+        if (start == 0 && tdb_load_width(name, length, &load_size, &load_signed)) {
+            tdb_expect(parser, "[");
+            tdb_parse_expression(parser);
+            tdb_expect(parser, "]");
+            tdb_emit_load(parser, load_size, load_signed);
+            return;
+        }
+
+        enum x86_64_register reg = tdb_get_register_from_name(name);
+        if (reg == x86_64_unknown) {
+            parser->position -= length;
+            tdb_parse_error(parser, "unknown register");
+            return;
+        }
+
+        tdb_emit(parser, TDB_OP_REGISTER, (uint64_t)reg);
+    }
+    else {
+        tdb_parse_error(parser, "expected a number, register, memory load or '('");
+    }
+}
+
+static void tdb_parse_unary(struct tdb_condition_parser* parser)
+{
+    if (tdb_accept(parser, "-")) {
+        tdb_parse_unary(parser);
+        tdb_emit(parser, TDB_OP_NEGATE, 0);
+    }
+    else if (tdb_accept(parser, "!")) {
+        tdb_parse_unary(parser);
+        tdb_emit(parser, TDB_OP_LOGICAL_NOT, 0);
+    }
+    else if (tdb_accept(parser, "~")) {
+        tdb_parse_unary(parser);
+        tdb_emit(parser, TDB_OP_BITWISE_NOT, 0);
+    }
+    else if (tdb_accept(parser, "*")) {
+        tdb_parse_unary(parser);
+        tdb_emit_load(parser, 8, false);
+    }
+    else {
+        tdb_parse_primary(parser);
+    }
+}
+
+struct tdb_binary_operator {
+    const char* token;
+    enum tdb_condition_opcode opcode;
+};
+
+// binary operators from lowest to highest precedence, one level per row
+static const struct tdb_binary_operator g_tdb_binary_operators[][4] = {
+    {{"|", TDB_OP_BITWISE_OR}},
+    {{"^", TDB_OP_BITWISE_XOR}},
+    {{"&", TDB_OP_BITWISE_AND}},
+    {{"==", TDB_OP_EQUAL}, {"!=", TDB_OP_NOT_EQUAL}},
+    {{"<=", TDB_OP_LESS_EQUAL}, {">=", TDB_OP_GREATER_EQUAL}, {"<", TDB_OP_LESS}, {">", TDB_OP_GREATER}},
+    {{"<<", TDB_OP_SHIFT_LEFT}, {">>", TDB_OP_SHIFT_RIGHT}},
+    {{"+", TDB_OP_ADD}, {"-", TDB_OP_SUBTRACT}},
+    {{"*", TDB_OP_MULTIPLY}, {"/", TDB_OP_DIVIDE}, {"%", TDB_OP_MODULO}},
+};
+
+static const size_t TDB_BINARY_PRECEDENCE_LEVELS = sizeof(g_tdb_binary_operators) / sizeof(g_tdb_binary_operators[0]);
+
+static void tdb_parse_binary(struct tdb_condition_parser* parser, size_t level)
+{
+    if (level == TDB_BINARY_PRECEDENCE_LEVELS) {
+        tdb_parse_unary(parser);
+        return;
+    }
+
+    tdb_parse_binary(parser, level + 1);
+
+    while (!parser->failed) {
+        const struct tdb_binary_operator* matched = NULL;
+        for (size_t i = 0; i < 4 && g_tdb_binary_operators[level][i].token != NULL; i++) {
+            if (tdb_accept(parser, g_tdb_binary_operators[level][i].token)) {
+                matched = &g_tdb_binary_operators[level][i];
+                break;
+            }
+        }
+
+        if (matched == NULL) {
+            break;
+        }
+
+        tdb_parse_binary(parser, level + 1);
+        tdb_emit(parser, matched->opcode, 0);
+    }
+}
+
+// a && b  =>  a; JUMP_IF_ZERO end; POP; b; end: TO_BOOL   (and likewise for ||)
+static void tdb_parse_logical(struct tdb_condition_parser* parser, bool is_or)
+{
+    if (is_or) {
+        tdb_parse_logical(parser, false);
+    }
+    else {
+        tdb_parse_binary(parser, 0);
+    }
+
+    while (!parser->failed && tdb_accept(parser, is_or ? "||" : "&&")) {
+        size_t jump = tdb_emit(parser, is_or ? TDB_OP_JUMP_IF_NOT_ZERO : TDB_OP_JUMP_IF_ZERO, 0);
+        tdb_emit(parser, TDB_OP_POP, 0);
+
+        if (is_or) {
+            tdb_parse_logical(parser, false);
+        }
+        else {
+            tdb_parse_binary(parser, 0);
+        }
+
+        size_t target = tdb_emit(parser, TDB_OP_TO_BOOL, 0);
+        if (!parser->failed) {
+            parser->condition->code[jump].operand = target;
+        }
+    }
+}
+
+static void tdb_parse_expression(struct tdb_condition_parser* parser)
+{
+    tdb_parse_logical(parser, true);
+}
+
+bool tdb_condition_compile(struct tdb_condition* condition, const char* source)
+{
+    condition->code = NULL;
+    condition->length = 0;
+    condition->capacity = 0;
+    condition->max_stack_depth = 0;
+    condition->source = strdup(source);
+    if (condition->source == NULL) {
+        fprintf(stderr, "Failed to allocate breakpoint condition\n");
+        return false;
+    }
+
+    struct tdb_condition_parser parser = {
+        .source = source, .position = 0, .stack_depth = 0, .failed = false, .condition = condition};
+
+    tdb_parse_expression(&parser);
+
+    tdb_skip_whitespace(&parser);
+    if (parser.source[parser.position] != '\0') {
+        tdb_parse_error(&parser, "unexpected trailing characters");
+    }
+
+    if (!parser.failed && condition->max_stack_depth > TDB_CONDITION_MAX_STACK) {
+        tdb_parse_error(&parser, "expression too deeply nested");
+    }
+
+    if (parser.failed) {
+        tdb_condition_free(condition);
+        return false;
+    }
+
+    return true;
+}
+
+void tdb_condition_free(struct tdb_condition* condition)
+{
+    free(condition->code);
+    free(condition->source);
+    condition->code = NULL;
+    condition->source = NULL;
+    condition->length = 0;
+    condition->capacity = 0;
+}
+
+bool tdb_condition_evaluate(const struct tdb_condition* condition, struct tdb_register_cache* registers,
+                            pid_t pid, bool* result)
+{
+    uint64_t stack[TDB_CONDITION_MAX_STACK];
+    size_t top = 0;
+
+    for (size_t pc = 0; pc < condition->length; pc++) {
+        const struct tdb_condition_instruction* instruction = &condition->code[pc];
+
+        switch ((enum tdb_condition_opcode)instruction->opcode) {
+            case TDB_OP_PUSH:
+                stack[top++] = instruction->operand;
+                break;
+            case TDB_OP_REGISTER: {
+                bool success;
+                stack[top++] =
+                    tdb_get_register_value(registers, (enum x86_64_register)instruction->operand, &success);
+                if (!success) {
+                    return false;
+                }
+            } break;
+            case TDB_OP_LOAD: {
+                const uintptr_t address = stack[top - 1];
+                uint64_t value = 0;
+                if (tdb_read_memory_range(pid, address, &value, instruction->load_size) != instruction->load_size) {
+                    fprintf(stderr, "condition: failed to read memory at 0x%zx\n", address);
+                    return false;
+                }
+
+                if (instruction->load_signed && instruction->load_size < 8) {
+                    const unsigned shift = 64 - 8 * instruction->load_size;
+                    value = (uint64_t)(((int64_t)(value << shift)) >> shift);
+                }
+
+                stack[top - 1] = value;
+            } break;
+            case TDB_OP_NEGATE:
+                stack[top - 1] = -stack[top - 1];
+                break;
+            case TDB_OP_LOGICAL_NOT:
+                stack[top - 1] = !stack[top - 1];
+                break;
+            case TDB_OP_BITWISE_NOT:
+                stack[top - 1] = ~stack[top - 1];
+                break;
+            case TDB_OP_TO_BOOL:
+                stack[top - 1] = stack[top - 1] != 0;
+                break;
+            case TDB_OP_JUMP_IF_ZERO:
+                if (stack[top - 1] == 0) {
+                    pc = instruction->operand - 1;
+                }
+                break;
+            case TDB_OP_JUMP_IF_NOT_ZERO:
+                if (stack[top - 1] != 0) {
+                    pc = instruction->operand - 1;
+                }
+                break;
+            case TDB_OP_POP:
+                top--;
+                break;
+            default: {
+                const uint64_t rhs = stack[--top];
+                const uint64_t lhs = stack[top - 1];
+                uint64_t value = 0;
+
+                switch ((enum tdb_condition_opcode)instruction->opcode) {
+                    case TDB_OP_MULTIPLY:
+                        value = lhs * rhs;
+                        break;
+                    case TDB_OP_DIVIDE:
+                    case TDB_OP_MODULO:
+                        if (rhs == 0) {
+                            fprintf(stderr, "condition: division by zero\n");
+                            return false;
+                        }
+                        value = instruction->opcode == TDB_OP_DIVIDE ? lhs / rhs : lhs % rhs;
+                        break;
+                    case TDB_OP_ADD:
+                        value = lhs + rhs;
+                        break;
+                    case TDB_OP_SUBTRACT:
+                        value = lhs - rhs;
+                        break;
+                    case TDB_OP_SHIFT_LEFT:
+                        value = rhs < 64 ? lhs << rhs : 0;
+                        break;
+                    case TDB_OP_SHIFT_RIGHT:
+                        value = rhs < 64 ? lhs >> rhs : 0;
+                        break;
+                    case TDB_OP_LESS:
+                        value = (int64_t)lhs < (int64_t)rhs;
+                        break;
+                    case TDB_OP_LESS_EQUAL:
+                        value = (int64_t)lhs <= (int64_t)rhs;
+                        break;
+                    case TDB_OP_GREATER:
+                        value = (int64_t)lhs > (int64_t)rhs;
+                        break;
+                    case TDB_OP_GREATER_EQUAL:
+                        value = (int64_t)lhs >= (int64_t)rhs;
+                        break;
+                    case TDB_OP_EQUAL:
+                        value = lhs == rhs;
+                        break;
+                    case TDB_OP_NOT_EQUAL:
+                        value = lhs != rhs;
+                        break;
+                    case TDB_OP_BITWISE_AND:
+                        value = lhs & rhs;
+                        break;
+                    case TDB_OP_BITWISE_XOR:
+                        value = lhs ^ rhs;
+                        break;
+                    case TDB_OP_BITWISE_OR:
+                        value = lhs | rhs;
+                        break;
+                    default:
+                        fprintf(stderr, "condition: invalid opcode %d\n", instruction->opcode);
+                        return false;
+                }
+
+                stack[top - 1] = value;
+            } break;
+        }
+    }
+
+    *result = top > 0 && stack[top - 1] != 0;
+    return true;
+}
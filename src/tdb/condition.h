@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "tdb/register.h"
+
+// A breakpoint condition, compiled once from a C-like expression into bytecode for a
+// small stack machine so that it can be evaluated right after a trap without
+// re-parsing. Supported syntax:
+//
+//   literals          42, 0x2a
+//   registers         rax, $rdi, rip, eflags, ...
+//   memory loads      *expr (64 bits), u8[expr], u16[expr], u32[expr], u64[expr] and the
+//                     sign-extending i8[expr], i16[expr], i32[expr]
+//   operators         unary - ! ~, * / %, + -, << >>, < <= > >= (signed), == !=, & ^ |, && ||
+//   grouping          ( expr )
+enum tdb_condition_opcode {
+    TDB_OP_PUSH,
+    TDB_OP_REGISTER,
+    TDB_OP_LOAD,
+    TDB_OP_NEGATE,
+    TDB_OP_LOGICAL_NOT,
+    TDB_OP_BITWISE_NOT,
+    TDB_OP_MULTIPLY,
+    TDB_OP_DIVIDE,
+    TDB_OP_MODULO,
+    TDB_OP_ADD,
+    TDB_OP_SUBTRACT,
+    TDB_OP_SHIFT_LEFT,
+    TDB_OP_SHIFT_RIGHT,
+    TDB_OP_LESS,
+    TDB_OP_LESS_EQUAL,
+    TDB_OP_GREATER,
+    TDB_OP_GREATER_EQUAL,
+    TDB_OP_EQUAL,
+    TDB_OP_NOT_EQUAL,
+    TDB_OP_BITWISE_AND,
+    TDB_OP_BITWISE_XOR,
+    TDB_OP_BITWISE_OR,
+    TDB_OP_TO_BOOL,
+    TDB_OP_JUMP_IF_ZERO,      // peeks, leaves the value on the stack
+    TDB_OP_JUMP_IF_NOT_ZERO,  // peeks, leaves the value on the stack
+    TDB_OP_POP,
+};
+
+struct tdb_condition_instruction {
+    uint8_t opcode;
+    uint8_t load_size;
+    bool load_signed;
+    uint64_t operand;
+};
+
+struct tdb_condition {
+    struct tdb_condition_instruction* code;
+    size_t length;
+    size_t capacity;
+    size_t max_stack_depth;
+    char* source;
+};
+
+bool tdb_condition_compile(struct tdb_condition* condition, const char* source);
+void tdb_condition_free(struct tdb_condition* condition);
+
+// Returns false if evaluation failed (unreadable memory, division by zero), in which
+// case *result is left untouched.
+bool tdb_condition_evaluate(const struct tdb_condition* condition, struct tdb_register_cache* registers,
+                            pid_t pid, bool* result);
@@ -0,0 +1,1052 @@
+#define _GNU_SOURCE
+
+#include "core.h"
+
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/procfs.h>
+#include <sys/stat.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "tdb/stats.h"
+#include "tdb/tdb.h"
+#include "tdb/utility.h"
+
+#define TDB_CORE_PAGE_SIZE 4096
+#define TDB_CORE_BATCH_SIZE (4 * 1024 * 1024)
+
+_Static_assert(sizeof(elf_gregset_t) == sizeof(struct user_regs_struct), "elf_gregset_t is not user_regs_struct");
+_Static_assert(sizeof(elf_fpregset_t) == sizeof(struct user_fpregs_struct),
+               "elf_fpregset_t is not user_fpregs_struct");
+
+// The contents of the PT_NOTE segment, built in memory before anything is written.
+struct tdb_core_notes {
+    uint8_t* data;
+    size_t size;
+    size_t capacity;
+};
+
+// What /proc/pid/stat says about the process, for NT_PRSTATUS and NT_PRPSINFO.
+struct tdb_core_process_info {
+    char state;
+    int ppid;
+    int pgrp;
+    int sid;
+    int nice;
+};
+
+// The original byte under an enabled breakpoint, put back into the copied memory.
+struct tdb_core_patch {
+    uint64_t address;
+    uint8_t byte;
+};
+
+struct tdb_core_totals {
+    uint64_t written;
+    uint64_t holes;
+};
+
+static uint64_t tdb_core_page_align(uint64_t value)
+{
+    return (value + TDB_CORE_PAGE_SIZE - 1) & ~(uint64_t)(TDB_CORE_PAGE_SIZE - 1);
+}
+
+static bool tdb_core_notes_append(struct tdb_core_notes* notes, const void* data, size_t size)
+{
+    // note names and descriptors are padded to 4 bytes
+    const size_t padded = (size + 3) & ~(size_t)3;
+
+    if (notes->size + padded > notes->capacity) {
+        size_t capacity = notes->capacity == 0 ? 4096 : notes->capacity;
+        while (notes->size + padded > capacity) {
+            capacity *= 2;
+        }
+
+        uint8_t* grown = realloc(notes->data, capacity);
+        if (grown == NULL) {
+            fprintf(stderr, "Failed to allocate core notes\n");
+            return false;
+        }
+
+        notes->data = grown;
+        notes->capacity = capacity;
+    }
+
+    memcpy(notes->data + notes->size, data, size);
+    memset(notes->data + notes->size + size, 0, padded - size);
+    notes->size += padded;
+    return true;
+}
+
+static bool tdb_core_add_note(struct tdb_core_notes* notes, uint32_t type, const void* desc, size_t desc_size)
+{
+    static const char name[] = "CORE";
+
+    Elf64_Nhdr header = {.n_namesz = sizeof(name), .n_descsz = (Elf64_Word)desc_size, .n_type = type};
+
+    return tdb_core_notes_append(notes, &header, sizeof(header)) &&
+           tdb_core_notes_append(notes, name, sizeof(name)) && tdb_core_notes_append(notes, desc, desc_size);
+}
+
+// Reads a whole file under /proc/pid. The size of these can't be known up front.
+static uint8_t* tdb_core_read_proc_file(pid_t pid, const char* name, size_t* size)
+{
+    const uint64_t start = tdb_stats_start();
+
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/%s", pid, name);
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        tdb_stats_record(TDB_STAT_PROC_OTHER, start);
+        return NULL;
+    }
+
+    size_t capacity = 4096;
+    uint8_t* data = malloc(capacity);
+    *size = 0;
+
+    while (data != NULL) {
+        if (*size == capacity) {
+            capacity *= 2;
+            uint8_t* grown = realloc(data, capacity);
+            if (grown == NULL) {
+                free(data);
+                data = NULL;
+                break;
+            }
+            data = grown;
+        }
+
+        ssize_t count = read(fd, data + *size, capacity - *size);
+        if (count <= 0) {
+            break;
+        }
+        *size += (size_t)count;
+    }
+
+    close(fd);
+    tdb_stats_record(TDB_STAT_PROC_OTHER, start);
+    return data;
+}
+
+static bool tdb_core_read_process_info(pid_t pid, struct tdb_core_process_info* info)
+{
+    size_t size = 0;
+    char* contents = (char*)tdb_core_read_proc_file(pid, "stat", &size);
+    if (contents == NULL) {
+        return false;
+    }
+
+    // the command name is in parentheses and may contain anything, including them
+    bool success = false;
+    char* fields = size > 0 ? memrchr(contents, ')', size) : NULL;
+    if (fields != NULL) {
+        contents[size - 1] = '\0';
+
+        // state ppid pgrp session tty_nr tpgid flags minflt cminflt majflt cmajflt
+        // utime stime cutime cstime priority nice
+        long nice = 0;
+        success = sscanf(fields + 1,
+                         " %c %d %d %d %*d %*d %*u %*u %*u %*u %*u %*u %*u %*d %*d %*d %ld",
+                         &info->state, &info->ppid, &info->pgrp, &info->sid, &nice) == 5;
+        info->nice = (int)nice;
+    }
+
+    if (!success) {
+        fprintf(stderr, "Failed to parse /proc/%d/stat\n", pid);
+    }
+
+    free(contents);
+    return success;
+}
+
+static int tdb_core_compare_patches(const void* a, const void* b)
+{
+    const struct tdb_core_patch* left = a;
+    const struct tdb_core_patch* right = b;
+    return (left->address > right->address) - (left->address < right->address);
+}
+
+// Collects the original bytes of the breakpoints currently planted, sorted by address.
+static struct tdb_core_patch* tdb_core_collect_patches(struct tdb_context* context, size_t* count)
+{
+    struct tdb_core_patch* patches = malloc((context->breakpoints.count + 1) * sizeof(*patches));
+    *count = 0;
+    if (patches == NULL) {
+        return NULL;
+    }
+
+    size_t cursor = 0;
+    struct tdb_breakpoint* bp;
+    while ((bp = tdb_breakpoint_table_next(&context->breakpoints, &cursor)) != NULL) {
+        if (bp->enabled) {
+            patches[*count].address = bp->address;
+            patches[*count].byte = bp->saved_data;
+            (*count)++;
+        }
+    }
+
+    qsort(patches, *count, sizeof(*patches), tdb_core_compare_patches);
+    return patches;
+}
+
+// Returns the index of the first patch at or after address.
+static size_t tdb_core_find_patch(const struct tdb_core_patch* patches, size_t patch_count, uint64_t address)
+{
+    size_t low = 0;
+    size_t high = patch_count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (patches[middle].address < address) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+
+    return low;
+}
+
+static bool tdb_core_has_patch(const struct tdb_core_patch* patches, size_t patch_count, uint64_t address)
+{
+    const size_t index = tdb_core_find_patch(patches, patch_count, address);
+    return index < patch_count && patches[index].address == address;
+}
+
+static void tdb_core_apply_patches(uint8_t* buffer, uint64_t address, size_t length,
+                                   const struct tdb_core_patch* patches, size_t patch_count)
+{
+    for (size_t i = tdb_core_find_patch(patches, patch_count, address);
+         i < patch_count && patches[i].address < address + length; i++) {
+        buffer[patches[i].address - address] = patches[i].byte;
+    }
+}
+
+static bool tdb_core_add_thread_notes(struct tdb_core_notes* notes, const struct tdb_core_process_info* info,
+                                      struct tdb_thread* thread, const struct tdb_core_patch* patches,
+                                      size_t patch_count)
+{
+    bool success;
+    tdb_get_register_value(&thread->registers, x86_64_rip, &success);  // fills the cache
+    if (!success) {
+        return false;
+    }
+
+    struct elf_prstatus status;
+    memset(&status, 0, sizeof(status));
+
+    int signal = thread->pending_signal;
+    if (signal == 0 && thread->stopped_at_breakpoint) {
+        signal = SIGTRAP;
+    }
+
+    status.pr_info.si_signo = signal;
+    status.pr_cursig = (short)signal;
+    status.pr_pid = thread->tid;
+    status.pr_ppid = info->ppid;
+    status.pr_pgrp = info->pgrp;
+    status.pr_sid = info->sid;
+
+    // a breakpoint stop that hasn't been handled yet still has the PC past the int3
+    struct user_regs_struct registers = thread->registers.regs;
+    const int wait_status = thread->wait_status;
+    if (thread->has_pending_status && WSTOPSIG(wait_status) == SIGTRAP && wait_status >> 16 == 0 &&
+        tdb_core_has_patch(patches, patch_count, registers.rip - 1)) {
+        registers.rip--;
+    }
+    memcpy(&status.pr_reg, &registers, sizeof(status.pr_reg));
+
+    struct user_fpregs_struct fp_registers;
+    errno = 0;
+    tdb_ptrace(PTRACE_GETFPREGS, thread->tid, NULL, &fp_registers);
+    status.pr_fpvalid = errno == 0;
+
+    if (!tdb_core_add_note(notes, NT_PRSTATUS, &status, sizeof(status))) {
+        return false;
+    }
+
+    return !status.pr_fpvalid || tdb_core_add_note(notes, NT_FPREGSET, &fp_registers, sizeof(fp_registers));
+}
+
+static bool tdb_core_add_process_notes(struct tdb_core_notes* notes, const struct tdb_core_process_info* info,
+                                       pid_t pid)
+{
+    struct elf_prpsinfo psinfo;
+    memset(&psinfo, 0, sizeof(psinfo));
+
+    static const char states[] = "RSDTZW";
+    const char* state = strchr(states, info->state);
+    psinfo.pr_state = state != NULL ? (char)(state - states) : 0;
+    psinfo.pr_sname = info->state;
+    psinfo.pr_zomb = info->state == 'Z';
+    psinfo.pr_nice = (char)info->nice;
+    psinfo.pr_pid = pid;
+    psinfo.pr_ppid = info->ppid;
+    psinfo.pr_pgrp = info->pgrp;
+    psinfo.pr_sid = info->sid;
+
+    char proc_path[64];
+    snprintf(proc_path, sizeof(proc_path), "/proc/%d", pid);
+    struct stat proc_stat;
+    if (stat(proc_path, &proc_stat) == 0) {
+        psinfo.pr_uid = proc_stat.st_uid;
+        psinfo.pr_gid = proc_stat.st_gid;
+    }
+
+    size_t size = 0;
+    uint8_t* comm = tdb_core_read_proc_file(pid, "comm", &size);
+    if (comm != NULL) {
+        const uint8_t* newline = memchr(comm, '\n', size);
+        size = newline != NULL ? (size_t)(newline - comm) : size;
+        memcpy(psinfo.pr_fname, comm, size < sizeof(psinfo.pr_fname) ? size : sizeof(psinfo.pr_fname) - 1);
+        free(comm);
+    }
+
+    // the arguments are separated by NULs, and shown separated by spaces
+    uint8_t* cmdline = tdb_core_read_proc_file(pid, "cmdline", &size);
+    if (cmdline != NULL) {
+        size = size < sizeof(psinfo.pr_psargs) ? size : sizeof(psinfo.pr_psargs) - 1;
+        for (size_t i = 0; i < size; i++) {
+            psinfo.pr_psargs[i] = cmdline[i] != '\0' ? (char)cmdline[i] : ' ';
+        }
+        while (size > 0 && psinfo.pr_psargs[size - 1] == ' ') {
+            psinfo.pr_psargs[--size] = '\0';
+        }
+        free(cmdline);
+    }
+
+    if (!tdb_core_add_note(notes, NT_PRPSINFO, &psinfo, sizeof(psinfo))) {
+        return false;
+    }
+
+    uint8_t* auxv = tdb_core_read_proc_file(pid, "auxv", &size);
+    if (auxv == NULL) {
+        return false;
+    }
+
+    bool success = tdb_core_add_note(notes, NT_AUXV, auxv, size);
+    free(auxv);
+    return success;
+}
+
+// NT_FILE is a count and page size, then start, end and page offset of every mapped
+// file, then their paths in the same order.
+static bool tdb_core_add_file_note(struct tdb_core_notes* notes, const struct tdb_process_maps* maps)
+{
+    size_t file_count = 0;
+    size_t paths_size = 0;
+    for (size_t i = 0; i < maps->mapping_count; i++) {
+        const struct tdb_mapping* mapping = &maps->mappings[i];
+        if (mapping->object_index != TDB_MAPPING_NO_OBJECT) {
+            file_count++;
+            paths_size += strlen(maps->objects[mapping->object_index].path) + 1;
+        }
+    }
+
+    const size_t size = (2 + 3 * file_count) * sizeof(uint64_t) + paths_size;
+    uint8_t* desc = malloc(size);
+    if (desc == NULL) {
+        fprintf(stderr, "Failed to allocate NT_FILE note\n");
+        return false;
+    }
+
+    uint64_t* words = (uint64_t*)desc;
+    char* paths = (char*)(words + 2 + 3 * file_count);
+    *words++ = file_count;
+    *words++ = TDB_CORE_PAGE_SIZE;
+
+    for (size_t i = 0; i < maps->mapping_count; i++) {
+        const struct tdb_mapping* mapping = &maps->mappings[i];
+        if (mapping->object_index == TDB_MAPPING_NO_OBJECT) {
+            continue;
+        }
+
+        *words++ = mapping->start;
+        *words++ = mapping->end;
+        *words++ = mapping->file_offset / TDB_CORE_PAGE_SIZE;
+
+        const char* path = maps->objects[mapping->object_index].path;
+        const size_t length = strlen(path) + 1;
+        memcpy(paths, path, length);
+        paths += length;
+    }
+
+    bool success = tdb_core_add_note(notes, NT_FILE, desc, size);
+    free(desc);
+    return success;
+}
+
+static bool tdb_core_build_notes(struct tdb_context* context, struct tdb_core_notes* notes,
+                                  const struct tdb_core_patch* patches, size_t patch_count)
+{
+    struct tdb_core_process_info info;
+    if (!tdb_core_read_process_info(context->pid, &info)) {
+        return false;
+    }
+
+    // gdb takes the first thread as the one that "crashed", so that is the current one
+    struct tdb_thread* current = tdb_thread_table_find(&context->threads, context->current_tid);
+    if (current == NULL) {
+        current = &context->threads.threads[0];
+    }
+
+    if (!tdb_core_add_thread_notes(notes, &info, current, patches, patch_count) ||
+        !tdb_core_add_process_notes(notes, &info, context->pid) ||
+        !tdb_core_add_file_note(notes, &context->maps)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < context->threads.count; i++) {
+        struct tdb_thread* thread = &context->threads.threads[i];
+        if (thread != current && !tdb_core_add_thread_notes(notes, &info, thread, patches, patch_count)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool tdb_core_skip_mapping(const struct tdb_mapping* mapping, bool skip_file_backed_readonly)
+{
+    if (!(mapping->permissions & TDB_MAPPING_READ)) {
+        return true;
+    }
+
+    return skip_file_backed_readonly && mapping->object_index != TDB_MAPPING_NO_OBJECT &&
+           !(mapping->permissions & TDB_MAPPING_WRITE);
+}
+
+static bool tdb_core_page_is_zero(const uint8_t* page)
+{
+    const uint64_t* words = (const uint64_t*)page;
+
+    uint64_t bits = 0;
+    for (size_t i = 0; i < TDB_CORE_PAGE_SIZE / sizeof(uint64_t); i++) {
+        bits |= words[i];
+    }
+
+    return bits == 0;
+}
+
+// Writes the runs of pages in buffer that aren't all zero, leaving holes for the rest.
+static bool tdb_core_write_sparse(int fd, const uint8_t* buffer, size_t length, uint64_t offset,
+                                  struct tdb_core_totals* totals)
+{
+    size_t page = 0;
+    while (page < length) {
+        if (tdb_core_page_is_zero(buffer + page)) {
+            totals->holes += TDB_CORE_PAGE_SIZE;
+            page += TDB_CORE_PAGE_SIZE;
+            continue;
+        }
+
+        size_t run_end = page + TDB_CORE_PAGE_SIZE;
+        while (run_end < length && !tdb_core_page_is_zero(buffer + run_end)) {
+            run_end += TDB_CORE_PAGE_SIZE;
+        }
+
+        for (size_t written = page; written < run_end;) {
+            ssize_t count = pwrite(fd, buffer + written, run_end - written, (off_t)(offset + written));
+            if (count <= 0) {
+                fprintf(stderr, "Failed to write core: %s\n", strerror(errno));
+                return false;
+            }
+            written += (size_t)count;
+        }
+
+        totals->written += run_end - page;
+        page = run_end;
+    }
+
+    return true;
+}
+
+static bool tdb_core_write_mapping(pid_t pid, int fd, const struct tdb_mapping* mapping, uint64_t offset,
+                                   uint8_t* buffer, const struct tdb_core_patch* patches, size_t patch_count,
+                                   struct tdb_core_totals* totals)
+{
+    uint64_t address = mapping->start;
+
+    while (address < mapping->end) {
+        size_t length = mapping->end - address < TDB_CORE_BATCH_SIZE ? mapping->end - address : TDB_CORE_BATCH_SIZE;
+
+        // pages that can't be read (like [vvar], or a file mapping past the end of the
+        // file) are left as zeros, and the next batch starts after them
+        size_t read = tdb_read_memory_range(pid, address, buffer, length);
+        if (read < length) {
+            memset(buffer + read, 0, length - read);
+            length = read == 0 ? TDB_CORE_PAGE_SIZE : tdb_core_page_align(read);
+        }
+
+        tdb_core_apply_patches(buffer, address, length, patches, patch_count);
+
+        if (!tdb_core_write_sparse(fd, buffer, length, offset + (address - mapping->start), totals)) {
+            return false;
+        }
+
+        address += length;
+    }
+
+    return true;
+}
+
+static bool tdb_core_write_headers(int fd, const struct tdb_process_maps* maps, const struct tdb_core_notes* notes,
+                                   bool skip_file_backed_readonly, uint64_t* data_offset, uint64_t* file_size)
+{
+    const size_t phdr_count = 1 + maps->mapping_count;
+    const size_t headers_size = sizeof(Elf64_Ehdr) + phdr_count * sizeof(Elf64_Phdr);
+
+    uint8_t* headers = calloc(1, headers_size);
+    if (headers == NULL) {
+        fprintf(stderr, "Failed to allocate core headers\n");
+        return false;
+    }
+
+    Elf64_Ehdr* ehdr = (Elf64_Ehdr*)headers;
+    memcpy(ehdr->e_ident, ELFMAG, SELFMAG);
+    ehdr->e_ident[EI_CLASS] = ELFCLASS64;
+    ehdr->e_ident[EI_DATA] = ELFDATA2LSB;
+    ehdr->e_ident[EI_VERSION] = EV_CURRENT;
+    ehdr->e_ident[EI_OSABI] = ELFOSABI_NONE;
+    ehdr->e_type = ET_CORE;
+    ehdr->e_machine = EM_X86_64;
+    ehdr->e_version = EV_CURRENT;
+    ehdr->e_phoff = sizeof(Elf64_Ehdr);
+    ehdr->e_ehsize = sizeof(Elf64_Ehdr);
+    ehdr->e_phentsize = sizeof(Elf64_Phdr);
+    ehdr->e_phnum = (Elf64_Half)phdr_count;
+
+    Elf64_Phdr* phdrs = (Elf64_Phdr*)(headers + sizeof(Elf64_Ehdr));
+    phdrs[0].p_type = PT_NOTE;
+    phdrs[0].p_offset = headers_size;
+    phdrs[0].p_filesz = notes->size;
+    phdrs[0].p_align = 4;
+
+    uint64_t offset = tdb_core_page_align(headers_size + notes->size);
+    *data_offset = offset;
+
+    for (size_t i = 0; i < maps->mapping_count; i++) {
+        const struct tdb_mapping* mapping = &maps->mappings[i];
+        Elf64_Phdr* phdr = &phdrs[i + 1];
+
+        phdr->p_type = PT_LOAD;
+        phdr->p_flags = ((mapping->permissions & TDB_MAPPING_READ) ? PF_R : 0) |
+                        ((mapping->permissions & TDB_MAPPING_WRITE) ? PF_W : 0) |
+                        ((mapping->permissions & TDB_MAPPING_EXECUTE) ? PF_X : 0);
+        phdr->p_offset = offset;
+        phdr->p_vaddr = mapping->start;
+        phdr->p_memsz = mapping->end - mapping->start;
+        phdr->p_filesz = tdb_core_skip_mapping(mapping, skip_file_backed_readonly) ? 0 : phdr->p_memsz;
+        phdr->p_align = TDB_CORE_PAGE_SIZE;
+
+        offset += phdr->p_filesz;
+    }
+
+    bool success = pwrite(fd, headers, headers_size, 0) == (ssize_t)headers_size &&
+                   pwrite(fd, notes->data, notes->size, (off_t)headers_size) == (ssize_t)notes->size;
+    if (!success) {
+        fprintf(stderr, "Failed to write core headers: %s\n", strerror(errno));
+    }
+
+    *file_size = offset;
+    free(headers);
+    return success;
+}
+
+bool tdb_write_core(struct tdb_context* context, const char* path, bool skip_file_backed_readonly)
+{
+    if (context->threads.count == 0) {
+        fprintf(stderr, "No process to write a core of\n");
+        return false;
+    }
+
+    // the maps are only refreshed when shared objects come and go, not on every mmap
+    if (!tdb_process_maps_refresh(&context->maps, context->pid)) {
+        return false;
+    }
+
+    if (1 + context->maps.mapping_count >= PN_XNUM) {
+        fprintf(stderr, "Too many mappings for a core file: %zu\n", context->maps.mapping_count);
+        return false;
+    }
+
+    size_t patch_count = 0;
+    struct tdb_core_patch* patches = tdb_core_collect_patches(context, &patch_count);
+
+    struct tdb_core_notes notes = {0};
+    if (patches == NULL || !tdb_core_build_notes(context, &notes, patches, patch_count)) {
+        free(notes.data);
+        free(patches);
+        return false;
+    }
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        free(notes.data);
+        free(patches);
+        return false;
+    }
+
+    uint8_t* buffer = aligned_alloc(TDB_CORE_PAGE_SIZE, TDB_CORE_BATCH_SIZE);
+
+    uint64_t offset = 0;
+    uint64_t file_size = 0;
+    bool success = buffer != NULL &&
+                   tdb_core_write_headers(fd, &context->maps, &notes, skip_file_backed_readonly, &offset, &file_size);
+
+    struct tdb_core_totals totals = {0};
+
+    for (size_t i = 0; success && i < context->maps.mapping_count; i++) {
+        const struct tdb_mapping* mapping = &context->maps.mappings[i];
+        if (tdb_core_skip_mapping(mapping, skip_file_backed_readonly)) {
+            continue;
+        }
+
+        success = tdb_core_write_mapping(context->pid, fd, mapping, offset, buffer, patches, patch_count, &totals);
+        offset += mapping->end - mapping->start;
+    }
+
+    // the holes at the end only exist once the file is extended over them
+    if (success && ftruncate(fd, (off_t)file_size) != 0) {
+        fprintf(stderr, "Failed to extend core file: %s\n", strerror(errno));
+        success = false;
+    }
+
+    if (success) {
+        printf("wrote core of process %d to %s: %zu threads, %zu segments, %.1f MiB written, %.1f MiB of holes\n",
+               context->pid, path, context->threads.count, context->maps.mapping_count,
+               (double)totals.written / (1024 * 1024), (double)totals.holes / (1024 * 1024));
+    }
+
+    close(fd);
+    free(buffer);
+    free(patches);
+    free(notes.data);
+    return success;
+}
+
+// An NT_FILE entry, matched up with the PT_LOAD segment starting at the same address.
+struct tdb_core_file {
+    uint64_t start;
+    uint64_t file_offset;
+    const char* path;
+};
+
+static bool tdb_core_image_add_thread(struct tdb_core_image* image, const struct elf_prstatus* status,
+                                      size_t* capacity)
+{
+    if (image->thread_count == *capacity) {
+        *capacity = *capacity == 0 ? 8 : 2 * *capacity;
+        struct tdb_core_thread* threads = realloc(image->threads, *capacity * sizeof(struct tdb_core_thread));
+        if (threads == NULL) {
+            fprintf(stderr, "Failed to allocate core threads\n");
+            return false;
+        }
+        image->threads = threads;
+    }
+
+    struct tdb_core_thread* thread = &image->threads[image->thread_count++];
+    thread->tid = status->pr_pid;
+    thread->signal = status->pr_cursig;
+    memcpy(&thread->regs, &status->pr_reg, sizeof(thread->regs));
+    return true;
+}
+
+// The paths follow the table of start, end and page offset, each terminated by a NUL
+// inside the note.
+static bool tdb_core_parse_file_note(const uint8_t* desc, size_t size, struct tdb_core_file** files,
+                                     size_t* file_count)
+{
+    const uint64_t* words = (const uint64_t*)desc;
+    if (size < 2 * sizeof(uint64_t) || words[0] > (size - 2 * sizeof(uint64_t)) / (3 * sizeof(uint64_t))) {
+        return false;
+    }
+
+    const size_t count = words[0];
+    const uint64_t page_size = words[1];
+    const char* path = (const char*)(words + 2 + 3 * count);
+    const char* end = (const char*)desc + size;
+
+    *files = malloc((count + 1) * sizeof(struct tdb_core_file));
+    if (*files == NULL) {
+        return false;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        const char* terminator = memchr(path, '\0', (size_t)(end - path));
+        if (terminator == NULL) {
+            return false;
+        }
+
+        (*files)[i].start = words[2 + 3 * i];
+        (*files)[i].file_offset = words[2 + 3 * i + 2] * page_size;
+        (*files)[i].path = path;
+        path = terminator + 1;
+    }
+
+    *file_count = count;
+    return true;
+}
+
+static bool tdb_core_parse_notes(struct tdb_core_image* image, const uint8_t* notes, size_t size,
+                                 struct tdb_core_file** files, size_t* file_count)
+{
+    size_t thread_capacity = 0;
+    size_t offset = 0;
+
+    while (offset + sizeof(Elf64_Nhdr) <= size) {
+        const Elf64_Nhdr* header = (const Elf64_Nhdr*)(notes + offset);
+        const size_t desc_offset = offset + sizeof(Elf64_Nhdr) + ((header->n_namesz + 3) & ~(size_t)3);
+        if (desc_offset + header->n_descsz > size) {
+            return false;
+        }
+
+        const uint8_t* desc = notes + desc_offset;
+
+        switch (header->n_type) {
+        case NT_PRSTATUS:
+            if (header->n_descsz >= sizeof(struct elf_prstatus) &&
+                !tdb_core_image_add_thread(image, (const struct elf_prstatus*)desc, &thread_capacity)) {
+                return false;
+            }
+            break;
+        case NT_PRPSINFO:
+            if (header->n_descsz >= sizeof(struct elf_prpsinfo)) {
+                image->pid = ((const struct elf_prpsinfo*)desc)->pr_pid;
+            }
+            break;
+        case NT_AUXV:
+            image->auxv = (const uint64_t*)desc;
+            image->auxv_count = header->n_descsz / (2 * sizeof(uint64_t));
+            break;
+        case NT_FILE:
+            if (*files == NULL && !tdb_core_parse_file_note(desc, header->n_descsz, files, file_count)) {
+                return false;
+            }
+            break;
+        default:
+            break;
+        }
+
+        offset = desc_offset + ((header->n_descsz + 3) & ~(size_t)3);
+    }
+
+    return true;
+}
+
+static int tdb_core_compare_segments(const void* a, const void* b)
+{
+    const struct tdb_core_segment* left = a;
+    const struct tdb_core_segment* right = b;
+    return (left->start > right->start) - (left->start < right->start);
+}
+
+static bool tdb_core_image_parse(struct tdb_core_image* image)
+{
+    const Elf64_Ehdr* ehdr = (const Elf64_Ehdr*)image->data;
+    if (image->size < sizeof(Elf64_Ehdr) || memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 ||
+        ehdr->e_ident[EI_CLASS] != ELFCLASS64 || ehdr->e_type != ET_CORE || ehdr->e_machine != EM_X86_64 ||
+        ehdr->e_phentsize != sizeof(Elf64_Phdr) || ehdr->e_phoff > image->size ||
+        ehdr->e_phnum > (image->size - ehdr->e_phoff) / sizeof(Elf64_Phdr)) {
+        fprintf(stderr, "Not an x86-64 ELF core file\n");
+        return false;
+    }
+
+    const Elf64_Phdr* phdrs = (const Elf64_Phdr*)(image->data + ehdr->e_phoff);
+
+    image->segments = malloc((ehdr->e_phnum + 1) * sizeof(struct tdb_core_segment));
+    if (image->segments == NULL) {
+        fprintf(stderr, "Failed to allocate core segments\n");
+        return false;
+    }
+
+    struct tdb_core_file* files = NULL;
+    size_t file_count = 0;
+    bool success = true;
+
+    for (size_t i = 0; i < ehdr->e_phnum && success; i++) {
+        const Elf64_Phdr* phdr = &phdrs[i];
+        if (phdr->p_offset > image->size) {
+            continue;
+        }
+
+        // a truncated core still has everything up to where it was cut off
+        const uint64_t available = image->size - phdr->p_offset;
+        const uint64_t data_size = phdr->p_filesz < available ? phdr->p_filesz : available;
+
+        if (phdr->p_type == PT_NOTE) {
+            success = tdb_core_parse_notes(image, image->data + phdr->p_offset, data_size, &files, &file_count);
+        }
+        else if (phdr->p_type == PT_LOAD && phdr->p_memsz > 0) {
+            struct tdb_core_segment* segment = &image->segments[image->segment_count++];
+            memset(segment, 0, sizeof(*segment));
+            segment->start = phdr->p_vaddr;
+            segment->end = phdr->p_vaddr + phdr->p_memsz;
+            segment->permissions = ((phdr->p_flags & PF_R) ? TDB_MAPPING_READ : 0) |
+                                   ((phdr->p_flags & PF_W) ? TDB_MAPPING_WRITE : 0) |
+                                   ((phdr->p_flags & PF_X) ? TDB_MAPPING_EXECUTE : 0);
+            segment->data = image->data + phdr->p_offset;
+            segment->data_size = data_size < phdr->p_memsz ? data_size : phdr->p_memsz;
+        }
+    }
+
+    if (!success) {
+        fprintf(stderr, "Malformed notes in core file\n");
+    }
+    else if (image->thread_count == 0) {
+        fprintf(stderr, "No threads (NT_PRSTATUS notes) in core file\n");
+        success = false;
+    }
+
+    if (success) {
+        if (image->pid == 0) {
+            image->pid = image->threads[0].tid;
+        }
+
+        qsort(image->segments, image->segment_count, sizeof(struct tdb_core_segment), tdb_core_compare_segments);
+
+        for (size_t i = 0; i < file_count; i++) {
+            for (size_t j = 0; j < image->segment_count; j++) {
+                if (image->segments[j].start == files[i].start) {
+                    image->segments[j].path = files[i].path;
+                    image->segments[j].file_offset = files[i].file_offset;
+                    break;
+                }
+            }
+        }
+    }
+
+    free(files);
+    return success;
+}
+
+bool tdb_core_image_open(struct tdb_core_image* image, const char* path)
+{
+    memset(image, 0, sizeof(*image));
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) {
+        fprintf(stderr, "Failed to read %s\n", path);
+        close(fd);
+        return false;
+    }
+
+    void* data = mmap(NULL, (size_t)file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "Failed to map %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    image->data = data;
+    image->size = (size_t)file_stat.st_size;
+
+    if (!tdb_core_image_parse(image)) {
+        tdb_core_image_close(image);
+        return false;
+    }
+
+    return true;
+}
+
+void tdb_core_image_close(struct tdb_core_image* image)
+{
+    for (size_t i = 0; i < image->segment_count; i++) {
+        if (image->segments[i].file_data != NULL) {
+            munmap((void*)image->segments[i].file_data, image->segments[i].file_data_size);
+        }
+    }
+
+    if (image->data != NULL) {
+        munmap(image->data, image->size);
+    }
+
+    free(image->segments);
+    free(image->threads);
+    memset(image, 0, sizeof(*image));
+}
+
+// Maps the part of a file that a segment left out of the core. Files that are gone or
+// shorter than the segment leave the rest of it unreadable.
+static void tdb_core_map_segment_file(struct tdb_core_segment* segment)
+{
+    segment->file_mapped = true;
+
+    int fd = open(segment->path, O_RDONLY);
+    if (fd == -1) {
+        return;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) == 0 && (uint64_t)file_stat.st_size > segment->file_offset) {
+        uint64_t size = (uint64_t)file_stat.st_size - segment->file_offset;
+        if (size > segment->end - segment->start) {
+            size = segment->end - segment->start;
+        }
+
+        void* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, (off_t)segment->file_offset);
+        if (data != MAP_FAILED) {
+            segment->file_data = data;
+            segment->file_data_size = size;
+        }
+    }
+
+    close(fd);
+}
+
+static struct tdb_core_segment* tdb_core_image_find_segment(struct tdb_core_image* image, uint64_t address)
+{
+    // find the last segment starting at or before the address
+    size_t low = 0;
+    size_t high = image->segment_count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (image->segments[middle].start <= address) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+
+    if (low == 0 || address >= image->segments[low - 1].end) {
+        return NULL;
+    }
+
+    return &image->segments[low - 1];
+}
+
+size_t tdb_core_image_read(struct tdb_core_image* image, uint64_t address, void* buffer, size_t length)
+{
+    size_t transferred = 0;
+
+    while (transferred < length) {
+        const uint64_t current = address + transferred;
+
+        struct tdb_core_segment* segment = tdb_core_image_find_segment(image, current);
+        if (segment == NULL) {
+            break;
+        }
+
+        const uint64_t offset = current - segment->start;
+        size_t count = segment->end - current < length - transferred ? segment->end - current : length - transferred;
+        const uint8_t* source = NULL;
+
+        if (offset < segment->data_size) {
+            source = segment->data + offset;
+            count = segment->data_size - offset < count ? segment->data_size - offset : count;
+        }
+        else if (segment->path != NULL) {
+            if (!segment->file_mapped) {
+                tdb_core_map_segment_file(segment);
+            }
+
+            if (offset >= segment->file_data_size) {
+                break;
+            }
+
+            source = segment->file_data + offset;
+            count = segment->file_data_size - offset < count ? segment->file_data_size - offset : count;
+        }
+        else {
+            break;
+        }
+
+        memcpy((uint8_t*)buffer + transferred, source, count);
+        transferred += count;
+    }
+
+    return transferred;
+}
+
+static size_t tdb_core_read_memory(void* source, uintptr_t address, void* buffer, size_t length)
+{
+    return tdb_core_image_read(source, address, buffer, length);
+}
+
+static uint64_t tdb_core_image_auxv_value(const struct tdb_core_image* image, uint64_t type)
+{
+    for (size_t i = 0; i < image->auxv_count; i++) {
+        if (image->auxv[2 * i] == type) {
+            return image->auxv[2 * i + 1];
+        }
+    }
+
+    return 0;
+}
+
+bool tdb_load_core(struct tdb_context* context, struct tdb_core_image* image)
+{
+    context->core = *image;
+    memset(image, 0, sizeof(*image));
+    image = &context->core;
+
+    tdb_set_memory_reader(image->pid, tdb_core_read_memory, image);
+
+    // the registers are never fetched with ptrace, the cache is valid from the start
+    tdb_thread_table_free(&context->threads);
+    tdb_thread_table_init(&context->threads);
+
+    for (size_t i = 0; i < image->thread_count; i++) {
+        struct tdb_thread* thread = tdb_thread_table_add(&context->threads, image->threads[i].tid, TDB_THREAD_STOPPED);
+        if (thread == NULL) {
+            return false;
+        }
+
+        thread->registers.regs = image->threads[i].regs;
+        thread->registers.valid = true;
+    }
+
+    context->current_tid = image->threads[0].tid;
+
+    // the executable is the file the entry point is in, and is replaced by the one given
+    // to tdb, which the core may have been copied away from
+    const struct tdb_core_segment* main_segment =
+        tdb_core_image_find_segment(image, tdb_core_image_auxv_value(image, AT_ENTRY));
+    const char* main_path = main_segment != NULL ? main_segment->path : NULL;
+
+    tdb_process_maps_free(&context->maps);
+
+    for (size_t i = 0; i < image->segment_count; i++) {
+        const struct tdb_core_segment* segment = &image->segments[i];
+
+        struct tdb_mapping mapping = {
+            .start = segment->start,
+            .end = segment->end,
+            .file_offset = segment->file_offset,
+            .permissions = segment->permissions,
+            .object_index = TDB_MAPPING_NO_OBJECT,
+        };
+
+        const bool is_main = main_path != NULL && segment->path != NULL && !strcmp(segment->path, main_path);
+        if (!tdb_process_maps_add(&context->maps, &mapping, is_main ? context->target_path : segment->path)) {
+            fprintf(stderr, "Failed to add core segments to the maps\n");
+            return false;
+        }
+
+        if (is_main && context->maps.main_object == TDB_MAPPING_NO_OBJECT) {
+            context->maps.main_object = context->maps.mappings[context->maps.mapping_count - 1].object_index;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/user.h>
+
+struct tdb_context;
+
+// Writes an ELF core file of the stopped process that gdb and tdb --core can load: a
+// PT_NOTE segment with NT_PRSTATUS and NT_FPREGSET for every thread (the current one
+// first), NT_PRPSINFO, NT_AUXV and NT_FILE, followed by one page-aligned PT_LOAD segment
+// per mapping. Memory is copied in large batches and pages that are all zero are left
+// as holes in a sparse file. Read-only mappings of files can be left out, since their
+// contents can be found through NT_FILE.
+bool tdb_write_core(struct tdb_context* context, const char* path, bool skip_file_backed_readonly);
+
+// A PT_LOAD segment of a core file. Its first data_size bytes are in the core, the rest
+// is zero, or comes from the file it maps if the core left that out.
+struct tdb_core_segment {
+    uint64_t start;
+    uint64_t end;
+    uint32_t permissions;  // TDB_MAPPING_* flags
+    const uint8_t* data;
+    uint64_t data_size;
+
+    const char* path;  // from NT_FILE, NULL for anonymous memory
+    uint64_t file_offset;
+
+    // mapped on the first read past data_size
+    const uint8_t* file_data;
+    size_t file_data_size;
+    bool file_mapped;
+};
+
+struct tdb_core_thread {
+    pid_t tid;
+    int signal;
+    struct user_regs_struct regs;
+};
+
+// A core file mapped into memory. Nothing is copied out of it: segments and notes point
+// into the mapping, so opening even a core of many gigabytes only reads its headers.
+struct tdb_core_image {
+    uint8_t* data;  // NULL if no core is open
+    size_t size;
+    pid_t pid;
+
+    struct tdb_core_segment* segments;  // sorted by address
+    size_t segment_count;
+
+    struct tdb_core_thread* threads;  // in note order, so the one that crashed first
+    size_t thread_count;
+
+    const uint64_t* auxv;  // pairs of type and value
+    size_t auxv_count;
+};
+
+bool tdb_core_image_open(struct tdb_core_image* image, const char* path);
+void tdb_core_image_close(struct tdb_core_image* image);
+
+// Reads like tdb_read_memory_range, returning less than length at memory that isn't in
+// the core.
+size_t tdb_core_image_read(struct tdb_core_image* image, uint64_t address, void* buffer, size_t length);
+
+// Moves an opened core into the context, whose pid must be image->pid: its threads
+// and registers, maps, and reads of its memory are all served from the core from then on.
+bool tdb_load_core(struct tdb_context* context, struct tdb_core_image* image);
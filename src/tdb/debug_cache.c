@@ -0,0 +1,389 @@
+#include "debug_cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <gelf.h>
+#include <libelf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "stats.h"
+
+#define TDB_DEBUG_CACHE_MAGIC "TDBCACHE"
+#define TDB_DEBUG_CACHE_VERSION 2
+
+// sections start on cache line boundaries
+#define TDB_DEBUG_CACHE_ALIGNMENT 64
+
+enum tdb_debug_cache_section_kind {
+    TDB_CACHE_SYMBOLS,
+    TDB_CACHE_SYMBOL_STRINGS,
+    TDB_CACHE_SYMBOL_BUCKETS,
+    TDB_CACHE_UNITS,
+    TDB_CACHE_UNIT_RANGES,
+    TDB_CACHE_LINES,
+    TDB_CACHE_LINES_BY_LOCATION,
+    TDB_CACHE_LINE_STRINGS,
+    TDB_CACHE_FILES,
+    TDB_CACHE_FILE_BUCKETS,
+    TDB_CACHE_SECTION_COUNT
+};
+
+struct tdb_debug_cache_section {
+    uint64_t offset;
+    uint64_t size;  // in bytes
+};
+
+struct tdb_debug_cache_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t build_id_size;
+    uint8_t build_id[TDB_DEBUG_CACHE_MAX_BUILD_ID];
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t file_size;
+    uint64_t total_size;
+    struct tdb_debug_cache_section sections[TDB_CACHE_SECTION_COUNT];
+};
+
+static bool tdb_read_build_id(struct tdb_debug_cache* cache, const char* elf_path)
+{
+    if (elf_version(EV_CURRENT) == EV_NONE) {
+        return false;
+    }
+
+    int fd = open(elf_path, O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+
+    Elf* elf = elf_begin(fd, ELF_C_READ_MMAP, NULL);
+    if (elf == NULL) {
+        close(fd);
+        return false;
+    }
+
+    bool found = false;
+    Elf_Scn* section = NULL;
+    while (!found && (section = elf_nextscn(elf, section)) != NULL) {
+        GElf_Shdr header;
+        if (gelf_getshdr(section, &header) == NULL || header.sh_type != SHT_NOTE) {
+            continue;
+        }
+
+        Elf_Data* data = elf_getdata(section, NULL);
+        if (data == NULL) {
+            continue;
+        }
+
+        GElf_Nhdr note;
+        size_t name_offset, desc_offset;
+        size_t offset = 0;
+        while (!found && (offset = gelf_getnote(data, offset, &note, &name_offset, &desc_offset)) != 0) {
+            const char* name = (const char*)data->d_buf + name_offset;
+            if (note.n_type == NT_GNU_BUILD_ID && note.n_namesz == 4 && !memcmp(name, "GNU", 4) &&
+                note.n_descsz > 0 && note.n_descsz <= TDB_DEBUG_CACHE_MAX_BUILD_ID) {
+                memcpy(cache->build_id, (const uint8_t*)data->d_buf + desc_offset, note.n_descsz);
+                cache->build_id_size = note.n_descsz;
+                found = true;
+            }
+        }
+    }
+
+    elf_end(elf);
+    close(fd);
+
+    return found;
+}
+
+static bool tdb_make_directory(const char* path)
+{
+    return mkdir(path, 0755) == 0 || errno == EEXIST;
+}
+
+// Resolves (and creates) the directory that holds the caches of all binaries.
+static bool tdb_debug_cache_directory(char* buffer, size_t buffer_size)
+{
+    const char* cache_home = getenv("XDG_CACHE_HOME");
+    int length;
+
+    if (cache_home != NULL && cache_home[0] == '/') {
+        length = snprintf(buffer, buffer_size, "%s", cache_home);
+    }
+    else {
+        const char* home = getenv("HOME");
+        if (home == NULL || home[0] == '\0') {
+            return false;
+        }
+
+        length = snprintf(buffer, buffer_size, "%s/.cache", home);
+    }
+
+    if (length < 0 || (size_t)length >= buffer_size || !tdb_make_directory(buffer)) {
+        return false;
+    }
+
+    length = snprintf(buffer + length, buffer_size - (size_t)length, "/tdb") + length;
+    return (size_t)length < buffer_size && tdb_make_directory(buffer);
+}
+
+bool tdb_debug_cache_open(struct tdb_debug_cache* cache, const char* elf_path)
+{
+    memset(cache, 0, sizeof(*cache));
+
+    struct stat file_stat;
+    if (stat(elf_path, &file_stat) == -1 || !tdb_read_build_id(cache, elf_path)) {
+        return false;
+    }
+
+    cache->mtime_sec = file_stat.st_mtim.tv_sec;
+    cache->mtime_nsec = file_stat.st_mtim.tv_nsec;
+    cache->file_size = (uint64_t)file_stat.st_size;
+
+    char directory[PATH_MAX];
+    if (!tdb_debug_cache_directory(directory, sizeof(directory))) {
+        return false;
+    }
+
+    char build_id[2 * TDB_DEBUG_CACHE_MAX_BUILD_ID + 1];
+    for (uint32_t i = 0; i < cache->build_id_size; i++) {
+        sprintf(build_id + 2 * i, "%02x", cache->build_id[i]);
+    }
+    build_id[2 * cache->build_id_size] = '\0';
+
+    int length = snprintf(cache->path, sizeof(cache->path), "%s/%s", directory, build_id);
+    if (length < 0 || (size_t)length >= sizeof(cache->path)) {
+        cache->path[0] = '\0';
+        return false;
+    }
+
+    return true;
+}
+
+static bool tdb_debug_cache_header_matches(const struct tdb_debug_cache* cache,
+                                           const struct tdb_debug_cache_header* header, size_t mapping_size)
+{
+    if (memcmp(header->magic, TDB_DEBUG_CACHE_MAGIC, sizeof(header->magic)) ||
+        header->version != TDB_DEBUG_CACHE_VERSION || header->total_size != mapping_size) {
+        return false;
+    }
+
+    // a rebuilt binary usually gets a new build-id, but not if it is only relinked
+    // with the same inputs, so the modification time is checked as well
+    if (header->build_id_size != cache->build_id_size ||
+        memcmp(header->build_id, cache->build_id, cache->build_id_size) || header->mtime_sec != cache->mtime_sec ||
+        header->mtime_nsec != cache->mtime_nsec || header->file_size != cache->file_size) {
+        return false;
+    }
+
+    for (size_t i = 0; i < TDB_CACHE_SECTION_COUNT; i++) {
+        const struct tdb_debug_cache_section* section = &header->sections[i];
+        if (section->offset % TDB_DEBUG_CACHE_ALIGNMENT != 0 || section->offset > mapping_size ||
+            section->size > mapping_size - section->offset) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool tdb_debug_cache_read(struct tdb_debug_cache* cache, struct tdb_symbol_table* symbols,
+                                 struct tdb_line_table* lines)
+{
+    if (cache->path[0] == '\0') {
+        return false;
+    }
+
+    int fd = open(cache->path, O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+
+    struct stat cache_stat;
+    if (fstat(fd, &cache_stat) == -1 || (size_t)cache_stat.st_size < sizeof(struct tdb_debug_cache_header)) {
+        close(fd);
+        return false;
+    }
+
+    const size_t mapping_size = (size_t)cache_stat.st_size;
+    void* mapping = mmap(NULL, mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+
+    const struct tdb_debug_cache_header* header = mapping;
+    if (!tdb_debug_cache_header_matches(cache, header, mapping_size)) {
+        munmap(mapping, mapping_size);
+        return false;
+    }
+
+    const char* base = mapping;
+    const struct tdb_debug_cache_section* sections = header->sections;
+
+    tdb_symbol_table_init(symbols);
+    symbols->symbols = (const struct tdb_symbol*)(base + sections[TDB_CACHE_SYMBOLS].offset);
+    symbols->symbol_count = sections[TDB_CACHE_SYMBOLS].size / sizeof(struct tdb_symbol);
+    symbols->strings = base + sections[TDB_CACHE_SYMBOL_STRINGS].offset;
+    symbols->strings_size = sections[TDB_CACHE_SYMBOL_STRINGS].size;
+    symbols->name_buckets = (const uint32_t*)(base + sections[TDB_CACHE_SYMBOL_BUCKETS].offset);
+    symbols->bucket_count = sections[TDB_CACHE_SYMBOL_BUCKETS].size / sizeof(uint32_t);
+    symbols->owns_memory = false;
+
+    // nothing writes to these arrays unless the table is resumed, which copies them first
+    tdb_line_table_init(lines);
+    lines->units = (struct tdb_compile_unit*)(base + sections[TDB_CACHE_UNITS].offset);
+    lines->unit_count = sections[TDB_CACHE_UNITS].size / sizeof(struct tdb_compile_unit);
+    lines->ranges = (struct tdb_unit_range*)(base + sections[TDB_CACHE_UNIT_RANGES].offset);
+    lines->range_count = sections[TDB_CACHE_UNIT_RANGES].size / sizeof(struct tdb_unit_range);
+    lines->range_capacity = lines->range_count;
+    lines->lines = (struct tdb_line_entry*)(base + sections[TDB_CACHE_LINES].offset);
+    lines->line_count = sections[TDB_CACHE_LINES].size / sizeof(struct tdb_line_entry);
+    lines->line_capacity = lines->line_count;
+    lines->lines_by_location = (uint32_t*)(base + sections[TDB_CACHE_LINES_BY_LOCATION].offset);
+    lines->strings = (char*)(base + sections[TDB_CACHE_LINE_STRINGS].offset);
+    lines->strings_size = sections[TDB_CACHE_LINE_STRINGS].size;
+    lines->strings_capacity = lines->strings_size;
+    lines->files = (uint32_t*)(base + sections[TDB_CACHE_FILES].offset);
+    lines->file_count = sections[TDB_CACHE_FILES].size / sizeof(uint32_t);
+    lines->file_capacity = lines->file_count;
+    lines->file_buckets = (uint32_t*)(base + sections[TDB_CACHE_FILE_BUCKETS].offset);
+    lines->file_bucket_count = sections[TDB_CACHE_FILE_BUCKETS].size / sizeof(uint32_t);
+    lines->owns_memory = false;
+
+    cache->mapping = mapping;
+    cache->mapping_size = mapping_size;
+    cache->decoded_units = tdb_line_table_decoded_count(lines);
+
+    return true;
+}
+
+bool tdb_debug_cache_load(struct tdb_debug_cache* cache, struct tdb_symbol_table* symbols,
+                          struct tdb_line_table* lines)
+{
+    const uint64_t start = tdb_stats_start();
+    const bool success = tdb_debug_cache_read(cache, symbols, lines);
+    tdb_stats_record(TDB_STAT_DEBUG_CACHE, start);
+    return success;
+}
+
+static bool tdb_write_cache_section(FILE* file, struct tdb_debug_cache_section* section, const void* data,
+                                    size_t size, uint64_t* offset)
+{
+    static const uint8_t zeros[TDB_DEBUG_CACHE_ALIGNMENT] = {0};
+
+    const size_t padding = (TDB_DEBUG_CACHE_ALIGNMENT - *offset % TDB_DEBUG_CACHE_ALIGNMENT) % TDB_DEBUG_CACHE_ALIGNMENT;
+    if (fwrite(zeros, 1, padding, file) != padding) {
+        return false;
+    }
+    *offset += padding;
+
+    section->offset = *offset;
+    section->size = size;
+
+    if (size > 0 && fwrite(data, 1, size, file) != size) {
+        return false;
+    }
+    *offset += size;
+
+    return true;
+}
+
+static bool tdb_debug_cache_write(struct tdb_debug_cache* cache, const struct tdb_symbol_table* symbols,
+                                  const struct tdb_line_table* lines)
+{
+    if (cache->path[0] == '\0') {
+        return false;
+    }
+
+    char temporary_path[PATH_MAX + 32];
+    snprintf(temporary_path, sizeof(temporary_path), "%s.%d.tmp", cache->path, getpid());
+
+    FILE* file = fopen(temporary_path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Failed to create debug info cache %s: %s\n", temporary_path, strerror(errno));
+        return false;
+    }
+
+    struct tdb_debug_cache_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TDB_DEBUG_CACHE_MAGIC, sizeof(header.magic));
+    header.version = TDB_DEBUG_CACHE_VERSION;
+    header.build_id_size = cache->build_id_size;
+    memcpy(header.build_id, cache->build_id, sizeof(header.build_id));
+    header.mtime_sec = cache->mtime_sec;
+    header.mtime_nsec = cache->mtime_nsec;
+    header.file_size = cache->file_size;
+
+    // the header is rewritten with the section table once everything else is out
+    bool success = fwrite(&header, sizeof(header), 1, file) == 1;
+    uint64_t offset = sizeof(header);
+    struct tdb_debug_cache_section* sections = header.sections;
+
+    const void* section_data[TDB_CACHE_SECTION_COUNT] = {
+        [TDB_CACHE_SYMBOLS] = symbols->symbols,
+        [TDB_CACHE_SYMBOL_STRINGS] = symbols->strings,
+        [TDB_CACHE_SYMBOL_BUCKETS] = symbols->name_buckets,
+        [TDB_CACHE_UNITS] = lines->units,
+        [TDB_CACHE_UNIT_RANGES] = lines->ranges,
+        [TDB_CACHE_LINES] = lines->lines,
+        [TDB_CACHE_LINES_BY_LOCATION] = lines->lines_by_location,
+        [TDB_CACHE_LINE_STRINGS] = lines->strings,
+        [TDB_CACHE_FILES] = lines->files,
+        [TDB_CACHE_FILE_BUCKETS] = lines->file_buckets,
+    };
+    const size_t section_sizes[TDB_CACHE_SECTION_COUNT] = {
+        [TDB_CACHE_SYMBOLS] = symbols->symbol_count * sizeof(struct tdb_symbol),
+        [TDB_CACHE_SYMBOL_STRINGS] = symbols->strings_size,
+        [TDB_CACHE_SYMBOL_BUCKETS] = symbols->bucket_count * sizeof(uint32_t),
+        [TDB_CACHE_UNITS] = lines->unit_count * sizeof(struct tdb_compile_unit),
+        [TDB_CACHE_UNIT_RANGES] = lines->range_count * sizeof(struct tdb_unit_range),
+        [TDB_CACHE_LINES] = lines->line_count * sizeof(struct tdb_line_entry),
+        [TDB_CACHE_LINES_BY_LOCATION] = lines->line_count * sizeof(uint32_t),
+        [TDB_CACHE_LINE_STRINGS] = lines->strings_size,
+        [TDB_CACHE_FILES] = lines->file_count * sizeof(uint32_t),
+        [TDB_CACHE_FILE_BUCKETS] = lines->file_bucket_count * sizeof(uint32_t),
+    };
+
+    for (size_t i = 0; success && i < TDB_CACHE_SECTION_COUNT; i++) {
+        success = tdb_write_cache_section(file, &sections[i], section_data[i], section_sizes[i], &offset);
+    }
+
+    header.total_size = offset;
+    success = success && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+    success = fclose(file) == 0 && success;
+
+    // renaming makes the new cache appear atomically to other tdb instances
+    if (!success || rename(temporary_path, cache->path) == -1) {
+        fprintf(stderr, "Failed to write debug info cache %s\n", cache->path);
+        unlink(temporary_path);
+        return false;
+    }
+
+    cache->decoded_units = tdb_line_table_decoded_count(lines);
+
+    return true;
+}
+
+bool tdb_debug_cache_store(struct tdb_debug_cache* cache, const struct tdb_symbol_table* symbols,
+                           const struct tdb_line_table* lines)
+{
+    const uint64_t start = tdb_stats_start();
+    const bool success = tdb_debug_cache_write(cache, symbols, lines);
+    tdb_stats_record(TDB_STAT_DEBUG_CACHE, start);
+    return success;
+}
+
+void tdb_debug_cache_close(struct tdb_debug_cache* cache)
+{
+    if (cache->mapping != NULL) {
+        munmap(cache->mapping, cache->mapping_size);
+    }
+
+    memset(cache, 0, sizeof(*cache));
+}
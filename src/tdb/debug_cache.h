@@ -0,0 +1,44 @@
+#pragma once
+
+#include <linux/limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tdb/line_table.h"
+#include "tdb/symbols.h"
+
+#define TDB_DEBUG_CACHE_MAX_BUILD_ID 64
+
+// On-disk cache of the symbol and line tables of one binary, stored under
+// $XDG_CACHE_HOME/tdb/<build-id>. The file is a header followed by the flat arrays of
+// both tables, so loading it is a single mmap and the tables point straight into it.
+struct tdb_debug_cache {
+    char path[PATH_MAX];  // empty if the binary can't be cached (e.g. has no build-id)
+
+    uint8_t build_id[TDB_DEBUG_CACHE_MAX_BUILD_ID];
+    uint32_t build_id_size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t file_size;
+
+    void* mapping;
+    size_t mapping_size;
+
+    size_t decoded_units;  // compile units with decoded line tables in the cache file
+};
+
+// Works out the identity of the binary and where its cache lives.
+bool tdb_debug_cache_open(struct tdb_debug_cache* cache, const char* elf_path);
+
+// Maps the cache file if it exists and matches the binary. On success both tables
+// point into the mapping, which has to outlive them.
+bool tdb_debug_cache_load(struct tdb_debug_cache* cache, struct tdb_symbol_table* symbols,
+                          struct tdb_line_table* lines);
+
+// Writes the cache file with the line tables decoded so far. Units that weren't are
+// decoded on first use after loading it, and the cache can be stored again to add them.
+bool tdb_debug_cache_store(struct tdb_debug_cache* cache, const struct tdb_symbol_table* symbols,
+                           const struct tdb_line_table* lines);
+
+void tdb_debug_cache_close(struct tdb_debug_cache* cache);
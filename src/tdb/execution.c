@@ -0,0 +1,1340 @@
+#include "execution.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tdb/breakpoint_batch.h"
+#include "tdb/condition.h"
+#include "tdb/stats.h"
+#include "tdb/utility.h"
+
+struct tdb_thread* tdb_current_thread(struct tdb_context* context)
+{
+    return tdb_thread_table_find(&context->threads, context->current_tid);
+}
+
+uint64_t tdb_get_pc(struct tdb_thread* thread)
+{
+    bool success;
+    uint64_t value = tdb_get_register_value(&thread->registers, x86_64_rip, &success);
+
+    if (!success) {
+        fprintf(stderr, "failed to get program counter (PC).\n");
+        return 0;
+    }
+
+    return value;
+}
+
+bool tdb_set_pc(struct tdb_thread* thread, uint64_t value)
+{
+    bool success = tdb_set_register_value(&thread->registers, x86_64_rip, value);
+
+    if (!success) {
+        fprintf(stderr, "failed to set program counter (PC).\n");
+        return false;
+    }
+
+    return true;
+}
+
+bool tdb_resume_thread(struct tdb_thread* thread, enum __ptrace_request request)
+{
+    if (!tdb_register_cache_flush(&thread->registers)) {
+        return false;
+    }
+
+    tdb_register_cache_invalidate(&thread->registers);
+
+    errno = 0;
+    tdb_ptrace(request, thread->tid, NULL, (void*)(intptr_t)thread->pending_signal);
+    if (errno != 0) {
+        fprintf(stderr, "Failed to resume thread %d: %s\n", thread->tid, strerror(errno));
+        return false;
+    }
+
+    thread->pending_signal = 0;
+    thread->state = TDB_THREAD_RUNNING;
+    return true;
+}
+
+bool tdb_apply_hw_breakpoints(struct tdb_context* context)
+{
+    bool success = true;
+
+    for (size_t i = 0; i < context->threads.count; i++) {
+        struct tdb_thread* thread = &context->threads.threads[i];
+        if (thread->state == TDB_THREAD_STOPPED) {
+            success &= tdb_hw_breakpoints_apply(&context->hw_breakpoints, thread->tid);
+        }
+    }
+
+    return success;
+}
+
+// How to let a thread run freely: a traced or caught system call it is in needs its
+// exit stop, and catching calls the seccomp filter doesn't cover needs every one.
+static enum __ptrace_request tdb_resume_request(struct tdb_context* context, struct tdb_thread* thread)
+{
+    return context->syscall_stepping || thread->trace_syscall_exit ? PTRACE_SYSCALL : PTRACE_CONT;
+}
+
+// Thread creation and our own interrupts are handled internally, everything else
+// (breakpoints, single steps, signals, the exec event) needs a decision.
+static bool tdb_is_interesting_stop(int status)
+{
+    const int event = status >> 16;
+    return event != PTRACE_EVENT_CLONE && event != PTRACE_EVENT_STOP;
+}
+
+struct tdb_thread* tdb_record_wait_status(struct tdb_context* context, pid_t tid, int status)
+{
+    if (WIFEXITED(status) || WIFSIGNALED(status)) {
+        if (tid != context->pid) {
+            tdb_thread_table_remove(&context->threads, tid);
+            return NULL;
+        }
+
+        // the thread group leader is only reaped once every other thread is gone
+        if (WIFEXITED(status)) {
+            printf("process %d exited with status %d\n", context->pid, WEXITSTATUS(status));
+        }
+        else {
+            printf("process %d terminated by signal %s\n", context->pid, strsignal(WTERMSIG(status)));
+        }
+
+        context->threads.count = 0;
+        return NULL;
+    }
+
+    struct tdb_thread* thread = tdb_thread_table_find(&context->threads, tid);
+    if (thread == NULL) {  // the initial stop of a new thread can beat its parent's clone event
+        thread = tdb_thread_table_add(&context->threads, tid, TDB_THREAD_NEW);
+        if (thread == NULL) {
+            // it couldn't be stopped or resumed with the others, so it is let go
+            fprintf(stderr, "Detaching from thread %d, which can't be tracked\n", tid);
+            tdb_ptrace(PTRACE_DETACH, tid, NULL, NULL);
+            return NULL;
+        }
+    }
+
+    if (thread->state == TDB_THREAD_NEW && tdb_hw_breakpoints_any_active(&context->hw_breakpoints)) {
+        // debug registers aren't inherited across clone
+        tdb_hw_breakpoints_apply(&context->hw_breakpoints, tid);
+    }
+
+    thread->state = TDB_THREAD_STOPPED;
+    thread->wait_status = status;
+
+    const int event = status >> 16;
+
+    if (event == PTRACE_EVENT_CLONE) {
+        unsigned long new_tid = 0;
+        tdb_ptrace(PTRACE_GETEVENTMSG, tid, NULL, &new_tid);
+
+        // if it can't be added here, it is detached when its initial stop comes in
+        if (tdb_thread_table_find(&context->threads, (pid_t)new_tid) == NULL &&
+            tdb_thread_table_add(&context->threads, (pid_t)new_tid, TDB_THREAD_NEW) != NULL) {
+            thread = tdb_thread_table_find(&context->threads, tid);
+        }
+    }
+    else if (event == 0 && WSTOPSIG(status) != SIGTRAP && WSTOPSIG(status) != (SIGTRAP | 0x80)) {
+        // signal-delivery-stop, pass the signal on when the thread is resumed
+        thread->pending_signal = WSTOPSIG(status);
+    }
+
+    return thread;
+}
+
+static volatile sig_atomic_t g_tdb_interrupt_requested;
+
+static void tdb_sigint_handler(int signal_number)
+{
+    (void)signal_number;
+    g_tdb_interrupt_requested = 1;
+}
+
+void tdb_install_interrupt_handler(void)
+{
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = tdb_sigint_handler;
+    sigemptyset(&action.sa_mask);
+
+    // no SA_RESTART, so a blocking waitpid returns to check the flag
+    sigaction(SIGINT, &action, NULL);
+}
+
+// Makes sure a Ctrl-C pressed while the inferior runs stops it with a SIGINT.
+static void tdb_check_interrupt(struct tdb_context* context)
+{
+    if (!g_tdb_interrupt_requested) {
+        return;
+    }
+
+    g_tdb_interrupt_requested = 0;
+
+    // the terminal already sent it to the inferior if it is in our process group
+    if (getpgid(context->pid) != getpgrp()) {
+        kill(context->pid, SIGINT);
+    }
+}
+
+static void tdb_print_thread_prefix(struct tdb_context* context, struct tdb_thread* thread)
+{
+    if (context->threads.count > 1) {
+        printf("[thread %d] ", thread->tid);
+    }
+}
+
+static void tdb_print_syscall(struct tdb_context* context, struct tdb_thread* thread, const char* prefix,
+                              const char* result)
+{
+    char call[512];
+    tdb_format_syscall(thread->syscall_number, thread->syscall_arguments, call, sizeof(call));
+
+    tdb_print_thread_prefix(context, thread);
+    printf("%s%s%s\n", prefix, call, result);
+}
+
+static bool tdb_is_syscall_stop(int status)
+{
+    return status >> 16 == PTRACE_EVENT_SECCOMP || WSTOPSIG(status) == (SIGTRAP | 0x80);
+}
+
+// Entry stops come from the seccomp filter, or from PTRACE_SYSCALL when catching calls
+// outside it, exit stops only from PTRACE_SYSCALL. The kernel tells them apart and hands
+// over the number and arguments or the return value in one call.
+static bool tdb_get_syscall_info(struct tdb_thread* thread, struct __ptrace_syscall_info* info)
+{
+    if (tdb_ptrace(PTRACE_GET_SYSCALL_INFO, thread->tid, (void*)sizeof(*info), info) <= 0) {
+        fprintf(stderr, "Failed to get system call of thread %d: %s\n", thread->tid, strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+// The number of the call a syscall stop is for, or -1 if it isn't about one.
+static long tdb_syscall_stop_number(struct tdb_context* context, struct tdb_thread* thread,
+                                    const struct __ptrace_syscall_info* info)
+{
+    switch (info->op) {
+    case PTRACE_SYSCALL_INFO_ENTRY:
+        return (long)info->entry.nr;
+    case PTRACE_SYSCALL_INFO_SECCOMP:
+        // with PTRACE_SYSCALL, a filtered call already stopped on entry
+        return context->syscall_stepping ? -1 : (long)info->seccomp.nr;
+    case PTRACE_SYSCALL_INFO_EXIT:
+        return thread->syscall_number;
+    default:
+        return -1;
+    }
+}
+
+// Prints traced calls and reports caught ones. Returns true if the call was caught.
+static bool tdb_handle_syscall_stop(struct tdb_context* context, struct tdb_thread* thread,
+                                    const struct __ptrace_syscall_info* info)
+{
+    const long number = tdb_syscall_stop_number(context, thread, info);
+    if (number == -1) {
+        return false;
+    }
+
+    const bool traced = tdb_syscall_set_contains(&context->traced_syscalls, number);
+    const bool caught = tdb_syscall_set_contains(&context->caught_syscalls, number);
+
+    if (info->op != PTRACE_SYSCALL_INFO_EXIT) {
+        const uint64_t* arguments = info->op == PTRACE_SYSCALL_INFO_ENTRY ? info->entry.args : info->seccomp.args;
+
+        thread->syscall_number = number;
+        memcpy(thread->syscall_arguments, arguments, sizeof(thread->syscall_arguments));
+
+        // these never return, so there won't be an exit stop to print them at
+        const bool no_return = number == 60 || number == 231;  // exit, exit_group
+        thread->trace_syscall_exit = (traced || caught) && !no_return;
+
+        if (traced && no_return) {
+            tdb_print_syscall(context, thread, "", " = ?");
+        }
+
+        if (caught) {
+            tdb_print_syscall(context, thread, "system call ", "");
+            return true;
+        }
+
+        return false;
+    }
+
+    thread->trace_syscall_exit = false;
+
+    const int64_t value = info->exit.rval;
+    char result[128];
+    if (info->exit.is_error) {
+        snprintf(result, sizeof(result), " = -1 %s", strerror((int)-value));
+    }
+    else if (value >= 0 && value < 0x10000) {
+        snprintf(result, sizeof(result), " = %" PRId64, value);
+    }
+    else {
+        snprintf(result, sizeof(result), " = 0x%" PRIx64, (uint64_t)value);
+    }
+
+    if (traced) {
+        tdb_print_syscall(context, thread, "", result);
+    }
+
+    if (caught) {
+        tdb_print_syscall(context, thread, "returned from system call ", result);
+        return true;
+    }
+
+    return false;
+}
+
+// Traced system calls that aren't caught are printed without stopping the other
+// threads. Returns true if the stop was dealt with here.
+static bool tdb_handle_traced_syscall(struct tdb_context* context, struct tdb_thread* thread)
+{
+    if (!tdb_is_syscall_stop(thread->wait_status)) {
+        return false;
+    }
+
+    struct __ptrace_syscall_info info;
+    if (!tdb_get_syscall_info(thread, &info)) {
+        return false;
+    }
+
+    const long number = tdb_syscall_stop_number(context, thread, &info);
+    if (tdb_syscall_set_contains(&context->caught_syscalls, number)) {
+        return false;
+    }
+
+    tdb_handle_syscall_stop(context, thread, &info);
+    return true;
+}
+
+struct tdb_thread* tdb_wait_for_stop(struct tdb_context* context)
+{
+    while (context->threads.count > 0) {
+        int status;
+        pid_t tid = tdb_waitpid(-1, &status, __WALL);
+
+        if (tid == -1) {
+            if (errno == EINTR) {
+                tdb_check_interrupt(context);
+                continue;
+            }
+
+            fprintf(stderr, "waitpid failed: %s\n", strerror(errno));
+            context->threads.count = 0;
+            return NULL;
+        }
+
+        struct tdb_thread* thread = tdb_record_wait_status(context, tid, status);
+        if (thread == NULL) {
+            continue;
+        }
+
+        if (tdb_is_interesting_stop(status) && !tdb_handle_traced_syscall(context, thread)) {
+            return thread;
+        }
+
+        tdb_resume_thread(thread, tdb_resume_request(context, thread));
+    }
+
+    return NULL;
+}
+
+static bool tdb_any_thread_running(struct tdb_context* context)
+{
+    for (size_t i = 0; i < context->threads.count; i++) {
+        if (context->threads.threads[i].state != TDB_THREAD_STOPPED) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void tdb_stop_all_threads(struct tdb_context* context)
+{
+    const uint64_t start = tdb_stats_start();
+
+    for (size_t i = 0; i < context->threads.count; i++) {
+        struct tdb_thread* thread = &context->threads.threads[i];
+        if (thread->state == TDB_THREAD_RUNNING) {
+            // ESRCH here just means the thread is on its way out, its exit is reaped below
+            tdb_ptrace(PTRACE_INTERRUPT, thread->tid, NULL, NULL);
+        }
+    }
+
+    while (tdb_any_thread_running(context)) {
+        int status;
+        pid_t tid = tdb_waitpid(-1, &status, __WALL);
+
+        if (tid == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            break;
+        }
+
+        struct tdb_thread* thread = tdb_record_wait_status(context, tid, status);
+        if (thread != NULL && tdb_is_interesting_stop(status)) {
+            thread->has_pending_status = true;
+        }
+    }
+
+    tdb_stats_record(TDB_STAT_STOP_ALL, start);
+}
+
+static void tdb_report_hw_breakpoint_hit(struct tdb_context* context, struct tdb_thread* thread, int slot)
+{
+    const struct tdb_hw_breakpoint* hw = &context->hw_breakpoints.slots[slot];
+
+    tdb_print_thread_prefix(context, thread);
+
+    if (hw->type == TDB_HW_BREAKPOINT_EXECUTE) {
+        char location[320];
+        tdb_format_address(context, hw->address, location, sizeof(location));
+        printf("hardware breakpoint %d hit at %s\n", slot, location);
+        tdb_print_source_line(context, hw->address);
+        return;
+    }
+
+    char location[320];
+    tdb_format_address(context, tdb_get_pc(thread), location, sizeof(location));
+
+    uint64_t value = 0;
+    if (tdb_read_memory_range(context->pid, hw->address, &value, hw->length) == hw->length) {
+        printf("watchpoint %d triggered at 0x%" PRIx64 " (PC = %s), value = 0x%" PRIx64 "\n", slot, hw->address,
+               location, value);
+    }
+    else {
+        printf("watchpoint %d triggered at 0x%" PRIx64 " (PC = %s)\n", slot, hw->address, location);
+    }
+}
+
+// Decide whether a software breakpoint hit should be reported to the user, or
+// skipped over because of its ignore count or condition.
+static bool tdb_breakpoint_should_stop(struct tdb_context* context, struct tdb_thread* thread,
+                                       struct tdb_breakpoint* bp)
+{
+    bp->hit_count++;
+
+    if (bp->ignore_count > 0) {
+        bp->ignore_count--;
+        return false;
+    }
+
+    if (bp->condition != NULL) {
+        bool result;
+        if (!tdb_condition_evaluate(bp->condition, &thread->registers, context->pid, &result)) {
+            fprintf(stderr, "failed to evaluate condition of breakpoint %u, stopping\n", bp->id);
+            return true;
+        }
+
+        return result;
+    }
+
+    return true;
+}
+
+// Whether a thread stopping at a breakpoint ends the step in progress.
+static bool tdb_step_target_reached(struct tdb_context* context, struct tdb_thread* thread, uint64_t address)
+{
+    struct tdb_step_plan* plan = &context->step;
+    const struct tdb_step_target* target = tdb_step_plan_find(plan, address);
+    if (!plan->active || thread->tid != plan->tid || target == NULL) {
+        return false;
+    }
+
+    if (target->call) {
+        // at the entry of a function, the return address is on top of the stack
+        bool success;
+        const uint64_t sp = tdb_get_register_value(&thread->registers, x86_64_rsp, &success);
+
+        uint64_t return_address = 0;
+        if (success) {
+            tdb_read_memory_range(context->pid, sp, &return_address, sizeof(return_address));
+        }
+
+        if (return_address < plan->caller_low || return_address >= plan->caller_high) {
+            return false;
+        }
+    }
+    else if (plan->min_cfa != 0) {
+        struct tdb_frame frame;
+        if (tdb_unwind(&context->unwinder, &context->maps, context->pid, &thread->registers, &frame, 1) == 1 &&
+            frame.cfa < plan->min_cfa) {
+            return false;
+        }
+    }
+
+    plan->reached = true;
+    return true;
+}
+
+// Work out why a thread stopped, returning false if the stop should be handled
+// silently and the inferior resumed. A software breakpoint leaves the PC one byte
+// past the int3, so it is rewound here to the breakpoint address, which
+// tdb_step_over_breakpoint then relies on when the thread is next resumed.
+static bool tdb_handle_stop(struct tdb_context* context, struct tdb_thread* thread)
+{
+    const int status = thread->wait_status;
+    thread->stopped_at_breakpoint = false;
+
+    if (tdb_is_syscall_stop(status)) {
+        struct __ptrace_syscall_info info;
+        return tdb_get_syscall_info(thread, &info) && tdb_handle_syscall_stop(context, thread, &info);
+    }
+
+    if (WSTOPSIG(status) != SIGTRAP) {
+        if (WSTOPSIG(status) == SIGINT) {  // Ctrl-C is meant for tdb, so the program never sees it
+            thread->pending_signal = 0;
+        }
+
+        tdb_print_thread_prefix(context, thread);
+        printf("stopped by signal %s\n", strsignal(WSTOPSIG(status)));
+        return true;
+    }
+
+    if (status >> 16 == PTRACE_EVENT_EXEC) {
+        tdb_handle_exec(context);
+        printf("process %d is executing a new program\n", context->pid);
+        return true;
+    }
+
+    if (tdb_hw_breakpoints_any_active(&context->hw_breakpoints)) {
+        int slot = tdb_hw_breakpoint_check_hit(thread->tid);
+        if (slot != -1) {
+            tdb_report_hw_breakpoint_hit(context, thread, slot);
+            return true;
+        }
+    }
+
+    const uint64_t pc = tdb_get_pc(thread);
+    char location[320];
+
+    struct tdb_breakpoint* bp = tdb_breakpoint_table_find(&context->breakpoints, context->pid, pc - 1);
+    if (bp == NULL || !bp->enabled) {
+        tdb_format_address(context, pc, location, sizeof(location));
+        tdb_print_thread_prefix(context, thread);
+        printf("PC = %s\n", location);
+        tdb_print_source_line(context, pc);
+        return true;
+    }
+
+    tdb_set_pc(thread, pc - 1);
+    thread->stopped_at_breakpoint = true;
+
+    if (thread->interrupted_breakpoint == pc - 1) {  // counted before the signal, just step off it again
+        thread->interrupted_breakpoint = 0;
+        return false;
+    }
+
+    if (bp->traced_function != TDB_NO_TRACED_FUNCTION || bp->call_return) {
+        tdb_handle_calltrace_breakpoint(context, thread, pc - 1);
+
+        // planting a return breakpoint can move the breakpoints around
+        bp = tdb_breakpoint_table_find(&context->breakpoints, context->pid, pc - 1);
+    }
+
+    if (bp->internal) {  // the dynamic loader's, objects were just loaded or unloaded
+        tdb_process_maps_refresh(&context->maps, context->pid);
+        tdb_instruction_cache_clear(&context->instructions);
+    }
+
+    if (tdb_step_target_reached(context, thread, pc - 1)) {
+        return true;
+    }
+
+    if (bp->id == 0) {  // only there for calltrace, the loader or some other thread's step
+        return false;
+    }
+
+    if (!tdb_breakpoint_should_stop(context, thread, bp)) {
+        return false;
+    }
+
+    tdb_format_address(context, pc - 1, location, sizeof(location));
+    tdb_print_thread_prefix(context, thread);
+    printf("breakpoint %u hit, PC = %s\n", bp->id, location);
+    tdb_print_source_line(context, pc - 1);
+    return true;
+}
+
+static struct tdb_thread* tdb_next_pending_thread(struct tdb_context* context)
+{
+    for (size_t i = 0; i < context->threads.count; i++) {
+        struct tdb_thread* thread = &context->threads.threads[i];
+        if (thread->has_pending_status) {
+            return thread;
+        }
+    }
+
+    return NULL;
+}
+
+// Stops collected while stopping all threads are handled before anything is resumed.
+// Returns true if one of them is reported to the user.
+static bool tdb_handle_pending_stops(struct tdb_context* context)
+{
+    struct tdb_thread* thread;
+    while ((thread = tdb_next_pending_thread(context)) != NULL) {
+        thread->has_pending_status = false;
+
+        const uint64_t start = tdb_stats_start();
+        const bool report = tdb_handle_stop(context, thread);
+        tdb_stats_record(TDB_STAT_STOP, start);
+
+        if (report) {
+            // a breakpoint it was interrupted stepping off is hit anew after any other
+            // stop than more signals, it may never get back to it (a signal handler
+            // can longjmp away)
+            const int signal_number = WSTOPSIG(thread->wait_status);
+            if (signal_number == SIGTRAP || signal_number == (SIGTRAP | 0x80)) {
+                thread->interrupted_breakpoint = 0;
+            }
+            context->current_tid = thread->tid;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Single-step one thread off the breakpoint it is stopped at, with every other thread
+// stopped so none of them can run through the temporarily removed int3. A signal can
+// stop the thread before it has moved, which is reported like any other; the thread
+// steps off the breakpoint when it gets back to it. Returns false if something else
+// stopped the thread while doing so.
+static bool tdb_step_over_breakpoint(struct tdb_context* context, struct tdb_thread* thread)
+{
+    thread->stopped_at_breakpoint = false;
+
+    const uint64_t address = tdb_get_pc(thread);
+    struct tdb_breakpoint* bp = tdb_breakpoint_table_find(&context->breakpoints, context->pid, address);
+    if (bp == NULL || !bp->enabled) {
+        return true;
+    }
+
+    const pid_t tid = thread->tid;
+
+    tdb_breakpoint_disable(bp);
+    tdb_resume_thread(thread, PTRACE_SINGLESTEP);
+
+    int status;
+    while (tdb_waitpid(tid, &status, __WALL) == -1 && errno == EINTR) {
+    }
+
+    thread = tdb_record_wait_status(context, tid, status);
+    if (thread == NULL) {
+        if (context->threads.count > 0) {
+            tdb_breakpoint_enable(bp);
+        }
+        return true;
+    }
+
+    // the int3 goes back in either way, the other threads are resumed with this one
+    tdb_breakpoint_enable(bp);
+
+    if (WSTOPSIG(status) != SIGTRAP || tdb_get_pc(thread) == address) {
+        thread->has_pending_status = true;
+        tdb_handle_pending_stops(context);
+
+        // set after the report, which would clear it
+        thread = tdb_thread_table_find(&context->threads, tid);
+        if (thread != NULL) {
+            thread->interrupted_breakpoint = address;
+        }
+        return false;
+    }
+
+    if (tdb_hw_breakpoints_any_active(&context->hw_breakpoints)) {
+        int slot = tdb_hw_breakpoint_check_hit(tid);
+        if (slot != -1) {
+            context->current_tid = tid;
+            tdb_report_hw_breakpoint_hit(context, thread, slot);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool tdb_resume_all_threads(struct tdb_context* context)
+{
+    for (size_t i = 0; i < context->threads.count; i++) {
+        struct tdb_thread* thread = &context->threads.threads[i];
+        if (thread->state != TDB_THREAD_STOPPED || !thread->stopped_at_breakpoint) {
+            continue;
+        }
+
+        const uint64_t start = tdb_stats_start();
+        const bool stepped = tdb_step_over_breakpoint(context, thread);
+        tdb_stats_record(TDB_STAT_STEP_OVER, start);
+
+        if (!stepped) {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < context->threads.count; i++) {
+        struct tdb_thread* thread = &context->threads.threads[i];
+        if (thread->state == TDB_THREAD_STOPPED) {
+            tdb_resume_thread(thread, tdb_resume_request(context, thread));
+        }
+    }
+
+    return true;
+}
+
+void tdb_continue(struct tdb_context* context)
+{
+    if (context->threads.count == 0) {
+        printf("The program is not being run.\n");
+        return;
+    }
+
+    while (true) {
+        if (tdb_handle_pending_stops(context) || !tdb_resume_all_threads(context)) {
+            return;
+        }
+
+        struct tdb_thread* thread = tdb_wait_for_stop(context);
+        if (thread == NULL) {
+            return;
+        }
+
+        thread->has_pending_status = true;
+        tdb_stop_all_threads(context);
+    }
+}
+
+void tdb_detach(struct tdb_context* context)
+{
+    tdb_stop_all_threads(context);
+
+    // a breakpoint stop that hasn't been handled yet still has the PC past the int3
+    for (size_t i = 0; i < context->threads.count; i++) {
+        struct tdb_thread* thread = &context->threads.threads[i];
+        const int status = thread->wait_status;
+
+        if (thread->has_pending_status && WSTOPSIG(status) == SIGTRAP && status >> 16 == 0) {
+            const uint64_t pc = tdb_get_pc(thread);
+            struct tdb_breakpoint* bp = tdb_breakpoint_table_find(&context->breakpoints, context->pid, pc - 1);
+            if (bp != NULL && bp->enabled) {
+                tdb_set_pc(thread, pc - 1);
+            }
+        }
+    }
+
+    struct tdb_breakpoint_batch batch;
+    tdb_breakpoint_batch_init(&batch, context->pid);
+
+    size_t cursor = 0;
+    struct tdb_breakpoint* bp;
+    while ((bp = tdb_breakpoint_table_next(&context->breakpoints, &cursor)) != NULL) {
+        if (bp->enabled) {
+            tdb_breakpoint_batch_add(&batch, bp->address, false);
+        }
+    }
+
+    tdb_breakpoint_batch_apply(&batch, &context->breakpoints);
+    tdb_breakpoint_batch_free(&batch);
+
+    for (int slot = 0; slot < TDB_HW_BREAKPOINT_SLOTS; slot++) {
+        if (context->hw_breakpoints.slots[slot].active) {
+            tdb_hw_breakpoint_clear(&context->hw_breakpoints, slot);
+        }
+    }
+    tdb_apply_hw_breakpoints(context);
+
+    for (size_t i = 0; i < context->threads.count; i++) {
+        struct tdb_thread* thread = &context->threads.threads[i];
+        tdb_register_cache_flush(&thread->registers);
+
+        // the signal it stopped with (if any) is delivered as it goes
+        if (tdb_ptrace(PTRACE_DETACH, thread->tid, NULL, (void*)(intptr_t)thread->pending_signal) == -1 &&
+            errno != ESRCH) {
+            fprintf(stderr, "Failed to detach from thread %d: %s\n", thread->tid, strerror(errno));
+        }
+    }
+
+    printf("detached from process %d\n", context->pid);
+    context->threads.count = 0;
+}
+
+uint64_t tdb_trace_thread(struct tdb_context* context, struct tdb_trace_writer* writer, uint64_t max_steps,
+                          uint64_t until_address)
+{
+    struct tdb_thread* thread = tdb_current_thread(context);
+    if (thread == NULL) {
+        printf("The program is not being run.\n");
+        return 0;
+    }
+
+    if (!tdb_register_cache_flush(&thread->registers)) {
+        return 0;
+    }
+    tdb_register_cache_invalidate(&thread->registers);
+
+    // stepping runs any system call the thread is in to completion without an exit stop
+    thread->trace_syscall_exit = false;
+
+    const pid_t tid = thread->tid;
+    uint64_t pc = (uint64_t)tdb_ptrace(PTRACE_PEEKUSER, tid, (void*)offsetof(struct user_regs_struct, rip), NULL);
+
+    // two register sets used alternately, so the previous step's are still around
+    struct user_regs_struct registers[2];
+    memset(registers, 0, sizeof(registers));
+    unsigned current = 0;
+
+    uint64_t steps = 0;
+    while (steps < max_steps && !g_tdb_interrupt_requested) {
+        // step over breakpoints instead of stopping at them
+        struct tdb_breakpoint* bp = tdb_breakpoint_table_find(&context->breakpoints, context->pid, pc);
+        const bool reinsert = bp != NULL && bp->enabled;
+        if (reinsert) {
+            tdb_breakpoint_disable(bp);
+        }
+
+        errno = 0;
+        tdb_ptrace(PTRACE_SINGLESTEP, tid, NULL, (void*)(intptr_t)thread->pending_signal);
+        if (errno != 0) {
+            fprintf(stderr, "Failed to step thread %d: %s\n", tid, strerror(errno));
+            break;
+        }
+        thread->pending_signal = 0;
+
+        int status;
+        while (tdb_waitpid(tid, &status, __WALL) == -1 && errno == EINTR) {
+        }
+
+        if (reinsert && !WIFEXITED(status) && !WIFSIGNALED(status)) {
+            tdb_breakpoint_enable(bp);
+        }
+
+        if (!WIFSTOPPED(status) || WSTOPSIG(status) != SIGTRAP || status >> 16 != 0) {
+            thread = tdb_record_wait_status(context, tid, status);
+            if (thread == NULL) {
+                return steps;
+            }
+
+            if (status >> 16 == PTRACE_EVENT_CLONE) {
+                continue;  // the new thread is left stopped with the others
+            }
+
+            if (status >> 16 == PTRACE_EVENT_SECCOMP) {
+                continue;  // the system call runs on the next step
+            }
+
+            tdb_print_thread_prefix(context, thread);
+            printf("stopped by signal %s\n", strsignal(WSTOPSIG(status)));
+            break;
+        }
+
+        if (writer->record_registers) {
+            tdb_ptrace(PTRACE_GETREGS, tid, NULL, &registers[current]);
+            pc = registers[current].rip;
+            tdb_trace_writer_push(writer, pc, (const uint64_t*)&registers[current],
+                                  (const uint64_t*)&registers[current ^ 1]);
+            current ^= 1;
+        }
+        else {
+            pc = (uint64_t)tdb_ptrace(PTRACE_PEEKUSER, tid, (void*)offsetof(struct user_regs_struct, rip), NULL);
+            tdb_trace_writer_push(writer, pc, NULL, NULL);
+        }
+
+        steps++;
+
+        if (pc == until_address) {
+            break;
+        }
+    }
+
+    g_tdb_interrupt_requested = 0;
+
+    // the loader breakpoint was stepped over too, so objects may have come and gone
+    tdb_process_maps_refresh(&context->maps, context->pid);
+
+    struct tdb_breakpoint* bp = tdb_breakpoint_table_find(&context->breakpoints, context->pid, pc);
+    thread->stopped_at_breakpoint = bp != NULL && bp->enabled;
+
+    return steps;
+}
+
+static uint64_t tdb_monotonic_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
+}
+
+bool tdb_continue_profiling(struct tdb_context* context, struct tdb_profiler* profiler, int64_t duration_ms)
+{
+    if (context->threads.count == 0) {
+        printf("The program is not being run.\n");
+        return false;
+    }
+
+    for (size_t i = 0; i < context->threads.count; i++) {
+        if (!tdb_profiler_add_thread(profiler, context->threads.threads[i].tid)) {
+            return false;
+        }
+    }
+
+    const uint64_t deadline = tdb_monotonic_ms() + (uint64_t)duration_ms;
+    bool resume = true;
+    bool stopped = false;
+
+    tdb_profiler_enable(profiler);
+
+    // like tdb_continue, but instead of blocking in waitpid the rings are drained
+    // between non-blocking checks for stops
+    while (context->threads.count > 0 && !stopped) {
+        if (resume) {
+            if (tdb_handle_pending_stops(context) || !tdb_resume_all_threads(context)) {
+                stopped = true;
+                break;
+            }
+            resume = false;
+        }
+
+        const uint64_t now = tdb_monotonic_ms();
+        if (duration_ms >= 0 && now >= deadline) {
+            break;
+        }
+
+        const uint64_t remaining = duration_ms >= 0 ? deadline - now : UINT64_MAX;
+        tdb_profiler_poll(profiler, remaining < 100 ? (int)remaining : 100);
+        tdb_check_interrupt(context);
+
+        int status;
+        pid_t tid;
+        while (!resume && (tid = tdb_waitpid(-1, &status, __WALL | WNOHANG)) > 0) {
+            struct tdb_thread* thread = tdb_record_wait_status(context, tid, status);
+            if (thread == NULL) {
+                continue;
+            }
+
+            if (status >> 16 == PTRACE_EVENT_CLONE) {
+                for (size_t i = 0; i < context->threads.count; i++) {
+                    tdb_profiler_add_thread(profiler, context->threads.threads[i].tid);
+                }
+            }
+
+            if (!tdb_is_interesting_stop(status) || tdb_handle_traced_syscall(context, thread)) {
+                tdb_resume_thread(thread, tdb_resume_request(context, thread));
+                continue;
+            }
+
+            thread->has_pending_status = true;
+            tdb_stop_all_threads(context);
+            resume = true;
+        }
+    }
+
+    tdb_profiler_disable(profiler);
+
+    if (!stopped && context->threads.count > 0) {
+        tdb_stop_all_threads(context);
+        printf("process %d stopped after profiling\n", context->pid);
+    }
+
+    tdb_profiler_poll(profiler, 0);
+    return !stopped;
+}
+
+// Plants a breakpoint at every target of the step plan that doesn't have one yet.
+static void tdb_plant_step_targets(struct tdb_context* context)
+{
+    struct tdb_step_plan* plan = &context->step;
+
+    for (size_t i = 0; i < plan->target_count; i++) {
+        struct tdb_step_target* target = &plan->targets[i];
+        if (tdb_breakpoint_table_find(&context->breakpoints, context->pid, target->address) != NULL) {
+            continue;
+        }
+
+        struct tdb_breakpoint new_breakpoint;
+        tdb_breakpoint_init(&new_breakpoint, context->pid, target->address);
+        if (!tdb_breakpoint_enable(&new_breakpoint)) {
+            continue;
+        }
+
+        if (tdb_breakpoint_table_insert(&context->breakpoints, &new_breakpoint) == NULL) {
+            tdb_breakpoint_disable(&new_breakpoint);
+            continue;
+        }
+
+        target->planted = true;
+    }
+}
+
+// Takes out the breakpoints the step planted, unless the user or calltrace started
+// using them in the meantime.
+static void tdb_remove_step_targets(struct tdb_context* context)
+{
+    struct tdb_step_plan* plan = &context->step;
+
+    for (size_t i = 0; i < plan->target_count; i++) {
+        const struct tdb_step_target* target = &plan->targets[i];
+        struct tdb_breakpoint* bp = tdb_breakpoint_table_find(&context->breakpoints, context->pid, target->address);
+        if (!target->planted || bp == NULL || bp->id != 0 || bp->traced_function != TDB_NO_TRACED_FUNCTION ||
+            bp->call_return) {
+            continue;
+        }
+
+        if (context->threads.count > 0) {
+            tdb_breakpoint_disable(bp);
+        }
+        tdb_breakpoint_table_remove(&context->breakpoints, context->pid, target->address);
+    }
+
+    // other threads that hit them while stopping would otherwise report a stray SIGTRAP,
+    // so they are rewound to run the original instruction instead
+    for (size_t i = 0; i < context->threads.count; i++) {
+        struct tdb_thread* thread = &context->threads.threads[i];
+        const int status = thread->wait_status;
+        if (!thread->has_pending_status || WSTOPSIG(status) != SIGTRAP || status >> 16 != 0) {
+            continue;
+        }
+
+        const uint64_t pc = tdb_get_pc(thread);
+        if (tdb_step_plan_contains(plan, pc - 1) &&
+            tdb_breakpoint_table_find(&context->breakpoints, context->pid, pc - 1) == NULL) {
+            tdb_set_pc(thread, pc - 1);
+            thread->has_pending_status = false;
+        }
+    }
+
+    tdb_step_plan_clear(plan);
+}
+
+// Runs every thread until the stepped one reaches a target of the step plan, or
+// something else stops the program. Returns true in the first case.
+static bool tdb_run_step_plan(struct tdb_context* context, struct tdb_thread* thread)
+{
+    struct tdb_step_plan* plan = &context->step;
+    plan->tid = thread->tid;
+    plan->reached = false;
+    plan->active = true;
+
+    tdb_plant_step_targets(context);
+
+    // it may be sitting on one of them, or on any other breakpoint
+    thread->stopped_at_breakpoint = true;
+
+    tdb_continue(context);
+
+    plan->active = false;
+    tdb_remove_step_targets(context);
+    return plan->reached;
+}
+
+// Single-steps one thread while the others stay stopped. Returns false if it stopped
+// for another reason, which is then reported.
+static bool tdb_single_step(struct tdb_context* context, struct tdb_thread* thread)
+{
+    const pid_t tid = thread->tid;
+
+    struct tdb_breakpoint* bp = tdb_breakpoint_table_find(&context->breakpoints, context->pid, tdb_get_pc(thread));
+    const bool reinsert = bp != NULL && bp->enabled;
+    if (reinsert) {
+        tdb_breakpoint_disable(bp);
+    }
+
+    // stepping runs any system call the thread is in to completion without an exit stop
+    thread->trace_syscall_exit = false;
+    thread->stopped_at_breakpoint = false;
+
+    int status;
+    do {
+        if (!tdb_resume_thread(thread, PTRACE_SINGLESTEP)) {
+            return false;
+        }
+
+        while (tdb_waitpid(tid, &status, __WALL) == -1 && errno == EINTR) {
+        }
+
+        // a new thread is left stopped with the others, a filtered system call runs on the next step
+        thread = tdb_record_wait_status(context, tid, status);
+    } while (thread != NULL && (status >> 16 == PTRACE_EVENT_CLONE || status >> 16 == PTRACE_EVENT_SECCOMP));
+
+    if (reinsert && context->threads.count > 0 && status >> 16 != PTRACE_EVENT_EXEC) {
+        tdb_breakpoint_enable(bp);
+    }
+
+    if (thread == NULL) {
+        return false;
+    }
+
+    if (WSTOPSIG(status) != SIGTRAP || status >> 16 != 0) {
+        // signals and the exec event are reported as by continue
+        thread->has_pending_status = true;
+        tdb_handle_pending_stops(context);
+        return false;
+    }
+
+    if (tdb_hw_breakpoints_any_active(&context->hw_breakpoints)) {
+        int slot = tdb_hw_breakpoint_check_hit(tid);
+        if (slot != -1) {
+            tdb_report_hw_breakpoint_hit(context, thread, slot);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void tdb_report_step(struct tdb_context* context)
+{
+    struct tdb_thread* thread = tdb_current_thread(context);
+    if (thread == NULL) {
+        return;
+    }
+
+    const uint64_t pc = tdb_get_pc(thread);
+    char location[320];
+    tdb_format_address(context, pc, location, sizeof(location));
+    tdb_print_thread_prefix(context, thread);
+    printf("PC = %s\n", location);
+    tdb_print_source_line(context, pc);
+}
+
+// The CFA of the innermost frame of a thread, 0 if it can't be unwound.
+static uint64_t tdb_frame_cfa(struct tdb_context* context, struct tdb_thread* thread)
+{
+    struct tdb_frame frame;
+    if (tdb_unwind(&context->unwinder, &context->maps, context->pid, &thread->registers, &frame, 1) != 1) {
+        return 0;
+    }
+
+    return frame.cfa;
+}
+
+// Runs the current function of a thread until it returns to its caller.
+static bool tdb_run_to_return(struct tdb_context* context, struct tdb_thread* thread)
+{
+    struct tdb_frame frames[2];
+    if (tdb_unwind(&context->unwinder, &context->maps, context->pid, &thread->registers, frames, 2) != 2) {
+        printf("Can't find the caller of the current function.\n");
+        return false;
+    }
+
+    tdb_step_plan_clear(&context->step);
+    context->step.min_cfa = frames[0].cfa + 1;
+    return tdb_step_plan_add(&context->step, frames[1].pc) && tdb_run_step_plan(context, thread);
+}
+
+// Instructions that can't be planned around, because where they go isn't encoded in them.
+static bool tdb_needs_single_step(const struct tdb_instruction* instruction, bool step_into,
+                                  uint64_t return_address)
+{
+    switch (instruction->kind) {
+    case TDB_INSTRUCTION_INVALID:
+    case TDB_INSTRUCTION_JUMP_INDIRECT:
+        return true;
+    case TDB_INSTRUCTION_CALL_INDIRECT:
+        return step_into;
+    case TDB_INSTRUCTION_RETURN:
+        return return_address == 0;
+    default:
+        return false;
+    }
+}
+
+// Plans breakpoints at everywhere control can leave the addresses [low, high) for:
+// branch targets outside of them, the address after them, the return address of the
+// frame, and calls into code with line information when stepping into them.
+// Instructions tdb_needs_single_step rejects are targets themselves.
+static bool tdb_plan_line_step(struct tdb_context* context, uint64_t low, uint64_t high, bool step_into,
+                               uint64_t return_address)
+{
+    struct tdb_step_plan* plan = &context->step;
+    tdb_step_plan_clear(plan);
+    plan->caller_low = low;
+    plan->caller_high = high;
+
+    uint64_t address = low;
+    bool falls_through = true;
+
+    while (address < high) {
+        const struct tdb_instruction* instruction =
+            tdb_instruction_cache_decode(&context->instructions, context->pid, &context->breakpoints, address, NULL);
+        if (instruction == NULL) {
+            return false;
+        }
+
+        bool success = true;
+        struct tdb_source_location location;
+
+        if (tdb_needs_single_step(instruction, step_into, return_address)) {
+            success = tdb_step_plan_add(plan, address);
+        }
+        else if (instruction->kind == TDB_INSTRUCTION_JUMP || instruction->kind == TDB_INSTRUCTION_BRANCH) {
+            if (instruction->target < low || instruction->target >= high) {
+                success = tdb_step_plan_add(plan, instruction->target);
+            }
+        }
+        else if (instruction->kind == TDB_INSTRUCTION_CALL && step_into &&
+                 tdb_lookup_source_location(context, instruction->target, &location)) {
+            success = tdb_step_plan_add_call(plan, instruction->target);
+        }
+        else if (instruction->kind == TDB_INSTRUCTION_RETURN) {
+            success = tdb_step_plan_add(plan, return_address);
+        }
+
+        if (!success) {
+            return false;
+        }
+
+        falls_through = instruction->kind != TDB_INSTRUCTION_JUMP &&
+                        instruction->kind != TDB_INSTRUCTION_JUMP_INDIRECT &&
+                        instruction->kind != TDB_INSTRUCTION_RETURN;
+        address += instruction->length;
+    }
+
+    return !falls_through || tdb_step_plan_add(plan, address);
+}
+
+void tdb_step_line(struct tdb_context* context, bool step_into)
+{
+    struct tdb_thread* thread = tdb_current_thread(context);
+    if (thread == NULL) {
+        printf("The program is not being run.\n");
+        return;
+    }
+
+    struct tdb_source_location location;
+    if (!tdb_lookup_source_location(context, tdb_get_pc(thread), &location)) {
+        printf("No line information here, running until the function returns.\n");
+        tdb_finish(context);
+        return;
+    }
+
+    // the step ends on another line, or the same one in another frame
+    const uint32_t start_file = location.file_index;
+    const uint32_t start_line = location.line;
+    const uint64_t start_cfa = tdb_frame_cfa(context, thread);
+
+    struct tdb_frame frames[2];
+    const uint64_t return_address =
+        tdb_unwind(&context->unwinder, &context->maps, context->pid, &thread->registers, frames, 2) == 2 ? frames[1].pc
+                                                                                                           : 0;
+
+    while (true) {
+        const uint64_t pc = tdb_get_pc(thread);
+        const uint64_t cfa = tdb_frame_cfa(context, thread);
+
+        if (!tdb_lookup_source_location(context, pc, &location)) {
+            // a call into code without line information is run until it returns,
+            // returning into some is where the step ends
+            if (cfa == 0 || start_cfa == 0 || cfa >= start_cfa) {
+                break;
+            }
+
+            if (!tdb_run_to_return(context, thread)) {
+                return;
+            }
+        }
+        else if (location.file_index != start_file || location.line != start_line || cfa != start_cfa) {
+            break;
+        }
+        else {
+            const struct tdb_instruction* instruction =
+                tdb_instruction_cache_decode(&context->instructions, context->pid, &context->breakpoints, pc, NULL);
+            if (instruction == NULL) {
+                fprintf(stderr, "Failed to read the instruction at 0x%" PRIx64 "\n", pc);
+                return;
+            }
+
+            if (tdb_needs_single_step(instruction, step_into, return_address)) {
+                if (!tdb_single_step(context, thread)) {
+                    return;
+                }
+            }
+            else {
+                if (!tdb_plan_line_step(context, location.low, location.high, step_into, return_address)) {
+                    tdb_step_plan_clear(&context->step);
+                    fprintf(stderr, "Failed to decode the instructions of the line\n");
+                    return;
+                }
+
+                context->step.min_cfa = start_cfa;
+                if (!tdb_run_step_plan(context, thread)) {
+                    return;
+                }
+            }
+        }
+
+        // the thread table may have grown while running
+        thread = tdb_current_thread(context);
+        if (thread == NULL) {
+            return;
+        }
+    }
+
+    tdb_report_step(context);
+}
+
+void tdb_step_instruction(struct tdb_context* context, bool step_over_calls)
+{
+    struct tdb_thread* thread = tdb_current_thread(context);
+    if (thread == NULL) {
+        printf("The program is not being run.\n");
+        return;
+    }
+
+    const uint64_t pc = tdb_get_pc(thread);
+    const struct tdb_instruction* instruction =
+        tdb_instruction_cache_decode(&context->instructions, context->pid, &context->breakpoints, pc, NULL);
+
+    if (step_over_calls && instruction != NULL &&
+        (instruction->kind == TDB_INSTRUCTION_CALL || instruction->kind == TDB_INSTRUCTION_CALL_INDIRECT)) {
+        tdb_step_plan_clear(&context->step);
+        context->step.min_cfa = tdb_frame_cfa(context, thread);
+        if (!tdb_step_plan_add(&context->step, pc + instruction->length) || !tdb_run_step_plan(context, thread)) {
+            return;
+        }
+    }
+    else if (!tdb_single_step(context, thread)) {
+        return;
+    }
+
+    tdb_report_step(context);
+}
+
+void tdb_finish(struct tdb_context* context)
+{
+    struct tdb_thread* thread = tdb_current_thread(context);
+    if (thread == NULL) {
+        printf("The program is not being run.\n");
+        return;
+    }
+
+    if (!tdb_run_to_return(context, thread)) {
+        return;
+    }
+
+    tdb_report_step(context);
+
+    thread = tdb_current_thread(context);
+    bool success;
+    const uint64_t value = tdb_get_register_value(&thread->registers, x86_64_rax, &success);
+    if (success) {
+        printf("rax = 0x%" PRIx64 "\n", value);
+    }
+}
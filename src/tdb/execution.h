@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/ptrace.h>
+
+#include "tdb/tdb.h"
+#include "tdb/profile.h"
+#include "tdb/thread.h"
+#include "tdb/trace.h"
+
+// Execution control of the inferior in all-stop mode: whenever one thread stops for a
+// reason the user may care about, every other thread is stopped with PTRACE_INTERRUPT
+// before control returns to the prompt, and everything is resumed together.
+
+struct tdb_thread* tdb_current_thread(struct tdb_context* context);
+
+uint64_t tdb_get_pc(struct tdb_thread* thread);
+bool tdb_set_pc(struct tdb_thread* thread, uint64_t value);
+
+// Write back any modified registers and resume one stopped thread, delivering the
+// signal it stopped with (if any). The cached registers are stale until the next stop.
+bool tdb_resume_thread(struct tdb_thread* thread, enum __ptrace_request request);
+
+// Wait until some thread stops for a reason worth handling, doing the book-keeping for
+// thread creation and exit (and silently resuming threads after uninteresting stops)
+// along the way. Returns NULL once the whole process is gone.
+struct tdb_thread* tdb_wait_for_stop(struct tdb_context* context);
+
+// Interrupt every running thread and wait until all of them have stopped. Interesting
+// stops collected on the way are kept as pending statuses on their threads.
+void tdb_stop_all_threads(struct tdb_context* context);
+
+// Program the hardware breakpoint slots into every thread.
+bool tdb_apply_hw_breakpoints(struct tdb_context* context);
+
+// Update the thread table for a status returned by waitpid. Returns the thread if it
+// is now stopped, or NULL if it exited.
+struct tdb_thread* tdb_record_wait_status(struct tdb_context* context, pid_t tid, int status);
+
+// Single-step the current thread up to max_steps times, or until it reaches
+// until_address if that isn't 0, recording every step. The other threads stay stopped.
+// Breakpoints are stepped over rather than hit. Returns the number of steps taken.
+uint64_t tdb_trace_thread(struct tdb_context* context, struct tdb_trace_writer* writer, uint64_t max_steps,
+                          uint64_t until_address);
+
+// Lets Ctrl-C stop the inferior (with a SIGINT that is then not passed on to it)
+// instead of killing tdb.
+void tdb_install_interrupt_handler(void);
+
+// Take every breakpoint out of the stopped process, restoring the original bytes and
+// clearing the debug registers, and let its threads go with PTRACE_DETACH.
+void tdb_detach(struct tdb_context* context);
+
+// Resume all threads until a stop that should be reported to the user. Breakpoint hits
+// that are skipped because of an ignore count or condition never reach the prompt.
+void tdb_continue(struct tdb_context* context);
+
+// Resume all threads and sample them with the profiler for duration_ms, or until the
+// process exits if it is negative. Stops the user should see end profiling early and
+// are reported as by tdb_continue. Returns false if that happened.
+bool tdb_continue_profiling(struct tdb_context* context, struct tdb_profiler* profiler, int64_t duration_ms);
+
+// Runs the current thread to the next source line, over calls or into those with line
+// information, while the other threads run too.
+void tdb_step_line(struct tdb_context* context, bool step_into);
+
+// Executes one instruction of the current thread, or runs over it if it is a call and
+// step_over_calls is set.
+void tdb_step_instruction(struct tdb_context* context, bool step_over_calls);
+
+// Runs until the current function returns to its caller.
+void tdb_finish(struct tdb_context* context);
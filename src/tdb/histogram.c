@@ -0,0 +1,73 @@
+#include "histogram.h"
+
+#include <string.h>
+
+void tdb_histogram_init(struct tdb_histogram* histogram)
+{
+    memset(histogram, 0, sizeof(*histogram));
+    histogram->min = UINT64_MAX;
+}
+
+static unsigned tdb_histogram_bucket(uint64_t value)
+{
+    // small values get a bucket each
+    if (value < TDB_HISTOGRAM_SUB_BUCKETS) {
+        return (unsigned)value;
+    }
+
+    const unsigned exponent = 63 - (unsigned)__builtin_clzll(value);
+    const unsigned shift = exponent - TDB_HISTOGRAM_SUB_BUCKET_BITS;
+    const unsigned sub_bucket = (unsigned)(value >> shift) & (TDB_HISTOGRAM_SUB_BUCKETS - 1);
+
+    return (shift + 1) * TDB_HISTOGRAM_SUB_BUCKETS + sub_bucket;
+}
+
+static uint64_t tdb_histogram_bucket_highest_value(unsigned bucket)
+{
+    if (bucket < TDB_HISTOGRAM_SUB_BUCKETS) {
+        return bucket;
+    }
+
+    const unsigned shift = bucket / TDB_HISTOGRAM_SUB_BUCKETS - 1;
+    const uint64_t sub_bucket = bucket % TDB_HISTOGRAM_SUB_BUCKETS;
+    const uint64_t lowest = (TDB_HISTOGRAM_SUB_BUCKETS + sub_bucket) << shift;
+
+    return lowest + ((uint64_t)1 << shift) - 1;
+}
+
+void tdb_histogram_record(struct tdb_histogram* histogram, uint64_t value)
+{
+    histogram->buckets[tdb_histogram_bucket(value)]++;
+    histogram->count++;
+    histogram->sum += value;
+
+    if (value < histogram->min) {
+        histogram->min = value;
+    }
+    if (value > histogram->max) {
+        histogram->max = value;
+    }
+}
+
+uint64_t tdb_histogram_percentile(const struct tdb_histogram* histogram, double percentile)
+{
+    if (histogram->count == 0) {
+        return 0;
+    }
+
+    uint64_t wanted = (uint64_t)(percentile / 100.0 * (double)histogram->count + 0.5);
+    if (wanted == 0) {
+        wanted = 1;
+    }
+
+    uint64_t seen = 0;
+    for (unsigned bucket = 0; bucket < TDB_HISTOGRAM_BUCKETS; bucket++) {
+        seen += histogram->buckets[bucket];
+        if (seen >= wanted) {
+            const uint64_t highest = tdb_histogram_bucket_highest_value(bucket);
+            return highest < histogram->max ? highest : histogram->max;
+        }
+    }
+
+    return histogram->max;
+}
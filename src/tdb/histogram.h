@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+
+// Log-linear histogram in the style of HdrHistogram: every power of two is split into
+// TDB_HISTOGRAM_SUB_BUCKETS equal buckets, so any value is recorded with a relative
+// error of at most 1/TDB_HISTOGRAM_SUB_BUCKETS, over the whole 64-bit range, in a fixed
+// array and without any division on the recording path.
+
+#define TDB_HISTOGRAM_SUB_BUCKET_BITS 4
+#define TDB_HISTOGRAM_SUB_BUCKETS (1 << TDB_HISTOGRAM_SUB_BUCKET_BITS)
+#define TDB_HISTOGRAM_BUCKETS ((64 - TDB_HISTOGRAM_SUB_BUCKET_BITS + 1) * TDB_HISTOGRAM_SUB_BUCKETS)
+
+struct tdb_histogram {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+    uint64_t buckets[TDB_HISTOGRAM_BUCKETS];
+};
+
+void tdb_histogram_init(struct tdb_histogram* histogram);
+void tdb_histogram_record(struct tdb_histogram* histogram, uint64_t value);
+
+// The highest value in the bucket holding the given percentile (0-100) of the values.
+uint64_t tdb_histogram_percentile(const struct tdb_histogram* histogram, double percentile);
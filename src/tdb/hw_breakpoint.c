@@ -0,0 +1,152 @@
+#include "hw_breakpoint.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ptrace.h>
+#include <sys/user.h>
+
+#include "tdb/stats.h"
+
+#define TDB_DEBUG_REGISTER_OFFSET(N) (offsetof(struct user, u_debugreg) + (N) * sizeof(((struct user*)0)->u_debugreg[0]))
+
+static const int DR6_INDEX = 6;
+static const int DR7_INDEX = 7;
+
+void tdb_hw_breakpoints_init(struct tdb_hw_breakpoints* hw)
+{
+    memset(hw, 0, sizeof(*hw));
+}
+
+bool tdb_hw_breakpoints_any_active(const struct tdb_hw_breakpoints* hw)
+{
+    return hw->dr7 != 0;
+}
+
+static bool tdb_poke_debug_register(pid_t tid, int index, uint64_t value)
+{
+    errno = 0;
+    tdb_ptrace(PTRACE_POKEUSER, tid, (void*)TDB_DEBUG_REGISTER_OFFSET(index), (void*)value);
+
+    if (errno != 0) {
+        fprintf(stderr, "Failed to write debug register DR%d: %s\n", index, strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+static uint64_t tdb_length_bits(uint8_t length)
+{
+    switch (length) {
+        case 2:
+            return 1;
+        case 8:
+            return 2;
+        case 4:
+            return 3;
+        default:
+            return 0;
+    }
+}
+
+static uint64_t tdb_dr7_slot_bits(int slot, enum tdb_hw_breakpoint_type type, uint8_t length)
+{
+    const uint64_t local_enable = 1ULL << (2 * slot);
+    const uint64_t control = ((uint64_t)type | (tdb_length_bits(length) << 2)) << (16 + 4 * slot);
+    return local_enable | control;
+}
+
+static uint64_t tdb_dr7_slot_mask(int slot)
+{
+    return (3ULL << (2 * slot)) | (0xfULL << (16 + 4 * slot));
+}
+
+int tdb_hw_breakpoint_set(struct tdb_hw_breakpoints* hw, uintptr_t address, enum tdb_hw_breakpoint_type type,
+                          uint8_t length)
+{
+    if (type == TDB_HW_BREAKPOINT_EXECUTE) {
+        length = 1;
+    }
+
+    if (length != 1 && length != 2 && length != 4 && length != 8) {
+        fprintf(stderr, "hardware watchpoint length must be 1, 2, 4 or 8 bytes\n");
+        return -1;
+    }
+
+    if (address % length != 0) {
+        fprintf(stderr, "hardware watchpoint address must be aligned to its length\n");
+        return -1;
+    }
+
+    int slot = -1;
+    for (int i = 0; i < TDB_HW_BREAKPOINT_SLOTS; i++) {
+        if (!hw->slots[i].active) {
+            slot = i;
+            break;
+        }
+    }
+
+    if (slot == -1) {
+        fprintf(stderr, "all %d hardware debug registers are in use\n", TDB_HW_BREAKPOINT_SLOTS);
+        return -1;
+    }
+
+    hw->dr7 = (hw->dr7 & ~tdb_dr7_slot_mask(slot)) | tdb_dr7_slot_bits(slot, type, length);
+    hw->slots[slot].address = address;
+    hw->slots[slot].type = type;
+    hw->slots[slot].length = length;
+    hw->slots[slot].active = true;
+
+    return slot;
+}
+
+bool tdb_hw_breakpoint_clear(struct tdb_hw_breakpoints* hw, int slot)
+{
+    if (slot < 0 || slot >= TDB_HW_BREAKPOINT_SLOTS || !hw->slots[slot].active) {
+        return false;
+    }
+
+    hw->dr7 &= ~tdb_dr7_slot_mask(slot);
+    hw->slots[slot].active = false;
+
+    return true;
+}
+
+bool tdb_hw_breakpoints_apply(const struct tdb_hw_breakpoints* hw, pid_t tid)
+{
+    // the addresses must be in place before their slots are enabled in DR7
+    for (int i = 0; i < TDB_HW_BREAKPOINT_SLOTS; i++) {
+        if (hw->slots[i].active && !tdb_poke_debug_register(tid, i, hw->slots[i].address)) {
+            return false;
+        }
+    }
+
+    return tdb_poke_debug_register(tid, DR7_INDEX, hw->dr7);
+}
+
+int tdb_hw_breakpoint_check_hit(pid_t tid)
+{
+    errno = 0;
+    uint64_t dr6 = tdb_ptrace(PTRACE_PEEKUSER, tid, (void*)TDB_DEBUG_REGISTER_OFFSET(DR6_INDEX), NULL);
+    if (errno != 0) {
+        fprintf(stderr, "Failed to read debug status register DR6: %s\n", strerror(errno));
+        return -1;
+    }
+
+    int slot = -1;
+    for (int i = 0; i < TDB_HW_BREAKPOINT_SLOTS; i++) {
+        if (dr6 & (1ULL << i)) {
+            slot = i;
+            break;
+        }
+    }
+
+    // the CPU never clears the B0-B3 status bits itself
+    if (slot != -1) {
+        tdb_poke_debug_register(tid, DR6_INDEX, 0);
+    }
+
+    return slot;
+}
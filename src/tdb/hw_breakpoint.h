@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define TDB_HW_BREAKPOINT_SLOTS 4
+
+// values match the R/W field encoding of DR7
+enum tdb_hw_breakpoint_type {
+    TDB_HW_BREAKPOINT_EXECUTE = 0,
+    TDB_HW_BREAKPOINT_WRITE = 1,
+    TDB_HW_BREAKPOINT_READ_WRITE = 3,
+};
+
+struct tdb_hw_breakpoint {
+    uintptr_t address;
+    enum tdb_hw_breakpoint_type type;
+    uint8_t length;
+    bool active;
+};
+
+// Mirrors the state of the DR0-DR3/DR7 debug registers of the inferior.
+struct tdb_hw_breakpoints {
+    struct tdb_hw_breakpoint slots[TDB_HW_BREAKPOINT_SLOTS];
+    uint64_t dr7;
+};
+
+void tdb_hw_breakpoints_init(struct tdb_hw_breakpoints* hw);
+bool tdb_hw_breakpoints_any_active(const struct tdb_hw_breakpoints* hw);
+
+// Debug registers are per thread, so set/clear only update the slots and DR7 value
+// here, and tdb_hw_breakpoints_apply has to be called on every (stopped) thread of the
+// inferior afterwards, as well as on each new thread when it first appears.
+
+// Returns the slot that was reserved, or -1 if all slots are in use or the
+// address/length combination can't be represented in the debug registers.
+int tdb_hw_breakpoint_set(struct tdb_hw_breakpoints* hw, uintptr_t address, enum tdb_hw_breakpoint_type type,
+                          uint8_t length);
+bool tdb_hw_breakpoint_clear(struct tdb_hw_breakpoints* hw, int slot);
+bool tdb_hw_breakpoints_apply(const struct tdb_hw_breakpoints* hw, pid_t tid);
+
+// Reads and clears DR6 after a SIGTRAP, returning the slot that triggered or -1.
+int tdb_hw_breakpoint_check_hit(pid_t tid);
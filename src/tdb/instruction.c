@@ -0,0 +1,1759 @@
+#include "instruction.h"
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+// How the operands of an opcode are printed. E is the ModRM r/m operand, G its reg
+// field, V the VEX vvvv register, X a vector register in G and "GPR" a general purpose
+// register (or memory) where vector instructions usually have a vector register.
+enum tdb_operand_form {
+    FORM_NONE = 0,
+    FORM_E,
+    FORM_E_G,
+    FORM_G_E,
+    FORM_G_M,  // lea, whose memory operand has no size
+    FORM_G_EB,
+    FORM_G_EW,
+    FORM_G_ED,
+    FORM_E_IMM,
+    FORM_E_1,
+    FORM_E_CL,
+    FORM_G_E_IMM,
+    FORM_E_G_IMM,
+    FORM_E_G_CL,
+    FORM_E_SEG,
+    FORM_SEG_E,
+    FORM_ACC_IMM,
+    FORM_IMM_ACC,
+    FORM_ACC_DX,
+    FORM_DX_ACC,
+    FORM_ACC_MOFFS,
+    FORM_MOFFS_ACC,
+    FORM_ACC_REG,
+    FORM_REG,
+    FORM_REG_IMM,
+    FORM_REL,
+    FORM_IMM,
+    FORM_STRING,
+    FORM_X87,
+    FORM_X_E,
+    FORM_E_X,
+    FORM_X_E_IMM,
+    FORM_X_GPR,
+    FORM_X_GPR_IMM,
+    FORM_GPR_X,
+    FORM_GPR_X_IMM,
+    FORM_G_X,
+    FORM_G_X_IMM,
+    FORM_X_SHIFT,
+    FORM_G_V_E,
+    FORM_G_E_V,
+    FORM_V_E,
+};
+
+enum tdb_immediate_kind {
+    IMM_NONE = 0,
+    IMM_8,
+    IMM_16,
+    IMM_Z,       // 16 or 32 bits, sign-extended to 64
+    IMM_V,       // 16, 32 or 64 bits (mov r64, imm64)
+    IMM_MOFFS,   // an address, 64 bits
+    IMM_ENTER,   // 16 and 8 bits
+    IMM_GROUP3,  // only test (f6/f7 /0 and /1) has one
+};
+
+#define F_VALID 0x001
+#define F_MODRM 0x002
+#define F_BYTE 0x004          // 8-bit operands
+#define F_DEFAULT64 0x008     // 64-bit operands without REX.W (push, pop)
+#define F_CONDITION 0x010     // the mnemonic is completed by a condition code
+#define F_MMX 0x020           // mm registers without a 66, f3 or f2 prefix
+#define F_NO_VVVV 0x040       // has no V operand when VEX encoded
+#define F_VVVV_SCALAR 0x080   // has a V operand only in its ss/sd forms
+#define F_VVVV_REGISTER 0x100 // has a V operand only if E is a register
+#define F_GPR 0x200           // VEX encoded but on general purpose registers (BMI)
+
+enum tdb_opcode_group {
+    GROUP_NONE = 0,
+    GROUP_1,
+    GROUP_1A,
+    GROUP_2,
+    GROUP_3,
+    GROUP_4,
+    GROUP_5,
+    GROUP_11,
+    GROUP_6,
+    GROUP_7,
+    GROUP_8,
+    GROUP_9,
+    GROUP_12,
+    GROUP_13,
+    GROUP_14,
+    GROUP_15,
+    GROUP_16,
+    GROUP_P,
+    GROUP_COUNT,
+};
+
+struct tdb_opcode {
+    const char* names[4];  // without a prefix, with 66, f3 and f2; the first stands in for missing ones
+    uint8_t form;
+    uint8_t immediate;  // only used for one-byte opcodes, the others follow simple rules
+    uint16_t flags;
+    uint8_t group;  // names by the ModRM reg field instead
+};
+
+static const char* const GROUP_NAMES[GROUP_COUNT][8] = {
+    [GROUP_1] = {"add", "or", "adc", "sbb", "and", "sub", "xor", "cmp"},
+    [GROUP_1A] = {"pop"},
+    [GROUP_2] = {"rol", "ror", "rcl", "rcr", "shl", "shr", "sal", "sar"},
+    [GROUP_3] = {"test", "test", "not", "neg", "mul", "imul", "div", "idiv"},
+    [GROUP_4] = {"inc", "dec"},
+    [GROUP_5] = {"inc", "dec", "call", "call far", "jmp", "jmp far", "push"},
+    [GROUP_11] = {"mov"},
+    [GROUP_6] = {"sldt", "str", "lldt", "ltr", "verr", "verw"},
+    [GROUP_7] = {"sgdt", "sidt", "lgdt", "lidt", "smsw", NULL, "lmsw", "invlpg"},
+    [GROUP_8] = {NULL, NULL, NULL, NULL, "bt", "bts", "btr", "btc"},
+    [GROUP_9] = {NULL, "cmpxchg8b", NULL, NULL, NULL, NULL, "rdrand", "rdseed"},
+    [GROUP_12] = {NULL, NULL, "psrlw", NULL, "psraw", NULL, "psllw"},
+    [GROUP_13] = {NULL, NULL, "psrld", NULL, "psrad", NULL, "pslld"},
+    [GROUP_14] = {NULL, NULL, "psrlq", "psrldq", NULL, NULL, "psllq", "pslldq"},
+    [GROUP_15] = {"fxsave", "fxrstor", "ldmxcsr", "stmxcsr", "xsave", "xrstor", "xsaveopt", "clflush"},
+    [GROUP_16] = {"prefetchnta", "prefetcht0", "prefetcht1", "prefetcht2", "nop", "nop", "nop", "nop"},
+    [GROUP_P] = {"prefetch", "prefetchw", "prefetch", "prefetch", "prefetch", "prefetch", "prefetch", "prefetch"},
+};
+
+static const char* const CONDITIONS[16] = {"o", "no", "b", "ae", "e", "ne", "be", "a",
+                                           "s", "ns", "p", "np", "l", "ge", "le", "g"};
+
+#define OP(name, form, immediate, flags) {{name}, form, immediate, (flags) | F_VALID, GROUP_NONE}
+#define GROUP(group, form, immediate, flags) {{NULL}, form, immediate, (flags) | F_VALID | F_MODRM, group}
+#define SSE(a, b, c, d, form, flags) {{a, b, c, d}, form, IMM_NONE, (flags) | F_VALID | F_MODRM, GROUP_NONE}
+#define MMX(name, form) SSE(name, NULL, NULL, NULL, form, F_MMX)
+
+#define EIGHT(opcode, ...)                                                                                   \
+    [opcode] = __VA_ARGS__, [opcode + 1] = __VA_ARGS__, [opcode + 2] = __VA_ARGS__, [opcode + 3] = __VA_ARGS__,  \
+    [opcode + 4] = __VA_ARGS__, [opcode + 5] = __VA_ARGS__, [opcode + 6] = __VA_ARGS__, [opcode + 7] = __VA_ARGS__
+#define SIXTEEN(opcode, ...) EIGHT(opcode, __VA_ARGS__), EIGHT(opcode + 8, __VA_ARGS__)
+
+#define ALU(opcode, name)                                                                                     \
+    [opcode] = OP(name, FORM_E_G, IMM_NONE, F_MODRM | F_BYTE), [opcode + 1] = OP(name, FORM_E_G, IMM_NONE, F_MODRM), \
+    [opcode + 2] = OP(name, FORM_G_E, IMM_NONE, F_MODRM | F_BYTE),                                           \
+    [opcode + 3] = OP(name, FORM_G_E, IMM_NONE, F_MODRM), [opcode + 4] = OP(name, FORM_ACC_IMM, IMM_8, F_BYTE), \
+    [opcode + 5] = OP(name, FORM_ACC_IMM, IMM_Z, 0)
+
+// Opcodes that aren't listed are invalid in 64-bit mode, or prefixes.
+static const struct tdb_opcode ONE_BYTE_OPCODES[256] = {
+    ALU(0x00, "add"),
+    ALU(0x08, "or"),
+    ALU(0x10, "adc"),
+    ALU(0x18, "sbb"),
+    ALU(0x20, "and"),
+    ALU(0x28, "sub"),
+    ALU(0x30, "xor"),
+    ALU(0x38, "cmp"),
+    EIGHT(0x50, OP("push", FORM_REG, IMM_NONE, F_DEFAULT64)),
+    EIGHT(0x58, OP("pop", FORM_REG, IMM_NONE, F_DEFAULT64)),
+    [0x63] = OP("movsxd", FORM_G_ED, IMM_NONE, F_MODRM),
+    [0x68] = OP("push", FORM_IMM, IMM_Z, F_DEFAULT64),
+    [0x69] = OP("imul", FORM_G_E_IMM, IMM_Z, F_MODRM),
+    [0x6a] = OP("push", FORM_IMM, IMM_8, F_DEFAULT64),
+    [0x6b] = OP("imul", FORM_G_E_IMM, IMM_8, F_MODRM),
+    [0x6c] = OP("ins", FORM_STRING, IMM_NONE, F_BYTE),
+    [0x6d] = OP("ins", FORM_STRING, IMM_NONE, 0),
+    [0x6e] = OP("outs", FORM_STRING, IMM_NONE, F_BYTE),
+    [0x6f] = OP("outs", FORM_STRING, IMM_NONE, 0),
+    SIXTEEN(0x70, OP("j", FORM_REL, IMM_8, F_CONDITION)),
+    [0x80] = GROUP(GROUP_1, FORM_E_IMM, IMM_8, F_BYTE),
+    [0x81] = GROUP(GROUP_1, FORM_E_IMM, IMM_Z, 0),
+    [0x83] = GROUP(GROUP_1, FORM_E_IMM, IMM_8, 0),
+    [0x84] = OP("test", FORM_E_G, IMM_NONE, F_MODRM | F_BYTE),
+    [0x85] = OP("test", FORM_E_G, IMM_NONE, F_MODRM),
+    [0x86] = OP("xchg", FORM_E_G, IMM_NONE, F_MODRM | F_BYTE),
+    [0x87] = OP("xchg", FORM_E_G, IMM_NONE, F_MODRM),
+    [0x88] = OP("mov", FORM_E_G, IMM_NONE, F_MODRM | F_BYTE),
+    [0x89] = OP("mov", FORM_E_G, IMM_NONE, F_MODRM),
+    [0x8a] = OP("mov", FORM_G_E, IMM_NONE, F_MODRM | F_BYTE),
+    [0x8b] = OP("mov", FORM_G_E, IMM_NONE, F_MODRM),
+    [0x8c] = OP("mov", FORM_E_SEG, IMM_NONE, F_MODRM),
+    [0x8d] = OP("lea", FORM_G_M, IMM_NONE, F_MODRM),
+    [0x8e] = OP("mov", FORM_SEG_E, IMM_NONE, F_MODRM),
+    [0x8f] = GROUP(GROUP_1A, FORM_E, IMM_NONE, F_DEFAULT64),
+    [0x90] = OP("nop", FORM_NONE, IMM_NONE, 0),
+    [0x91] = OP("xchg", FORM_ACC_REG, IMM_NONE, 0),
+    [0x92] = OP("xchg", FORM_ACC_REG, IMM_NONE, 0),
+    [0x93] = OP("xchg", FORM_ACC_REG, IMM_NONE, 0),
+    [0x94] = OP("xchg", FORM_ACC_REG, IMM_NONE, 0),
+    [0x95] = OP("xchg", FORM_ACC_REG, IMM_NONE, 0),
+    [0x96] = OP("xchg", FORM_ACC_REG, IMM_NONE, 0),
+    [0x97] = OP("xchg", FORM_ACC_REG, IMM_NONE, 0),
+    [0x98] = OP("cwde", FORM_NONE, IMM_NONE, 0),
+    [0x99] = OP("cdq", FORM_NONE, IMM_NONE, 0),
+    [0x9b] = OP("fwait", FORM_NONE, IMM_NONE, 0),
+    [0x9c] = OP("pushfq", FORM_NONE, IMM_NONE, F_DEFAULT64),
+    [0x9d] = OP("popfq", FORM_NONE, IMM_NONE, F_DEFAULT64),
+    [0x9e] = OP("sahf", FORM_NONE, IMM_NONE, 0),
+    [0x9f] = OP("lahf", FORM_NONE, IMM_NONE, 0),
+    [0xa0] = OP("mov", FORM_ACC_MOFFS, IMM_MOFFS, F_BYTE),
+    [0xa1] = OP("mov", FORM_ACC_MOFFS, IMM_MOFFS, 0),
+    [0xa2] = OP("mov", FORM_MOFFS_ACC, IMM_MOFFS, F_BYTE),
+    [0xa3] = OP("mov", FORM_MOFFS_ACC, IMM_MOFFS, 0),
+    [0xa4] = OP("movs", FORM_STRING, IMM_NONE, F_BYTE),
+    [0xa5] = OP("movs", FORM_STRING, IMM_NONE, 0),
+    [0xa6] = OP("cmps", FORM_STRING, IMM_NONE, F_BYTE),
+    [0xa7] = OP("cmps", FORM_STRING, IMM_NONE, 0),
+    [0xa8] = OP("test", FORM_ACC_IMM, IMM_8, F_BYTE),
+    [0xa9] = OP("test", FORM_ACC_IMM, IMM_Z, 0),
+    [0xaa] = OP("stos", FORM_STRING, IMM_NONE, F_BYTE),
+    [0xab] = OP("stos", FORM_STRING, IMM_NONE, 0),
+    [0xac] = OP("lods", FORM_STRING, IMM_NONE, F_BYTE),
+    [0xad] = OP("lods", FORM_STRING, IMM_NONE, 0),
+    [0xae] = OP("scas", FORM_STRING, IMM_NONE, F_BYTE),
+    [0xaf] = OP("scas", FORM_STRING, IMM_NONE, 0),
+    EIGHT(0xb0, OP("mov", FORM_REG_IMM, IMM_8, F_BYTE)),
+    EIGHT(0xb8, OP("mov", FORM_REG_IMM, IMM_V, 0)),
+    [0xc0] = GROUP(GROUP_2, FORM_E_IMM, IMM_8, F_BYTE),
+    [0xc1] = GROUP(GROUP_2, FORM_E_IMM, IMM_8, 0),
+    [0xc2] = OP("ret", FORM_IMM, IMM_16, 0),
+    [0xc3] = OP("ret", FORM_NONE, IMM_NONE, 0),
+    [0xc6] = GROUP(GROUP_11, FORM_E_IMM, IMM_8, F_BYTE),
+    [0xc7] = GROUP(GROUP_11, FORM_E_IMM, IMM_Z, 0),
+    [0xc8] = OP("enter", FORM_IMM, IMM_ENTER, 0),
+    [0xc9] = OP("leave", FORM_NONE, IMM_NONE, F_DEFAULT64),
+    [0xca] = OP("retf", FORM_IMM, IMM_16, 0),
+    [0xcb] = OP("retf", FORM_NONE, IMM_NONE, 0),
+    [0xcc] = OP("int3", FORM_NONE, IMM_NONE, 0),
+    [0xcd] = OP("int", FORM_IMM, IMM_8, 0),
+    [0xcf] = OP("iret", FORM_NONE, IMM_NONE, 0),
+    [0xd0] = GROUP(GROUP_2, FORM_E_1, IMM_NONE, F_BYTE),
+    [0xd1] = GROUP(GROUP_2, FORM_E_1, IMM_NONE, 0),
+    [0xd2] = GROUP(GROUP_2, FORM_E_CL, IMM_NONE, F_BYTE),
+    [0xd3] = GROUP(GROUP_2, FORM_E_CL, IMM_NONE, 0),
+    [0xd7] = OP("xlat", FORM_NONE, IMM_NONE, 0),
+    EIGHT(0xd8, OP(NULL, FORM_X87, IMM_NONE, F_MODRM)),
+    [0xe0] = OP("loopne", FORM_REL, IMM_8, 0),
+    [0xe1] = OP("loope", FORM_REL, IMM_8, 0),
+    [0xe2] = OP("loop", FORM_REL, IMM_8, 0),
+    [0xe3] = OP("jrcxz", FORM_REL, IMM_8, 0),
+    [0xe4] = OP("in", FORM_ACC_IMM, IMM_8, F_BYTE),
+    [0xe5] = OP("in", FORM_ACC_IMM, IMM_8, 0),
+    [0xe6] = OP("out", FORM_IMM_ACC, IMM_8, F_BYTE),
+    [0xe7] = OP("out", FORM_IMM_ACC, IMM_8, 0),
+    [0xe8] = OP("call", FORM_REL, IMM_Z, 0),
+    [0xe9] = OP("jmp", FORM_REL, IMM_Z, 0),
+    [0xeb] = OP("jmp", FORM_REL, IMM_8, 0),
+    [0xec] = OP("in", FORM_ACC_DX, IMM_NONE, F_BYTE),
+    [0xed] = OP("in", FORM_ACC_DX, IMM_NONE, 0),
+    [0xee] = OP("out", FORM_DX_ACC, IMM_NONE, F_BYTE),
+    [0xef] = OP("out", FORM_DX_ACC, IMM_NONE, 0),
+    [0xf1] = OP("int1", FORM_NONE, IMM_NONE, 0),
+    [0xf4] = OP("hlt", FORM_NONE, IMM_NONE, 0),
+    [0xf5] = OP("cmc", FORM_NONE, IMM_NONE, 0),
+    [0xf6] = GROUP(GROUP_3, FORM_E, IMM_GROUP3, F_BYTE),
+    [0xf7] = GROUP(GROUP_3, FORM_E, IMM_GROUP3, 0),
+    [0xf8] = OP("clc", FORM_NONE, IMM_NONE, 0),
+    [0xf9] = OP("stc", FORM_NONE, IMM_NONE, 0),
+    [0xfa] = OP("cli", FORM_NONE, IMM_NONE, 0),
+    [0xfb] = OP("sti", FORM_NONE, IMM_NONE, 0),
+    [0xfc] = OP("cld", FORM_NONE, IMM_NONE, 0),
+    [0xfd] = OP("std", FORM_NONE, IMM_NONE, 0),
+    [0xfe] = GROUP(GROUP_4, FORM_E, IMM_NONE, F_BYTE),
+    [0xff] = GROUP(GROUP_5, FORM_E, IMM_NONE, 0),
+};
+
+// Names and operands of 0f opcodes; their lengths come from tdb_0f_has_modrm and
+// tdb_0f_immediate, so unnamed ones still decode.
+static const struct tdb_opcode TWO_BYTE_OPCODES[256] = {
+    [0x00] = GROUP(GROUP_6, FORM_E, IMM_NONE, 0),
+    [0x01] = GROUP(GROUP_7, FORM_E, IMM_NONE, 0),
+    [0x02] = OP("lar", FORM_G_E, IMM_NONE, F_MODRM),
+    [0x03] = OP("lsl", FORM_G_E, IMM_NONE, F_MODRM),
+    [0x05] = OP("syscall", FORM_NONE, IMM_NONE, 0),
+    [0x06] = OP("clts", FORM_NONE, IMM_NONE, 0),
+    [0x07] = OP("sysret", FORM_NONE, IMM_NONE, 0),
+    [0x08] = OP("invd", FORM_NONE, IMM_NONE, 0),
+    [0x09] = OP("wbinvd", FORM_NONE, IMM_NONE, 0),
+    [0x0b] = OP("ud2", FORM_NONE, IMM_NONE, 0),
+    [0x0d] = GROUP(GROUP_P, FORM_E, IMM_NONE, 0),
+    [0x10] = SSE("movups", "movupd", "movss", "movsd", FORM_X_E, F_VVVV_REGISTER),
+    [0x11] = SSE("movups", "movupd", "movss", "movsd", FORM_E_X, F_VVVV_REGISTER),
+    [0x12] = SSE("movlps", "movlpd", "movsldup", "movddup", FORM_X_E, F_VVVV_REGISTER),
+    [0x13] = SSE("movlps", "movlpd", NULL, NULL, FORM_E_X, F_NO_VVVV),
+    [0x14] = SSE("unpcklps", "unpcklpd", NULL, NULL, FORM_X_E, 0),
+    [0x15] = SSE("unpckhps", "unpckhpd", NULL, NULL, FORM_X_E, 0),
+    [0x16] = SSE("movhps", "movhpd", "movshdup", NULL, FORM_X_E, F_VVVV_REGISTER),
+    [0x17] = SSE("movhps", "movhpd", NULL, NULL, FORM_E_X, F_NO_VVVV),
+    [0x18] = GROUP(GROUP_16, FORM_E, IMM_NONE, 0),
+    [0x19] = OP("nop", FORM_E, IMM_NONE, F_MODRM),
+    [0x1a] = OP("nop", FORM_E, IMM_NONE, F_MODRM),
+    [0x1b] = OP("nop", FORM_E, IMM_NONE, F_MODRM),
+    [0x1c] = OP("nop", FORM_E, IMM_NONE, F_MODRM),
+    [0x1d] = OP("nop", FORM_E, IMM_NONE, F_MODRM),
+    [0x1e] = OP("nop", FORM_E, IMM_NONE, F_MODRM),
+    [0x1f] = OP("nop", FORM_E, IMM_NONE, F_MODRM),
+    [0x28] = SSE("movaps", "movapd", NULL, NULL, FORM_X_E, F_NO_VVVV),
+    [0x29] = SSE("movaps", "movapd", NULL, NULL, FORM_E_X, F_NO_VVVV),
+    [0x2a] = SSE("cvtpi2ps", "cvtpi2pd", "cvtsi2ss", "cvtsi2sd", FORM_X_GPR, 0),
+    [0x2b] = SSE("movntps", "movntpd", NULL, NULL, FORM_E_X, F_NO_VVVV),
+    [0x2c] = SSE("cvttps2pi", "cvttpd2pi", "cvttss2si", "cvttsd2si", FORM_G_X, F_NO_VVVV),
+    [0x2d] = SSE("cvtps2pi", "cvtpd2pi", "cvtss2si", "cvtsd2si", FORM_G_X, F_NO_VVVV),
+    [0x2e] = SSE("ucomiss", "ucomisd", NULL, NULL, FORM_X_E, F_NO_VVVV),
+    [0x2f] = SSE("comiss", "comisd", NULL, NULL, FORM_X_E, F_NO_VVVV),
+    [0x30] = OP("wrmsr", FORM_NONE, IMM_NONE, 0),
+    [0x31] = OP("rdtsc", FORM_NONE, IMM_NONE, 0),
+    [0x32] = OP("rdmsr", FORM_NONE, IMM_NONE, 0),
+    [0x33] = OP("rdpmc", FORM_NONE, IMM_NONE, 0),
+    [0x34] = OP("sysenter", FORM_NONE, IMM_NONE, 0),
+    [0x35] = OP("sysexit", FORM_NONE, IMM_NONE, 0),
+    SIXTEEN(0x40, OP("cmov", FORM_G_E, IMM_NONE, F_MODRM | F_CONDITION)),
+    [0x50] = SSE("movmskps", "movmskpd", NULL, NULL, FORM_G_X, F_NO_VVVV),
+    [0x51] = SSE("sqrtps", "sqrtpd", "sqrtss", "sqrtsd", FORM_X_E, F_VVVV_SCALAR),
+    [0x52] = SSE("rsqrtps", NULL, "rsqrtss", NULL, FORM_X_E, F_VVVV_SCALAR),
+    [0x53] = SSE("rcpps", NULL, "rcpss", NULL, FORM_X_E, F_VVVV_SCALAR),
+    [0x54] = SSE("andps", "andpd", NULL, NULL, FORM_X_E, 0),
+    [0x55] = SSE("andnps", "andnpd", NULL, NULL, FORM_X_E, 0),
+    [0x56] = SSE("orps", "orpd", NULL, NULL, FORM_X_E, 0),
+    [0x57] = SSE("xorps", "xorpd", NULL, NULL, FORM_X_E, 0),
+    [0x58] = SSE("addps", "addpd", "addss", "addsd", FORM_X_E, 0),
+    [0x59] = SSE("mulps", "mulpd", "mulss", "mulsd", FORM_X_E, 0),
+    [0x5a] = SSE("cvtps2pd", "cvtpd2ps", "cvtss2sd", "cvtsd2ss", FORM_X_E, F_VVVV_SCALAR),
+    [0x5b] = SSE("cvtdq2ps", "cvtps2dq", "cvttps2dq", NULL, FORM_X_E, F_NO_VVVV),
+    [0x5c] = SSE("subps", "subpd", "subss", "subsd", FORM_X_E, 0),
+    [0x5d] = SSE("minps", "minpd", "minss", "minsd", FORM_X_E, 0),
+    [0x5e] = SSE("divps", "divpd", "divss", "divsd", FORM_X_E, 0),
+    [0x5f] = SSE("maxps", "maxpd", "maxss", "maxsd", FORM_X_E, 0),
+    [0x60] = MMX("punpcklbw", FORM_X_E),
+    [0x61] = MMX("punpcklwd", FORM_X_E),
+    [0x62] = MMX("punpckldq", FORM_X_E),
+    [0x63] = MMX("packsswb", FORM_X_E),
+    [0x64] = MMX("pcmpgtb", FORM_X_E),
+    [0x65] = MMX("pcmpgtw", FORM_X_E),
+    [0x66] = MMX("pcmpgtd", FORM_X_E),
+    [0x67] = MMX("packuswb", FORM_X_E),
+    [0x68] = MMX("punpckhbw", FORM_X_E),
+    [0x69] = MMX("punpckhwd", FORM_X_E),
+    [0x6a] = MMX("punpckhdq", FORM_X_E),
+    [0x6b] = MMX("packssdw", FORM_X_E),
+    [0x6c] = SSE(NULL, "punpcklqdq", NULL, NULL, FORM_X_E, 0),
+    [0x6d] = SSE(NULL, "punpckhqdq", NULL, NULL, FORM_X_E, 0),
+    [0x6e] = SSE("movd", NULL, NULL, NULL, FORM_X_GPR, F_MMX | F_NO_VVVV),
+    [0x6f] = SSE("movq", "movdqa", "movdqu", NULL, FORM_X_E, F_MMX | F_NO_VVVV),
+    [0x70] = SSE("pshufw", "pshufd", "pshufhw", "pshuflw", FORM_X_E_IMM, F_MMX | F_NO_VVVV),
+    [0x71] = {{NULL}, FORM_X_SHIFT, IMM_NONE, F_VALID | F_MODRM | F_MMX, GROUP_12},
+    [0x72] = {{NULL}, FORM_X_SHIFT, IMM_NONE, F_VALID | F_MODRM | F_MMX, GROUP_13},
+    [0x73] = {{NULL}, FORM_X_SHIFT, IMM_NONE, F_VALID | F_MODRM | F_MMX, GROUP_14},
+    [0x74] = MMX("pcmpeqb", FORM_X_E),
+    [0x75] = MMX("pcmpeqw", FORM_X_E),
+    [0x76] = MMX("pcmpeqd", FORM_X_E),
+    [0x77] = OP("emms", FORM_NONE, IMM_NONE, 0),
+    [0x7e] = SSE("movd", NULL, "movq", NULL, FORM_GPR_X, F_MMX | F_NO_VVVV),
+    [0x7f] = SSE("movq", "movdqa", "movdqu", NULL, FORM_E_X, F_MMX | F_NO_VVVV),
+    SIXTEEN(0x80, OP("j", FORM_REL, IMM_NONE, F_CONDITION)),
+    SIXTEEN(0x90, OP("set", FORM_E, IMM_NONE, F_MODRM | F_BYTE | F_CONDITION)),
+    [0xa0] = OP("push fs", FORM_NONE, IMM_NONE, 0),
+    [0xa1] = OP("pop fs", FORM_NONE, IMM_NONE, 0),
+    [0xa2] = OP("cpuid", FORM_NONE, IMM_NONE, 0),
+    [0xa3] = OP("bt", FORM_E_G, IMM_NONE, F_MODRM),
+    [0xa4] = OP("shld", FORM_E_G_IMM, IMM_NONE, F_MODRM),
+    [0xa5] = OP("shld", FORM_E_G_CL, IMM_NONE, F_MODRM),
+    [0xa8] = OP("push gs", FORM_NONE, IMM_NONE, 0),
+    [0xa9] = OP("pop gs", FORM_NONE, IMM_NONE, 0),
+    [0xab] = OP("bts", FORM_E_G, IMM_NONE, F_MODRM),
+    [0xac] = OP("shrd", FORM_E_G_IMM, IMM_NONE, F_MODRM),
+    [0xad] = OP("shrd", FORM_E_G_CL, IMM_NONE, F_MODRM),
+    [0xae] = GROUP(GROUP_15, FORM_E, IMM_NONE, 0),
+    [0xaf] = OP("imul", FORM_G_E, IMM_NONE, F_MODRM),
+    [0xb0] = OP("cmpxchg", FORM_E_G, IMM_NONE, F_MODRM | F_BYTE),
+    [0xb1] = OP("cmpxchg", FORM_E_G, IMM_NONE, F_MODRM),
+    [0xb3] = OP("btr", FORM_E_G, IMM_NONE, F_MODRM),
+    [0xb6] = OP("movzx", FORM_G_EB, IMM_NONE, F_MODRM),
+    [0xb7] = OP("movzx", FORM_G_EW, IMM_NONE, F_MODRM),
+    [0xb8] = SSE(NULL, NULL, "popcnt", NULL, FORM_G_E, 0),
+    [0xb9] = OP("ud1", FORM_G_E, IMM_NONE, F_MODRM),
+    [0xba] = GROUP(GROUP_8, FORM_E_IMM, IMM_NONE, 0),
+    [0xbb] = OP("btc", FORM_E_G, IMM_NONE, F_MODRM),
+    [0xbc] = SSE("bsf", NULL, "tzcnt", NULL, FORM_G_E, 0),
+    [0xbd] = SSE("bsr", NULL, "lzcnt", NULL, FORM_G_E, 0),
+    [0xbe] = OP("movsx", FORM_G_EB, IMM_NONE, F_MODRM),
+    [0xbf] = OP("movsx", FORM_G_EW, IMM_NONE, F_MODRM),
+    [0xc0] = OP("xadd", FORM_E_G, IMM_NONE, F_MODRM | F_BYTE),
+    [0xc1] = OP("xadd", FORM_E_G, IMM_NONE, F_MODRM),
+    [0xc2] = SSE("cmpps", "cmppd", "cmpss", "cmpsd", FORM_X_E_IMM, 0),
+    [0xc3] = OP("movnti", FORM_E_G, IMM_NONE, F_MODRM),
+    [0xc4] = SSE("pinsrw", NULL, NULL, NULL, FORM_X_GPR_IMM, F_MMX),
+    [0xc5] = SSE("pextrw", NULL, NULL, NULL, FORM_G_X_IMM, F_MMX | F_NO_VVVV),
+    [0xc6] = SSE("shufps", "shufpd", NULL, NULL, FORM_X_E_IMM, 0),
+    [0xc7] = GROUP(GROUP_9, FORM_E, IMM_NONE, 0),
+    EIGHT(0xc8, OP("bswap", FORM_REG, IMM_NONE, 0)),
+    [0xd1] = MMX("psrlw", FORM_X_E),
+    [0xd2] = MMX("psrld", FORM_X_E),
+    [0xd3] = MMX("psrlq", FORM_X_E),
+    [0xd4] = MMX("paddq", FORM_X_E),
+    [0xd5] = MMX("pmullw", FORM_X_E),
+    [0xd6] = SSE(NULL, "movq", NULL, NULL, FORM_E_X, F_NO_VVVV),
+    [0xd7] = SSE("pmovmskb", NULL, NULL, NULL, FORM_G_X, F_MMX | F_NO_VVVV),
+    [0xd8] = MMX("psubusb", FORM_X_E),
+    [0xd9] = MMX("psubusw", FORM_X_E),
+    [0xda] = MMX("pminub", FORM_X_E),
+    [0xdb] = MMX("pand", FORM_X_E),
+    [0xdc] = MMX("paddusb", FORM_X_E),
+    [0xdd] = MMX("paddusw", FORM_X_E),
+    [0xde] = MMX("pmaxub", FORM_X_E),
+    [0xdf] = MMX("pandn", FORM_X_E),
+    [0xe0] = MMX("pavgb", FORM_X_E),
+    [0xe1] = MMX("psraw", FORM_X_E),
+    [0xe2] = MMX("psrad", FORM_X_E),
+    [0xe3] = MMX("pavgw", FORM_X_E),
+    [0xe4] = MMX("pmulhuw", FORM_X_E),
+    [0xe5] = MMX("pmulhw", FORM_X_E),
+    [0xe6] = SSE(NULL, "cvttpd2dq", "cvtdq2pd", "cvtpd2dq", FORM_X_E, F_NO_VVVV),
+    [0xe7] = SSE("movntq", "movntdq", NULL, NULL, FORM_E_X, F_MMX | F_NO_VVVV),
+    [0xe8] = MMX("psubsb", FORM_X_E),
+    [0xe9] = MMX("psubsw", FORM_X_E),
+    [0xea] = MMX("pminsw", FORM_X_E),
+    [0xeb] = MMX("por", FORM_X_E),
+    [0xec] = MMX("paddsb", FORM_X_E),
+    [0xed] = MMX("paddsw", FORM_X_E),
+    [0xee] = MMX("pmaxsw", FORM_X_E),
+    [0xef] = MMX("pxor", FORM_X_E),
+    [0xf0] = SSE(NULL, NULL, NULL, "lddqu", FORM_X_E, F_NO_VVVV),
+    [0xf1] = MMX("psllw", FORM_X_E),
+    [0xf2] = MMX("pslld", FORM_X_E),
+    [0xf3] = MMX("psllq", FORM_X_E),
+    [0xf4] = MMX("pmuludq", FORM_X_E),
+    [0xf5] = MMX("pmaddwd", FORM_X_E),
+    [0xf6] = MMX("psadbw", FORM_X_E),
+    [0xf7] = SSE("maskmovq", "maskmovdqu", NULL, NULL, FORM_X_E, F_MMX | F_NO_VVVV),
+    [0xf8] = MMX("psubb", FORM_X_E),
+    [0xf9] = MMX("psubw", FORM_X_E),
+    [0xfa] = MMX("psubd", FORM_X_E),
+    [0xfb] = MMX("psubq", FORM_X_E),
+    [0xfc] = MMX("paddb", FORM_X_E),
+    [0xfd] = MMX("paddw", FORM_X_E),
+    [0xfe] = MMX("paddd", FORM_X_E),
+    [0xff] = OP("ud0", FORM_G_E, IMM_NONE, F_MODRM),
+};
+
+#define VEC(name, form, flags) SSE(name, NULL, NULL, NULL, form, flags)
+
+// 0f 38 and 0f 3a opcodes all have a ModRM byte, and those of 0f 3a an 8-bit immediate.
+// Most are only defined with a 66 prefix, which is left out of the names.
+static const struct tdb_opcode THREE_BYTE_38_OPCODES[256] = {
+    [0x00] = VEC("pshufb", FORM_X_E, 0),
+    [0x01] = VEC("phaddw", FORM_X_E, 0),
+    [0x02] = VEC("phaddd", FORM_X_E, 0),
+    [0x04] = VEC("pmaddubsw", FORM_X_E, 0),
+    [0x08] = VEC("psignb", FORM_X_E, 0),
+    [0x0b] = VEC("pmulhrsw", FORM_X_E, 0),
+    [0x10] = VEC("pblendvb", FORM_X_E, 0),
+    [0x16] = VEC("permps", FORM_X_E, 0),
+    [0x17] = VEC("ptest", FORM_X_E, F_NO_VVVV),
+    [0x18] = VEC("broadcastss", FORM_X_E, F_NO_VVVV),
+    [0x19] = VEC("broadcastsd", FORM_X_E, F_NO_VVVV),
+    [0x1c] = VEC("pabsb", FORM_X_E, F_NO_VVVV),
+    [0x1d] = VEC("pabsw", FORM_X_E, F_NO_VVVV),
+    [0x1e] = VEC("pabsd", FORM_X_E, F_NO_VVVV),
+    [0x20] = VEC("pmovsxbw", FORM_X_E, F_NO_VVVV),
+    [0x21] = VEC("pmovsxbd", FORM_X_E, F_NO_VVVV),
+    [0x22] = VEC("pmovsxbq", FORM_X_E, F_NO_VVVV),
+    [0x23] = VEC("pmovsxwd", FORM_X_E, F_NO_VVVV),
+    [0x24] = VEC("pmovsxwq", FORM_X_E, F_NO_VVVV),
+    [0x25] = VEC("pmovsxdq", FORM_X_E, F_NO_VVVV),
+    [0x28] = VEC("pmuldq", FORM_X_E, 0),
+    [0x29] = VEC("pcmpeqq", FORM_X_E, 0),
+    [0x2b] = VEC("packusdw", FORM_X_E, 0),
+    [0x30] = VEC("pmovzxbw", FORM_X_E, F_NO_VVVV),
+    [0x31] = VEC("pmovzxbd", FORM_X_E, F_NO_VVVV),
+    [0x32] = VEC("pmovzxbq", FORM_X_E, F_NO_VVVV),
+    [0x33] = VEC("pmovzxwd", FORM_X_E, F_NO_VVVV),
+    [0x34] = VEC("pmovzxwq", FORM_X_E, F_NO_VVVV),
+    [0x35] = VEC("pmovzxdq", FORM_X_E, F_NO_VVVV),
+    [0x36] = VEC("permd", FORM_X_E, 0),
+    [0x37] = VEC("pcmpgtq", FORM_X_E, 0),
+    [0x38] = VEC("pminsb", FORM_X_E, 0),
+    [0x39] = VEC("pminsd", FORM_X_E, 0),
+    [0x3a] = VEC("pminuw", FORM_X_E, 0),
+    [0x3b] = VEC("pminud", FORM_X_E, 0),
+    [0x3c] = VEC("pmaxsb", FORM_X_E, 0),
+    [0x3d] = VEC("pmaxsd", FORM_X_E, 0),
+    [0x3e] = VEC("pmaxuw", FORM_X_E, 0),
+    [0x3f] = VEC("pmaxud", FORM_X_E, 0),
+    [0x40] = VEC("pmulld", FORM_X_E, 0),
+    [0x45] = VEC("psrlv", FORM_X_E, 0),
+    [0x46] = VEC("psravd", FORM_X_E, 0),
+    [0x47] = VEC("psllv", FORM_X_E, 0),
+    [0x58] = VEC("pbroadcastd", FORM_X_E, F_NO_VVVV),
+    [0x59] = VEC("pbroadcastq", FORM_X_E, F_NO_VVVV),
+    [0x5a] = VEC("broadcasti128", FORM_X_E, F_NO_VVVV),
+    [0x78] = VEC("pbroadcastb", FORM_X_E, F_NO_VVVV),
+    [0x79] = VEC("pbroadcastw", FORM_X_E, F_NO_VVVV),
+    [0xf0] = SSE("movbe", NULL, NULL, "crc32", FORM_G_E, 0),
+    [0xf1] = SSE("movbe", NULL, NULL, "crc32", FORM_G_E, 0),
+    [0xf2] = VEC("andn", FORM_G_V_E, F_GPR),
+    [0xf3] = VEC(NULL, FORM_V_E, F_GPR),
+    [0xf5] = SSE("bzhi", NULL, "pext", "pdep", FORM_G_V_E, F_GPR),
+    [0xf6] = SSE(NULL, NULL, NULL, "mulx", FORM_G_V_E, F_GPR),
+    [0xf7] = SSE("bextr", "shlx", "sarx", "shrx", FORM_G_E_V, F_GPR),
+};
+
+static const struct tdb_opcode THREE_BYTE_3A_OPCODES[256] = {
+    [0x00] = VEC("permq", FORM_X_E_IMM, F_NO_VVVV),
+    [0x01] = VEC("permpd", FORM_X_E_IMM, F_NO_VVVV),
+    [0x02] = VEC("pblendd", FORM_X_E_IMM, 0),
+    [0x04] = VEC("permilps", FORM_X_E_IMM, F_NO_VVVV),
+    [0x05] = VEC("permilpd", FORM_X_E_IMM, F_NO_VVVV),
+    [0x06] = VEC("perm2f128", FORM_X_E_IMM, 0),
+    [0x08] = VEC("roundps", FORM_X_E_IMM, F_NO_VVVV),
+    [0x09] = VEC("roundpd", FORM_X_E_IMM, F_NO_VVVV),
+    [0x0a] = VEC("roundss", FORM_X_E_IMM, 0),
+    [0x0b] = VEC("roundsd", FORM_X_E_IMM, 0),
+    [0x0c] = VEC("blendps", FORM_X_E_IMM, 0),
+    [0x0d] = VEC("blendpd", FORM_X_E_IMM, 0),
+    [0x0e] = VEC("pblendw", FORM_X_E_IMM, 0),
+    [0x0f] = VEC("palignr", FORM_X_E_IMM, 0),
+    [0x14] = VEC("pextrb", FORM_GPR_X_IMM, F_NO_VVVV),
+    [0x15] = VEC("pextrw", FORM_GPR_X_IMM, F_NO_VVVV),
+    [0x16] = VEC("pextrd", FORM_GPR_X_IMM, F_NO_VVVV),
+    [0x17] = VEC("extractps", FORM_GPR_X_IMM, F_NO_VVVV),
+    [0x18] = VEC("insertf128", FORM_X_E_IMM, 0),
+    [0x19] = VEC("extractf128", FORM_E_X, F_NO_VVVV),
+    [0x20] = VEC("pinsrb", FORM_X_GPR_IMM, 0),
+    [0x21] = VEC("insertps", FORM_X_E_IMM, 0),
+    [0x22] = VEC("pinsrd", FORM_X_GPR_IMM, 0),
+    [0x38] = VEC("inserti128", FORM_X_E_IMM, 0),
+    [0x39] = VEC("extracti128", FORM_E_X, F_NO_VVVV),
+    [0x40] = VEC("dpps", FORM_X_E_IMM, 0),
+    [0x41] = VEC("dppd", FORM_X_E_IMM, 0),
+    [0x42] = VEC("mpsadbw", FORM_X_E_IMM, 0),
+    [0x44] = VEC("pclmulqdq", FORM_X_E_IMM, 0),
+    [0x46] = VEC("perm2i128", FORM_X_E_IMM, 0),
+    [0x4a] = VEC("blendvps", FORM_X_E_IMM, 0),
+    [0x4b] = VEC("blendvpd", FORM_X_E_IMM, 0),
+    [0x4c] = VEC("pblendvb", FORM_X_E_IMM, 0),
+    [0x60] = VEC("pcmpestrm", FORM_X_E_IMM, F_NO_VVVV),
+    [0x61] = VEC("pcmpestri", FORM_X_E_IMM, F_NO_VVVV),
+    [0x62] = VEC("pcmpistrm", FORM_X_E_IMM, F_NO_VVVV),
+    [0x63] = VEC("pcmpistri", FORM_X_E_IMM, F_NO_VVVV),
+    [0xf0] = SSE(NULL, NULL, NULL, "rorx", FORM_G_E_IMM, F_GPR),
+};
+
+static bool tdb_0f_is_valid(uint8_t opcode)
+{
+    switch (opcode) {
+        case 0x04:
+        case 0x0a:
+        case 0x0c:
+        case 0x0f:
+        case 0x24:
+        case 0x25:
+        case 0x26:
+        case 0x27:
+        case 0x36:
+        case 0x39:
+        case 0x3b:
+        case 0x3c:
+        case 0x3d:
+        case 0x3e:
+        case 0x3f:
+        case 0x7a:
+        case 0x7b:
+        case 0xa6:
+        case 0xa7:
+            return false;
+        default:
+            return true;
+    }
+}
+
+static bool tdb_0f_has_modrm(uint8_t opcode)
+{
+    if ((opcode >= 0x30 && opcode <= 0x37) || (opcode >= 0x80 && opcode <= 0x8f) || opcode >= 0xc8) {
+        return opcode > 0xcf;
+    }
+
+    switch (opcode) {
+        case 0x05:
+        case 0x06:
+        case 0x07:
+        case 0x08:
+        case 0x09:
+        case 0x0b:
+        case 0x0e:
+        case 0x77:
+        case 0xa0:
+        case 0xa1:
+        case 0xa2:
+        case 0xa8:
+        case 0xa9:
+        case 0xaa:
+            return false;
+        default:
+            return true;
+    }
+}
+
+static uint8_t tdb_0f_immediate(uint8_t opcode)
+{
+    if (opcode >= 0x80 && opcode <= 0x8f) {
+        return IMM_Z;
+    }
+
+    switch (opcode) {
+        case 0x70:
+        case 0x71:
+        case 0x72:
+        case 0x73:
+        case 0xa4:
+        case 0xac:
+        case 0xba:
+        case 0xc2:
+        case 0xc4:
+        case 0xc5:
+        case 0xc6:
+            return IMM_8;
+        default:
+            return IMM_NONE;
+    }
+}
+
+static bool tdb_decode_invalid(struct tdb_instruction* instruction)
+{
+    const uint64_t address = instruction->address;
+    memset(instruction, 0, sizeof(*instruction));
+    instruction->address = address;
+    instruction->length = 1;
+    instruction->kind = TDB_INSTRUCTION_INVALID;
+    return false;
+}
+
+static uint8_t tdb_modrm_reg(const struct tdb_instruction* instruction)
+{
+    return (instruction->modrm >> 3) & 7;
+}
+
+static const struct tdb_opcode* tdb_lookup_opcode(const struct tdb_instruction* instruction)
+{
+    switch (instruction->map) {
+        case 0:
+            return &ONE_BYTE_OPCODES[instruction->opcode];
+        case 1:
+            return &TWO_BYTE_OPCODES[instruction->opcode];
+        case 2:
+            return &THREE_BYTE_38_OPCODES[instruction->opcode];
+        case 3:
+            return &THREE_BYTE_3A_OPCODES[instruction->opcode];
+        default:
+            return NULL;
+    }
+}
+
+// Decodes a VEX (c4, c5) or EVEX (62) prefix, which also holds the opcode map.
+static bool tdb_decode_vector_prefix(const uint8_t* code, size_t limit, size_t* position,
+                                     struct tdb_instruction* instruction)
+{
+    static const uint8_t PP_PREFIXES[4] = {0, TDB_PREFIX_OPERAND_SIZE, TDB_PREFIX_REP, TDB_PREFIX_REPNE};
+
+    // VEX and EVEX can't be combined with these
+    if (instruction->rex != 0 ||
+        (instruction->prefixes & (TDB_PREFIX_LOCK | TDB_PREFIX_REP | TDB_PREFIX_REPNE | TDB_PREFIX_OPERAND_SIZE))) {
+        return false;
+    }
+
+    const size_t p = *position;
+    const uint8_t escape = code[p];
+    uint8_t r, x, b, w = 0, pp;
+
+    if (escape == 0xc5) {
+        if (p + 2 >= limit) {
+            return false;
+        }
+        const uint8_t byte1 = code[p + 1];
+        r = !(byte1 & 0x80);
+        x = 0;
+        b = 0;
+        instruction->vector_register = (~byte1 >> 3) & 15;
+        instruction->vector_length = (byte1 >> 2) & 1;
+        pp = byte1 & 3;
+        instruction->map = 1;
+        instruction->prefixes |= TDB_PREFIX_VEX;
+        *position = p + 2;
+    }
+    else if (escape == 0xc4) {
+        if (p + 3 >= limit) {
+            return false;
+        }
+        const uint8_t byte1 = code[p + 1];
+        const uint8_t byte2 = code[p + 2];
+        r = !(byte1 & 0x80);
+        x = !(byte1 & 0x40);
+        b = !(byte1 & 0x20);
+        w = byte2 >> 7;
+        instruction->vector_register = (~byte2 >> 3) & 15;
+        instruction->vector_length = (byte2 >> 2) & 1;
+        pp = byte2 & 3;
+        instruction->map = byte1 & 0x1f;
+        instruction->prefixes |= TDB_PREFIX_VEX;
+        *position = p + 3;
+    }
+    else {
+        if (p + 4 >= limit) {
+            return false;
+        }
+        const uint8_t p0 = code[p + 1];
+        const uint8_t p1 = code[p + 2];
+        const uint8_t p2 = code[p + 3];
+        if ((p0 & 0x08) || !(p1 & 0x04)) {
+            return false;
+        }
+        r = !(p0 & 0x80);
+        x = !(p0 & 0x40);
+        b = !(p0 & 0x20);
+        w = p1 >> 7;
+        // R' extends G and X the register E to 32 vector registers
+        instruction->rex = (uint8_t)((!(p0 & 0x10) << 4) | (x << 5));
+        instruction->vector_register = (uint8_t)(((~p1 >> 3) & 15) | (!(p2 & 0x08) << 4));
+        instruction->vector_length = (p2 >> 5) & 3;
+        pp = p1 & 3;
+        instruction->map = p0 & 7;
+        instruction->prefixes |= TDB_PREFIX_EVEX;
+        *position = p + 4;
+    }
+
+    if (instruction->map == 0 || instruction->map == 4 || instruction->map > 6) {
+        return false;
+    }
+
+    instruction->rex |= (uint8_t)(0x40 | (w << 3) | (r << 2) | (x << 1) | b);
+    instruction->prefixes |= PP_PREFIXES[pp];
+    return true;
+}
+
+static int64_t tdb_read_signed(const uint8_t* bytes, uint8_t size)
+{
+    int16_t value16;
+    int32_t value32;
+    int64_t value64;
+
+    switch (size) {
+        case 1:
+            return (int8_t)bytes[0];
+        case 2:
+            memcpy(&value16, bytes, sizeof(value16));
+            return value16;
+        case 4:
+            memcpy(&value32, bytes, sizeof(value32));
+            return value32;
+        case 8:
+            memcpy(&value64, bytes, sizeof(value64));
+            return value64;
+        default:
+            return 0;
+    }
+}
+
+static void tdb_classify_instruction(struct tdb_instruction* instruction)
+{
+    const uint64_t next = instruction->address + instruction->length;
+    const uint8_t opcode = instruction->opcode;
+    instruction->kind = TDB_INSTRUCTION_OTHER;
+
+    if (instruction->rip_relative) {
+        instruction->target = next + (uint64_t)(int64_t)instruction->displacement;
+    }
+
+    if (instruction->prefixes & (TDB_PREFIX_VEX | TDB_PREFIX_EVEX)) {
+        return;
+    }
+
+    if (instruction->map == 0) {
+        if (opcode == 0xe8 || opcode == 0xe9 || opcode == 0xeb || (opcode >= 0x70 && opcode <= 0x7f) ||
+            (opcode >= 0xe0 && opcode <= 0xe3)) {
+            instruction->kind = opcode == 0xe8   ? TDB_INSTRUCTION_CALL
+                                : opcode == 0xe9 || opcode == 0xeb ? TDB_INSTRUCTION_JUMP
+                                                                   : TDB_INSTRUCTION_BRANCH;
+            instruction->target = next + (uint64_t)instruction->immediate;
+        }
+        else if (opcode == 0xc2 || opcode == 0xc3 || opcode == 0xca || opcode == 0xcb || opcode == 0xcf) {
+            instruction->kind = TDB_INSTRUCTION_RETURN;
+        }
+        else if (opcode == 0xcd && instruction->immediate == 0x80) {
+            instruction->kind = TDB_INSTRUCTION_SYSCALL;
+        }
+        else if (opcode == 0xcc || opcode == 0xcd || opcode == 0xf1 || opcode == 0xf4) {
+            instruction->kind = TDB_INSTRUCTION_TRAP;
+        }
+        else if (opcode == 0xc7 && instruction->modrm == 0xf8) {
+            instruction->target = next + (uint64_t)instruction->immediate;  // xbegin's abort handler
+        }
+        else if (opcode == 0xff) {
+            const uint8_t reg = tdb_modrm_reg(instruction);
+            if (reg == 2 || reg == 3) {
+                instruction->kind = TDB_INSTRUCTION_CALL_INDIRECT;
+            }
+            else if (reg == 4 || reg == 5) {
+                instruction->kind = TDB_INSTRUCTION_JUMP_INDIRECT;
+            }
+        }
+    }
+    else if (instruction->map == 1) {
+        if (opcode >= 0x80 && opcode <= 0x8f) {
+            instruction->kind = TDB_INSTRUCTION_BRANCH;
+            instruction->target = next + (uint64_t)instruction->immediate;
+        }
+        else if (opcode == 0x05 || opcode == 0x34) {
+            instruction->kind = TDB_INSTRUCTION_SYSCALL;
+        }
+        else if (opcode == 0x0b || opcode == 0xb9 || opcode == 0xff) {
+            instruction->kind = TDB_INSTRUCTION_TRAP;
+        }
+    }
+}
+
+bool tdb_decode_instruction(const uint8_t* code, size_t available, uint64_t address,
+                            struct tdb_instruction* instruction)
+{
+    memset(instruction, 0, sizeof(*instruction));
+    instruction->address = address;
+
+    const size_t limit = available < TDB_INSTRUCTION_MAX_LENGTH ? available : TDB_INSTRUCTION_MAX_LENGTH;
+    bool ds_prefix = false;
+    size_t p = 0;
+
+    // legacy prefixes, of which the last f2/f3 counts, and then REX right before the opcode
+    for (; p < limit; p++) {
+        const uint8_t byte = code[p];
+        if (byte == 0xf0) {
+            instruction->prefixes |= TDB_PREFIX_LOCK;
+        }
+        else if (byte == 0xf2 || byte == 0xf3) {
+            instruction->prefixes &= (uint8_t)~(TDB_PREFIX_REP | TDB_PREFIX_REPNE);
+            instruction->prefixes |= byte == 0xf3 ? TDB_PREFIX_REP : TDB_PREFIX_REPNE;
+        }
+        else if (byte == 0x66) {
+            instruction->prefixes |= TDB_PREFIX_OPERAND_SIZE;
+        }
+        else if (byte == 0x67) {
+            instruction->prefixes |= TDB_PREFIX_ADDRESS_SIZE;
+        }
+        else if (byte == 0x64 || byte == 0x65) {
+            instruction->segment = byte;
+        }
+        else if (byte == 0x3e) {
+            ds_prefix = true;
+        }
+        else if (byte != 0x26 && byte != 0x2e && byte != 0x36) {
+            break;
+        }
+    }
+
+    if (p < limit && (code[p] & 0xf0) == 0x40) {
+        instruction->rex = code[p++];
+    }
+    if (p >= limit) {
+        return tdb_decode_invalid(instruction);
+    }
+
+    const uint8_t escape = code[p];
+    if (escape == 0xc4 || escape == 0xc5 || escape == 0x62) {
+        if (!tdb_decode_vector_prefix(code, limit, &p, instruction)) {
+            return tdb_decode_invalid(instruction);
+        }
+    }
+    else if (escape == 0x0f) {
+        if (++p >= limit) {
+            return tdb_decode_invalid(instruction);
+        }
+        instruction->map = 1;
+        if (code[p] == 0x38 || code[p] == 0x3a) {
+            instruction->map = code[p] == 0x38 ? 2 : 3;
+            if (++p >= limit) {
+                return tdb_decode_invalid(instruction);
+            }
+        }
+    }
+
+    instruction->opcode = code[p++];
+
+    const bool vector_prefix = instruction->prefixes & (TDB_PREFIX_VEX | TDB_PREFIX_EVEX);
+    const struct tdb_opcode* entry = tdb_lookup_opcode(instruction);
+    uint16_t flags = entry != NULL ? entry->flags : 0;
+    uint8_t immediate_kind = IMM_NONE;
+
+    switch (instruction->map) {
+        case 0:
+            if (!(flags & F_VALID)) {
+                return tdb_decode_invalid(instruction);
+            }
+            instruction->has_modrm = flags & F_MODRM;
+            immediate_kind = entry->immediate;
+            break;
+        case 1:
+            if (!vector_prefix && !tdb_0f_is_valid(instruction->opcode)) {
+                return tdb_decode_invalid(instruction);
+            }
+            instruction->has_modrm =
+                vector_prefix ? instruction->opcode != 0x77 : tdb_0f_has_modrm(instruction->opcode);
+            immediate_kind = tdb_0f_immediate(instruction->opcode);
+            if (vector_prefix && immediate_kind == IMM_Z) {
+                return tdb_decode_invalid(instruction);
+            }
+            break;
+        case 3:
+            instruction->has_modrm = true;
+            immediate_kind = IMM_8;
+            break;
+        default:
+            instruction->has_modrm = true;
+            break;
+    }
+
+    if (instruction->has_modrm) {
+        if (p >= limit) {
+            return tdb_decode_invalid(instruction);
+        }
+        instruction->modrm = code[p++];
+
+        const uint8_t mod = instruction->modrm >> 6;
+        const uint8_t rm = instruction->modrm & 7;
+        uint8_t displacement_size = 0;
+
+        if (mod != 3) {
+            if (rm == 4) {
+                if (p >= limit) {
+                    return tdb_decode_invalid(instruction);
+                }
+                instruction->sib = code[p++];
+                instruction->has_sib = true;
+            }
+
+            if (mod == 1) {
+                displacement_size = 1;
+            }
+            else if (mod == 2) {
+                displacement_size = 4;
+            }
+            else if (rm == 5) {
+                displacement_size = 4;
+                instruction->rip_relative = true;
+            }
+            else if (instruction->has_sib && (instruction->sib & 7) == 5) {
+                displacement_size = 4;
+            }
+        }
+
+        if (p + displacement_size > limit) {
+            return tdb_decode_invalid(instruction);
+        }
+        instruction->displacement = (int32_t)tdb_read_signed(code + p, displacement_size);
+        p += displacement_size;
+    }
+
+    // operand size: 8-bit opcodes, REX.W, 66, then the default of 32 bits, which push, pop
+    // and near indirect branches raise to 64
+    const uint8_t reg = tdb_modrm_reg(instruction);
+    if (instruction->map == 0 && instruction->opcode == 0xff && (reg == 2 || reg == 4 || reg == 6)) {
+        flags |= F_DEFAULT64;
+    }
+
+    if (flags & F_BYTE) {
+        instruction->operand_size = 1;
+    }
+    else if (instruction->rex & 0x08) {
+        instruction->operand_size = 8;
+    }
+    else if ((instruction->prefixes & TDB_PREFIX_OPERAND_SIZE) && !vector_prefix) {
+        instruction->operand_size = 2;
+    }
+    else {
+        instruction->operand_size = flags & F_DEFAULT64 ? 8 : 4;
+    }
+
+    switch (immediate_kind) {
+        case IMM_8:
+            instruction->immediate_size = 1;
+            break;
+        case IMM_16:
+            instruction->immediate_size = 2;
+            break;
+        case IMM_Z:
+            // relative branches stay 32 bits with a 66 prefix on Intel
+            instruction->immediate_size = instruction->operand_size == 2 && entry->form != FORM_REL ? 2 : 4;
+            break;
+        case IMM_V:
+            instruction->immediate_size = instruction->operand_size;
+            break;
+        case IMM_MOFFS:
+            instruction->immediate_size = instruction->prefixes & TDB_PREFIX_ADDRESS_SIZE ? 4 : 8;
+            break;
+        case IMM_ENTER:
+            instruction->immediate_size = 3;
+            break;
+        case IMM_GROUP3:
+            if (reg < 2) {
+                instruction->immediate_size = instruction->operand_size < 4 ? instruction->operand_size : 4;
+            }
+            break;
+        default:
+            break;
+    }
+
+    if (p + instruction->immediate_size > limit) {
+        return tdb_decode_invalid(instruction);
+    }
+
+    if (immediate_kind == IMM_ENTER) {
+        instruction->immediate = code[p] | (code[p + 1] << 8) | (code[p + 2] << 16);
+    }
+    else if (immediate_kind == IMM_MOFFS && instruction->immediate_size == 4) {
+        uint32_t offset;
+        memcpy(&offset, code + p, sizeof(offset));
+        instruction->immediate = offset;
+    }
+    else {
+        instruction->immediate = tdb_read_signed(code + p, instruction->immediate_size);
+    }
+
+    instruction->length = (uint8_t)(p + instruction->immediate_size);
+
+    if (ds_prefix && instruction->map == 0 && instruction->opcode == 0xff && (reg == 2 || reg == 4)) {
+        instruction->prefixes |= TDB_PREFIX_NOTRACK;
+    }
+
+    tdb_classify_instruction(instruction);
+    return true;
+}
+
+// Formatting.
+
+struct tdb_text {
+    char* buffer;
+    size_t size;
+    size_t length;
+    unsigned operand_count;
+};
+
+__attribute__((format(printf, 2, 3))) static void tdb_text_append(struct tdb_text* text, const char* format, ...)
+{
+    if (text->length + 1 >= text->size) {
+        return;
+    }
+
+    va_list arguments;
+    va_start(arguments, format);
+    const int count = vsnprintf(text->buffer + text->length, text->size - text->length, format, arguments);
+    va_end(arguments);
+
+    if (count > 0) {
+        text->length += (size_t)count;
+        if (text->length >= text->size) {
+            text->length = text->size - 1;
+        }
+    }
+}
+
+// Starts the next operand, separated from the one before.
+static void tdb_text_operand(struct tdb_text* text)
+{
+    if (text->operand_count++ > 0) {
+        tdb_text_append(text, ", ");
+    }
+}
+
+static const char* const REGISTERS_64[16] = {"rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+                                             "r8",  "r9",  "r10", "r11", "r12", "r13", "r14", "r15"};
+static const char* const REGISTERS_32[16] = {"eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi",
+                                             "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d"};
+static const char* const REGISTERS_16[16] = {"ax", "cx", "dx", "bx", "sp", "bp", "si", "di",
+                                             "r8w", "r9w", "r10w", "r11w", "r12w", "r13w", "r14w", "r15w"};
+static const char* const REGISTERS_8[16] = {"al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil",
+                                            "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b"};
+static const char* const REGISTERS_8_LEGACY[8] = {"al", "cl", "dl", "bl", "ah", "ch", "dh", "bh"};
+static const char* const SEGMENT_REGISTERS[8] = {"es", "cs", "ss", "ds", "fs", "gs", "?", "?"};
+
+static const char* tdb_register_name(const struct tdb_instruction* instruction, uint8_t number, uint8_t size)
+{
+    number &= 15;
+    switch (size) {
+        case 1:
+            return instruction->rex != 0 ? REGISTERS_8[number] : REGISTERS_8_LEGACY[number & 7];
+        case 2:
+            return REGISTERS_16[number];
+        case 4:
+            return REGISTERS_32[number];
+        default:
+            return REGISTERS_64[number];
+    }
+}
+
+static uint8_t tdb_reg_number(const struct tdb_instruction* instruction)
+{
+    return (uint8_t)(tdb_modrm_reg(instruction) | ((instruction->rex & 0x04) << 1) | (instruction->rex & 0x10));
+}
+
+static uint8_t tdb_rm_number(const struct tdb_instruction* instruction)
+{
+    return (uint8_t)((instruction->modrm & 7) | ((instruction->rex & 0x01) << 3) | ((instruction->rex & 0x20) >> 1));
+}
+
+static bool tdb_uses_mmx_registers(const struct tdb_instruction* instruction, const struct tdb_opcode* entry)
+{
+    return (entry->flags & F_MMX) &&
+           !(instruction->prefixes &
+             (TDB_PREFIX_OPERAND_SIZE | TDB_PREFIX_REP | TDB_PREFIX_REPNE | TDB_PREFIX_VEX | TDB_PREFIX_EVEX));
+}
+
+static void tdb_append_vector_register(struct tdb_text* text, const struct tdb_instruction* instruction,
+                                       const struct tdb_opcode* entry, uint8_t number)
+{
+    tdb_text_operand(text);
+    if (tdb_uses_mmx_registers(instruction, entry)) {
+        tdb_text_append(text, "mm%u", number & 7);
+    }
+    else {
+        static const char VECTOR_PREFIXES[4] = {'x', 'y', 'z', 'z'};
+        tdb_text_append(text, "%cmm%u", VECTOR_PREFIXES[instruction->vector_length & 3], number);
+    }
+}
+
+static void tdb_append_register(struct tdb_text* text, const struct tdb_instruction* instruction, uint8_t number,
+                                uint8_t size)
+{
+    tdb_text_operand(text);
+    tdb_text_append(text, "%s", tdb_register_name(instruction, number, size));
+}
+
+static void tdb_append_hex(struct tdb_text* text, uint64_t value, uint8_t size)
+{
+    if (size < 8) {
+        value &= (1ULL << (size * 8)) - 1;
+    }
+    tdb_text_append(text, "0x%" PRIx64, value);
+}
+
+static void tdb_append_immediate(struct tdb_text* text, const struct tdb_instruction* instruction, uint8_t size)
+{
+    tdb_text_operand(text);
+    tdb_append_hex(text, (uint64_t)instruction->immediate, size);
+}
+
+// The memory operand of ModRM, "qword ptr fs:[rbx+rcx*8+0x10]", with size 0 leaving out
+// the size.
+static void tdb_append_memory(struct tdb_text* text, const struct tdb_instruction* instruction, uint8_t size)
+{
+    static const char* const SIZE_NAMES[9] = {NULL, "byte", "word", NULL, "dword", NULL, NULL, NULL, "qword"};
+
+    tdb_text_operand(text);
+    if (size < sizeof(SIZE_NAMES) / sizeof(SIZE_NAMES[0]) && SIZE_NAMES[size] != NULL) {
+        tdb_text_append(text, "%s ptr ", SIZE_NAMES[size]);
+    }
+    if (instruction->segment != 0) {
+        tdb_text_append(text, "%s:", instruction->segment == 0x64 ? "fs" : "gs");
+    }
+
+    const uint8_t address_size = instruction->prefixes & TDB_PREFIX_ADDRESS_SIZE ? 4 : 8;
+    const uint8_t mod = instruction->modrm >> 6;
+    bool has_register = false;
+
+    tdb_text_append(text, "[");
+    if (instruction->rip_relative) {
+        tdb_text_append(text, "%s", address_size == 4 ? "eip" : "rip");
+        has_register = true;
+    }
+    else if (instruction->has_sib) {
+        const uint8_t base = (uint8_t)((instruction->sib & 7) | ((instruction->rex & 0x01) << 3));
+        const uint8_t index = (uint8_t)(((instruction->sib >> 3) & 7) | ((instruction->rex & 0x02) << 2));
+
+        if ((instruction->sib & 7) != 5 || mod != 0) {
+            tdb_text_append(text, "%s", tdb_register_name(instruction, base, address_size));
+            has_register = true;
+        }
+        if (index != 4) {
+            tdb_text_append(text, "%s%s*%u", has_register ? "+" : "",
+                            tdb_register_name(instruction, index, address_size),
+                            1u << (instruction->sib >> 6));
+            has_register = true;
+        }
+    }
+    else {
+        tdb_text_append(text, "%s", tdb_register_name(instruction, tdb_rm_number(instruction), address_size));
+        has_register = true;
+    }
+
+    if (!has_register) {
+        tdb_append_hex(text, (uint64_t)(int64_t)instruction->displacement, address_size);
+    }
+    else if (instruction->displacement < 0) {
+        tdb_text_append(text, "-0x%x", -(uint32_t)instruction->displacement);
+    }
+    else if (instruction->displacement > 0) {
+        tdb_text_append(text, "+0x%x", (uint32_t)instruction->displacement);
+    }
+    tdb_text_append(text, "]");
+}
+
+// The r/m operand, a register of the given size or memory.
+static void tdb_append_rm(struct tdb_text* text, const struct tdb_instruction* instruction, uint8_t size)
+{
+    if ((instruction->modrm >> 6) == 3) {
+        tdb_append_register(text, instruction, tdb_rm_number(instruction), size);
+    }
+    else {
+        tdb_append_memory(text, instruction, size);
+    }
+}
+
+static void tdb_append_vector_rm(struct tdb_text* text, const struct tdb_instruction* instruction,
+                                 const struct tdb_opcode* entry)
+{
+    if ((instruction->modrm >> 6) == 3) {
+        tdb_append_vector_register(text, instruction, entry, tdb_rm_number(instruction));
+    }
+    else {
+        tdb_append_memory(text, instruction, 0);
+    }
+}
+
+// Whether the VEX vvvv register is an operand, since encodings without one leave it 0
+// which can't be told from xmm0.
+static bool tdb_has_vector_register_operand(const struct tdb_instruction* instruction, const struct tdb_opcode* entry)
+{
+    if (!(instruction->prefixes & (TDB_PREFIX_VEX | TDB_PREFIX_EVEX)) || (entry->flags & F_NO_VVVV)) {
+        return false;
+    }
+    if (entry->flags & F_VVVV_SCALAR) {
+        return instruction->prefixes & (TDB_PREFIX_REP | TDB_PREFIX_REPNE);
+    }
+    if (entry->flags & F_VVVV_REGISTER) {
+        return (instruction->modrm >> 6) == 3;
+    }
+    return true;
+}
+
+static uint8_t tdb_gpr_size(const struct tdb_instruction* instruction)
+{
+    return instruction->rex & 0x08 ? 8 : 4;
+}
+
+static void tdb_append_operands(struct tdb_text* text, const struct tdb_instruction* instruction,
+                                const struct tdb_opcode* entry, uint8_t form)
+{
+    const uint8_t size = instruction->operand_size;
+    const uint8_t opcode_register = (uint8_t)((instruction->opcode & 7) | ((instruction->rex & 0x01) << 3));
+    const bool vector_register = tdb_has_vector_register_operand(instruction, entry);
+
+    switch (form) {
+        case FORM_E: {
+            // nop and setcc have a size, the system instructions in 0f groups don't
+            const bool nop = instruction->map == 1 && instruction->opcode >= 0x19 && instruction->opcode <= 0x1f;
+            tdb_append_rm(text, instruction, instruction->map == 0 || (entry->flags & F_BYTE) || nop ? size : 0);
+            break;
+        }
+        case FORM_E_G:
+            tdb_append_rm(text, instruction, size);
+            tdb_append_register(text, instruction, tdb_reg_number(instruction), size);
+            break;
+        case FORM_G_E:
+            tdb_append_register(text, instruction, tdb_reg_number(instruction), size);
+            tdb_append_rm(text, instruction, size);
+            break;
+        case FORM_G_M:
+            tdb_append_register(text, instruction, tdb_reg_number(instruction), size);
+            tdb_append_memory(text, instruction, 0);
+            break;
+        case FORM_G_EB:
+        case FORM_G_EW:
+        case FORM_G_ED:
+            tdb_append_register(text, instruction, tdb_reg_number(instruction), size);
+            tdb_append_rm(text, instruction, form == FORM_G_EB ? 1 : form == FORM_G_EW ? 2 : 4);
+            break;
+        case FORM_E_IMM:
+            tdb_append_rm(text, instruction, size);
+            tdb_append_immediate(text, instruction, size);
+            break;
+        case FORM_E_1:
+            tdb_append_rm(text, instruction, size);
+            tdb_text_operand(text);
+            tdb_text_append(text, "1");
+            break;
+        case FORM_E_CL:
+            tdb_append_rm(text, instruction, size);
+            tdb_append_register(text, instruction, 1, 1);
+            break;
+        case FORM_G_E_IMM:
+            tdb_append_register(text, instruction, tdb_reg_number(instruction), size);
+            tdb_append_rm(text, instruction, size);
+            tdb_append_immediate(text, instruction, size);
+            break;
+        case FORM_E_G_IMM:
+        case FORM_E_G_CL:
+            tdb_append_rm(text, instruction, size);
+            tdb_append_register(text, instruction, tdb_reg_number(instruction), size);
+            if (form == FORM_E_G_IMM) {
+                tdb_append_immediate(text, instruction, 1);
+            }
+            else {
+                tdb_append_register(text, instruction, 1, 1);
+            }
+            break;
+        case FORM_E_SEG:
+            tdb_append_rm(text, instruction, (instruction->modrm >> 6) == 3 ? size : 2);
+            tdb_text_operand(text);
+            tdb_text_append(text, "%s", SEGMENT_REGISTERS[tdb_modrm_reg(instruction)]);
+            break;
+        case FORM_SEG_E:
+            tdb_text_operand(text);
+            tdb_text_append(text, "%s", SEGMENT_REGISTERS[tdb_modrm_reg(instruction)]);
+            tdb_append_rm(text, instruction, (instruction->modrm >> 6) == 3 ? size : 2);
+            break;
+        case FORM_ACC_IMM:
+            tdb_append_register(text, instruction, 0, size);
+            // in's port is 8 bits whatever the size of the accumulator
+            tdb_append_immediate(text, instruction, instruction->opcode >= 0xe4 ? 1 : size);
+            break;
+        case FORM_IMM_ACC:
+            tdb_append_immediate(text, instruction, 1);
+            tdb_append_register(text, instruction, 0, size);
+            break;
+        case FORM_ACC_DX:
+        case FORM_DX_ACC:
+            if (form == FORM_DX_ACC) {
+                tdb_append_register(text, instruction, 2, 2);
+            }
+            tdb_append_register(text, instruction, 0, size);
+            if (form == FORM_ACC_DX) {
+                tdb_append_register(text, instruction, 2, 2);
+            }
+            break;
+        case FORM_ACC_MOFFS:
+        case FORM_MOFFS_ACC:
+            if (form == FORM_ACC_MOFFS) {
+                tdb_append_register(text, instruction, 0, size);
+            }
+            tdb_text_operand(text);
+            tdb_text_append(text, "%s[",
+                            instruction->segment == 0x64   ? "fs:"
+                            : instruction->segment == 0x65 ? "gs:"
+                                                           : "");
+            tdb_append_hex(text, (uint64_t)instruction->immediate, 8);
+            tdb_text_append(text, "]");
+            if (form == FORM_MOFFS_ACC) {
+                tdb_append_register(text, instruction, 0, size);
+            }
+            break;
+        case FORM_ACC_REG:
+            tdb_append_register(text, instruction, 0, size);
+            tdb_append_register(text, instruction, opcode_register, size);
+            break;
+        case FORM_REG:
+            tdb_append_register(text, instruction, opcode_register, size);
+            break;
+        case FORM_REG_IMM:
+            tdb_append_register(text, instruction, opcode_register, size);
+            tdb_append_immediate(text, instruction, size);
+            break;
+        case FORM_REL:
+            tdb_text_operand(text);
+            tdb_append_hex(text, instruction->target, 8);
+            break;
+        case FORM_IMM:
+            tdb_text_operand(text);
+            if (entry->immediate == IMM_ENTER) {
+                tdb_text_append(text, "0x%x, 0x%x", (unsigned)(instruction->immediate & 0xffff),
+                                (unsigned)(instruction->immediate >> 16));
+            }
+            else {
+                // push sign-extends its immediate to the 64 bits it pushes
+                const bool push = instruction->opcode == 0x68 || instruction->opcode == 0x6a;
+                tdb_append_hex(text, (uint64_t)instruction->immediate, push ? size : instruction->immediate_size);
+            }
+            break;
+        case FORM_X_E:
+        case FORM_X_E_IMM:
+            tdb_append_vector_register(text, instruction, entry, tdb_reg_number(instruction));
+            if (vector_register) {
+                tdb_append_vector_register(text, instruction, entry, instruction->vector_register);
+            }
+            tdb_append_vector_rm(text, instruction, entry);
+            if (form == FORM_X_E_IMM) {
+                tdb_append_immediate(text, instruction, 1);
+            }
+            break;
+        case FORM_E_X:
+            tdb_append_vector_rm(text, instruction, entry);
+            if (vector_register) {
+                tdb_append_vector_register(text, instruction, entry, instruction->vector_register);
+            }
+            tdb_append_vector_register(text, instruction, entry, tdb_reg_number(instruction));
+            if (instruction->map == 3) {
+                tdb_append_immediate(text, instruction, 1);
+            }
+            break;
+        case FORM_X_GPR:
+        case FORM_X_GPR_IMM:
+            tdb_append_vector_register(text, instruction, entry, tdb_reg_number(instruction));
+            if (vector_register) {
+                tdb_append_vector_register(text, instruction, entry, instruction->vector_register);
+            }
+            tdb_append_rm(text, instruction, tdb_gpr_size(instruction));
+            if (form == FORM_X_GPR_IMM) {
+                tdb_append_immediate(text, instruction, 1);
+            }
+            break;
+        case FORM_GPR_X:
+        case FORM_GPR_X_IMM:
+            tdb_append_rm(text, instruction, tdb_gpr_size(instruction));
+            tdb_append_vector_register(text, instruction, entry, tdb_reg_number(instruction));
+            if (form == FORM_GPR_X_IMM) {
+                tdb_append_immediate(text, instruction, 1);
+            }
+            break;
+        case FORM_G_X:
+        case FORM_G_X_IMM:
+            tdb_append_register(text, instruction, tdb_reg_number(instruction), tdb_gpr_size(instruction));
+            tdb_append_vector_rm(text, instruction, entry);
+            if (form == FORM_G_X_IMM) {
+                tdb_append_immediate(text, instruction, 1);
+            }
+            break;
+        case FORM_X_SHIFT:
+            if (vector_register) {
+                tdb_append_vector_register(text, instruction, entry, instruction->vector_register);
+            }
+            tdb_append_vector_rm(text, instruction, entry);
+            tdb_append_immediate(text, instruction, 1);
+            break;
+        case FORM_G_V_E:
+        case FORM_G_E_V:
+            tdb_append_register(text, instruction, tdb_reg_number(instruction), tdb_gpr_size(instruction));
+            if (form == FORM_G_V_E) {
+                tdb_append_register(text, instruction, instruction->vector_register, tdb_gpr_size(instruction));
+            }
+            tdb_append_rm(text, instruction, tdb_gpr_size(instruction));
+            if (form == FORM_G_E_V) {
+                tdb_append_register(text, instruction, instruction->vector_register, tdb_gpr_size(instruction));
+            }
+            break;
+        case FORM_V_E:
+            tdb_append_register(text, instruction, instruction->vector_register, tdb_gpr_size(instruction));
+            tdb_append_rm(text, instruction, tdb_gpr_size(instruction));
+            break;
+        default:
+            break;
+    }
+}
+
+static const char* const X87_MEMORY[8][8] = {
+    {"fadd", "fmul", "fcom", "fcomp", "fsub", "fsubr", "fdiv", "fdivr"},
+    {"fld", NULL, "fst", "fstp", "fldenv", "fldcw", "fnstenv", "fnstcw"},
+    {"fiadd", "fimul", "ficom", "ficomp", "fisub", "fisubr", "fidiv", "fidivr"},
+    {"fild", "fisttp", "fist", "fistp", NULL, "fld", NULL, "fstp"},
+    {"fadd", "fmul", "fcom", "fcomp", "fsub", "fsubr", "fdiv", "fdivr"},
+    {"fld", "fisttp", "fst", "fstp", "frstor", NULL, "fnsave", "fnstsw"},
+    {"fiadd", "fimul", "ficom", "ficomp", "fisub", "fisubr", "fidiv", "fidivr"},
+    {"fild", "fisttp", "fist", "fistp", "fbld", "fild", "fbstp", "fistp"},
+};
+
+// Operand sizes of the memory forms, 10 for tbyte and 0 for environments and states.
+static const uint8_t X87_MEMORY_SIZES[8][8] = {
+    {4, 4, 4, 4, 4, 4, 4, 4}, {4, 0, 4, 4, 0, 2, 0, 2}, {4, 4, 4, 4, 4, 4, 4, 4}, {4, 4, 4, 4, 0, 10, 0, 10},
+    {8, 8, 8, 8, 8, 8, 8, 8}, {8, 8, 8, 8, 0, 0, 0, 2}, {2, 2, 2, 2, 2, 2, 2, 2}, {2, 2, 2, 2, 10, 8, 10, 8},
+};
+
+// Register forms that name st(i), by escape byte and reg field; NULL where the r/m field
+// picks an instruction without operands instead.
+static const char* const X87_REGISTER[8][8] = {
+    {"fadd", "fmul", "fcom", "fcomp", "fsub", "fsubr", "fdiv", "fdivr"},
+    {"fld", "fxch", NULL, NULL, NULL, NULL, NULL, NULL},
+    {"fcmovb", "fcmove", "fcmovbe", "fcmovu", NULL, NULL, NULL, NULL},
+    {"fcmovnb", "fcmovne", "fcmovnbe", "fcmovnu", NULL, "fucomi", "fcomi", NULL},
+    {"fadd", "fmul", "fcom", "fcomp", "fsubr", "fsub", "fdivr", "fdiv"},
+    {"ffree", NULL, "fst", "fstp", "fucom", "fucomp", NULL, NULL},
+    {"faddp", "fmulp", NULL, NULL, "fsubrp", "fsubp", "fdivrp", "fdivp"},
+    {NULL, NULL, NULL, NULL, NULL, "fucomip", "fcomip", NULL},
+};
+
+// d9 e0 to d9 ff
+static const char* const X87_D9_CONSTANTS[32] = {
+    "fchs", "fabs", NULL, NULL, "ftst", "fxam", NULL, NULL, "fld1", "fldl2t", "fldl2e", "fldpi", "fldlg2",
+    "fldln2", "fldz", NULL, "f2xm1", "fyl2x", "fptan", "fpatan", "fxtract", "fprem1", "fdecstp", "fincstp",
+    "fprem", "fyl2xp1", "fsqrt", "fsincos", "frndint", "fscale", "fsin", "fcos",
+};
+
+static void tdb_format_x87(struct tdb_text* text, const struct tdb_instruction* instruction)
+{
+    static const char* const SIZE_NAMES[11] = {NULL, NULL, "word",  NULL, "dword", NULL,
+                                               NULL, NULL, "qword", NULL, "tbyte"};
+
+    const unsigned escape = instruction->opcode - 0xd8u;
+    const uint8_t reg = tdb_modrm_reg(instruction);
+    const uint8_t rm = instruction->modrm & 7;
+    const char* name = NULL;
+
+    if ((instruction->modrm >> 6) != 3) {
+        name = X87_MEMORY[escape][reg];
+        if (name != NULL) {
+            const uint8_t size = X87_MEMORY_SIZES[escape][reg];
+            tdb_text_append(text, "%-6s ", name);
+            if (SIZE_NAMES[size] != NULL) {
+                tdb_text_append(text, "%s ptr ", SIZE_NAMES[size]);
+            }
+            tdb_append_memory(text, instruction, 0);
+            return;
+        }
+    }
+    else if ((name = X87_REGISTER[escape][reg]) != NULL) {
+        const bool single = escape == 1 || escape == 5 || ((escape == 0 || escape == 4) && (reg == 2 || reg == 3));
+        if (single) {
+            tdb_text_append(text, "%-6s st(%u)", name, rm);
+        }
+        else if (escape == 4 || escape == 6) {
+            tdb_text_append(text, "%-6s st(%u), st", name, rm);
+        }
+        else {
+            tdb_text_append(text, "%-6s st, st(%u)", name, rm);
+        }
+        return;
+    }
+    else if (escape == 1 && instruction->modrm >= 0xe0) {
+        name = X87_D9_CONSTANTS[instruction->modrm - 0xe0];
+    }
+    else {
+        switch ((instruction->opcode << 8) | instruction->modrm) {
+            case 0xd9d0:
+                name = "fnop";
+                break;
+            case 0xdae9:
+                name = "fucompp";
+                break;
+            case 0xdbe2:
+                name = "fnclex";
+                break;
+            case 0xdbe3:
+                name = "fninit";
+                break;
+            case 0xded9:
+                name = "fcompp";
+                break;
+            case 0xdfe0:
+                name = "fnstsw ax";
+                break;
+            default:
+                break;
+        }
+    }
+
+    if (name != NULL) {
+        tdb_text_append(text, "%s", name);
+    }
+    else {
+        tdb_text_append(text, "(%02x %02x)", instruction->opcode, instruction->modrm);
+    }
+}
+
+// The mnemonic without prefixes, or NULL if the table doesn't name the instruction.
+static const char* tdb_instruction_mnemonic(const struct tdb_instruction* instruction, const struct tdb_opcode* entry,
+                                            char* buffer, size_t buffer_size)
+{
+    const uint8_t opcode = instruction->opcode;
+    const uint8_t reg = tdb_modrm_reg(instruction);
+    const uint8_t mod = instruction->modrm >> 6;
+    const bool rep = instruction->prefixes & TDB_PREFIX_REP;
+
+    if (instruction->map == 0) {
+        if (opcode == 0x90) {
+            return instruction->rex & 0x01 ? "xchg" : rep ? "pause" : "nop";
+        }
+        if (opcode == 0x98 || opcode == 0x99) {
+            static const char* const NAMES[2][3] = {{"cbw", "cwde", "cdqe"}, {"cwd", "cdq", "cqo"}};
+            return NAMES[opcode - 0x98][instruction->operand_size == 2 ? 0 : instruction->operand_size == 4 ? 1 : 2];
+        }
+        if (opcode == 0xcf) {
+            return instruction->operand_size == 8 ? "iretq" : "iretd";
+        }
+        if ((opcode == 0xc6 || opcode == 0xc7) && instruction->modrm == 0xf8) {
+            return opcode == 0xc6 ? "xabort" : "xbegin";
+        }
+    }
+    else if (instruction->map == 1) {
+        if (opcode == 0x1e && rep && (instruction->modrm == 0xfa || instruction->modrm == 0xfb)) {
+            return instruction->modrm == 0xfa ? "endbr64" : "endbr32";
+        }
+        if (opcode == 0x77 && (instruction->prefixes & TDB_PREFIX_VEX)) {
+            return instruction->vector_length ? "vzeroall" : "vzeroupper";
+        }
+        if (opcode == 0x01 && mod == 3) {
+            switch (instruction->modrm) {
+                case 0xd0:
+                    return "xgetbv";
+                case 0xd1:
+                    return "xsetbv";
+                case 0xca:
+                    return "clac";
+                case 0xcb:
+                    return "stac";
+                case 0xd5:
+                    return "xend";
+                case 0xd6:
+                    return "xtest";
+                case 0xee:
+                    return "rdpkru";
+                case 0xef:
+                    return "wrpkru";
+                case 0xf8:
+                    return "swapgs";
+                case 0xf9:
+                    return "rdtscp";
+                default:
+                    return NULL;
+            }
+        }
+        if (opcode == 0xae && mod == 3) {
+            static const char* const FS_GS_BASE[4] = {"rdfsbase", "rdgsbase", "wrfsbase", "wrgsbase"};
+            static const char* const FENCES[8] = {NULL, NULL, NULL, NULL, NULL, "lfence", "mfence", "sfence"};
+            return rep ? (reg < 4 ? FS_GS_BASE[reg] : NULL) : FENCES[reg];
+        }
+        if (opcode == 0xc7 && reg == 1 && (instruction->rex & 0x08)) {
+            return "cmpxchg16b";
+        }
+    }
+
+    const char* name;
+    if (instruction->map == 1 && (opcode == 0x6e || opcode == 0x7e) && (instruction->rex & 0x08) && !rep) {
+        name = "movq";
+    }
+    else if (instruction->map == 1 && (opcode == 0x12 || opcode == 0x16) && mod == 3 &&
+             !(instruction->prefixes & (TDB_PREFIX_OPERAND_SIZE | TDB_PREFIX_REP | TDB_PREFIX_REPNE))) {
+        name = opcode == 0x12 ? "movhlps" : "movlhps";
+    }
+    else if (instruction->map == 2 && opcode == 0xf3 && (instruction->prefixes & TDB_PREFIX_VEX)) {
+        static const char* const BMI_GROUP[8] = {NULL, "blsr", "blsmsk", "blsi"};
+        name = BMI_GROUP[reg];
+    }
+    else if (entry->group != GROUP_NONE) {
+        name = GROUP_NAMES[entry->group][reg];
+    }
+    else {
+        const unsigned index = instruction->prefixes & TDB_PREFIX_REP     ? 2
+                               : instruction->prefixes & TDB_PREFIX_REPNE ? 3
+                               : instruction->prefixes & TDB_PREFIX_OPERAND_SIZE ? 1
+                                                                                 : 0;
+        name = entry->names[index] != NULL ? entry->names[index] : entry->names[0];
+    }
+
+    if (name == NULL) {
+        return NULL;
+    }
+
+    if (entry->flags & F_CONDITION) {
+        snprintf(buffer, buffer_size, "%s%s", name, CONDITIONS[opcode & 15]);
+        return buffer;
+    }
+    if (entry->form == FORM_STRING) {
+        static const char SUFFIXES[9] = {0, 'b', 'w', 0, 'd', 0, 0, 0, 'q'};
+        snprintf(buffer, buffer_size, "%s%c", name, SUFFIXES[instruction->operand_size]);
+        return buffer;
+    }
+    if ((instruction->prefixes & (TDB_PREFIX_VEX | TDB_PREFIX_EVEX)) && !(entry->flags & F_GPR)) {
+        snprintf(buffer, buffer_size, "v%s", name);
+        return buffer;
+    }
+    return name;
+}
+
+void tdb_format_instruction(const struct tdb_instruction* instruction, char* buffer, size_t buffer_size)
+{
+    struct tdb_text text = {.buffer = buffer, .size = buffer_size, .length = 0, .operand_count = 0};
+    if (buffer_size == 0) {
+        return;
+    }
+    buffer[0] = '\0';
+
+    if (instruction->kind == TDB_INSTRUCTION_INVALID) {
+        tdb_text_append(&text, "(bad)");
+        return;
+    }
+
+    const struct tdb_opcode* entry = tdb_lookup_opcode(instruction);
+    char mnemonic_buffer[32];
+    const char* mnemonic =
+        entry != NULL ? tdb_instruction_mnemonic(instruction, entry, mnemonic_buffer, sizeof(mnemonic_buffer)) : NULL;
+
+    if (instruction->map == 0 && entry->form == FORM_X87) {
+        tdb_format_x87(&text, instruction);
+        return;
+    }
+
+    // VEX encoded opcodes that only mean something else with the legacy encoding, like
+    // the mask instructions that share cmovcc's
+    const bool vector_prefix = instruction->prefixes & (TDB_PREFIX_VEX | TDB_PREFIX_EVEX);
+    if (mnemonic != NULL && vector_prefix && instruction->map == 1 && entry->form < FORM_X_E &&
+        instruction->opcode != 0x77) {
+        mnemonic = NULL;
+    }
+
+    if (mnemonic == NULL) {
+        static const char* const MAPS[7] = {"", "0f ", "0f 38 ", "0f 3a ", "", "map5 ", "map6 "};
+        tdb_text_append(&text, "(%s%s%02x)",
+                        instruction->prefixes & TDB_PREFIX_EVEX  ? "evex "
+                        : instruction->prefixes & TDB_PREFIX_VEX ? "vex "
+                                                                 : "",
+                        MAPS[instruction->map], instruction->opcode);
+        return;
+    }
+
+    const uint8_t form = entry->form;
+    const bool string = form == FORM_STRING;
+    const bool compares = string && (instruction->opcode == 0xa6 || instruction->opcode == 0xa7 ||
+                                     instruction->opcode == 0xae || instruction->opcode == 0xaf);
+    const bool branch = instruction->kind != TDB_INSTRUCTION_OTHER && instruction->kind != TDB_INSTRUCTION_TRAP &&
+                        instruction->kind != TDB_INSTRUCTION_SYSCALL;
+
+    if (instruction->prefixes & TDB_PREFIX_LOCK) {
+        tdb_text_append(&text, "lock ");
+    }
+    if (string && (instruction->prefixes & TDB_PREFIX_REP)) {
+        tdb_text_append(&text, "%s ", compares ? "repe" : "rep");
+    }
+    if (string && (instruction->prefixes & TDB_PREFIX_REPNE)) {
+        tdb_text_append(&text, "repne ");
+    }
+    if (branch && (instruction->prefixes & TDB_PREFIX_REPNE)) {
+        tdb_text_append(&text, "bnd ");
+    }
+    if (instruction->prefixes & TDB_PREFIX_NOTRACK) {
+        tdb_text_append(&text, "notrack ");
+    }
+
+    const size_t mnemonic_start = text.length;
+    tdb_text_append(&text, "%s", mnemonic);
+
+    uint8_t operand_form = form;
+    if (instruction->map == 0 && instruction->opcode == 0x90) {
+        operand_form = instruction->rex & 0x01 ? FORM_ACC_REG : FORM_NONE;
+    }
+    else if (instruction->map == 0 && (instruction->opcode == 0xc6 || instruction->opcode == 0xc7) &&
+             instruction->modrm == 0xf8) {
+        operand_form = instruction->opcode == 0xc6 ? FORM_IMM : FORM_REL;
+    }
+    else if (entry->group == GROUP_3 && tdb_modrm_reg(instruction) < 2) {
+        operand_form = FORM_E_IMM;
+    }
+    else if (instruction->map == 1 && instruction->opcode == 0x7e && (instruction->prefixes & TDB_PREFIX_REP)) {
+        operand_form = FORM_X_E;
+    }
+    else if (instruction->map == 2 && instruction->opcode == 0xf5 &&
+             !(instruction->prefixes & (TDB_PREFIX_REP | TDB_PREFIX_REPNE))) {
+        operand_form = FORM_G_E_V;  // bzhi
+    }
+
+    if (operand_form == FORM_NONE || string) {
+        return;
+    }
+
+    // pad the mnemonic into a column
+    const size_t mnemonic_length = text.length - mnemonic_start;
+    tdb_text_append(&text, "%*s", mnemonic_length < 7 ? (int)(7 - mnemonic_length) : 1, "");
+    tdb_append_operands(&text, instruction, entry, operand_form);
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A table-driven x86-64 decoder: instruction lengths, operands and where control flow
+// goes next. It decodes from a caller's buffer and never allocates, since stepping has
+// to decode an instruction at every stop.
+
+#define TDB_INSTRUCTION_MAX_LENGTH 15
+
+enum tdb_instruction_kind {
+    TDB_INSTRUCTION_INVALID = 0,  // undefined in 64-bit mode, or cut off
+    TDB_INSTRUCTION_OTHER,
+    TDB_INSTRUCTION_CALL,  // direct, to target
+    TDB_INSTRUCTION_CALL_INDIRECT,
+    TDB_INSTRUCTION_JUMP,  // direct, to target
+    TDB_INSTRUCTION_JUMP_INDIRECT,
+    TDB_INSTRUCTION_BRANCH,  // conditional (jcc, loop, jrcxz), to target
+    TDB_INSTRUCTION_RETURN,
+    TDB_INSTRUCTION_SYSCALL,
+    TDB_INSTRUCTION_TRAP,  // int3, int n, ud2, hlt
+};
+
+#define TDB_PREFIX_LOCK 0x01
+#define TDB_PREFIX_REP 0x02    // f3
+#define TDB_PREFIX_REPNE 0x04  // f2
+#define TDB_PREFIX_OPERAND_SIZE 0x08
+#define TDB_PREFIX_ADDRESS_SIZE 0x10
+#define TDB_PREFIX_VEX 0x20
+#define TDB_PREFIX_EVEX 0x40
+#define TDB_PREFIX_NOTRACK 0x80  // 3e on an indirect branch
+
+struct tdb_instruction {
+    uint64_t address;
+    uint64_t target;  // of direct branches, or the address of a rip-relative operand
+    int64_t immediate;
+    int32_t displacement;
+
+    uint8_t length;
+    uint8_t kind;  // enum tdb_instruction_kind
+    uint8_t map;   // 0 for one-byte opcodes, 1 for 0f, 2 for 0f 38, 3 for 0f 3a
+    uint8_t opcode;
+    uint8_t modrm;
+    uint8_t sib;
+    uint8_t rex;  // 0 if none, VEX and EVEX register extensions are folded in
+    uint8_t prefixes;  // TDB_PREFIX_* flags, VEX and EVEX pp fields included
+    uint8_t segment;   // 0x64 (fs), 0x65 (gs) or 0
+    uint8_t operand_size;  // in bytes
+    uint8_t immediate_size;
+    uint8_t vector_register;  // VEX/EVEX vvvv, the extra source operand
+    uint8_t vector_length;    // 0 (xmm), 1 (ymm) or 2 (zmm)
+
+    bool has_modrm;
+    bool has_sib;
+    bool rip_relative;
+};
+
+// Decodes the instruction at the start of code, which holds the available bytes at
+// address. Returns false if they aren't a valid instruction, which is then one byte
+// long with kind TDB_INSTRUCTION_INVALID.
+bool tdb_decode_instruction(const uint8_t* code, size_t available, uint64_t address,
+                            struct tdb_instruction* instruction);
+
+// Formats an instruction in Intel syntax, like "mov rbp, rsp" or "call 0x401126".
+void tdb_format_instruction(const struct tdb_instruction* instruction, char* buffer, size_t buffer_size);
+
@@ -0,0 +1,116 @@
+#include "instruction_cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tdb/utility.h"
+
+void tdb_instruction_cache_init(struct tdb_instruction_cache* cache)
+{
+    memset(cache, 0, sizeof(*cache));
+}
+
+void tdb_instruction_cache_free(struct tdb_instruction_cache* cache)
+{
+    for (size_t i = 0; i < TDB_INSTRUCTION_CACHE_PAGES; i++) {
+        if (cache->pages[i] != NULL) {
+            free(cache->pages[i]->instructions);
+            free(cache->pages[i]);
+        }
+    }
+
+    tdb_instruction_cache_init(cache);
+}
+
+void tdb_instruction_cache_clear(struct tdb_instruction_cache* cache)
+{
+    for (size_t i = 0; i < TDB_INSTRUCTION_CACHE_PAGES; i++) {
+        if (cache->pages[i] != NULL) {
+            cache->pages[i]->address = 0;
+        }
+    }
+}
+
+// Reads a page into its slot, taking out the int3s of enabled breakpoints.
+static bool tdb_instruction_cache_fill(struct tdb_instruction_page* page, pid_t pid,
+                                       struct tdb_breakpoint_table* breakpoints, uint64_t address)
+{
+    page->readable = tdb_read_memory_range(pid, address, page->data, sizeof(page->data));
+    if (page->readable == 0) {
+        page->address = 0;
+        return false;
+    }
+
+    size_t cursor = 0;
+    struct tdb_breakpoint* bp;
+    while ((bp = tdb_breakpoint_table_next(breakpoints, &cursor)) != NULL) {
+        if (bp->enabled && bp->pid == pid && bp->address >= address && bp->address - address < page->readable) {
+            page->data[bp->address - address] = bp->saved_data;
+        }
+    }
+
+    memset(page->slots, 0, sizeof(page->slots));
+    page->instruction_count = 0;
+    page->address = address;
+    return true;
+}
+
+static struct tdb_instruction* tdb_instruction_cache_add(struct tdb_instruction_page* page, size_t offset)
+{
+    if (page->instruction_count == page->instruction_capacity) {
+        size_t new_capacity = page->instruction_capacity == 0 ? 256 : 2 * page->instruction_capacity;
+        struct tdb_instruction* instructions =
+            realloc(page->instructions, new_capacity * sizeof(struct tdb_instruction));
+        if (instructions == NULL) {
+            fprintf(stderr, "Failed to allocate decoded instructions\n");
+            return NULL;
+        }
+        page->instructions = instructions;
+        page->instruction_capacity = new_capacity;
+    }
+
+    page->slots[offset] = (uint16_t)(++page->instruction_count);
+    return &page->instructions[page->instruction_count - 1];
+}
+
+const struct tdb_instruction* tdb_instruction_cache_decode(struct tdb_instruction_cache* cache, pid_t pid,
+                                                           struct tdb_breakpoint_table* breakpoints, uint64_t address,
+                                                           const uint8_t** bytes)
+{
+    const uint64_t page_address = address & ~(uint64_t)(TDB_INSTRUCTION_PAGE_SIZE - 1);
+    const size_t offset = address - page_address;
+    const size_t index = (page_address / TDB_INSTRUCTION_PAGE_SIZE) % TDB_INSTRUCTION_CACHE_PAGES;
+
+    struct tdb_instruction_page* page = cache->pages[index];
+    if (page == NULL) {
+        page = cache->pages[index] = calloc(1, sizeof(struct tdb_instruction_page));
+        if (page == NULL) {
+            fprintf(stderr, "Failed to allocate instruction cache page\n");
+            return NULL;
+        }
+    }
+
+    if (page->address != page_address && !tdb_instruction_cache_fill(page, pid, breakpoints, page_address)) {
+        return NULL;
+    }
+    if (offset >= page->readable) {
+        return NULL;
+    }
+
+    if (bytes != NULL) {
+        *bytes = page->data + offset;
+    }
+
+    if (page->slots[offset] != 0) {
+        cache->hits++;
+        return &page->instructions[page->slots[offset] - 1];
+    }
+
+    cache->misses++;
+    struct tdb_instruction* instruction = tdb_instruction_cache_add(page, offset);
+    if (instruction != NULL) {
+        tdb_decode_instruction(page->data + offset, page->readable - offset, address, instruction);
+    }
+    return instruction;
+}
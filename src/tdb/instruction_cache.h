@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "tdb/breakpoint_table.h"
+#include "tdb/instruction.h"
+
+// Decoded instructions, cached per page of text. Text doesn't change apart from the
+// int3s tdb plants, so a page is read once, with the bytes the breakpoints saved put
+// back, and every instruction decoded from it is kept by its offset in the page. The
+// cache has to be cleared when code may have been replaced: on exec, when the dynamic
+// loader maps or unmaps objects, and when the user writes to memory.
+
+#define TDB_INSTRUCTION_CACHE_PAGES 64  // direct-mapped by page number
+#define TDB_INSTRUCTION_PAGE_SIZE 4096
+
+struct tdb_instruction_page {
+    uint64_t address;  // 0 if the page isn't cached
+
+    // the page and the start of the next one, for instructions that run into it
+    uint8_t data[TDB_INSTRUCTION_PAGE_SIZE + TDB_INSTRUCTION_MAX_LENGTH - 1];
+    size_t readable;  // bytes of data that could be read
+
+    uint16_t slots[TDB_INSTRUCTION_PAGE_SIZE];  // 1 + the index into instructions of the one at each offset, or 0
+    struct tdb_instruction* instructions;
+    size_t instruction_count;
+    size_t instruction_capacity;
+};
+
+struct tdb_instruction_cache {
+    struct tdb_instruction_page* pages[TDB_INSTRUCTION_CACHE_PAGES];  // allocated on first use
+    uint64_t hits;
+    uint64_t misses;
+};
+
+void tdb_instruction_cache_init(struct tdb_instruction_cache* cache);
+void tdb_instruction_cache_free(struct tdb_instruction_cache* cache);
+void tdb_instruction_cache_clear(struct tdb_instruction_cache* cache);
+
+// Decodes the instruction at address as the program has it, without breakpoints. If
+// bytes isn't NULL it is pointed at the instruction's bytes. Returns NULL if address
+// can't be read. The pointers stay valid until the next call.
+const struct tdb_instruction* tdb_instruction_cache_decode(struct tdb_instruction_cache* cache, pid_t pid,
+                                                           struct tdb_breakpoint_table* breakpoints, uint64_t address,
+                                                           const uint8_t** bytes);
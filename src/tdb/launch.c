@@ -0,0 +1,188 @@
+#include "launch.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <linux/audit.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "tdb/stats.h"
+
+// Builds a filter that returns SECCOMP_RET_TRACE for the system calls in the set and
+// lets everything else through without a stop. Each number gets its own compare and
+// return so that no jump has to span more than one instruction, whatever the set size.
+static struct sock_filter* tdb_build_seccomp_filter(const struct tdb_syscall_set* syscalls, size_t* length)
+{
+    struct sock_filter* filter = malloc((5 + 2 * TDB_SYSCALL_MAX) * sizeof(*filter));
+    if (filter == NULL) {
+        return NULL;
+    }
+
+    size_t count = 0;
+    filter[count++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, arch));
+    filter[count++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, AUDIT_ARCH_X86_64, 1, 0);
+    filter[count++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW);
+    filter[count++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, nr));
+
+    for (long number = 0; number < TDB_SYSCALL_MAX; number++) {
+        if (tdb_syscall_set_contains(syscalls, number)) {
+            filter[count++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, (uint32_t)number, 0, 1);
+            filter[count++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_TRACE);
+        }
+    }
+
+    filter[count++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW);
+
+    *length = count;
+    return filter;
+}
+
+pid_t tdb_launch(const char* target_path, const struct tdb_syscall_set* traced_syscalls)
+{
+    // built before the fork, so the child doesn't allocate
+    struct sock_fprog seccomp_program = {0};
+    if (traced_syscalls != NULL) {
+        size_t length;
+        seccomp_program.filter = tdb_build_seccomp_filter(traced_syscalls, &length);
+        if (seccomp_program.filter == NULL) {
+            fprintf(stderr, "Failed to allocate seccomp filter\n");
+            return -1;
+        }
+        seccomp_program.len = (unsigned short)length;
+    }
+
+    int release_pipe[2];
+    if (pipe(release_pipe) == -1) {
+        fprintf(stderr, "Failed to create pipe to launch debugee: %s\n", strerror(errno));
+        free(seccomp_program.filter);
+        return -1;
+    }
+
+    pid_t pid = fork();
+
+    if (pid == 0) {  // in child process, wait to be seized then execute program to be debugged
+        close(release_pipe[1]);
+
+        char go;
+        if (read(release_pipe[0], &go, 1) != 1) {
+            _exit(EXIT_FAILURE);
+        }
+        close(release_pipe[0]);
+
+        // The filter is installed last, so it is in force from the exec on. Without
+        // CAP_SYS_ADMIN it requires no_new_privs, which makes set-user-ID bits ineffective.
+        if (seccomp_program.filter != NULL) {
+            if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) == -1 ||
+                prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &seccomp_program) == -1) {
+                fprintf(stderr, "Failed to install seccomp filter: %s\n", strerror(errno));
+                _exit(127);
+            }
+        }
+
+        // TODO: use execve?
+        execl(target_path, target_path, NULL);
+
+        fprintf(stderr, "Failed to execute %s: %s\n", target_path, strerror(errno));
+        _exit(127);
+    }
+
+    close(release_pipe[0]);
+    free(seccomp_program.filter);
+
+    if (pid == -1) {
+        fprintf(stderr, "Failed to fork process to begin debugging: %s\n", strerror(errno));
+        close(release_pipe[1]);
+        return -1;
+    }
+
+    if (tdb_ptrace(PTRACE_SEIZE, pid, NULL, (void*)TDB_PTRACE_OPTIONS) == -1) {
+        fprintf(stderr, "Failed to initiate ptrace on debugee: %s\n", strerror(errno));
+        kill(pid, SIGKILL);
+        tdb_waitpid(pid, NULL, 0);
+        close(release_pipe[1]);
+        return -1;
+    }
+
+    const char go = 1;
+    ssize_t written = write(release_pipe[1], &go, 1);
+    close(release_pipe[1]);
+
+    if (written != 1) {
+        fprintf(stderr, "Failed to release debugee: %s\n", strerror(errno));
+        kill(pid, SIGKILL);
+        return -1;
+    }
+
+    return pid;
+}
+
+bool tdb_attach(pid_t pid, struct tdb_thread_table* threads)
+{
+    if (tdb_ptrace(PTRACE_SEIZE, pid, NULL, (void*)TDB_ATTACH_PTRACE_OPTIONS) == -1) {
+        fprintf(stderr, "Failed to attach to process %d: %s\n", pid, strerror(errno));
+        return false;
+    }
+
+    char task_path[64];
+    snprintf(task_path, sizeof(task_path), "/proc/%d/task", pid);
+
+    // Threads created by seized threads are traced from their start, but one that isn't
+    // seized yet can still create threads we haven't seen, so the list is read again
+    // until nothing new turns up.
+    bool found_new = true;
+    while (found_new) {
+        found_new = false;
+
+        const uint64_t start = tdb_stats_start();
+        DIR* tasks = opendir(task_path);
+        if (tasks == NULL) {
+            fprintf(stderr, "Failed to list threads of process %d: %s\n", pid, strerror(errno));
+            return false;
+        }
+
+        struct dirent* entry;
+        while ((entry = readdir(tasks)) != NULL) {
+            if (entry->d_name[0] == '.') {
+                continue;
+            }
+
+            const pid_t tid = (pid_t)strtol(entry->d_name, NULL, 10);
+            if (tdb_thread_table_find(threads, tid) != NULL) {
+                continue;
+            }
+
+            struct tdb_thread* thread = NULL;
+            if (tdb_ptrace(PTRACE_SEIZE, tid, NULL, (void*)TDB_ATTACH_PTRACE_OPTIONS) == 0) {
+                thread = tdb_thread_table_add(threads, tid, TDB_THREAD_RUNNING);
+            }
+            else if (errno == EPERM) {
+                // created by a seized thread, so already ours, its initial stop is on the way
+                thread = tdb_thread_table_add(threads, tid, TDB_THREAD_NEW);
+            }
+            else {  // ESRCH, it exited in the meantime
+                continue;
+            }
+
+            if (thread == NULL) {  // a thread that isn't tracked couldn't be stopped
+                fprintf(stderr, "Failed to attach to thread %d of process %d\n", tid, pid);
+                closedir(tasks);
+                return false;
+            }
+
+            found_new = true;
+        }
+
+        closedir(tasks);
+        tdb_stats_record(TDB_STAT_PROC_OTHER, start);
+    }
+
+    return true;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <sys/ptrace.h>
+#include <sys/types.h>
+
+#include "tdb/syscalls.h"
+#include "tdb/thread.h"
+
+#define TDB_PTRACE_OPTIONS                                                                       \
+    (PTRACE_O_TRACECLONE | PTRACE_O_TRACEEXEC | PTRACE_O_EXITKILL | PTRACE_O_TRACESECCOMP | \
+     PTRACE_O_TRACESYSGOOD)
+
+// a process we attached to must outlive tdb
+#define TDB_ATTACH_PTRACE_OPTIONS (TDB_PTRACE_OPTIONS & ~PTRACE_O_EXITKILL)
+
+// Fork and exec the target under PTRACE_SEIZE (rather than PTRACE_TRACEME, so that
+// PTRACE_INTERRUPT works on it and on every thread it creates). The child waits on a
+// pipe until it has been seized, so the first stop reported is its exec event.
+// If traced_syscalls isn't NULL, the child installs a seccomp filter before the exec
+// that makes exactly those system calls stop with PTRACE_EVENT_SECCOMP.
+// Returns -1 on failure.
+pid_t tdb_launch(const char* target_path, const struct tdb_syscall_set* traced_syscalls);
+
+// Seize every thread of a running process, which unlike PTRACE_ATTACH leaves them
+// running, and add them to the table (which already holds the thread group leader).
+// Returns false if the process can't be traced.
+bool tdb_attach(pid_t pid, struct tdb_thread_table* threads);
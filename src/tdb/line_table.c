@@ -0,0 +1,1060 @@
+#include "line_table.h"
+
+#include <dwarf.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "stats.h"
+#include "symbols.h"
+
+// an ordering key is kept next to each row while sorting, so rows sharing an address
+// stay in line program order and the last of them wins
+struct tdb_ordered_line_entry {
+    struct tdb_line_entry entry;
+    size_t order;
+};
+
+static void tdb_dwarf_error_free(Dwarf_Debug dbg, Dwarf_Error* error)
+{
+    if (*error != NULL) {
+        dwarf_dealloc(dbg, *error, DW_DLA_ERROR);
+        *error = NULL;
+    }
+}
+
+// Appends a string to the table's string blob, returning its offset.
+static uint32_t tdb_line_table_add_string(struct tdb_line_table* table, const char* string)
+{
+    const size_t length = strlen(string) + 1;
+
+    if (table->strings_size + length > table->strings_capacity) {
+        size_t new_capacity = table->strings_capacity == 0 ? 64 * 1024 : 2 * table->strings_capacity;
+        while (table->strings_size + length > new_capacity) {
+            new_capacity *= 2;
+        }
+
+        char* strings = realloc(table->strings, new_capacity);
+        if (strings == NULL) {
+            return TDB_LINE_NO_NAME;
+        }
+
+        table->strings = strings;
+        table->strings_capacity = new_capacity;
+    }
+
+    const uint32_t offset = (uint32_t)table->strings_size;
+    memcpy(table->strings + table->strings_size, string, length);
+    table->strings_size += length;
+
+    return offset;
+}
+
+static bool tdb_line_table_grow_file_buckets(struct tdb_line_table* table)
+{
+    const size_t bucket_count = table->file_bucket_count == 0 ? 64 : 2 * table->file_bucket_count;
+
+    uint32_t* buckets = malloc(bucket_count * sizeof(uint32_t));
+    if (buckets == NULL) {
+        return false;
+    }
+
+    for (size_t i = 0; i < bucket_count; i++) {
+        buckets[i] = TDB_LINE_NO_FILE;
+    }
+
+    for (size_t i = 0; i < table->file_count; i++) {
+        size_t bucket = tdb_symbol_name_hash(tdb_line_table_file(table, (uint32_t)i)) & (bucket_count - 1);
+        while (buckets[bucket] != TDB_LINE_NO_FILE) {
+            bucket = (bucket + 1) & (bucket_count - 1);
+        }
+        buckets[bucket] = (uint32_t)i;
+    }
+
+    free(table->file_buckets);
+    table->file_buckets = buckets;
+    table->file_bucket_count = bucket_count;
+
+    return true;
+}
+
+// Returns the index of the path in the file list, adding it if it's new.
+static uint32_t tdb_line_table_intern_file(struct tdb_line_table* table, const char* path)
+{
+    if (2 * (table->file_count + 1) > table->file_bucket_count && !tdb_line_table_grow_file_buckets(table)) {
+        return TDB_LINE_NO_FILE;
+    }
+
+    const size_t mask = table->file_bucket_count - 1;
+    size_t bucket = tdb_symbol_name_hash(path) & mask;
+
+    while (table->file_buckets[bucket] != TDB_LINE_NO_FILE) {
+        if (!strcmp(tdb_line_table_file(table, table->file_buckets[bucket]), path)) {
+            return table->file_buckets[bucket];
+        }
+        bucket = (bucket + 1) & mask;
+    }
+
+    if (table->file_count == table->file_capacity) {
+        size_t new_capacity = table->file_capacity == 0 ? 64 : 2 * table->file_capacity;
+
+        uint32_t* files = realloc(table->files, new_capacity * sizeof(uint32_t));
+        if (files == NULL) {
+            return TDB_LINE_NO_FILE;
+        }
+        table->files = files;
+        table->file_capacity = new_capacity;
+    }
+
+    const uint32_t offset = tdb_line_table_add_string(table, path);
+    if (offset == TDB_LINE_NO_NAME) {
+        return TDB_LINE_NO_FILE;
+    }
+
+    const uint32_t index = (uint32_t)table->file_count;
+    table->files[table->file_count++] = offset;
+    table->file_buckets[bucket] = index;
+
+    return index;
+}
+
+static bool tdb_line_table_add_range(struct tdb_line_table* table, uint64_t low, uint64_t high, size_t unit_index)
+{
+    if (table->range_count == table->range_capacity) {
+        size_t new_capacity = table->range_capacity == 0 ? 256 : 2 * table->range_capacity;
+
+        struct tdb_unit_range* ranges = realloc(table->ranges, new_capacity * sizeof(struct tdb_unit_range));
+        if (ranges == NULL) {
+            return false;
+        }
+        table->ranges = ranges;
+        table->range_capacity = new_capacity;
+    }
+
+    struct tdb_unit_range* range = &table->ranges[table->range_count++];
+    range->low = low;
+    range->high = high;
+    range->unit_index = (uint32_t)unit_index;
+
+    table->units[unit_index].has_range = true;
+
+    return true;
+}
+
+static int tdb_compare_ranges(const void* lhs_ptr, const void* rhs_ptr)
+{
+    const struct tdb_unit_range* lhs = lhs_ptr;
+    const struct tdb_unit_range* rhs = rhs_ptr;
+
+    if (lhs->low != rhs->low) {
+        return lhs->low < rhs->low ? -1 : 1;
+    }
+
+    return 0;
+}
+
+static void tdb_line_table_sort_ranges(struct tdb_line_table* table)
+{
+    qsort(table->ranges, table->range_count, sizeof(struct tdb_unit_range), tdb_compare_ranges);
+
+    uint64_t max_high = 0;
+    for (size_t i = 0; i < table->range_count; i++) {
+        if (table->ranges[i].high > max_high) {
+            max_high = table->ranges[i].high;
+        }
+        table->ranges[i].max_high = max_high;
+    }
+}
+
+// DWARF 2-4 units list their ranges in .debug_ranges, relative to the unit's low_pc
+// unless a base address selection entry says otherwise
+static bool tdb_line_table_read_debug_ranges(struct tdb_line_table* table, Dwarf_Die die, Dwarf_Off offset,
+                                             uint64_t base, size_t unit_index)
+{
+    Dwarf_Error error = NULL;
+    Dwarf_Off real_offset;
+    Dwarf_Ranges* ranges = NULL;
+    Dwarf_Signed range_count;
+    Dwarf_Unsigned byte_count;
+
+    if (dwarf_get_ranges_b(table->dbg, offset, die, &real_offset, &ranges, &range_count, &byte_count, &error) !=
+        DW_DLV_OK) {
+        tdb_dwarf_error_free(table->dbg, &error);
+        return true;
+    }
+
+    bool success = true;
+    for (Dwarf_Signed i = 0; success && i < range_count && ranges[i].dwr_type != DW_RANGES_END; i++) {
+        if (ranges[i].dwr_type == DW_RANGES_ADDRESS_SELECTION) {
+            base = ranges[i].dwr_addr2;
+        }
+        else if (ranges[i].dwr_addr2 > ranges[i].dwr_addr1 && base + ranges[i].dwr_addr1 != 0) {
+            success = tdb_line_table_add_range(table, base + ranges[i].dwr_addr1, base + ranges[i].dwr_addr2,
+                                               unit_index);
+        }
+    }
+
+    dwarf_ranges_dealloc(table->dbg, ranges, range_count);
+
+    return success;
+}
+
+// DWARF 5 units list theirs in .debug_rnglists, which libdwarf hands back already
+// resolved to absolute addresses
+static bool tdb_line_table_read_rnglists(struct tdb_line_table* table, Dwarf_Attribute attribute, Dwarf_Half form,
+                                         Dwarf_Unsigned value, size_t unit_index)
+{
+    Dwarf_Error error = NULL;
+    Dwarf_Rnglists_Head head = NULL;
+    Dwarf_Unsigned entry_count, global_offset;
+
+    if (dwarf_rnglists_get_rle_head(attribute, form, value, &head, &entry_count, &global_offset, &error) !=
+        DW_DLV_OK) {
+        tdb_dwarf_error_free(table->dbg, &error);
+        return true;
+    }
+
+    bool success = true;
+    for (Dwarf_Unsigned i = 0; success && i < entry_count; i++) {
+        unsigned entry_length, code;
+        Dwarf_Unsigned raw_low, raw_high, low, high;
+        if (dwarf_get_rnglists_entry_fields(head, i, &entry_length, &code, &raw_low, &raw_high, &low, &high,
+                                            &error) != DW_DLV_OK) {
+            tdb_dwarf_error_free(table->dbg, &error);
+            break;
+        }
+
+        switch (code) {
+        case DW_RLE_offset_pair:
+        case DW_RLE_start_end:
+        case DW_RLE_startx_endx:
+        case DW_RLE_start_length:
+        case DW_RLE_startx_length:
+            if (low != 0 && high > low) {
+                success = tdb_line_table_add_range(table, low, high, unit_index);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    dwarf_dealloc_rnglists_head(head);
+
+    return success;
+}
+
+// a non-contiguous unit has DW_AT_ranges instead of high_pc
+static bool tdb_line_table_read_unit_ranges(struct tdb_line_table* table, Dwarf_Die die, Dwarf_Half version,
+                                            uint64_t base, size_t unit_index)
+{
+    Dwarf_Error error = NULL;
+    Dwarf_Attribute attribute = NULL;
+    if (dwarf_attr(die, DW_AT_ranges, &attribute, &error) != DW_DLV_OK) {
+        tdb_dwarf_error_free(table->dbg, &error);
+        return true;
+    }
+
+    bool success = true;
+    Dwarf_Half form;
+    Dwarf_Unsigned value;
+    if (dwarf_whatform(attribute, &form, &error) == DW_DLV_OK) {
+        int result;
+        if (form == DW_FORM_rnglistx || form == DW_FORM_data4 || form == DW_FORM_data8) {
+            result = dwarf_formudata(attribute, &value, &error);
+        }
+        else {
+            Dwarf_Off offset;
+            result = dwarf_global_formref(attribute, &offset, &error);
+            value = offset;
+        }
+
+        if (result == DW_DLV_OK) {
+            success = version >= 5 ? tdb_line_table_read_rnglists(table, attribute, form, value, unit_index)
+                                   : tdb_line_table_read_debug_ranges(table, die, value, base, unit_index);
+        }
+    }
+    tdb_dwarf_error_free(table->dbg, &error);
+
+    dwarf_dealloc(table->dbg, attribute, DW_DLA_ATTR);
+
+    return success;
+}
+
+static bool tdb_line_table_read_units(struct tdb_line_table* table)
+{
+    Dwarf_Error error = NULL;
+    size_t unit_capacity = 0;
+
+    for (;;) {
+        Dwarf_Unsigned header_length, type_offset, next_header_offset;
+        Dwarf_Half version, address_size, length_size, extension_size, header_type;
+        Dwarf_Off abbrev_offset;
+        Dwarf_Sig8 signature;
+
+        int result = dwarf_next_cu_header_d(table->dbg, true, &header_length, &version, &abbrev_offset,
+                                            &address_size, &length_size, &extension_size, &signature,
+                                            &type_offset, &next_header_offset, &header_type, &error);
+        if (result == DW_DLV_NO_ENTRY) {
+            break;
+        }
+        if (result == DW_DLV_ERROR) {
+            fprintf(stderr, "Failed to read compile unit header: %s\n", dwarf_errmsg(error));
+            tdb_dwarf_error_free(table->dbg, &error);
+            return false;
+        }
+
+        Dwarf_Die die = NULL;
+        if (dwarf_siblingof_b(table->dbg, NULL, true, &die, &error) != DW_DLV_OK) {
+            tdb_dwarf_error_free(table->dbg, &error);
+            continue;
+        }
+
+        Dwarf_Off die_offset;
+        if (dwarf_dieoffset(die, &die_offset, &error) != DW_DLV_OK) {
+            tdb_dwarf_error_free(table->dbg, &error);
+            dwarf_dealloc(table->dbg, die, DW_DLA_DIE);
+            continue;
+        }
+
+        if (table->unit_count == unit_capacity) {
+            size_t new_capacity = unit_capacity == 0 ? 256 : 2 * unit_capacity;
+
+            struct tdb_compile_unit* units = realloc(table->units, new_capacity * sizeof(struct tdb_compile_unit));
+            if (units == NULL) {
+                fprintf(stderr, "Out of memory while reading compile units\n");
+                dwarf_dealloc(table->dbg, die, DW_DLA_DIE);
+                return false;
+            }
+            table->units = units;
+            unit_capacity = new_capacity;
+        }
+
+        const size_t unit_index = table->unit_count++;
+        struct tdb_compile_unit* unit = &table->units[unit_index];
+        memset(unit, 0, sizeof(*unit));
+        unit->die_offset = die_offset;
+        unit->name_offset = TDB_LINE_NO_NAME;
+
+        char* name = NULL;
+        if (dwarf_diename(die, &name, &error) == DW_DLV_OK) {
+            unit->name_offset = tdb_line_table_add_string(table, name);
+            dwarf_dealloc(table->dbg, name, DW_DLA_STRING);
+        }
+        tdb_dwarf_error_free(table->dbg, &error);
+
+        // a contiguous unit has low_pc/high_pc and others DW_AT_ranges; anything still left
+        // is covered by .debug_aranges or, failing that, by its line program once decoded
+        Dwarf_Addr low_pc = 0, high_pc;
+        Dwarf_Half high_pc_form;
+        enum Dwarf_Form_Class high_pc_class;
+        if (dwarf_lowpc(die, &low_pc, &error) != DW_DLV_OK) {
+            low_pc = 0;
+        }
+        tdb_dwarf_error_free(table->dbg, &error);
+
+        bool success = true;
+        if (dwarf_highpc_b(die, &high_pc, &high_pc_form, &high_pc_class, &error) == DW_DLV_OK) {
+            if (high_pc_class == DW_FORM_CLASS_CONSTANT) {
+                high_pc += low_pc;
+            }
+
+            if (low_pc != 0 && high_pc > low_pc) {
+                success = tdb_line_table_add_range(table, low_pc, high_pc, unit_index);
+            }
+        }
+        else {
+            success = tdb_line_table_read_unit_ranges(table, die, version, low_pc, unit_index);
+        }
+        tdb_dwarf_error_free(table->dbg, &error);
+
+        dwarf_dealloc(table->dbg, die, DW_DLA_DIE);
+
+        if (!success) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static size_t tdb_line_table_find_unit(const struct tdb_line_table* table, uint64_t die_offset)
+{
+    size_t low = 0;
+    size_t high = table->unit_count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (table->units[middle].die_offset < die_offset) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+
+    if (low == table->unit_count || table->units[low].die_offset != die_offset) {
+        return SIZE_MAX;
+    }
+
+    return low;
+}
+
+static bool tdb_line_table_read_aranges(struct tdb_line_table* table)
+{
+    Dwarf_Error error = NULL;
+    Dwarf_Arange* aranges = NULL;
+    Dwarf_Signed arange_count = 0;
+
+    if (dwarf_get_aranges(table->dbg, &aranges, &arange_count, &error) != DW_DLV_OK) {
+        tdb_dwarf_error_free(table->dbg, &error);
+        return true;
+    }
+
+    bool success = true;
+    for (Dwarf_Signed i = 0; i < arange_count; i++) {
+        Dwarf_Unsigned segment, segment_entry_size, length;
+        Dwarf_Addr start;
+        Dwarf_Off die_offset;
+
+        if (success && dwarf_get_arange_info_b(aranges[i], &segment, &segment_entry_size, &start, &length,
+                                               &die_offset, &error) == DW_DLV_OK) {
+            const size_t unit_index = tdb_line_table_find_unit(table, die_offset);
+            if (unit_index != SIZE_MAX && start != 0 && length != 0) {
+                success = tdb_line_table_add_range(table, start, start + length, unit_index);
+            }
+        }
+        tdb_dwarf_error_free(table->dbg, &error);
+
+        dwarf_dealloc(table->dbg, aranges[i], DW_DLA_ARANGE);
+    }
+    dwarf_dealloc(table->dbg, aranges, DW_DLA_LIST);
+
+    return success;
+}
+
+void tdb_line_table_init(struct tdb_line_table* table)
+{
+    memset(table, 0, sizeof(*table));
+    table->fd = -1;
+}
+
+static bool tdb_line_table_open_dwarf(struct tdb_line_table* table, const char* elf_path)
+{
+    int fd = open(elf_path, O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "Failed to open %s to load line tables\n", elf_path);
+        return false;
+    }
+
+    Dwarf_Error error = NULL;
+    int result = dwarf_init(fd, DW_DLC_READ, NULL, NULL, &table->dbg, &error);
+    if (result != DW_DLV_OK) {
+        if (result == DW_DLV_ERROR) {
+            fprintf(stderr, "Failed to read DWARF from %s: %s\n", elf_path, dwarf_errmsg(error));
+        }
+        close(fd);
+        table->dbg = NULL;
+        return false;
+    }
+
+    table->fd = fd;
+
+    return true;
+}
+
+static bool tdb_line_table_read(struct tdb_line_table* table, const char* elf_path)
+{
+    tdb_line_table_init(table);
+
+    if (!tdb_line_table_open_dwarf(table, elf_path)) {
+        return false;
+    }
+
+    table->owns_memory = true;
+
+    if (!tdb_line_table_read_units(table) || !tdb_line_table_read_aranges(table)) {
+        tdb_line_table_free(table);
+        return false;
+    }
+
+    tdb_line_table_sort_ranges(table);
+
+    return true;
+}
+
+bool tdb_line_table_load(struct tdb_line_table* table, const char* elf_path)
+{
+    const uint64_t start = tdb_stats_start();
+    const bool success = tdb_line_table_read(table, elf_path);
+    tdb_stats_record(TDB_STAT_LINE_TABLE_LOAD, start);
+    return success;
+}
+
+static void* tdb_copy_array(const void* data, size_t size)
+{
+    void* copy = malloc(size > 0 ? size : 1);
+    if (copy != NULL && size > 0) {
+        memcpy(copy, data, size);
+    }
+    return copy;
+}
+
+bool tdb_line_table_resume(struct tdb_line_table* table, const char* elf_path)
+{
+    if (table->owns_memory || tdb_line_table_decoded_count(table) == table->unit_count) {
+        return true;
+    }
+
+    struct tdb_line_table copy = *table;
+    copy.units = tdb_copy_array(table->units, table->unit_count * sizeof(struct tdb_compile_unit));
+    copy.ranges = tdb_copy_array(table->ranges, table->range_count * sizeof(struct tdb_unit_range));
+    copy.lines = tdb_copy_array(table->lines, table->line_count * sizeof(struct tdb_line_entry));
+    copy.lines_by_location = tdb_copy_array(table->lines_by_location, table->line_count * sizeof(uint32_t));
+    copy.strings = tdb_copy_array(table->strings, table->strings_size);
+    copy.files = tdb_copy_array(table->files, table->file_count * sizeof(uint32_t));
+    copy.file_buckets = tdb_copy_array(table->file_buckets, table->file_bucket_count * sizeof(uint32_t));
+    copy.owns_memory = true;
+
+    if (copy.units == NULL || copy.ranges == NULL || copy.lines == NULL || copy.lines_by_location == NULL ||
+        copy.strings == NULL || copy.files == NULL || copy.file_buckets == NULL) {
+        fprintf(stderr, "Out of memory while loading line tables\n");
+        tdb_line_table_free(&copy);
+        return false;
+    }
+
+    if (!tdb_line_table_open_dwarf(&copy, elf_path)) {
+        tdb_line_table_free(&copy);
+        return false;
+    }
+
+    *table = copy;
+
+    return true;
+}
+
+void tdb_line_table_free(struct tdb_line_table* table)
+{
+    if (table->owns_memory) {
+        free(table->units);
+        free(table->ranges);
+        free(table->lines);
+        free(table->lines_by_location);
+        free(table->strings);
+        free(table->files);
+        free(table->file_buckets);
+    }
+
+    if (table->dbg != NULL) {
+        Dwarf_Error error = NULL;
+        dwarf_finish(table->dbg, &error);
+    }
+    if (table->fd != -1) {
+        close(table->fd);
+    }
+
+    tdb_line_table_init(table);
+}
+
+const char* tdb_line_table_file(const struct tdb_line_table* table, uint32_t file_index)
+{
+    return table->strings + table->files[file_index];
+}
+
+const char* tdb_line_table_unit_name(const struct tdb_line_table* table, const struct tdb_compile_unit* unit)
+{
+    return unit->name_offset != TDB_LINE_NO_NAME ? table->strings + unit->name_offset : NULL;
+}
+
+static int tdb_compare_ordered_lines(const void* lhs_ptr, const void* rhs_ptr)
+{
+    const struct tdb_ordered_line_entry* lhs = lhs_ptr;
+    const struct tdb_ordered_line_entry* rhs = rhs_ptr;
+
+    if (lhs->entry.address != rhs->entry.address) {
+        return lhs->entry.address < rhs->entry.address ? -1 : 1;
+    }
+
+    // a sequence ending where the next one starts must not hide the start row
+    if (lhs->entry.is_end_sequence != rhs->entry.is_end_sequence) {
+        return lhs->entry.is_end_sequence ? -1 : 1;
+    }
+
+    return lhs->order < rhs->order ? -1 : 1;
+}
+
+static const struct tdb_line_entry* g_tdb_sorting_lines;
+
+static int tdb_compare_line_locations(const void* lhs_ptr, const void* rhs_ptr)
+{
+    const struct tdb_line_entry* lhs = &g_tdb_sorting_lines[*(const uint32_t*)lhs_ptr];
+    const struct tdb_line_entry* rhs = &g_tdb_sorting_lines[*(const uint32_t*)rhs_ptr];
+
+    if (lhs->file_index != rhs->file_index) {
+        return lhs->file_index < rhs->file_index ? -1 : 1;
+    }
+    if (lhs->line != rhs->line) {
+        return lhs->line < rhs->line ? -1 : 1;
+    }
+    if (lhs->address != rhs->address) {
+        return lhs->address < rhs->address ? -1 : 1;
+    }
+
+    return 0;
+}
+
+// Looks up (and interns on first use) the file of a line table row. File numbers are
+// small indices into the unit's file list, so they are mapped through file_map rather
+// than asking libdwarf to build the path string for every row.
+static uint32_t tdb_line_table_row_file(struct tdb_line_table* table, Dwarf_Line row, uint32_t** file_map,
+                                        size_t* file_map_size)
+{
+    Dwarf_Error error = NULL;
+    Dwarf_Unsigned file_number;
+
+    if (dwarf_line_srcfileno(row, &file_number, &error) != DW_DLV_OK) {
+        tdb_dwarf_error_free(table->dbg, &error);
+        return TDB_LINE_NO_FILE;
+    }
+
+    if (file_number < *file_map_size && (*file_map)[file_number] != TDB_LINE_NO_FILE) {
+        return (*file_map)[file_number];
+    }
+
+    char* path = NULL;
+    if (dwarf_linesrc(row, &path, &error) != DW_DLV_OK) {
+        tdb_dwarf_error_free(table->dbg, &error);
+        return TDB_LINE_NO_FILE;
+    }
+
+    const uint32_t file_index = tdb_line_table_intern_file(table, path);
+    dwarf_dealloc(table->dbg, path, DW_DLA_STRING);
+
+    if (file_number >= *file_map_size && file_number < 65536) {
+        size_t new_size = *file_map_size == 0 ? 64 : *file_map_size;
+        while (new_size <= file_number) {
+            new_size *= 2;
+        }
+
+        uint32_t* map = realloc(*file_map, new_size * sizeof(uint32_t));
+        if (map == NULL) {
+            return file_index;
+        }
+        for (size_t i = *file_map_size; i < new_size; i++) {
+            map[i] = TDB_LINE_NO_FILE;
+        }
+        *file_map = map;
+        *file_map_size = new_size;
+    }
+
+    if (file_number < *file_map_size) {
+        (*file_map)[file_number] = file_index;
+    }
+
+    return file_index;
+}
+
+static bool tdb_line_table_reserve_lines(struct tdb_line_table* table, size_t count)
+{
+    if (table->line_count + count <= table->line_capacity) {
+        return true;
+    }
+
+    size_t new_capacity = table->line_capacity == 0 ? 64 * 1024 : 2 * table->line_capacity;
+    while (table->line_count + count > new_capacity) {
+        new_capacity *= 2;
+    }
+
+    struct tdb_line_entry* lines = realloc(table->lines, new_capacity * sizeof(struct tdb_line_entry));
+    if (lines == NULL) {
+        return false;
+    }
+    table->lines = lines;
+
+    uint32_t* lines_by_location = realloc(table->lines_by_location, new_capacity * sizeof(uint32_t));
+    if (lines_by_location == NULL) {
+        return false;
+    }
+    table->lines_by_location = lines_by_location;
+    table->line_capacity = new_capacity;
+
+    return true;
+}
+
+static bool tdb_line_table_read_unit_lines(struct tdb_line_table* table, size_t unit_index)
+{
+    struct tdb_compile_unit* unit = &table->units[unit_index];
+
+    Dwarf_Error error = NULL;
+    Dwarf_Die die = NULL;
+    if (dwarf_offdie_b(table->dbg, unit->die_offset, true, &die, &error) != DW_DLV_OK) {
+        tdb_dwarf_error_free(table->dbg, &error);
+        return false;
+    }
+
+    Dwarf_Unsigned version;
+    Dwarf_Small table_count;
+    Dwarf_Line_Context line_context = NULL;
+    if (dwarf_srclines_b(die, &version, &table_count, &line_context, &error) != DW_DLV_OK) {
+        tdb_dwarf_error_free(table->dbg, &error);
+        dwarf_dealloc(table->dbg, die, DW_DLA_DIE);
+        return false;
+    }
+
+    Dwarf_Line* rows = NULL;
+    Dwarf_Signed row_count = 0;
+    if (dwarf_srclines_from_linecontext(line_context, &rows, &row_count, &error) != DW_DLV_OK || row_count <= 0) {
+        tdb_dwarf_error_free(table->dbg, &error);
+        dwarf_srclines_dealloc_b(line_context);
+        dwarf_dealloc(table->dbg, die, DW_DLA_DIE);
+        return false;
+    }
+
+    struct tdb_ordered_line_entry* ordered = malloc((size_t)row_count * sizeof(struct tdb_ordered_line_entry));
+    uint32_t* file_map = NULL;
+    size_t file_map_size = 0;
+    size_t line_count = 0;
+
+    // units not covered by a range yet get one per sequence of their line program
+    const bool needs_ranges = !unit->has_range;
+    uint64_t sequence_start = UINT64_MAX;
+
+    for (Dwarf_Signed i = 0; ordered != NULL && i < row_count; i++) {
+        Dwarf_Addr address;
+        Dwarf_Unsigned line_number;
+        Dwarf_Bool is_statement = false;
+        Dwarf_Bool is_end_sequence = false;
+
+        if (dwarf_lineaddr(rows[i], &address, &error) != DW_DLV_OK ||
+            dwarf_lineno(rows[i], &line_number, &error) != DW_DLV_OK) {
+            tdb_dwarf_error_free(table->dbg, &error);
+            continue;
+        }
+        if (dwarf_linebeginstatement(rows[i], &is_statement, &error) != DW_DLV_OK ||
+            dwarf_lineendsequence(rows[i], &is_end_sequence, &error) != DW_DLV_OK) {
+            tdb_dwarf_error_free(table->dbg, &error);
+        }
+
+        struct tdb_ordered_line_entry* ordered_entry = &ordered[line_count];
+        memset(ordered_entry, 0, sizeof(*ordered_entry));
+        ordered_entry->order = line_count;
+        ordered_entry->entry.address = address;
+        ordered_entry->entry.line = (uint32_t)line_number;
+        ordered_entry->entry.file_index = tdb_line_table_row_file(table, rows[i], &file_map, &file_map_size);
+        ordered_entry->entry.is_statement = is_statement != 0;
+        ordered_entry->entry.is_end_sequence = is_end_sequence != 0;
+        line_count++;
+
+        if (is_end_sequence) {
+            // sequences of discarded (e.g. inlined-and-removed) functions start at 0
+            if (needs_ranges && sequence_start != UINT64_MAX && sequence_start != 0 && address > sequence_start) {
+                tdb_line_table_add_range(table, sequence_start, address, unit_index);
+            }
+            sequence_start = UINT64_MAX;
+        }
+        else if (sequence_start == UINT64_MAX) {
+            sequence_start = address;
+        }
+    }
+
+    free(file_map);
+    dwarf_srclines_dealloc_b(line_context);
+    dwarf_dealloc(table->dbg, die, DW_DLA_DIE);
+
+    if (needs_ranges && unit->has_range) {
+        tdb_line_table_sort_ranges(table);
+    }
+
+    if (ordered == NULL || line_count == 0 || !tdb_line_table_reserve_lines(table, line_count)) {
+        const char* name = tdb_line_table_unit_name(table, unit);
+        fprintf(stderr, "Failed to decode line table of %s\n", name != NULL ? name : "compile unit");
+        free(ordered);
+        return false;
+    }
+
+    struct tdb_line_entry* lines = table->lines + table->line_count;
+    uint32_t* lines_by_location = table->lines_by_location + table->line_count;
+
+    qsort(ordered, line_count, sizeof(struct tdb_ordered_line_entry), tdb_compare_ordered_lines);
+    for (size_t i = 0; i < line_count; i++) {
+        lines[i] = ordered[i].entry;
+        lines_by_location[i] = (uint32_t)i;
+    }
+    free(ordered);
+
+    g_tdb_sorting_lines = lines;
+    qsort(lines_by_location, line_count, sizeof(uint32_t), tdb_compare_line_locations);
+    g_tdb_sorting_lines = NULL;
+
+    unit->first_line = table->line_count;
+    unit->line_count = (uint32_t)line_count;
+    table->line_count += line_count;
+
+    return true;
+}
+
+static bool tdb_line_table_decode_unit(struct tdb_line_table* table, size_t unit_index)
+{
+    struct tdb_compile_unit* unit = &table->units[unit_index];
+    if (unit->decoded || table->dbg == NULL) {
+        return unit->line_count != 0;
+    }
+
+    // a unit that fails to decode isn't retried on every lookup
+    unit->decoded = true;
+
+    const uint64_t start = tdb_stats_start();
+    const bool success = tdb_line_table_read_unit_lines(table, unit_index);
+    tdb_stats_record(TDB_STAT_LINE_TABLE_DECODE, start);
+    return success;
+}
+
+size_t tdb_line_table_decoded_count(const struct tdb_line_table* table)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < table->unit_count; i++) {
+        count += table->units[i].decoded;
+    }
+    return count;
+}
+
+static bool tdb_unit_lookup_address(const struct tdb_line_table* table, const struct tdb_compile_unit* unit,
+                                    uint64_t address, struct tdb_source_location* location)
+{
+    const struct tdb_line_entry* lines = table->lines + unit->first_line;
+
+    // find the last row starting at or before the address
+    size_t low = 0;
+    size_t high = unit->line_count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (lines[middle].address <= address) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+
+    if (low == 0) {
+        return false;
+    }
+
+    const struct tdb_line_entry* entry = &lines[low - 1];
+    if (entry->is_end_sequence || entry->line == 0 || entry->file_index == TDB_LINE_NO_FILE) {
+        return false;
+    }
+
+    location->file = tdb_line_table_file(table, entry->file_index);
+    location->file_index = entry->file_index;
+    location->line = entry->line;
+
+    // neighbouring rows of the same line, up to the row that ends the run
+    size_t first = low - 1;
+    while (first > 0 && !lines[first - 1].is_end_sequence && lines[first - 1].line == entry->line &&
+           lines[first - 1].file_index == entry->file_index) {
+        first--;
+    }
+
+    size_t last = low - 1;
+    while (last + 1 < unit->line_count && !lines[last + 1].is_end_sequence && lines[last + 1].line == entry->line &&
+           lines[last + 1].file_index == entry->file_index) {
+        last++;
+    }
+
+    location->low = lines[first].address;
+    location->high = last + 1 < unit->line_count ? lines[last + 1].address : address + 1;
+
+    return true;
+}
+
+bool tdb_line_table_lookup_address(struct tdb_line_table* table, uint64_t address,
+                                   struct tdb_source_location* location)
+{
+    // find the last range starting at or before the address
+    size_t low = 0;
+    size_t high = table->range_count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (table->ranges[middle].low <= address) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+
+    // ranges of different units can overlap or nest, so earlier ones may cover it too
+    for (size_t i = low; i > 0 && address < table->ranges[i - 1].max_high; i--) {
+        if (address >= table->ranges[i - 1].high) {
+            continue;
+        }
+
+        const size_t unit_index = table->ranges[i - 1].unit_index;
+        if (tdb_line_table_decode_unit(table, unit_index) &&
+            tdb_unit_lookup_address(table, &table->units[unit_index], address, location)) {
+            return true;
+        }
+    }
+
+    // units without low_pc/high_pc or aranges only get ranges once decoded
+    for (size_t i = 0; i < table->unit_count; i++) {
+        if (table->units[i].has_range || table->units[i].decoded) {
+            continue;
+        }
+
+        if (tdb_line_table_decode_unit(table, i) && tdb_unit_lookup_address(table, &table->units[i], address, location)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool tdb_path_matches(const char* path, const char* query)
+{
+    const size_t path_length = strlen(path);
+    const size_t query_length = strlen(query);
+
+    if (query_length > path_length || strcmp(path + path_length - query_length, query)) {
+        return false;
+    }
+
+    return query_length == path_length || path[path_length - query_length - 1] == '/';
+}
+
+// Finds the lowest address of the first line at or after the requested one, within the
+// files of the unit matching the query.
+static bool tdb_unit_lookup_line(const struct tdb_line_table* table, const struct tdb_compile_unit* unit,
+                                 const bool* matching_files, uint32_t line, uint32_t* found_line,
+                                 uint64_t* found_address)
+{
+    const struct tdb_line_entry* lines = table->lines + unit->first_line;
+    const uint32_t* by_location = table->lines_by_location + unit->first_line;
+    bool found = false;
+
+    for (size_t i = 0; i < unit->line_count; i++) {
+        const struct tdb_line_entry* entry = &lines[by_location[i]];
+        if (entry->file_index == TDB_LINE_NO_FILE || entry->file_index >= table->file_count ||
+            !matching_files[entry->file_index]) {
+            continue;
+        }
+
+        // skip ahead to the requested line within this file
+        size_t low = i;
+        size_t high = unit->line_count;
+        while (low < high) {
+            size_t middle = low + (high - low) / 2;
+            const struct tdb_line_entry* candidate = &lines[by_location[middle]];
+            if (candidate->file_index == entry->file_index && candidate->line < line) {
+                low = middle + 1;
+            }
+            else {
+                high = middle;
+            }
+        }
+
+        size_t j = low;
+        for (; j < unit->line_count; j++) {
+            const struct tdb_line_entry* candidate = &lines[by_location[j]];
+            if (candidate->file_index != entry->file_index) {
+                break;
+            }
+            if (!candidate->is_statement || candidate->is_end_sequence) {
+                continue;
+            }
+
+            if (!found || candidate->line < *found_line ||
+                (candidate->line == *found_line && candidate->address < *found_address)) {
+                *found_line = candidate->line;
+                *found_address = candidate->address;
+                found = true;
+            }
+            break;
+        }
+
+        // continue with the next file
+        while (j < unit->line_count && lines[by_location[j]].file_index == entry->file_index) {
+            j++;
+        }
+        i = j - 1;
+    }
+
+    return found;
+}
+
+size_t tdb_line_table_lookup_line(struct tdb_line_table* table, const char* file, uint32_t line,
+                                  uint64_t* addresses, size_t max_addresses, uint32_t* actual_line)
+{
+    if (table->unit_count == 0 || max_addresses == 0) {
+        return 0;
+    }
+
+    uint32_t* unit_lines = calloc(table->unit_count, sizeof(uint32_t));
+    uint64_t* unit_addresses = calloc(table->unit_count, sizeof(uint64_t));
+    bool* searched = calloc(table->unit_count, sizeof(bool));
+    bool* matching_files = NULL;
+
+    if (unit_lines == NULL || unit_addresses == NULL || searched == NULL) {
+        free(unit_lines);
+        free(unit_addresses);
+        free(searched);
+        return 0;
+    }
+
+    uint32_t best_line = 0;
+
+    // units named after the file come first; only if none of them has the line (e.g.
+    // it's in a header) is every unit decoded and searched
+    for (int pass = 0; pass < 2 && best_line == 0; pass++) {
+        for (size_t i = 0; i < table->unit_count; i++) {
+            const char* name = tdb_line_table_unit_name(table, &table->units[i]);
+            const bool name_matches = name != NULL && tdb_path_matches(name, file);
+            if (searched[i] || (pass == 0 && !name_matches)) {
+                continue;
+            }
+
+            searched[i] = true;
+            tdb_line_table_decode_unit(table, i);
+        }
+
+        // decoding may have interned new files
+        free(matching_files);
+        matching_files = calloc(table->file_count + 1, sizeof(bool));
+        if (matching_files == NULL) {
+            break;
+        }
+        for (size_t i = 0; i < table->file_count; i++) {
+            matching_files[i] = tdb_path_matches(tdb_line_table_file(table, (uint32_t)i), file);
+        }
+
+        for (size_t i = 0; i < table->unit_count; i++) {
+            if (!searched[i] || unit_lines[i] != 0 || table->units[i].line_count == 0) {
+                continue;
+            }
+
+            if (tdb_unit_lookup_line(table, &table->units[i], matching_files, line, &unit_lines[i],
+                                     &unit_addresses[i]) &&
+                (best_line == 0 || unit_lines[i] < best_line)) {
+                best_line = unit_lines[i];
+            }
+        }
+    }
+
+    size_t address_count = 0;
+    for (size_t i = 0; best_line != 0 && i < table->unit_count && address_count < max_addresses; i++) {
+        if (unit_lines[i] == best_line) {
+            addresses[address_count++] = unit_addresses[i];
+        }
+    }
+
+    *actual_line = best_line;
+
+    free(unit_lines);
+    free(unit_addresses);
+    free(searched);
+    free(matching_files);
+
+    return address_count;
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <libdwarf.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// One row of a decoded .debug_line program. Rows are sorted by address within their
+// compile unit; an end-of-sequence row marks the first address past a sequence and
+// doesn't map to any line itself. Files are indices into the table-wide file list.
+struct tdb_line_entry {
+    uint64_t address;
+    uint32_t line;
+    uint32_t file_index;
+    uint8_t is_statement;
+    uint8_t is_end_sequence;
+    uint8_t padding[6];
+};
+
+// Compile units are enumerated up front from their headers, but their line programs
+// are only decoded the first time an address or file inside them is looked up.
+struct tdb_compile_unit {
+    uint64_t die_offset;
+    uint64_t first_line;  // index of the unit's rows in tdb_line_table.lines
+    uint32_t line_count;
+    uint32_t name_offset;  // DW_AT_name in tdb_line_table.strings, or TDB_LINE_NO_NAME
+    uint8_t has_range;     // covered by at least one entry of tdb_line_table.ranges
+    uint8_t decoded;
+    uint8_t padding[6];
+};
+
+// A half-open [low, high) address interval covered by a compile unit. Ranges of
+// different units may overlap, so max_high bounds how far back a lookup has to look.
+struct tdb_unit_range {
+    uint64_t low;
+    uint64_t high;
+    uint64_t max_high;  // highest high of this and all preceding ranges
+    uint32_t unit_index;
+    uint32_t padding;
+};
+
+// Like the symbol table, everything is kept in flat, pointer-free arrays so that a
+// fully decoded table can be used straight out of a memory-mapped cache file.
+struct tdb_line_table {
+    int fd;
+    Dwarf_Debug dbg;  // NULL when the table came from the cache
+
+    struct tdb_compile_unit* units;  // sorted by DIE offset
+    size_t unit_count;
+
+    struct tdb_unit_range* ranges;  // sorted by low address
+    size_t range_count;
+    size_t range_capacity;
+
+    // rows of all decoded units, each unit's sorted by address; lines_by_location holds
+    // the same rows of each unit as unit-relative indices sorted by (file, line, address)
+    struct tdb_line_entry* lines;
+    uint32_t* lines_by_location;
+    size_t line_count;
+    size_t line_capacity;
+
+    char* strings;  // file paths and unit names
+    size_t strings_size;
+    size_t strings_capacity;
+
+    uint32_t* files;  // offsets of the file paths in strings
+    size_t file_count;
+    size_t file_capacity;
+
+    uint32_t* file_buckets;  // TDB_LINE_NO_FILE marks an empty bucket
+    size_t file_bucket_count;
+
+    bool owns_memory;
+};
+
+#define TDB_LINE_NO_FILE UINT32_MAX
+#define TDB_LINE_NO_NAME UINT32_MAX
+
+// The file name is only valid until the next lookup, which may decode more units.
+// [low, high) are the (unrelocated) addresses around the one looked up that belong to
+// the same line, which is what stepping over a line has to run through.
+struct tdb_source_location {
+    const char* file;
+    uint32_t file_index;
+    uint32_t line;
+    uint64_t low;
+    uint64_t high;
+};
+
+void tdb_line_table_init(struct tdb_line_table* table);
+
+// Only reads the compile unit headers and .debug_aranges, so this stays cheap even
+// for very large binaries. Returns false if the file has no usable DWARF.
+bool tdb_line_table_load(struct tdb_line_table* table, const char* elf_path);
+void tdb_line_table_free(struct tdb_line_table* table);
+
+// A table loaded from a cache written before all of its units were decoded is copied
+// out of the mapping and gets the binary's DWARF back, so the rest still decode on first
+// use. Does nothing for tables that are complete or already own their memory.
+bool tdb_line_table_resume(struct tdb_line_table* table, const char* elf_path);
+
+// Number of compile units whose line programs have been decoded.
+size_t tdb_line_table_decoded_count(const struct tdb_line_table* table);
+
+const char* tdb_line_table_file(const struct tdb_line_table* table, uint32_t file_index);
+const char* tdb_line_table_unit_name(const struct tdb_line_table* table, const struct tdb_compile_unit* unit);
+
+// Maps an (unrelocated) address to the source line containing it.
+bool tdb_line_table_lookup_address(struct tdb_line_table* table, uint64_t address,
+                                   struct tdb_source_location* location);
+
+// Finds the addresses at which to break for a source line, giving at most one address
+// per compile unit. A file matches by whole path components from the end, so "foo.c"
+// matches "/src/foo.c". If no code was generated for the exact line, the next line
+// that has code is used and stored in *actual_line. Returns the number of addresses.
+size_t tdb_line_table_lookup_line(struct tdb_line_table* table, const char* file, uint32_t line,
+                                  uint64_t* addresses, size_t max_addresses, uint32_t* actual_line);
@@ -0,0 +1,290 @@
+#include "maps.h"
+
+#include <elf.h>
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "stats.h"
+
+void tdb_process_maps_init(struct tdb_process_maps* maps)
+{
+    memset(maps, 0, sizeof(*maps));
+    maps->main_object = TDB_MAPPING_NO_OBJECT;
+}
+
+void tdb_process_maps_free(struct tdb_process_maps* maps)
+{
+    for (size_t i = 0; i < maps->object_count; i++) {
+        free(maps->objects[i].path);
+    }
+    free(maps->objects);
+    free(maps->mappings);
+
+    tdb_process_maps_init(maps);
+}
+
+// Works out the load bias from the program header covering the mapped file offset.
+// Executables that aren't position independent are always loaded at their link-time
+// addresses.
+static uint64_t tdb_compute_load_bias(const char* path, uint64_t start, uint64_t file_offset, bool* is_elf)
+{
+    uint64_t bias = start - file_offset;
+    *is_elf = false;
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return bias;
+    }
+
+    Elf64_Ehdr header;
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || memcmp(header.e_ident, ELFMAG, SELFMAG) ||
+        header.e_ident[EI_CLASS] != ELFCLASS64 || header.e_phentsize != sizeof(Elf64_Phdr)) {
+        close(fd);
+        return bias;
+    }
+
+    *is_elf = true;
+
+    if (header.e_type == ET_EXEC) {
+        close(fd);
+        return 0;
+    }
+
+    const size_t program_headers_size = header.e_phnum * sizeof(Elf64_Phdr);
+    Elf64_Phdr* program_headers = malloc(program_headers_size);
+
+    if (program_headers != NULL &&
+        pread(fd, program_headers, program_headers_size, (off_t)header.e_phoff) == (ssize_t)program_headers_size) {
+        const uint64_t page_mask = ~((uint64_t)getpagesize() - 1);
+
+        for (size_t i = 0; i < header.e_phnum; i++) {
+            const Elf64_Phdr* segment = &program_headers[i];
+            const uint64_t segment_offset = segment->p_offset & page_mask;
+
+            if (segment->p_type == PT_LOAD && segment_offset <= file_offset &&
+                file_offset < segment->p_offset + segment->p_filesz) {
+                bias = start - ((segment->p_vaddr & page_mask) + (file_offset - segment_offset));
+                break;
+            }
+        }
+    }
+
+    free(program_headers);
+    close(fd);
+
+    return bias;
+}
+
+static uint32_t tdb_process_maps_add_object(struct tdb_process_maps* maps, const struct tdb_process_maps* previous,
+                                            const char* path, uint64_t inode, const struct tdb_mapping* mapping)
+{
+    for (size_t i = 0; i < maps->object_count; i++) {
+        struct tdb_mapped_object* object = &maps->objects[i];
+        if (object->inode == inode && !strcmp(object->path, path)) {
+            object->end = mapping->end;
+            return (uint32_t)i;
+        }
+    }
+
+    if (maps->object_count == maps->object_capacity) {
+        size_t new_capacity = maps->object_capacity == 0 ? 32 : 2 * maps->object_capacity;
+
+        struct tdb_mapped_object* objects = realloc(maps->objects, new_capacity * sizeof(struct tdb_mapped_object));
+        if (objects == NULL) {
+            return TDB_MAPPING_NO_OBJECT;
+        }
+        maps->objects = objects;
+        maps->object_capacity = new_capacity;
+    }
+
+    struct tdb_mapped_object* object = &maps->objects[maps->object_count];
+    object->path = strdup(path);
+    object->inode = inode;
+    object->start = mapping->start;
+    object->end = mapping->end;
+
+    if (object->path == NULL) {
+        return TDB_MAPPING_NO_OBJECT;
+    }
+
+    // only objects that weren't mapped at the same place before need their headers read
+    bool known = false;
+    for (size_t i = 0; i < previous->object_count && !known; i++) {
+        const struct tdb_mapped_object* old = &previous->objects[i];
+        if (old->inode == inode && old->start == mapping->start && !strcmp(old->path, path)) {
+            object->load_bias = old->load_bias;
+            object->is_elf = old->is_elf;
+            known = true;
+        }
+    }
+
+    if (!known) {
+        object->load_bias = tdb_compute_load_bias(path, mapping->start, mapping->file_offset, &object->is_elf);
+    }
+
+    return (uint32_t)maps->object_count++;
+}
+
+static bool tdb_process_maps_add_mapping(struct tdb_process_maps* maps, const struct tdb_mapping* mapping)
+{
+    if (maps->mapping_count == maps->mapping_capacity) {
+        size_t new_capacity = maps->mapping_capacity == 0 ? 128 : 2 * maps->mapping_capacity;
+
+        struct tdb_mapping* mappings = realloc(maps->mappings, new_capacity * sizeof(struct tdb_mapping));
+        if (mappings == NULL) {
+            return false;
+        }
+        maps->mappings = mappings;
+        maps->mapping_capacity = new_capacity;
+    }
+
+    maps->mappings[maps->mapping_count++] = *mapping;
+    return true;
+}
+
+static bool tdb_process_maps_read(struct tdb_process_maps* maps, pid_t pid)
+{
+    char path[64];
+    sprintf(path, "/proc/%d/maps", pid);
+
+    FILE* maps_file = fopen(path, "r");
+    if (maps_file == NULL) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return false;
+    }
+
+    char exe_link[64];
+    sprintf(exe_link, "/proc/%d/exe", pid);
+
+    char exe_path[PATH_MAX] = "";
+    ssize_t exe_path_length = readlink(exe_link, exe_path, sizeof(exe_path) - 1);
+    if (exe_path_length > 0) {
+        exe_path[exe_path_length] = '\0';
+    }
+
+    struct tdb_process_maps updated;
+    tdb_process_maps_init(&updated);
+
+    char* line_buffer = NULL;
+    size_t line_buffer_size = 0;
+    bool success = true;
+
+    // the kernel lists mappings in address order
+    while (success && getline(&line_buffer, &line_buffer_size, maps_file) != -1) {
+        struct tdb_mapping mapping;
+        char permissions[5];
+        unsigned int device_major, device_minor;
+        uint64_t inode;
+        int path_start = 0;
+
+        if (sscanf(line_buffer, "%lx-%lx %4s %lx %x:%x %lu %n", &mapping.start, &mapping.end, permissions,
+                   &mapping.file_offset, &device_major, &device_minor, &inode, &path_start) < 7) {
+            continue;
+        }
+
+        mapping.permissions = (permissions[0] == 'r' ? TDB_MAPPING_READ : 0) |
+                              (permissions[1] == 'w' ? TDB_MAPPING_WRITE : 0) |
+                              (permissions[2] == 'x' ? TDB_MAPPING_EXECUTE : 0) |
+                              (permissions[3] == 's' ? TDB_MAPPING_SHARED : 0);
+        mapping.object_index = TDB_MAPPING_NO_OBJECT;
+
+        char* mapping_path = line_buffer + path_start;
+        mapping_path[strcspn(mapping_path, "\n")] = '\0';
+
+        // pseudo-paths like [heap] and [stack] aren't files
+        if (mapping_path[0] == '/' && inode != 0) {
+            mapping.object_index = tdb_process_maps_add_object(&updated, maps, mapping_path, inode, &mapping);
+
+            if (mapping.object_index != TDB_MAPPING_NO_OBJECT && updated.main_object == TDB_MAPPING_NO_OBJECT &&
+                !strcmp(mapping_path, exe_path)) {
+                updated.main_object = mapping.object_index;
+            }
+        }
+
+        success = tdb_process_maps_add_mapping(&updated, &mapping);
+    }
+
+    free(line_buffer);
+    fclose(maps_file);
+
+    if (!success) {
+        fprintf(stderr, "Out of memory while reading %s\n", path);
+        tdb_process_maps_free(&updated);
+        return false;
+    }
+
+    tdb_process_maps_free(maps);
+    *maps = updated;
+
+    return true;
+}
+
+bool tdb_process_maps_refresh(struct tdb_process_maps* maps, pid_t pid)
+{
+    const uint64_t start = tdb_stats_start();
+    const bool success = tdb_process_maps_read(maps, pid);
+    tdb_stats_record(TDB_STAT_PROC_MAPS, start);
+    return success;
+}
+
+bool tdb_process_maps_add(struct tdb_process_maps* maps, const struct tdb_mapping* mapping, const char* path)
+{
+    struct tdb_process_maps none;
+    tdb_process_maps_init(&none);
+
+    struct tdb_mapping added = *mapping;
+    added.object_index = path != NULL ? tdb_process_maps_add_object(maps, &none, path, 0, &added) : TDB_MAPPING_NO_OBJECT;
+
+    return tdb_process_maps_add_mapping(maps, &added);
+}
+
+const struct tdb_mapping* tdb_process_maps_find(const struct tdb_process_maps* maps, uint64_t address)
+{
+    // find the last mapping starting at or before the address
+    size_t low = 0;
+    size_t high = maps->mapping_count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (maps->mappings[middle].start <= address) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+
+    if (low == 0 || address >= maps->mappings[low - 1].end) {
+        return NULL;
+    }
+
+    return &maps->mappings[low - 1];
+}
+
+const struct tdb_mapped_object* tdb_process_maps_find_object(const struct tdb_process_maps* maps, uint64_t address)
+{
+    const struct tdb_mapping* mapping = tdb_process_maps_find(maps, address);
+    if (mapping == NULL || mapping->object_index == TDB_MAPPING_NO_OBJECT) {
+        return NULL;
+    }
+
+    return &maps->objects[mapping->object_index];
+}
+
+const struct tdb_mapped_object* tdb_process_maps_main_object(const struct tdb_process_maps* maps)
+{
+    if (maps->main_object == TDB_MAPPING_NO_OBJECT) {
+        return NULL;
+    }
+
+    return &maps->objects[maps->main_object];
+}
+
+uint64_t tdb_process_maps_main_bias(const struct tdb_process_maps* maps)
+{
+    const struct tdb_mapped_object* main_object = tdb_process_maps_main_object(maps);
+    return main_object != NULL ? main_object->load_bias : 0;
+}
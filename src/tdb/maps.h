@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define TDB_MAPPING_READ 0x1
+#define TDB_MAPPING_WRITE 0x2
+#define TDB_MAPPING_EXECUTE 0x4
+#define TDB_MAPPING_SHARED 0x8
+
+#define TDB_MAPPING_NO_OBJECT UINT32_MAX
+
+// One line of /proc/pid/maps.
+struct tdb_mapping {
+    uint64_t start;
+    uint64_t end;
+    uint64_t file_offset;
+    uint32_t permissions;   // TDB_MAPPING_* flags
+    uint32_t object_index;  // into tdb_process_maps.objects, or TDB_MAPPING_NO_OBJECT
+};
+
+// A file mapped into the process, usually the executable or a shared object. Runtime
+// addresses inside it are its link-time addresses plus load_bias.
+struct tdb_mapped_object {
+    char* path;
+    uint64_t inode;
+    uint64_t start;  // lowest mapped address
+    uint64_t end;
+    uint64_t load_bias;
+    bool is_elf;
+};
+
+// Mappings are kept sorted by address so lookups are a binary search. The maps are only
+// re-read when the process tells us they changed (exec, the dynamic loader's
+// breakpoint), and the load bias of an object that was already mapped is carried over
+// instead of reading its ELF headers again.
+struct tdb_process_maps {
+    struct tdb_mapping* mappings;
+    size_t mapping_count;
+    size_t mapping_capacity;
+
+    struct tdb_mapped_object* objects;
+    size_t object_count;
+    size_t object_capacity;
+
+    uint32_t main_object;  // the executable, or TDB_MAPPING_NO_OBJECT
+};
+
+void tdb_process_maps_init(struct tdb_process_maps* maps);
+void tdb_process_maps_free(struct tdb_process_maps* maps);
+
+bool tdb_process_maps_refresh(struct tdb_process_maps* maps, pid_t pid);
+
+// Adds a mapping of a process whose maps can't be read from /proc, like the one a core
+// file was taken of, with the path of the file it maps or NULL. Mappings have to be
+// added in address order.
+bool tdb_process_maps_add(struct tdb_process_maps* maps, const struct tdb_mapping* mapping, const char* path);
+
+const struct tdb_mapping* tdb_process_maps_find(const struct tdb_process_maps* maps, uint64_t address);
+
+// Returns the object a runtime address belongs to, or NULL for anonymous memory.
+const struct tdb_mapped_object* tdb_process_maps_find_object(const struct tdb_process_maps* maps, uint64_t address);
+
+// Returns the main executable, or NULL if it isn't mapped (yet).
+const struct tdb_mapped_object* tdb_process_maps_main_object(const struct tdb_process_maps* maps);
+
+// Returns the load bias of the main executable, 0 if it isn't known yet.
+uint64_t tdb_process_maps_main_bias(const struct tdb_process_maps* maps);
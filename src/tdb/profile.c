@@ -0,0 +1,445 @@
+#include "profile.h"
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "tdb/symbols.h"
+
+// data pages per ring, a power of two
+#define TDB_PROFILE_RING_PAGES 64
+
+// the deepest call chain the kernel records by default (kernel.perf_event_max_stack)
+#define TDB_PROFILE_MAX_FRAMES 127
+
+#define TDB_PROFILE_REPORT_ROWS 25
+
+static size_t tdb_profile_ring_data_size(void)
+{
+    return TDB_PROFILE_RING_PAGES * (size_t)getpagesize();
+}
+
+void tdb_profiler_init(struct tdb_profiler* profiler, unsigned frequency)
+{
+    memset(profiler, 0, sizeof(*profiler));
+    profiler->frequency = frequency;
+}
+
+void tdb_profiler_free(struct tdb_profiler* profiler)
+{
+    const size_t ring_size = tdb_profile_ring_data_size() + (size_t)getpagesize();
+
+    for (size_t i = 0; i < profiler->event_count; i++) {
+        munmap(profiler->events[i].ring, ring_size);
+        close(profiler->events[i].fd);
+    }
+
+    free(profiler->events);
+    free(profiler->samples);
+    free(profiler->scratch);
+
+    tdb_profiler_init(profiler, 0);
+}
+
+bool tdb_profiler_add_thread(struct tdb_profiler* profiler, pid_t tid)
+{
+    for (size_t i = 0; i < profiler->event_count; i++) {
+        if (profiler->events[i].tid == tid) {
+            return true;
+        }
+    }
+
+    if (profiler->event_count == profiler->event_capacity) {
+        size_t new_capacity = profiler->event_capacity == 0 ? 8 : 2 * profiler->event_capacity;
+
+        struct tdb_profile_event* events = realloc(profiler->events, new_capacity * sizeof(struct tdb_profile_event));
+        if (events == NULL) {
+            return false;
+        }
+        profiler->events = events;
+        profiler->event_capacity = new_capacity;
+    }
+
+    if (profiler->scratch == NULL && (profiler->scratch = malloc(tdb_profile_ring_data_size())) == NULL) {
+        return false;
+    }
+
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_SOFTWARE;
+    attr.config = PERF_COUNT_SW_CPU_CLOCK;
+    attr.freq = 1;
+    attr.sample_freq = profiler->frequency;
+    attr.sample_type = PERF_SAMPLE_IP | PERF_SAMPLE_TID | PERF_SAMPLE_CALLCHAIN;
+    attr.disabled = !profiler->enabled;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.exclude_callchain_kernel = 1;
+    attr.watermark = 1;
+    attr.wakeup_watermark = (uint32_t)(tdb_profile_ring_data_size() / 4);
+
+    int fd = (int)syscall(SYS_perf_event_open, &attr, tid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    if (fd == -1) {
+        fprintf(stderr, "Failed to open a perf event for thread %d: %s\n", tid, strerror(errno));
+        return false;
+    }
+
+    void* ring = mmap(NULL, tdb_profile_ring_data_size() + (size_t)getpagesize(), PROT_READ | PROT_WRITE, MAP_SHARED,
+                      fd, 0);
+    if (ring == MAP_FAILED) {
+        fprintf(stderr, "Failed to map the perf ring buffer for thread %d: %s\n", tid, strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    struct tdb_profile_event* event = &profiler->events[profiler->event_count++];
+    event->tid = tid;
+    event->fd = fd;
+    event->ring = ring;
+    event->hung_up = false;
+
+    return true;
+}
+
+void tdb_profiler_enable(struct tdb_profiler* profiler)
+{
+    for (size_t i = 0; i < profiler->event_count; i++) {
+        ioctl(profiler->events[i].fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    profiler->enabled = true;
+}
+
+void tdb_profiler_disable(struct tdb_profiler* profiler)
+{
+    for (size_t i = 0; i < profiler->event_count; i++) {
+        ioctl(profiler->events[i].fd, PERF_EVENT_IOC_DISABLE, 0);
+    }
+
+    profiler->enabled = false;
+}
+
+static bool tdb_profiler_store_sample(struct tdb_profiler* profiler, const uint64_t* frames, size_t frame_count)
+{
+    if (profiler->sample_words + 1 + frame_count > profiler->sample_capacity) {
+        size_t new_capacity = profiler->sample_capacity == 0 ? 64 * 1024 : 2 * profiler->sample_capacity;
+
+        uint64_t* samples = realloc(profiler->samples, new_capacity * sizeof(uint64_t));
+        if (samples == NULL) {
+            return false;
+        }
+        profiler->samples = samples;
+        profiler->sample_capacity = new_capacity;
+    }
+
+    uint64_t* sample = profiler->samples + profiler->sample_words;
+    sample[0] = frame_count;
+    memcpy(sample + 1, frames, frame_count * sizeof(uint64_t));
+
+    profiler->sample_words += 1 + frame_count;
+    profiler->sample_count++;
+    return true;
+}
+
+// A PERF_RECORD_SAMPLE with PERF_SAMPLE_IP | PERF_SAMPLE_TID | PERF_SAMPLE_CALLCHAIN.
+static void tdb_profiler_add_record(struct tdb_profiler* profiler, const struct perf_event_header* record)
+{
+    if (record->type == PERF_RECORD_LOST) {
+        const uint64_t* body = (const uint64_t*)(record + 1);  // id, lost
+        profiler->lost_count += body[1];
+        return;
+    }
+
+    if (record->type != PERF_RECORD_SAMPLE) {
+        return;
+    }
+
+    const uint64_t* body = (const uint64_t*)(record + 1);
+    const uint64_t ip = body[0];
+    const uint64_t chain_length = body[2];  // after ip and the pid/tid pair
+    const uint64_t* chain = body + 3;
+
+    uint64_t frames[TDB_PROFILE_MAX_FRAMES];
+    size_t frame_count = 0;
+
+    // the chain starts with the sampled ip itself, context markers mark where the
+    // kernel part ends and the user part starts
+    for (uint64_t i = 0; i < chain_length && frame_count < TDB_PROFILE_MAX_FRAMES; i++) {
+        if (chain[i] < (uint64_t)PERF_CONTEXT_MAX) {
+            frames[frame_count++] = chain[i];
+        }
+    }
+
+    if (frame_count == 0) {
+        frames[frame_count++] = ip;
+    }
+
+    tdb_profiler_store_sample(profiler, frames, frame_count);
+}
+
+static void tdb_profiler_drain(struct tdb_profiler* profiler, struct tdb_profile_event* event)
+{
+    struct perf_event_mmap_page* header = event->ring;
+    const uint8_t* data = (const uint8_t*)event->ring + getpagesize();
+    const size_t data_size = tdb_profile_ring_data_size();
+
+    const uint64_t head = __atomic_load_n(&header->data_head, __ATOMIC_ACQUIRE);
+    uint64_t tail = header->data_tail;
+
+    while (tail < head) {
+        // records are 8-byte aligned, so at least the header is always contiguous
+        const size_t offset = tail & (data_size - 1);
+        const struct perf_event_header* record = (const struct perf_event_header*)(data + offset);
+
+        if (offset + record->size > data_size) {
+            const size_t first_part = data_size - offset;
+            memcpy(profiler->scratch, data + offset, first_part);
+            memcpy(profiler->scratch + first_part, data, record->size - first_part);
+            record = (const struct perf_event_header*)profiler->scratch;
+        }
+
+        tdb_profiler_add_record(profiler, record);
+        tail += record->size;
+    }
+
+    __atomic_store_n(&header->data_tail, tail, __ATOMIC_RELEASE);
+}
+
+void tdb_profiler_poll(struct tdb_profiler* profiler, int timeout_ms)
+{
+    if (timeout_ms > 0) {
+        struct pollfd fds[profiler->event_count + 1];
+        size_t events[profiler->event_count + 1];
+        nfds_t fd_count = 0;
+
+        for (size_t i = 0; i < profiler->event_count; i++) {
+            if (!profiler->events[i].hung_up) {
+                fds[fd_count].fd = profiler->events[i].fd;
+                fds[fd_count].events = POLLIN;
+                fds[fd_count].revents = 0;
+                events[fd_count++] = i;
+            }
+        }
+
+        // with no live threads left this just sleeps
+        if (poll(fds, fd_count, timeout_ms) > 0) {
+            for (nfds_t i = 0; i < fd_count; i++) {
+                if (fds[i].revents & POLLHUP) {  // the thread exited, its ring is drained below
+                    profiler->events[events[i]].hung_up = true;
+                }
+            }
+        }
+    }
+
+    for (size_t i = 0; i < profiler->event_count; i++) {
+        tdb_profiler_drain(profiler, &profiler->events[i]);
+    }
+}
+
+struct tdb_profile_count {
+    char* key;
+    uint64_t self;   // samples with this function (or stack) innermost
+    uint64_t total;  // samples with this function anywhere on the stack
+};
+
+// Open-addressing hash table from function names or folded stacks to sample counts.
+struct tdb_profile_counts {
+    struct tdb_profile_count* entries;
+    size_t count;
+    size_t capacity;  // power of two
+};
+
+static void tdb_profile_counts_free(struct tdb_profile_counts* counts)
+{
+    for (size_t i = 0; i < counts->capacity; i++) {
+        free(counts->entries[i].key);
+    }
+    free(counts->entries);
+    memset(counts, 0, sizeof(*counts));
+}
+
+static struct tdb_profile_count* tdb_profile_counts_get(struct tdb_profile_counts* counts, const char* key)
+{
+    if (2 * (counts->count + 1) > counts->capacity) {
+        const size_t new_capacity = counts->capacity == 0 ? 1024 : 2 * counts->capacity;
+
+        struct tdb_profile_count* entries = calloc(new_capacity, sizeof(struct tdb_profile_count));
+        if (entries == NULL) {
+            return NULL;
+        }
+
+        for (size_t i = 0; i < counts->capacity; i++) {
+            if (counts->entries[i].key != NULL) {
+                size_t bucket = tdb_symbol_name_hash(counts->entries[i].key) & (new_capacity - 1);
+                while (entries[bucket].key != NULL) {
+                    bucket = (bucket + 1) & (new_capacity - 1);
+                }
+                entries[bucket] = counts->entries[i];
+            }
+        }
+
+        free(counts->entries);
+        counts->entries = entries;
+        counts->capacity = new_capacity;
+    }
+
+    size_t bucket = tdb_symbol_name_hash(key) & (counts->capacity - 1);
+    while (counts->entries[bucket].key != NULL) {
+        if (!strcmp(counts->entries[bucket].key, key)) {
+            return &counts->entries[bucket];
+        }
+        bucket = (bucket + 1) & (counts->capacity - 1);
+    }
+
+    if ((counts->entries[bucket].key = strdup(key)) == NULL) {
+        return NULL;
+    }
+
+    counts->count++;
+    return &counts->entries[bucket];
+}
+
+static int tdb_compare_counts_by_self(const void* a, const void* b)
+{
+    const struct tdb_profile_count* x = a;
+    const struct tdb_profile_count* y = b;
+
+    if (x->self != y->self) {
+        return x->self < y->self ? 1 : -1;
+    }
+    if (x->total != y->total) {
+        return x->total < y->total ? 1 : -1;
+    }
+
+    return (x->key == NULL) - (y->key == NULL);
+}
+
+static void tdb_profile_print_functions(struct tdb_profile_counts* functions, size_t sample_count)
+{
+    // the table is thrown away afterwards, so it is sorted in place
+    qsort(functions->entries, functions->capacity, sizeof(struct tdb_profile_count), tdb_compare_counts_by_self);
+
+    printf("  self%%  total%%  samples  function\n");
+
+    for (size_t i = 0; i < functions->count && i < TDB_PROFILE_REPORT_ROWS; i++) {
+        const struct tdb_profile_count* function = &functions->entries[i];
+        printf("%6.2f  %6.2f  %7zu  %s\n", 100.0 * (double)function->self / (double)sample_count,
+               100.0 * (double)function->total / (double)sample_count, function->self, function->key);
+    }
+}
+
+void tdb_profiler_report(const struct tdb_profiler* profiler, tdb_profile_symbolizer symbolize, void* data,
+                         const char* folded_path)
+{
+    printf("%zu samples", profiler->sample_count);
+    if (profiler->lost_count > 0) {
+        printf(" (%zu lost)", profiler->lost_count);
+    }
+    printf("\n");
+
+    if (profiler->sample_count == 0) {
+        return;
+    }
+
+    struct tdb_profile_counts functions;
+    struct tdb_profile_counts stacks;
+    memset(&functions, 0, sizeof(functions));
+    memset(&stacks, 0, sizeof(stacks));
+
+    // keys stay put when the count tables grow, unlike their entries
+    const char* names[TDB_PROFILE_MAX_FRAMES];
+
+    char* folded = NULL;
+    size_t folded_capacity = 0;
+
+    for (size_t word = 0; word < profiler->sample_words;) {
+        const size_t frame_count = profiler->samples[word];
+        const uint64_t* frames = profiler->samples + word + 1;
+        word += 1 + frame_count;
+
+        size_t folded_length = 0;
+
+        for (size_t i = 0; i < frame_count; i++) {
+            // the outer frames are return addresses, which can be just past the end of
+            // the calling function
+            const char* name = symbolize(data, i == 0 ? frames[i] : frames[i] - 1);
+
+            struct tdb_profile_count* function = tdb_profile_counts_get(&functions, name);
+            if (function == NULL) {
+                fprintf(stderr, "Out of memory while aggregating samples\n");
+                goto done;
+            }
+
+            bool seen = false;  // recursion only counts once towards the total
+            for (size_t j = 0; j < i && !seen; j++) {
+                seen = names[j] == function->key;
+            }
+
+            function->self += i == 0;
+            function->total += !seen;
+
+            names[i] = function->key;
+            folded_length += strlen(name) + 1;
+        }
+
+        if (folded_length > folded_capacity) {
+            folded_capacity = 2 * folded_length;
+            char* buffer = realloc(folded, folded_capacity);
+            if (buffer == NULL) {
+                fprintf(stderr, "Out of memory while aggregating samples\n");
+                goto done;
+            }
+            folded = buffer;
+        }
+
+        // outermost frame first
+        char* cursor = folded;
+        for (size_t i = frame_count; i-- > 0;) {
+            const size_t length = strlen(names[i]);
+            memcpy(cursor, names[i], length);
+            cursor += length;
+            *cursor++ = i > 0 ? ';' : '\0';
+        }
+
+        struct tdb_profile_count* stack = tdb_profile_counts_get(&stacks, folded);
+        if (stack == NULL) {
+            fprintf(stderr, "Out of memory while aggregating samples\n");
+            goto done;
+        }
+        stack->self++;
+    }
+
+    tdb_profile_print_functions(&functions, profiler->sample_count);
+
+    FILE* folded_file = fopen(folded_path, "w");
+    if (folded_file == NULL) {
+        fprintf(stderr, "Failed to create %s\n", folded_path);
+        goto done;
+    }
+
+    for (size_t i = 0; i < stacks.capacity; i++) {
+        if (stacks.entries[i].key != NULL) {
+            fprintf(folded_file, "%s %zu\n", stacks.entries[i].key, stacks.entries[i].self);
+        }
+    }
+
+    if (fclose(folded_file) == 0) {
+        printf("wrote %zu folded stacks to %s\n", stacks.count, folded_path);
+    }
+    else {
+        fprintf(stderr, "Failed to write %s\n", folded_path);
+    }
+
+done:
+    free(folded);
+    tdb_profile_counts_free(&functions);
+    tdb_profile_counts_free(&stacks);
+}
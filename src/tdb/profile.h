@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Statistical profiling with perf_event_open: a software CPU clock event per thread
+// samples the instruction pointer and the user call chain (walked by the kernel along
+// frame pointers) into an mmap'd ring buffer, so the inferior never has to be stopped
+// to take a sample. Samples are kept raw while profiling and only symbolized when the
+// report is made.
+
+#define TDB_PROFILE_DEFAULT_FREQUENCY 999
+
+struct tdb_profile_event {
+    pid_t tid;
+    int fd;
+    void* ring;  // the perf_event_mmap_page followed by the data pages
+    bool hung_up;  // the thread is gone, so polling would return right away
+};
+
+struct tdb_profiler {
+    struct tdb_profile_event* events;
+    size_t event_count;
+    size_t event_capacity;
+
+    unsigned frequency;  // samples per second of CPU time, per thread
+    bool enabled;
+
+    // each sample is its frame count followed by the frames, innermost first
+    uint64_t* samples;
+    size_t sample_words;
+    size_t sample_capacity;
+    size_t sample_count;
+
+    uint64_t lost_count;  // samples dropped by the kernel because a ring was full
+
+    uint8_t* scratch;  // for records wrapping around the end of a ring
+};
+
+void tdb_profiler_init(struct tdb_profiler* profiler, unsigned frequency);
+void tdb_profiler_free(struct tdb_profiler* profiler);
+
+// Opens an event for a thread, enabled right away if the profiler is. Adding a thread
+// twice does nothing.
+bool tdb_profiler_add_thread(struct tdb_profiler* profiler, pid_t tid);
+
+void tdb_profiler_enable(struct tdb_profiler* profiler);
+void tdb_profiler_disable(struct tdb_profiler* profiler);
+
+// Waits up to timeout_ms for a ring to fill up, then drains every ring.
+void tdb_profiler_poll(struct tdb_profiler* profiler, int timeout_ms);
+
+// Names the function a frame address is in, for the report. The name only needs to
+// stay valid until the next call.
+typedef const char* (*tdb_profile_symbolizer)(void* data, uint64_t address);
+
+// Prints the functions with the most samples and writes the folded stacks (one
+// "outer;...;inner count" line per distinct stack, as flamegraph.pl reads them) to
+// folded_path.
+void tdb_profiler_report(const struct tdb_profiler* profiler, tdb_profile_symbolizer symbolize, void* data,
+                         const char* folded_path);
@@ -1,53 +1,129 @@
 #include "register.h"
 
 #include <errno.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/ptrace.h>
 #include <sys/user.h>
 
+#include "tdb/stats.h"
+
 struct x86_64_register_descriptor {
     enum x86_64_register reg;
     int dwarf_reg;
+    size_t offset;
     char name[16];
 };
 
+#define TDB_REGISTER_OFFSET(FIELD) offsetof(struct user_regs_struct, FIELD)
+
+// indexed by enum x86_64_register
 static const struct x86_64_register_descriptor g_tdb_register_descriptors[X86_64_REGISTER_COUNT] = {
-    {.reg = x86_64_r15, .dwarf_reg = 15, .name = "r15"},
-    {.reg = x86_64_r14, .dwarf_reg = 14, .name = "r14"},
-    {.reg = x86_64_r13, .dwarf_reg = 13, .name = "r13"},
-    {.reg = x86_64_r12, .dwarf_reg = 12, .name = "r12"},
-    {.reg = x86_64_rbp, .dwarf_reg = 6, .name = "rbp"},
-    {.reg = x86_64_rbx, .dwarf_reg = 3, .name = "rbx"},
-    {.reg = x86_64_r11, .dwarf_reg = 11, .name = "r11"},
-    {.reg = x86_64_r10, .dwarf_reg = 10, .name = "r10"},
-    {.reg = x86_64_r9, .dwarf_reg = 9, .name = "r9"},
-    {.reg = x86_64_r8, .dwarf_reg = 8, .name = "r8"},
-    {.reg = x86_64_rax, .dwarf_reg = 0, .name = "rax"},
-    {.reg = x86_64_rcx, .dwarf_reg = 2, .name = "rcx"},
-    {.reg = x86_64_rdx, .dwarf_reg = 1, .name = "rdx"},
-    {.reg = x86_64_rsi, .dwarf_reg = 4, .name = "rsi"},
-    {.reg = x86_64_rdi, .dwarf_reg = 5, .name = "rdi"},
-    {.reg = x86_64_orig_rax, .dwarf_reg = -1, .name = "orig_rax"},
-    {.reg = x86_64_rip, .dwarf_reg = -1, .name = "rip"},
-    {.reg = x86_64_cs, .dwarf_reg = 51, .name = "cs"},
-    {.reg = x86_64_eflags, .dwarf_reg = 49, .name = "eflags"},
-    {.reg = x86_64_rsp, .dwarf_reg = 7, .name = "rsp"},
-    {.reg = x86_64_ss, .dwarf_reg = 52, .name = "ss"},
-    {.reg = x86_64_fs_base, .dwarf_reg = 58, .name = "fs_base"},
-    {.reg = x86_64_gs_base, .dwarf_reg = 59, .name = "gs_base"},
-    {.reg = x86_64_ds, .dwarf_reg = 53, .name = "ds"},
-    {.reg = x86_64_es, .dwarf_reg = 50, .name = "es"},
-    {.reg = x86_64_fs, .dwarf_reg = 54, .name = "fs"},
-    {.reg = x86_64_gs, .dwarf_reg = 55, .name = "gs"},
+    [x86_64_rax] = {.reg = x86_64_rax, .dwarf_reg = 0, .offset = TDB_REGISTER_OFFSET(rax), .name = "rax"},
+    [x86_64_rbx] = {.reg = x86_64_rbx, .dwarf_reg = 3, .offset = TDB_REGISTER_OFFSET(rbx), .name = "rbx"},
+    [x86_64_rcx] = {.reg = x86_64_rcx, .dwarf_reg = 2, .offset = TDB_REGISTER_OFFSET(rcx), .name = "rcx"},
+    [x86_64_rdx] = {.reg = x86_64_rdx, .dwarf_reg = 1, .offset = TDB_REGISTER_OFFSET(rdx), .name = "rdx"},
+    [x86_64_rdi] = {.reg = x86_64_rdi, .dwarf_reg = 5, .offset = TDB_REGISTER_OFFSET(rdi), .name = "rdi"},
+    [x86_64_rsi] = {.reg = x86_64_rsi, .dwarf_reg = 4, .offset = TDB_REGISTER_OFFSET(rsi), .name = "rsi"},
+    [x86_64_rbp] = {.reg = x86_64_rbp, .dwarf_reg = 6, .offset = TDB_REGISTER_OFFSET(rbp), .name = "rbp"},
+    [x86_64_rsp] = {.reg = x86_64_rsp, .dwarf_reg = 7, .offset = TDB_REGISTER_OFFSET(rsp), .name = "rsp"},
+    [x86_64_r8] = {.reg = x86_64_r8, .dwarf_reg = 8, .offset = TDB_REGISTER_OFFSET(r8), .name = "r8"},
+    [x86_64_r9] = {.reg = x86_64_r9, .dwarf_reg = 9, .offset = TDB_REGISTER_OFFSET(r9), .name = "r9"},
+    [x86_64_r10] = {.reg = x86_64_r10, .dwarf_reg = 10, .offset = TDB_REGISTER_OFFSET(r10), .name = "r10"},
+    [x86_64_r11] = {.reg = x86_64_r11, .dwarf_reg = 11, .offset = TDB_REGISTER_OFFSET(r11), .name = "r11"},
+    [x86_64_r12] = {.reg = x86_64_r12, .dwarf_reg = 12, .offset = TDB_REGISTER_OFFSET(r12), .name = "r12"},
+    [x86_64_r13] = {.reg = x86_64_r13, .dwarf_reg = 13, .offset = TDB_REGISTER_OFFSET(r13), .name = "r13"},
+    [x86_64_r14] = {.reg = x86_64_r14, .dwarf_reg = 14, .offset = TDB_REGISTER_OFFSET(r14), .name = "r14"},
+    [x86_64_r15] = {.reg = x86_64_r15, .dwarf_reg = 15, .offset = TDB_REGISTER_OFFSET(r15), .name = "r15"},
+    [x86_64_rip] = {.reg = x86_64_rip, .dwarf_reg = -1, .offset = TDB_REGISTER_OFFSET(rip), .name = "rip"},
+    [x86_64_eflags] = {.reg = x86_64_eflags, .dwarf_reg = 49, .offset = TDB_REGISTER_OFFSET(eflags), .name = "eflags"},
+    [x86_64_cs] = {.reg = x86_64_cs, .dwarf_reg = 51, .offset = TDB_REGISTER_OFFSET(cs), .name = "cs"},
+    [x86_64_orig_rax] = {.reg = x86_64_orig_rax, .dwarf_reg = -1, .offset = TDB_REGISTER_OFFSET(orig_rax), .name = "orig_rax"},
+    [x86_64_fs_base] = {.reg = x86_64_fs_base, .dwarf_reg = 58, .offset = TDB_REGISTER_OFFSET(fs_base), .name = "fs_base"},
+    [x86_64_gs_base] = {.reg = x86_64_gs_base, .dwarf_reg = 59, .offset = TDB_REGISTER_OFFSET(gs_base), .name = "gs_base"},
+    [x86_64_fs] = {.reg = x86_64_fs, .dwarf_reg = 54, .offset = TDB_REGISTER_OFFSET(fs), .name = "fs"},
+    [x86_64_gs] = {.reg = x86_64_gs, .dwarf_reg = 55, .offset = TDB_REGISTER_OFFSET(gs), .name = "gs"},
+    [x86_64_ss] = {.reg = x86_64_ss, .dwarf_reg = 52, .offset = TDB_REGISTER_OFFSET(ss), .name = "ss"},
+    [x86_64_ds] = {.reg = x86_64_ds, .dwarf_reg = 53, .offset = TDB_REGISTER_OFFSET(ds), .name = "ds"},
+    [x86_64_es] = {.reg = x86_64_es, .dwarf_reg = 50, .offset = TDB_REGISTER_OFFSET(es), .name = "es"},
 };
 
+#undef TDB_REGISTER_OFFSET
+
+void tdb_register_cache_init(struct tdb_register_cache* cache, pid_t pid)
+{
+    cache->pid = pid;
+    memset(&cache->regs, 0, sizeof(cache->regs));
+    cache->valid = false;
+    cache->dirty = false;
+}
+
+static bool tdb_register_cache_fetch(struct tdb_register_cache* cache)
+{
+    if (cache->valid) {
+        return true;
+    }
+
+    errno = 0;
+    tdb_ptrace(PTRACE_GETREGS, cache->pid, NULL, &cache->regs);
+
+    if (errno != 0) {
+        fprintf(stderr, "Failed to get register data: %s\n", strerror(errno));
+        return false;
+    }
+
+    cache->valid = true;
+    cache->dirty = false;
+    return true;
+}
+
+bool tdb_register_cache_flush(struct tdb_register_cache* cache)
+{
+    if (!cache->dirty) {
+        return true;
+    }
+
+    errno = 0;
+    tdb_ptrace(PTRACE_SETREGS, cache->pid, NULL, &cache->regs);
+
+    if (errno != 0) {
+        fprintf(stderr,
+                "tdb_register_cache_flush: failed to set register data.\n"
+                "REASON: %s\n",
+                strerror(errno));
+        return false;
+    }
+
+    cache->dirty = false;
+    return true;
+}
+
+void tdb_register_cache_invalidate(struct tdb_register_cache* cache)
+{
+    cache->valid = false;
+    cache->dirty = false;
+}
+
+static uint64_t* tdb_register_slot(struct tdb_register_cache* cache, enum x86_64_register r)
+{
+    return (uint64_t*)((uint8_t*)&cache->regs + g_tdb_register_descriptors[r].offset);
+}
+
 const char* tdb_get_name_from_register(enum x86_64_register reg)
+{
+    if (reg >= X86_64_REGISTER_COUNT) {
+        return NULL;
+    }
+
+    return g_tdb_register_descriptors[reg].name;
+}
+
+const char* tdb_get_name_from_register_offset(size_t offset)
 {
     for (size_t i = 0; i < X86_64_REGISTER_COUNT; i++) {
-        const struct x86_64_register_descriptor* desc = &g_tdb_register_descriptors[i];
-        if (desc->reg == reg) {
-            return desc->name;
+        if (g_tdb_register_descriptors[i].offset == offset) {
+            return g_tdb_register_descriptors[i].name;
         }
     }
 
@@ -66,231 +142,36 @@ enum x86_64_register tdb_get_register_from_name(const char* name)
     return x86_64_unknown;
 }
 
-bool tdb_set_register_value(pid_t pid, enum x86_64_register r, uint64_t value)
+bool tdb_set_register_value(struct tdb_register_cache* cache, enum x86_64_register r, uint64_t value)
 {
-    struct user_regs_struct uregs;
-    errno = 0;
-    ptrace(PTRACE_GETREGS, pid, NULL, &uregs);
-
-    if (errno != 0) {
-        fprintf(stderr,
-                "tdb_set_register_value: failed to get register data.\n"
-                "REASON: %s\n",
-                strerror(errno));
+    if (r >= X86_64_REGISTER_COUNT || !tdb_register_cache_fetch(cache)) {
         return false;
     }
 
-    switch (r) {
-        case x86_64_rax:
-            uregs.rax = value;
-            break;
-        case x86_64_rbx:
-            uregs.rbx = value;
-            break;
-        case x86_64_rcx:
-            uregs.rcx = value;
-            break;
-        case x86_64_rdx:
-            uregs.rdx = value;
-            break;
-        case x86_64_rdi:
-            uregs.rdi = value;
-            break;
-        case x86_64_rsi:
-            uregs.rsi = value;
-            break;
-        case x86_64_rbp:
-            uregs.rbp = value;
-            break;
-        case x86_64_rsp:
-            uregs.rsp = value;
-            break;
-        case x86_64_r8:
-            uregs.r8 = value;
-            break;
-        case x86_64_r9:
-            uregs.r9 = value;
-            break;
-        case x86_64_r10:
-            uregs.r10 = value;
-            break;
-        case x86_64_r11:
-            uregs.r11 = value;
-            break;
-        case x86_64_r12:
-            uregs.r12 = value;
-            break;
-        case x86_64_r13:
-            uregs.r13 = value;
-            break;
-        case x86_64_r14:
-            uregs.r14 = value;
-            break;
-        case x86_64_r15:
-            uregs.r15 = value;
-            break;
-        case x86_64_rip:
-            uregs.rip = value;
-            break;
-        case x86_64_eflags:
-            uregs.eflags = value;
-            break;
-        case x86_64_cs:
-            uregs.cs = value;
-            break;
-        case x86_64_orig_rax:
-            uregs.orig_rax = value;
-            break;
-        case x86_64_fs_base:
-            uregs.fs_base = value;
-            break;
-        case x86_64_gs_base:
-            uregs.gs_base = value;
-            break;
-        case x86_64_fs:
-            uregs.fs = value;
-            break;
-        case x86_64_gs:
-            uregs.gs = value;
-            break;
-        case x86_64_ss:
-            uregs.ss = value;
-            break;
-        case x86_64_ds:
-            uregs.ds = value;
-            break;
-        case x86_64_es:
-            uregs.es = value;
-            break;
-        default:
-            return false;
-            break;
-    };
-
-    errno = 0;
-    ptrace(PTRACE_SETREGS, pid, NULL, &uregs);
-
-    if (errno != 0) {
-        fprintf(stderr,
-                "tdb_set_register_value: failed to set register data.\n"
-                "REASON: %s\n",
-                strerror(errno));
-        return false;
-    }
+    *tdb_register_slot(cache, r) = value;
+    cache->dirty = true;
 
     return true;
 }
 
-uint64_t tdb_get_register_value(pid_t pid, enum x86_64_register r, bool* success)
+uint64_t tdb_get_register_value(struct tdb_register_cache* cache, enum x86_64_register r, bool* success)
 {
-    struct user_regs_struct uregs;
-    errno = 0;
-    ptrace(PTRACE_GETREGS, pid, NULL, &uregs);
-
-    if (errno != 0) {
-        fprintf(stderr, "Failed to get register data: %s\n", strerror(errno));
+    if (r >= X86_64_REGISTER_COUNT || !tdb_register_cache_fetch(cache)) {
         *success = false;
         return 0;
     }
 
     *success = true;
-    uint64_t register_content = 0;
-    switch (r) {
-        case x86_64_rax:
-            register_content = uregs.rax;
-            break;
-        case x86_64_rbx:
-            register_content = uregs.rbx;
-            break;
-        case x86_64_rcx:
-            register_content = uregs.rcx;
-            break;
-        case x86_64_rdx:
-            register_content = uregs.rdx;
-            break;
-        case x86_64_rdi:
-            register_content = uregs.rdi;
-            break;
-        case x86_64_rsi:
-            register_content = uregs.rsi;
-            break;
-        case x86_64_rbp:
-            register_content = uregs.rbp;
-            break;
-        case x86_64_rsp:
-            register_content = uregs.rsp;
-            break;
-        case x86_64_r8:
-            register_content = uregs.r8;
-            break;
-        case x86_64_r9:
-            register_content = uregs.r9;
-            break;
-        case x86_64_r10:
-            register_content = uregs.r10;
-            break;
-        case x86_64_r11:
-            register_content = uregs.r11;
-            break;
-        case x86_64_r12:
-            register_content = uregs.r12;
-            break;
-        case x86_64_r13:
-            register_content = uregs.r13;
-            break;
-        case x86_64_r14:
-            register_content = uregs.r14;
-            break;
-        case x86_64_r15:
-            register_content = uregs.r15;
-            break;
-        case x86_64_rip:
-            register_content = uregs.rip;
-            break;
-        case x86_64_eflags:
-            register_content = uregs.eflags;
-            break;
-        case x86_64_cs:
-            register_content = uregs.cs;
-            break;
-        case x86_64_orig_rax:
-            register_content = uregs.orig_rax;
-            break;
-        case x86_64_fs_base:
-            register_content = uregs.fs_base;
-            break;
-        case x86_64_gs_base:
-            register_content = uregs.gs_base;
-            break;
-        case x86_64_fs:
-            register_content = uregs.fs;
-            break;
-        case x86_64_gs:
-            register_content = uregs.gs;
-            break;
-        case x86_64_ss:
-            register_content = uregs.ss;
-            break;
-        case x86_64_ds:
-            register_content = uregs.ds;
-            break;
-        case x86_64_es:
-            register_content = uregs.es;
-            break;
-        default:
-            *success = false;
-            break;
-    };
-
-    return register_content;
+    return *tdb_register_slot(cache, r);
 }
 
-uint64_t tdb_get_register_value_from_dwarf_register(pid_t pid, int dwarf_reg, bool* success)
+uint64_t tdb_get_register_value_from_dwarf_register(struct tdb_register_cache* cache, int dwarf_reg,
+                                                    bool* success)
 {
     for (size_t i = 0; i < X86_64_REGISTER_COUNT; i++) {
         const struct x86_64_register_descriptor* desc = &g_tdb_register_descriptors[i];
         if (desc->dwarf_reg == dwarf_reg) {
-            return tdb_get_register_value(pid, desc->reg, success);
+            return tdb_get_register_value(cache, desc->reg, success);
         }
     }
 
@@ -298,13 +179,13 @@ uint64_t tdb_get_register_value_from_dwarf_register(pid_t pid, int dwarf_reg, bo
     return 0;
 }
 
-void tdb_dump_registers(pid_t pid)
+void tdb_dump_registers(struct tdb_register_cache* cache)
 {
     for (size_t i = 0; i < X86_64_REGISTER_COUNT; i++) {
         const struct x86_64_register_descriptor* desc = &g_tdb_register_descriptors[i];
 
         bool success;
-        uint64_t reg_val = tdb_get_register_value(pid, desc->reg, &success);
+        uint64_t reg_val = tdb_get_register_value(cache, desc->reg, &success);
         if (success) {
             printf("%s\t\t 0x%zx\n", desc->name, reg_val);
         }
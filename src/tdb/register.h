@@ -3,6 +3,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <sys/types.h>
+#include <sys/user.h>
 #include <unistd.h>
 
 enum x86_64_register {
@@ -37,11 +38,28 @@ enum x86_64_register {
     x86_64_unknown
 };
 
+// Holds the general purpose registers of a stopped inferior. The registers are
+// fetched with a single PTRACE_GETREGS the first time they are needed after a
+// stop, and modifications are only written back by tdb_register_cache_flush,
+// which must happen before the inferior is resumed.
+struct tdb_register_cache {
+    pid_t pid;
+    struct user_regs_struct regs;
+    bool valid;
+    bool dirty;
+};
+
+void tdb_register_cache_init(struct tdb_register_cache* cache, pid_t pid);
+bool tdb_register_cache_flush(struct tdb_register_cache* cache);
+void tdb_register_cache_invalidate(struct tdb_register_cache* cache);
+
 const char* tdb_get_name_from_register(enum x86_64_register reg);
+const char* tdb_get_name_from_register_offset(size_t offset);  // offset into struct user_regs_struct
 enum x86_64_register tdb_get_register_from_name(const char* name);
 
-bool tdb_set_register_value(pid_t pid, enum x86_64_register r, uint64_t value);
-uint64_t tdb_get_register_value(pid_t pid, enum x86_64_register r, bool* success);
+bool tdb_set_register_value(struct tdb_register_cache* cache, enum x86_64_register r, uint64_t value);
+uint64_t tdb_get_register_value(struct tdb_register_cache* cache, enum x86_64_register r, bool* success);
 
-uint64_t tdb_get_register_value_from_dwarf_register(pid_t pid, int dwarf_reg, bool* success);
-void tdb_dump_registers(pid_t pid);
+uint64_t tdb_get_register_value_from_dwarf_register(struct tdb_register_cache* cache, int dwarf_reg,
+                                                    bool* success);
+void tdb_dump_registers(struct tdb_register_cache* cache);
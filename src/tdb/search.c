@@ -0,0 +1,345 @@
+#define _GNU_SOURCE
+
+#include "search.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "tdb/stats.h"
+
+#define TDB_SEARCH_CHUNK_SIZE (16 * 1024 * 1024)
+#define TDB_SEARCH_PAGE_SIZE 4096
+
+// Per worker, so searching for something common like a zero word stays bounded. All
+// matches are still counted.
+#define TDB_SEARCH_MAX_STORED_MATCHES (1024 * 1024)
+
+// Matches start in [start, end), and may run on up to read_end.
+struct tdb_search_chunk {
+    uint64_t start;
+    uint64_t end;
+    uint64_t read_end;
+    const uint8_t* data;  // bytes from start to read_end if already in memory, else NULL
+};
+
+struct tdb_search_job {
+    pid_t pid;
+    const uint8_t* pattern;
+    size_t pattern_length;
+
+    struct tdb_search_chunk* chunks;
+    size_t chunk_count;
+    _Atomic size_t next_chunk;
+};
+
+struct tdb_search_worker {
+    struct tdb_search_job* job;
+    pthread_t thread;
+    uint8_t* buffer;
+
+    uint64_t* matches;
+    size_t stored_count;
+    size_t capacity;
+    size_t match_count;
+    bool failed;
+
+    uint64_t bytes_searched;
+    struct tdb_stat_counter reads;  // added to the totals once the workers are done
+};
+
+static void tdb_search_add_match(struct tdb_search_worker* worker, uint64_t address)
+{
+    worker->match_count++;
+
+    if (worker->stored_count == worker->capacity) {
+        if (worker->capacity == TDB_SEARCH_MAX_STORED_MATCHES) {
+            return;
+        }
+
+        size_t new_capacity = worker->capacity == 0 ? 64 : 2 * worker->capacity;
+        uint64_t* matches = realloc(worker->matches, new_capacity * sizeof(uint64_t));
+        if (matches == NULL) {
+            worker->failed = true;
+            return;
+        }
+        worker->matches = matches;
+        worker->capacity = new_capacity;
+    }
+
+    worker->matches[worker->stored_count++] = address;
+}
+
+// Finds the matches starting before start_limit in data, which holds the bytes at address.
+static void tdb_search_scan(struct tdb_search_worker* worker, const uint8_t* data, size_t length,
+                            size_t start_limit, uint64_t address)
+{
+    const uint8_t* pattern = worker->job->pattern;
+    const size_t k = worker->job->pattern_length;
+
+    if (length < k) {
+        return;
+    }
+    if (start_limit > length - k + 1) {
+        start_limit = length - k + 1;
+    }
+
+    worker->bytes_searched += start_limit;
+    size_t i = 0;
+
+#if defined(__AVX2__)
+    const __m256i first = _mm256_set1_epi8((char)pattern[0]);
+    const __m256i last = _mm256_set1_epi8((char)pattern[k - 1]);
+
+    for (; i + 32 <= start_limit; i += 32) {
+        const __m256i block_first = _mm256_loadu_si256((const __m256i*)(data + i));
+        const __m256i block_last = _mm256_loadu_si256((const __m256i*)(data + i + k - 1));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(block_first, first), _mm256_cmpeq_epi8(block_last, last)));
+
+        while (mask != 0) {
+            const size_t position = i + (size_t)__builtin_ctz(mask);
+            if (k <= 2 || memcmp(data + position + 1, pattern + 1, k - 2) == 0) {
+                tdb_search_add_match(worker, address + position);
+            }
+            mask &= mask - 1;
+        }
+    }
+#elif defined(__SSE2__)
+    const __m128i first = _mm_set1_epi8((char)pattern[0]);
+    const __m128i last = _mm_set1_epi8((char)pattern[k - 1]);
+
+    for (; i + 16 <= start_limit; i += 16) {
+        const __m128i block_first = _mm_loadu_si128((const __m128i*)(data + i));
+        const __m128i block_last = _mm_loadu_si128((const __m128i*)(data + i + k - 1));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(block_first, first), _mm_cmpeq_epi8(block_last, last)));
+
+        while (mask != 0) {
+            const size_t position = i + (size_t)__builtin_ctz(mask);
+            if (k <= 2 || memcmp(data + position + 1, pattern + 1, k - 2) == 0) {
+                tdb_search_add_match(worker, address + position);
+            }
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    // the tail, or everything without SIMD
+    while (i < start_limit) {
+        const uint8_t* candidate = memchr(data + i, pattern[0], start_limit - i);
+        if (candidate == NULL) {
+            break;
+        }
+
+        i = (size_t)(candidate - data);
+        if (data[i + k - 1] == pattern[k - 1] && memcmp(data + i, pattern, k) == 0) {
+            tdb_search_add_match(worker, address + i);
+        }
+        i++;
+    }
+}
+
+// Reads a chunk in as few process_vm_readv calls as it takes. A page that can't be read
+// splits the chunk: what was read before it is searched, and reading resumes after it.
+static void tdb_search_read_chunk(struct tdb_search_worker* worker, const struct tdb_search_chunk* chunk)
+{
+    uint64_t span_start = chunk->start;
+    uint64_t address = chunk->start;
+    size_t filled = 0;
+
+    while (address < chunk->read_end) {
+        struct iovec local = {.iov_base = worker->buffer + filled, .iov_len = chunk->read_end - address};
+        struct iovec remote = {.iov_base = (void*)address, .iov_len = chunk->read_end - address};
+
+        const uint64_t start = tdb_stats_start();
+        const ssize_t count = process_vm_readv(worker->job->pid, &local, 1, &remote, 1, 0);
+        worker->reads.count++;
+        worker->reads.cycles += tdb_stats_start() - start;
+
+        if (count > 0) {
+            filled += (size_t)count;
+            address += (uint64_t)count;
+            continue;
+        }
+
+        if (span_start < chunk->end) {
+            tdb_search_scan(worker, worker->buffer, filled, chunk->end - span_start, span_start);
+        }
+
+        address = (address & ~(uint64_t)(TDB_SEARCH_PAGE_SIZE - 1)) + TDB_SEARCH_PAGE_SIZE;
+        span_start = address;
+        filled = 0;
+    }
+
+    if (span_start < chunk->end) {
+        tdb_search_scan(worker, worker->buffer, filled, chunk->end - span_start, span_start);
+    }
+}
+
+static void* tdb_search_worker_main(void* argument)
+{
+    struct tdb_search_worker* worker = argument;
+    struct tdb_search_job* job = worker->job;
+
+    size_t index;
+    while (!worker->failed && (index = atomic_fetch_add(&job->next_chunk, 1)) < job->chunk_count) {
+        const struct tdb_search_chunk* chunk = &job->chunks[index];
+
+        if (chunk->data != NULL) {
+            tdb_search_scan(worker, chunk->data, chunk->read_end - chunk->start, chunk->end - chunk->start,
+                            chunk->start);
+        }
+        else {
+            tdb_search_read_chunk(worker, chunk);
+        }
+    }
+
+    return NULL;
+}
+
+static int tdb_search_compare_addresses(const void* a, const void* b)
+{
+    const uint64_t left = *(const uint64_t*)a;
+    const uint64_t right = *(const uint64_t*)b;
+    return (left > right) - (left < right);
+}
+
+static bool tdb_search_make_chunks(struct tdb_search_job* job, const struct tdb_search_region* regions,
+                                   size_t region_count)
+{
+    size_t capacity = 0;
+
+    for (size_t i = 0; i < region_count; i++) {
+        const struct tdb_search_region* region = &regions[i];
+
+        for (uint64_t start = region->start; start + job->pattern_length <= region->end;
+             start += TDB_SEARCH_CHUNK_SIZE) {
+            if (job->chunk_count == capacity) {
+                capacity = capacity == 0 ? 64 : 2 * capacity;
+                struct tdb_search_chunk* chunks = realloc(job->chunks, capacity * sizeof(struct tdb_search_chunk));
+                if (chunks == NULL) {
+                    fprintf(stderr, "Failed to allocate search chunks\n");
+                    return false;
+                }
+                job->chunks = chunks;
+            }
+
+            // chunks overlap by one byte less than the pattern, so no match is missed or
+            // found twice
+            struct tdb_search_chunk* chunk = &job->chunks[job->chunk_count++];
+            chunk->start = start;
+            chunk->end = region->end - start < TDB_SEARCH_CHUNK_SIZE ? region->end : start + TDB_SEARCH_CHUNK_SIZE;
+            chunk->read_end = region->end - chunk->end < job->pattern_length - 1 ? region->end
+                                                                                  : chunk->end + job->pattern_length - 1;
+            chunk->data = region->data != NULL ? region->data + (start - region->start) : NULL;
+        }
+    }
+
+    return true;
+}
+
+bool tdb_search_memory(pid_t pid, const struct tdb_search_region* regions, size_t region_count, const uint8_t* pattern,
+                       size_t pattern_length, struct tdb_search_result* result)
+{
+    memset(result, 0, sizeof(*result));
+
+    if (pattern_length == 0) {
+        return false;
+    }
+
+    struct tdb_search_job job = {.pid = pid, .pattern = pattern, .pattern_length = pattern_length};
+    atomic_init(&job.next_chunk, 0);
+
+    if (!tdb_search_make_chunks(&job, regions, region_count)) {
+        free(job.chunks);
+        return false;
+    }
+
+    long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t worker_count = cpu_count > 0 ? (size_t)cpu_count : 1;
+    if (worker_count > TDB_SEARCH_MAX_WORKERS) {
+        worker_count = TDB_SEARCH_MAX_WORKERS;
+    }
+    if (worker_count > job.chunk_count) {
+        worker_count = job.chunk_count > 0 ? job.chunk_count : 1;
+    }
+
+    struct tdb_search_worker workers[TDB_SEARCH_MAX_WORKERS];
+    memset(workers, 0, sizeof(workers));
+
+    bool success = true;
+    for (size_t i = 0; i < worker_count; i++) {
+        workers[i].job = &job;
+        workers[i].buffer = malloc(TDB_SEARCH_CHUNK_SIZE + pattern_length);
+        success = success && workers[i].buffer != NULL;
+    }
+
+    // the calling thread is the first worker
+    size_t started = 1;
+    for (; success && started < worker_count; started++) {
+        if (pthread_create(&workers[started].thread, NULL, tdb_search_worker_main, &workers[started]) != 0) {
+            break;
+        }
+    }
+
+    if (success) {
+        tdb_search_worker_main(&workers[0]);
+    }
+
+    for (size_t i = 1; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+
+    size_t stored_count = 0;
+    for (size_t i = 0; i < worker_count; i++) {
+        stored_count += workers[i].stored_count;
+        success = success && !workers[i].failed;
+    }
+
+    result->matches = success ? malloc((stored_count + 1) * sizeof(uint64_t)) : NULL;
+    success = success && result->matches != NULL;
+
+    for (size_t i = 0; i < worker_count; i++) {
+        struct tdb_search_worker* worker = &workers[i];
+
+        if (success) {
+            memcpy(result->matches + result->stored_count, worker->matches, worker->stored_count * sizeof(uint64_t));
+            result->stored_count += worker->stored_count;
+            result->match_count += worker->match_count;
+            result->bytes_searched += worker->bytes_searched;
+        }
+
+        g_tdb_stats[TDB_STAT_PROCESS_VM].count += worker->reads.count;
+        g_tdb_stats[TDB_STAT_PROCESS_VM].cycles += worker->reads.cycles;
+
+        free(worker->matches);
+        free(worker->buffer);
+    }
+
+    free(job.chunks);
+
+    if (!success) {
+        fprintf(stderr, "Out of memory while searching\n");
+        tdb_search_result_free(result);
+        return false;
+    }
+
+    qsort(result->matches, result->stored_count, sizeof(uint64_t), tdb_search_compare_addresses);
+    result->worker_count = (unsigned)started;
+    return true;
+}
+
+void tdb_search_result_free(struct tdb_search_result* result)
+{
+    free(result->matches);
+    memset(result, 0, sizeof(*result));
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Searching the memory of a stopped process for a byte pattern. Regions are cut into
+// chunks that a few worker threads read with large process_vm_readv calls and scan with
+// a first-byte/last-byte filter: candidates are positions where both the first and the
+// last byte of the pattern match, found 32 (AVX2) or 16 (SSE2) positions at a time, and
+// only those are compared in full.
+
+#define TDB_SEARCH_MAX_WORKERS 8
+
+struct tdb_search_region {
+    uint64_t start;
+    uint64_t end;
+    const uint8_t* data;  // the region's bytes if they are already in memory (a core file), else NULL
+};
+
+struct tdb_search_result {
+    uint64_t* matches;  // sorted start addresses, only up to a limit when there are very many
+    size_t stored_count;
+    size_t match_count;
+    uint64_t bytes_searched;
+    unsigned worker_count;
+};
+
+bool tdb_search_memory(pid_t pid, const struct tdb_search_region* regions, size_t region_count, const uint8_t* pattern,
+                       size_t pattern_length, struct tdb_search_result* result);
+void tdb_search_result_free(struct tdb_search_result* result);
@@ -0,0 +1,427 @@
+#include "snapshot.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tdb/stats.h"
+#include "tdb/utility.h"
+
+#define TDB_SNAPSHOT_PAGE_SIZE 4096
+#define TDB_SNAPSHOT_BATCH_PAGES 1024  // 4 MiB of memory and 8 KiB of pagemap at a time
+
+#define TDB_PAGEMAP_SOFT_DIRTY (1ULL << 55)
+#define TDB_PAGEMAP_SWAPPED (1ULL << 62)
+#define TDB_PAGEMAP_PRESENT (1ULL << 63)
+
+void tdb_snapshot_init(struct tdb_snapshot* snapshot)
+{
+    memset(snapshot, 0, sizeof(*snapshot));
+}
+
+void tdb_snapshot_free(struct tdb_snapshot* snapshot)
+{
+    for (size_t i = 0; i < snapshot->region_count; i++) {
+        free(snapshot->regions[i].page_hashes);
+    }
+    free(snapshot->regions);
+
+    tdb_snapshot_init(snapshot);
+}
+
+// Four independent lanes, so the multiplies of one word don't wait for the previous.
+static uint64_t tdb_snapshot_hash_page(const uint8_t* page)
+{
+    const uint64_t* words = (const uint64_t*)page;
+    uint64_t lanes[4] = {0x9e3779b97f4a7c15, 0xbf58476d1ce4e5b9, 0x94d049bb133111eb, 0x2545f4914f6cdd1d};
+
+    for (size_t i = 0; i < TDB_SNAPSHOT_PAGE_SIZE / sizeof(uint64_t); i += 4) {
+        for (size_t lane = 0; lane < 4; lane++) {
+            lanes[lane] = (lanes[lane] ^ words[i + lane]) * 0xff51afd7ed558ccd;
+            lanes[lane] ^= lanes[lane] >> 32;
+        }
+    }
+
+    uint64_t hash = lanes[0] ^ (lanes[1] * 3) ^ (lanes[2] * 5) ^ (lanes[3] * 7);
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+static uint64_t tdb_snapshot_zero_page_hash(void)
+{
+    static const uint8_t zero_page[TDB_SNAPSHOT_PAGE_SIZE];
+    static uint64_t hash = 0;
+
+    if (hash == 0) {
+        hash = tdb_snapshot_hash_page(zero_page);
+    }
+    return hash;
+}
+
+static int tdb_snapshot_open_proc_file(pid_t pid, const char* name, int flags)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/%s", pid, name);
+
+    int fd = open(path, flags);
+    if (fd == -1) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+    }
+    return fd;
+}
+
+// Reads the pagemap entries of page_count pages from address on. Entries of pages that
+// aren't mapped read as 0.
+static bool tdb_snapshot_read_pagemap(int pagemap_fd, uint64_t address, size_t page_count, uint64_t* entries)
+{
+    const uint64_t start = tdb_stats_start();
+    const size_t size = page_count * sizeof(uint64_t);
+    const off_t offset = (off_t)(address / TDB_SNAPSHOT_PAGE_SIZE * sizeof(uint64_t));
+
+    size_t done = 0;
+    while (done < size) {
+        ssize_t count = pread(pagemap_fd, (uint8_t*)entries + done, size - done, offset + (off_t)done);
+        if (count <= 0) {
+            break;
+        }
+        done += (size_t)count;
+    }
+
+    memset((uint8_t*)entries + done, 0, size - done);
+    tdb_stats_record(TDB_STAT_PROC_OTHER, start);
+    return done == size;
+}
+
+// Hashes the selected pages of a batch, reading each run of consecutive selected pages
+// with one call. Pages that can't be read hash like zero pages. Returns the number of
+// pages read.
+static uint64_t tdb_snapshot_hash_pages(pid_t pid, uint64_t address, size_t page_count, const bool* selected,
+                                        uint8_t* buffer, uint64_t* hashes)
+{
+    uint64_t pages_read = 0;
+    size_t page = 0;
+
+    while (page < page_count) {
+        if (!selected[page]) {
+            page++;
+            continue;
+        }
+
+        size_t run_end = page + 1;
+        while (run_end < page_count && selected[run_end]) {
+            run_end++;
+        }
+
+        const size_t length = (run_end - page) * TDB_SNAPSHOT_PAGE_SIZE;
+        const size_t received =
+            tdb_read_memory_range(pid, address + page * TDB_SNAPSHOT_PAGE_SIZE, buffer, length);
+        memset(buffer + received, 0, length - received);
+
+        for (size_t i = page; i < run_end; i++) {
+            hashes[i] = tdb_snapshot_hash_page(buffer + (i - page) * TDB_SNAPSHOT_PAGE_SIZE);
+        }
+
+        pages_read += run_end - page;
+        page = run_end;
+    }
+
+    return pages_read;
+}
+
+static bool tdb_snapshot_add_region(struct tdb_snapshot* snapshot, const struct tdb_mapping* mapping)
+{
+    if (snapshot->region_count == snapshot->region_capacity) {
+        size_t new_capacity = snapshot->region_capacity == 0 ? 32 : 2 * snapshot->region_capacity;
+        struct tdb_snapshot_region* regions =
+            realloc(snapshot->regions, new_capacity * sizeof(struct tdb_snapshot_region));
+        if (regions == NULL) {
+            return false;
+        }
+        snapshot->regions = regions;
+        snapshot->region_capacity = new_capacity;
+    }
+
+    struct tdb_snapshot_region* region = &snapshot->regions[snapshot->region_count];
+    region->start = mapping->start;
+    region->end = mapping->end;
+    region->page_hashes = malloc((mapping->end - mapping->start) / TDB_SNAPSHOT_PAGE_SIZE * sizeof(uint64_t));
+    if (region->page_hashes == NULL) {
+        return false;
+    }
+
+    snapshot->region_count++;
+    return true;
+}
+
+static bool tdb_snapshot_is_writable(const struct tdb_mapping* mapping)
+{
+    const uint32_t wanted = TDB_MAPPING_READ | TDB_MAPPING_WRITE;
+    return (mapping->permissions & wanted) == wanted;
+}
+
+static bool tdb_snapshot_clear_soft_dirty(pid_t pid)
+{
+    const uint64_t start = tdb_stats_start();
+
+    int fd = tdb_snapshot_open_proc_file(pid, "clear_refs", O_WRONLY);
+    bool success = fd != -1 && write(fd, "4", 1) == 1;
+    if (fd != -1) {
+        close(fd);
+    }
+
+    tdb_stats_record(TDB_STAT_PROC_OTHER, start);
+    return success;
+}
+
+bool tdb_snapshot_take(struct tdb_snapshot* snapshot, pid_t pid, const struct tdb_process_maps* maps)
+{
+    // a process that wrote nothing since the last snapshot has no soft-dirty bits to
+    // show that the kernel tracks them
+    const bool soft_dirty_known = snapshot->soft_dirty;
+    tdb_snapshot_free(snapshot);
+
+    int pagemap_fd = tdb_snapshot_open_proc_file(pid, "pagemap", O_RDONLY);
+    if (pagemap_fd == -1) {
+        return false;
+    }
+
+    uint8_t* buffer = malloc(TDB_SNAPSHOT_BATCH_PAGES * TDB_SNAPSHOT_PAGE_SIZE);
+    uint64_t entries[TDB_SNAPSHOT_BATCH_PAGES];
+    bool selected[TDB_SNAPSHOT_BATCH_PAGES];
+
+    bool any_soft_dirty = false;
+    bool success = buffer != NULL;
+
+    for (size_t i = 0; success && i < maps->mapping_count; i++) {
+        const struct tdb_mapping* mapping = &maps->mappings[i];
+        if (!tdb_snapshot_is_writable(mapping)) {
+            continue;
+        }
+
+        if (!tdb_snapshot_add_region(snapshot, mapping)) {
+            success = false;
+            break;
+        }
+
+        uint64_t* hashes = snapshot->regions[snapshot->region_count - 1].page_hashes;
+        const bool anonymous = mapping->object_index == TDB_MAPPING_NO_OBJECT;
+
+        for (uint64_t address = mapping->start; address < mapping->end;
+             address += TDB_SNAPSHOT_BATCH_PAGES * TDB_SNAPSHOT_PAGE_SIZE) {
+            size_t page_count = (mapping->end - address) / TDB_SNAPSHOT_PAGE_SIZE;
+            if (page_count > TDB_SNAPSHOT_BATCH_PAGES) {
+                page_count = TDB_SNAPSHOT_BATCH_PAGES;
+            }
+
+            tdb_snapshot_read_pagemap(pagemap_fd, address, page_count, entries);
+
+            // anonymous pages that were never touched are zero, without reading them;
+            // those of files have the file's contents
+            uint64_t* batch_hashes = hashes + (address - mapping->start) / TDB_SNAPSHOT_PAGE_SIZE;
+            for (size_t page = 0; page < page_count; page++) {
+                any_soft_dirty = any_soft_dirty || (entries[page] & TDB_PAGEMAP_SOFT_DIRTY);
+                selected[page] = !anonymous || (entries[page] & (TDB_PAGEMAP_PRESENT | TDB_PAGEMAP_SWAPPED));
+                batch_hashes[page] = tdb_snapshot_zero_page_hash();
+            }
+
+            snapshot->pages_read += tdb_snapshot_hash_pages(pid, address, page_count, selected, buffer, batch_hashes);
+        }
+    }
+
+    free(buffer);
+    close(pagemap_fd);
+
+    if (!success) {
+        fprintf(stderr, "Out of memory while taking a snapshot\n");
+        tdb_snapshot_free(snapshot);
+        return false;
+    }
+
+    snapshot->taken = true;
+    snapshot->soft_dirty = (soft_dirty_known || any_soft_dirty) && tdb_snapshot_clear_soft_dirty(pid);
+    return true;
+}
+
+static bool tdb_snapshot_add_change(struct tdb_snapshot_diff* diff, uint64_t start, uint64_t end,
+                                    enum tdb_snapshot_change_kind kind)
+{
+    if (diff->change_count > 0) {
+        struct tdb_snapshot_change* last = &diff->changes[diff->change_count - 1];
+        if (kind == TDB_SNAPSHOT_CHANGED && last->kind == TDB_SNAPSHOT_CHANGED && last->end == start) {
+            last->end = end;
+            return true;
+        }
+    }
+
+    if (diff->change_count == diff->change_capacity) {
+        size_t new_capacity = diff->change_capacity == 0 ? 64 : 2 * diff->change_capacity;
+        struct tdb_snapshot_change* changes = realloc(diff->changes, new_capacity * sizeof(struct tdb_snapshot_change));
+        if (changes == NULL) {
+            return false;
+        }
+        diff->changes = changes;
+        diff->change_capacity = new_capacity;
+    }
+
+    diff->changes[diff->change_count++] = (struct tdb_snapshot_change){.start = start, .end = end, .kind = kind};
+    return true;
+}
+
+// Adds the parts of a writable mapping that no snapshot region covers, such as a new
+// mapping the kernel merged with one that already existed.
+static bool tdb_snapshot_add_new_parts(const struct tdb_snapshot* snapshot, const struct tdb_mapping* mapping,
+                                       struct tdb_snapshot_diff* diff)
+{
+    uint64_t uncovered = mapping->start;
+
+    for (size_t i = 0; i < snapshot->region_count && uncovered < mapping->end; i++) {
+        const struct tdb_snapshot_region* region = &snapshot->regions[i];
+        if (region->end <= uncovered || region->start >= mapping->end) {
+            continue;
+        }
+
+        if (region->start > uncovered &&
+            !tdb_snapshot_add_change(diff, uncovered, region->start, TDB_SNAPSHOT_MAPPED)) {
+            return false;
+        }
+        uncovered = region->end;
+    }
+
+    return uncovered >= mapping->end || tdb_snapshot_add_change(diff, uncovered, mapping->end, TDB_SNAPSHOT_MAPPED);
+}
+
+static int tdb_snapshot_compare_changes(const void* a, const void* b)
+{
+    const struct tdb_snapshot_change* left = a;
+    const struct tdb_snapshot_change* right = b;
+    return (left->start > right->start) - (left->start < right->start);
+}
+
+// Compares the pages [start, end) of a region, which are all still mapped, with their
+// hashes in the snapshot.
+static bool tdb_snapshot_diff_pages(const struct tdb_snapshot* snapshot, const struct tdb_snapshot_region* region,
+                                    pid_t pid, int pagemap_fd, uint8_t* buffer, uint64_t start, uint64_t end,
+                                    struct tdb_snapshot_diff* diff)
+{
+    uint64_t entries[TDB_SNAPSHOT_BATCH_PAGES];
+    uint64_t hashes[TDB_SNAPSHOT_BATCH_PAGES];
+    bool selected[TDB_SNAPSHOT_BATCH_PAGES];
+
+    for (uint64_t address = start; address < end; address += TDB_SNAPSHOT_BATCH_PAGES * TDB_SNAPSHOT_PAGE_SIZE) {
+        size_t page_count = (end - address) / TDB_SNAPSHOT_PAGE_SIZE;
+        if (page_count > TDB_SNAPSHOT_BATCH_PAGES) {
+            page_count = TDB_SNAPSHOT_BATCH_PAGES;
+        }
+
+        bool any_selected = !snapshot->soft_dirty;
+        if (snapshot->soft_dirty) {
+            tdb_snapshot_read_pagemap(pagemap_fd, address, page_count, entries);
+            for (size_t page = 0; page < page_count; page++) {
+                selected[page] = entries[page] & TDB_PAGEMAP_SOFT_DIRTY;
+                any_selected = any_selected || selected[page];
+            }
+        }
+        else {
+            memset(selected, true, page_count * sizeof(bool));
+        }
+
+        if (!any_selected) {
+            continue;
+        }
+
+        diff->pages_read += tdb_snapshot_hash_pages(pid, address, page_count, selected, buffer, hashes);
+
+        const uint64_t* old_hashes = region->page_hashes + (address - region->start) / TDB_SNAPSHOT_PAGE_SIZE;
+        for (size_t page = 0; page < page_count; page++) {
+            if (selected[page] && hashes[page] != old_hashes[page]) {
+                const uint64_t page_address = address + page * TDB_SNAPSHOT_PAGE_SIZE;
+                if (!tdb_snapshot_add_change(diff, page_address, page_address + TDB_SNAPSHOT_PAGE_SIZE,
+                                             TDB_SNAPSHOT_CHANGED)) {
+                    return false;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+// Compares the parts of a region that are still mapped and adds those that are gone,
+// the other way around from tdb_snapshot_add_new_parts.
+static bool tdb_snapshot_diff_region(const struct tdb_snapshot* snapshot, const struct tdb_snapshot_region* region,
+                                     pid_t pid, const struct tdb_process_maps* maps, int pagemap_fd, uint8_t* buffer,
+                                     struct tdb_snapshot_diff* diff)
+{
+    uint64_t covered = region->start;
+
+    for (size_t i = 0; i < maps->mapping_count && covered < region->end; i++) {
+        const struct tdb_mapping* mapping = &maps->mappings[i];
+        if (mapping->end <= covered || mapping->start >= region->end) {
+            continue;
+        }
+
+        if (mapping->start > covered &&
+            !tdb_snapshot_add_change(diff, covered, mapping->start, TDB_SNAPSHOT_UNMAPPED)) {
+            return false;
+        }
+
+        const uint64_t start = mapping->start > covered ? mapping->start : covered;
+        const uint64_t end = mapping->end < region->end ? mapping->end : region->end;
+        if (!tdb_snapshot_diff_pages(snapshot, region, pid, pagemap_fd, buffer, start, end, diff)) {
+            return false;
+        }
+        covered = end;
+    }
+
+    return covered >= region->end || tdb_snapshot_add_change(diff, covered, region->end, TDB_SNAPSHOT_UNMAPPED);
+}
+
+bool tdb_snapshot_diff(const struct tdb_snapshot* snapshot, pid_t pid, const struct tdb_process_maps* maps,
+                       struct tdb_snapshot_diff* diff)
+{
+    memset(diff, 0, sizeof(*diff));
+
+    int pagemap_fd = tdb_snapshot_open_proc_file(pid, "pagemap", O_RDONLY);
+    if (pagemap_fd == -1) {
+        return false;
+    }
+
+    uint8_t* buffer = malloc(TDB_SNAPSHOT_BATCH_PAGES * TDB_SNAPSHOT_PAGE_SIZE);
+    bool success = buffer != NULL;
+
+    for (size_t i = 0; success && i < snapshot->region_count; i++) {
+        const struct tdb_snapshot_region* region = &snapshot->regions[i];
+        diff->pages_total += (region->end - region->start) / TDB_SNAPSHOT_PAGE_SIZE;
+        success = tdb_snapshot_diff_region(snapshot, region, pid, maps, pagemap_fd, buffer, diff);
+    }
+
+    for (size_t i = 0; success && i < maps->mapping_count; i++) {
+        const struct tdb_mapping* mapping = &maps->mappings[i];
+        if (tdb_snapshot_is_writable(mapping)) {
+            success = tdb_snapshot_add_new_parts(snapshot, mapping, diff);
+        }
+    }
+
+    free(buffer);
+    close(pagemap_fd);
+
+    if (!success) {
+        fprintf(stderr, "Out of memory while comparing with the snapshot\n");
+        tdb_snapshot_diff_free(diff);
+        return false;
+    }
+
+    qsort(diff->changes, diff->change_count, sizeof(struct tdb_snapshot_change), tdb_snapshot_compare_changes);
+    return true;
+}
+
+void tdb_snapshot_diff_free(struct tdb_snapshot_diff* diff)
+{
+    free(diff->changes);
+    memset(diff, 0, sizeof(*diff));
+}
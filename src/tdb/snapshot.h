@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "tdb/maps.h"
+
+// Snapshots of the writable memory of a process, for finding out what it wrote in
+// between. A snapshot keeps a 64-bit hash of every page rather than its contents, and
+// clears the kernel's soft-dirty bits through /proc/pid/clear_refs. A diff then only
+// has to read and hash the pages /proc/pid/pagemap marks as written since. Kernels
+// without soft-dirty tracking get every page compared instead.
+
+struct tdb_snapshot_region {
+    uint64_t start;
+    uint64_t end;
+    uint64_t* page_hashes;  // one per page
+};
+
+struct tdb_snapshot {
+    struct tdb_snapshot_region* regions;  // sorted by address
+    size_t region_count;
+    size_t region_capacity;
+
+    bool taken;
+    bool soft_dirty;  // written pages are tracked by the kernel
+    uint64_t pages_read;
+};
+
+enum tdb_snapshot_change_kind {
+    TDB_SNAPSHOT_CHANGED,   // a run of pages that were written to
+    TDB_SNAPSHOT_MAPPED,    // a writable mapping that didn't exist at the snapshot
+    TDB_SNAPSHOT_UNMAPPED,  // a snapshot region that is gone
+};
+
+struct tdb_snapshot_change {
+    uint64_t start;
+    uint64_t end;
+    enum tdb_snapshot_change_kind kind;
+};
+
+struct tdb_snapshot_diff {
+    struct tdb_snapshot_change* changes;  // sorted by address
+    size_t change_count;
+    size_t change_capacity;
+
+    uint64_t pages_read;  // dirty pages that had to be read to compare their hashes
+    uint64_t pages_total;
+};
+
+void tdb_snapshot_init(struct tdb_snapshot* snapshot);
+void tdb_snapshot_free(struct tdb_snapshot* snapshot);
+
+// Replaces the snapshot with one of the writable mappings in maps, which have to be up
+// to date.
+bool tdb_snapshot_take(struct tdb_snapshot* snapshot, pid_t pid, const struct tdb_process_maps* maps);
+
+bool tdb_snapshot_diff(const struct tdb_snapshot* snapshot, pid_t pid, const struct tdb_process_maps* maps,
+                       struct tdb_snapshot_diff* diff);
+void tdb_snapshot_diff_free(struct tdb_snapshot_diff* diff);
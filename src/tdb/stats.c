@@ -0,0 +1,207 @@
+#include "stats.h"
+
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+
+struct tdb_stat_counter g_tdb_stats[TDB_STAT_COUNT];
+
+static const char* const g_tdb_stat_names[TDB_STAT_COUNT] = {
+    [TDB_STAT_PTRACE_PEEKDATA] = "ptrace_peekdata",
+    [TDB_STAT_PTRACE_POKEDATA] = "ptrace_pokedata",
+    [TDB_STAT_PTRACE_PEEKUSER] = "ptrace_peekuser",
+    [TDB_STAT_PTRACE_POKEUSER] = "ptrace_pokeuser",
+    [TDB_STAT_PTRACE_GETREGS] = "ptrace_getregs",
+    [TDB_STAT_PTRACE_SETREGS] = "ptrace_setregs",
+    [TDB_STAT_PTRACE_CONT] = "ptrace_cont",
+    [TDB_STAT_PTRACE_SYSCALL] = "ptrace_syscall",
+    [TDB_STAT_PTRACE_SINGLESTEP] = "ptrace_singlestep",
+    [TDB_STAT_PTRACE_INTERRUPT] = "ptrace_interrupt",
+    [TDB_STAT_PTRACE_GETEVENTMSG] = "ptrace_geteventmsg",
+    [TDB_STAT_PTRACE_GET_SYSCALL_INFO] = "ptrace_get_syscall_info",
+    [TDB_STAT_PTRACE_SEIZE] = "ptrace_seize",
+    [TDB_STAT_PTRACE_DETACH] = "ptrace_detach",
+    [TDB_STAT_PTRACE_OTHER] = "ptrace_other",
+    [TDB_STAT_WAITPID] = "waitpid",
+    [TDB_STAT_PROCESS_VM] = "process_vm",
+    [TDB_STAT_PROC_MEM] = "proc_mem",
+    [TDB_STAT_PROC_MAPS] = "proc_maps",
+    [TDB_STAT_PROC_OTHER] = "proc_other",
+    [TDB_STAT_SYMBOL_LOAD] = "symbol_load",
+    [TDB_STAT_LINE_TABLE_LOAD] = "line_table_load",
+    [TDB_STAT_LINE_TABLE_DECODE] = "line_table_decode",
+    [TDB_STAT_DEBUG_CACHE] = "debug_cache",
+    [TDB_STAT_CFI_DECODE] = "cfi_decode",
+    [TDB_STAT_STOP] = "stop",
+    [TDB_STAT_STOP_ALL] = "stop_all",
+    [TDB_STAT_STEP_OVER] = "step_over",
+};
+
+// the TSC and the clock at the last reset, to measure the TSC rate against
+static uint64_t g_tdb_reference_cycles;
+static uint64_t g_tdb_reference_ns;
+
+static struct tdb_stat_counter g_tdb_command_start[TDB_STAT_COUNT];
+static struct tdb_stat_counter g_tdb_last_command[TDB_STAT_COUNT];
+static char g_tdb_last_command_line[128];
+static char g_tdb_current_command_line[128];
+
+static uint64_t tdb_stats_now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+static enum tdb_stat tdb_ptrace_stat(enum __ptrace_request request)
+{
+    switch (request) {
+    case PTRACE_PEEKDATA:
+        return TDB_STAT_PTRACE_PEEKDATA;
+    case PTRACE_POKEDATA:
+        return TDB_STAT_PTRACE_POKEDATA;
+    case PTRACE_PEEKUSER:
+        return TDB_STAT_PTRACE_PEEKUSER;
+    case PTRACE_POKEUSER:
+        return TDB_STAT_PTRACE_POKEUSER;
+    case PTRACE_GETREGS:
+        return TDB_STAT_PTRACE_GETREGS;
+    case PTRACE_SETREGS:
+        return TDB_STAT_PTRACE_SETREGS;
+    case PTRACE_CONT:
+        return TDB_STAT_PTRACE_CONT;
+    case PTRACE_SYSCALL:
+        return TDB_STAT_PTRACE_SYSCALL;
+    case PTRACE_SINGLESTEP:
+        return TDB_STAT_PTRACE_SINGLESTEP;
+    case PTRACE_INTERRUPT:
+        return TDB_STAT_PTRACE_INTERRUPT;
+    case PTRACE_GETEVENTMSG:
+        return TDB_STAT_PTRACE_GETEVENTMSG;
+    case PTRACE_GET_SYSCALL_INFO:
+        return TDB_STAT_PTRACE_GET_SYSCALL_INFO;
+    case PTRACE_SEIZE:
+        return TDB_STAT_PTRACE_SEIZE;
+    case PTRACE_DETACH:
+        return TDB_STAT_PTRACE_DETACH;
+    default:
+        return TDB_STAT_PTRACE_OTHER;
+    }
+}
+
+long tdb_ptrace(enum __ptrace_request request, pid_t pid, void* address, void* data)
+{
+    const uint64_t start = tdb_stats_start();
+    const long result = ptrace(request, pid, address, data);
+    tdb_stats_record(tdb_ptrace_stat(request), start);
+    return result;
+}
+
+pid_t tdb_waitpid(pid_t pid, int* status, int options)
+{
+    const uint64_t start = tdb_stats_start();
+    const pid_t result = waitpid(pid, status, options);
+    tdb_stats_record(TDB_STAT_WAITPID, start);
+    return result;
+}
+
+void tdb_stats_reset(void)
+{
+    memset(g_tdb_stats, 0, sizeof(g_tdb_stats));
+    memset(g_tdb_last_command, 0, sizeof(g_tdb_last_command));
+    g_tdb_last_command_line[0] = '\0';
+
+    g_tdb_reference_cycles = __rdtsc();
+    g_tdb_reference_ns = tdb_stats_now_ns();
+}
+
+void tdb_stats_begin_command(const char* line)
+{
+    memcpy(g_tdb_command_start, g_tdb_stats, sizeof(g_tdb_stats));
+    snprintf(g_tdb_current_command_line, sizeof(g_tdb_current_command_line), "%s", line);
+}
+
+void tdb_stats_end_command(void)
+{
+    // looking at the stats shouldn't replace the command being looked at
+    if (strncmp(g_tdb_current_command_line, "stats", 5) == 0) {
+        return;
+    }
+
+    for (int i = 0; i < TDB_STAT_COUNT; i++) {
+        g_tdb_last_command[i].count = g_tdb_stats[i].count - g_tdb_command_start[i].count;
+        g_tdb_last_command[i].cycles = g_tdb_stats[i].cycles - g_tdb_command_start[i].cycles;
+    }
+    memcpy(g_tdb_last_command_line, g_tdb_current_command_line, sizeof(g_tdb_last_command_line));
+}
+
+static void tdb_stats_print_json_string(FILE* file, const char* string)
+{
+    fputc('"', file);
+    for (const char* c = string; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\') {
+            fputc('\\', file);
+        }
+        fputc((unsigned char)*c >= 0x20 ? *c : '?', file);
+    }
+    fputc('"', file);
+}
+
+static void tdb_stats_print_json_counters(FILE* file, const struct tdb_stat_counter* counters, double ns_per_cycle)
+{
+    fprintf(file, "{");
+
+    bool first = true;
+    for (int i = 0; i < TDB_STAT_COUNT; i++) {
+        if (counters[i].count == 0) {
+            continue;
+        }
+
+        fprintf(file, "%s\"%s\": {\"count\": %lu, \"ns\": %.0f}", first ? "" : ", ", g_tdb_stat_names[i],
+                counters[i].count, (double)counters[i].cycles * ns_per_cycle);
+        first = false;
+    }
+
+    fprintf(file, "}");
+}
+
+void tdb_stats_print(FILE* file, bool json)
+{
+    const uint64_t elapsed_cycles = __rdtsc() - g_tdb_reference_cycles;
+    const uint64_t elapsed_ns = tdb_stats_now_ns() - g_tdb_reference_ns;
+    const double ns_per_cycle = elapsed_cycles > 0 ? (double)elapsed_ns / (double)elapsed_cycles : 0;
+
+    const uint64_t stops = g_tdb_stats[TDB_STAT_STOP].count;
+
+    if (json) {
+        fprintf(file, "{\"elapsed_ns\": %lu, \"stops\": %lu, \"counters\": ", elapsed_ns, stops);
+        tdb_stats_print_json_counters(file, g_tdb_stats, ns_per_cycle);
+        fprintf(file, ", \"last_command\": {\"line\": ");
+        tdb_stats_print_json_string(file, g_tdb_last_command_line);
+        fprintf(file, ", \"counters\": ");
+        tdb_stats_print_json_counters(file, g_tdb_last_command, ns_per_cycle);
+        fprintf(file, "}}\n");
+        return;
+    }
+
+    fprintf(file, "%-24s %10s %12s %10s %10s %12s %10s\n", "", "count", "total ms", "ns/op", "per stop", "last count",
+            "last ms");
+    for (int i = 0; i < TDB_STAT_COUNT; i++) {
+        const struct tdb_stat_counter* counter = &g_tdb_stats[i];
+        if (counter->count == 0) {
+            continue;
+        }
+
+        const double total_ns = (double)counter->cycles * ns_per_cycle;
+        fprintf(file, "%-24s %10lu %12.3f %10.0f %10.2f %12lu %10.3f\n", g_tdb_stat_names[i], counter->count,
+                total_ns / 1e6, total_ns / (double)counter->count,
+                stops > 0 ? (double)counter->count / (double)stops : 0.0, g_tdb_last_command[i].count,
+                (double)g_tdb_last_command[i].cycles * ns_per_cycle / 1e6);
+    }
+
+    fprintf(file, "%lu stops in %.3f s", stops, (double)elapsed_ns / 1e9);
+    if (g_tdb_last_command_line[0] != '\0') {
+        fprintf(file, ", last command: %s", g_tdb_last_command_line);
+    }
+    fprintf(file, "\n");
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/ptrace.h>
+#include <sys/types.h>
+#include <x86intrin.h>
+
+// Counters and TSC timers around every system call and decoding step tdb makes on the
+// user's behalf. Recording is an increment and two rdtsc reads, so they are always on;
+// cycles are only turned into time when printed, using the TSC rate measured between
+// the last reset and then. Besides the totals, the counters of the last command run at
+// the prompt are kept so they can be looked at on their own.
+
+enum tdb_stat {
+    TDB_STAT_PTRACE_PEEKDATA,
+    TDB_STAT_PTRACE_POKEDATA,
+    TDB_STAT_PTRACE_PEEKUSER,
+    TDB_STAT_PTRACE_POKEUSER,
+    TDB_STAT_PTRACE_GETREGS,
+    TDB_STAT_PTRACE_SETREGS,
+    TDB_STAT_PTRACE_CONT,
+    TDB_STAT_PTRACE_SYSCALL,
+    TDB_STAT_PTRACE_SINGLESTEP,
+    TDB_STAT_PTRACE_INTERRUPT,
+    TDB_STAT_PTRACE_GETEVENTMSG,
+    TDB_STAT_PTRACE_GET_SYSCALL_INFO,
+    TDB_STAT_PTRACE_SEIZE,
+    TDB_STAT_PTRACE_DETACH,
+    TDB_STAT_PTRACE_OTHER,
+    TDB_STAT_WAITPID,
+    TDB_STAT_PROCESS_VM,  // process_vm_readv/writev
+    TDB_STAT_PROC_MEM,    // /proc/pid/mem
+    TDB_STAT_PROC_MAPS,   // reading and parsing /proc/pid/maps
+    TDB_STAT_PROC_OTHER,  // auxv, task lists
+    TDB_STAT_SYMBOL_LOAD,
+    TDB_STAT_LINE_TABLE_LOAD,
+    TDB_STAT_LINE_TABLE_DECODE,  // line programs, one compile unit at a time
+    TDB_STAT_DEBUG_CACHE,
+    TDB_STAT_CFI_DECODE,  // opening an object's CFI and computing unwind rows
+    TDB_STAT_STOP,        // working out why a thread stopped, once per stop
+    TDB_STAT_STOP_ALL,    // interrupting every thread for an all-stop
+    TDB_STAT_STEP_OVER,   // single-stepping off a breakpoint
+    TDB_STAT_COUNT,
+};
+
+struct tdb_stat_counter {
+    uint64_t count;
+    uint64_t cycles;
+};
+
+extern struct tdb_stat_counter g_tdb_stats[TDB_STAT_COUNT];
+
+static inline uint64_t tdb_stats_start(void)
+{
+    return __rdtsc();
+}
+
+static inline void tdb_stats_record(enum tdb_stat stat, uint64_t start)
+{
+    g_tdb_stats[stat].count++;
+    g_tdb_stats[stat].cycles += __rdtsc() - start;
+}
+
+// ptrace and waitpid, counted and timed. errno is left as the call set it.
+long tdb_ptrace(enum __ptrace_request request, pid_t pid, void* address, void* data);
+pid_t tdb_waitpid(pid_t pid, int* status, int options);
+
+void tdb_stats_reset(void);
+
+// Called around each command, so its counters can be told apart from the totals.
+void tdb_stats_begin_command(const char* line);
+void tdb_stats_end_command(void);
+
+// A table of the non-zero counters, or a single JSON object.
+void tdb_stats_print(FILE* file, bool json);
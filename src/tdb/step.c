@@ -0,0 +1,76 @@
+#include "step.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void tdb_step_plan_init(struct tdb_step_plan* plan)
+{
+    memset(plan, 0, sizeof(*plan));
+}
+
+void tdb_step_plan_free(struct tdb_step_plan* plan)
+{
+    free(plan->targets);
+    tdb_step_plan_init(plan);
+}
+
+void tdb_step_plan_clear(struct tdb_step_plan* plan)
+{
+    plan->target_count = 0;
+    plan->min_cfa = 0;
+    plan->caller_low = 0;
+    plan->caller_high = 0;
+}
+
+static bool tdb_step_plan_append(struct tdb_step_plan* plan, uint64_t address, bool call)
+{
+    if (tdb_step_plan_contains(plan, address)) {
+        return true;
+    }
+
+    if (plan->target_count == plan->target_capacity) {
+        size_t new_capacity = plan->target_capacity == 0 ? 16 : 2 * plan->target_capacity;
+
+        struct tdb_step_target* targets = realloc(plan->targets, new_capacity * sizeof(struct tdb_step_target));
+        if (targets == NULL) {
+            fprintf(stderr, "Failed to allocate step targets\n");
+            return false;
+        }
+        plan->targets = targets;
+        plan->target_capacity = new_capacity;
+    }
+
+    plan->targets[plan->target_count].address = address;
+    plan->targets[plan->target_count].planted = false;
+    plan->targets[plan->target_count].call = call;
+    plan->target_count++;
+    return true;
+}
+
+bool tdb_step_plan_add(struct tdb_step_plan* plan, uint64_t address)
+{
+    return tdb_step_plan_append(plan, address, false);
+}
+
+bool tdb_step_plan_add_call(struct tdb_step_plan* plan, uint64_t address)
+{
+    return tdb_step_plan_append(plan, address, true);
+}
+
+bool tdb_step_plan_contains(const struct tdb_step_plan* plan, uint64_t address)
+{
+    return tdb_step_plan_find(plan, address) != NULL;
+}
+
+// A line has a handful of exits, so a linear scan is all this needs.
+const struct tdb_step_target* tdb_step_plan_find(const struct tdb_step_plan* plan, uint64_t address)
+{
+    for (size_t i = 0; i < plan->target_count; i++) {
+        if (plan->targets[i].address == address) {
+            return &plan->targets[i];
+        }
+    }
+
+    return NULL;
+}
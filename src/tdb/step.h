@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Stepping lets the program run freely up to temporary breakpoints at every address
+// control can leave the stepped code for, so stepping over a call takes one stop no
+// matter how long the call runs. Only instructions whose destination can't be worked
+// out from their encoding (indirect jumps, and indirect calls when stepping into
+// them) are single-stepped.
+
+struct tdb_step_target {
+    uint64_t address;
+    bool planted;  // the breakpoint there is the plan's own, not one that was already set
+    bool call;     // the entry of a function the stepped code calls
+};
+
+struct tdb_step_plan {
+    bool active;
+    bool reached;
+    pid_t tid;  // other threads run past the targets
+
+    // hits in frames with a smaller CFA are deeper, recursive calls and are ignored,
+    // 0 if the frame couldn't be unwound
+    uint64_t min_cfa;
+
+    // call targets are only reached by calls returning into [caller_low, caller_high),
+    // which a callee's frame is always deeper than, so min_cfa doesn't apply to them
+    uint64_t caller_low;
+    uint64_t caller_high;
+
+    struct tdb_step_target* targets;
+    size_t target_count;
+    size_t target_capacity;
+};
+
+void tdb_step_plan_init(struct tdb_step_plan* plan);
+void tdb_step_plan_free(struct tdb_step_plan* plan);
+
+// Forgets the targets, which have to be removed from the process first.
+void tdb_step_plan_clear(struct tdb_step_plan* plan);
+
+bool tdb_step_plan_add(struct tdb_step_plan* plan, uint64_t address);
+bool tdb_step_plan_add_call(struct tdb_step_plan* plan, uint64_t address);
+bool tdb_step_plan_contains(const struct tdb_step_plan* plan, uint64_t address);
+
+// The target at address, NULL if there is none.
+const struct tdb_step_target* tdb_step_plan_find(const struct tdb_step_plan* plan, uint64_t address);
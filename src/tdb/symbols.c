@@ -0,0 +1,363 @@
+#include "symbols.h"
+
+#include <fcntl.h>
+#include <gelf.h>
+#include <libelf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "stats.h"
+
+struct tdb_symbol_builder {
+    struct tdb_symbol* symbols;
+    size_t symbol_count;
+    size_t symbol_capacity;
+
+    char* strings;
+    size_t strings_size;
+    size_t strings_capacity;
+};
+
+static bool tdb_builder_add(struct tdb_symbol_builder* builder, const GElf_Sym* sym, const char* name)
+{
+    const size_t name_length = strlen(name) + 1;
+
+    if (builder->strings_size + name_length > builder->strings_capacity) {
+        size_t new_capacity = builder->strings_capacity == 0 ? 64 * 1024 : 2 * builder->strings_capacity;
+        while (builder->strings_size + name_length > new_capacity) {
+            new_capacity *= 2;
+        }
+
+        char* strings = realloc(builder->strings, new_capacity);
+        if (strings == NULL) {
+            return false;
+        }
+
+        builder->strings = strings;
+        builder->strings_capacity = new_capacity;
+    }
+
+    if (builder->symbol_count == builder->symbol_capacity) {
+        size_t new_capacity = builder->symbol_capacity == 0 ? 1024 : 2 * builder->symbol_capacity;
+
+        struct tdb_symbol* symbols = realloc(builder->symbols, new_capacity * sizeof(struct tdb_symbol));
+        if (symbols == NULL) {
+            return false;
+        }
+        builder->symbols = symbols;
+        builder->symbol_capacity = new_capacity;
+    }
+
+    struct tdb_symbol* symbol = &builder->symbols[builder->symbol_count];
+    memset(symbol, 0, sizeof(*symbol));
+    symbol->address = sym->st_value;
+    symbol->size = sym->st_size;
+    symbol->name_offset = (uint32_t)builder->strings_size;
+    symbol->type = (uint8_t)GELF_ST_TYPE(sym->st_info);
+    symbol->binding = (uint8_t)GELF_ST_BIND(sym->st_info);
+    builder->symbol_count++;
+
+    memcpy(builder->strings + builder->strings_size, name, name_length);
+    builder->strings_size += name_length;
+
+    return true;
+}
+
+static bool tdb_builder_add_section(struct tdb_symbol_builder* builder, Elf* elf, Elf_Scn* section,
+                                    const GElf_Shdr* header)
+{
+    Elf_Data* data = elf_getdata(section, NULL);
+    if (data == NULL || header->sh_entsize == 0) {
+        return true;
+    }
+
+    const size_t count = header->sh_size / header->sh_entsize;
+
+    for (size_t i = 0; i < count; i++) {
+        GElf_Sym sym;
+        if (gelf_getsym(data, (int)i, &sym) == NULL) {
+            continue;
+        }
+
+        const int type = GELF_ST_TYPE(sym.st_info);
+        if ((type != STT_FUNC && type != STT_OBJECT) || sym.st_shndx == SHN_UNDEF || sym.st_value == 0) {
+            continue;
+        }
+
+        const char* name = elf_strptr(elf, header->sh_link, sym.st_name);
+        if (name == NULL || name[0] == '\0') {
+            continue;
+        }
+
+        if (!tdb_builder_add(builder, &sym, name)) {
+            fprintf(stderr, "Out of memory while loading symbols\n");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static const struct tdb_symbol_builder* g_tdb_sorting_builder;
+
+static int tdb_compare_symbols(const void* lhs_ptr, const void* rhs_ptr)
+{
+    const struct tdb_symbol* lhs = lhs_ptr;
+    const struct tdb_symbol* rhs = rhs_ptr;
+
+    if (lhs->address != rhs->address) {
+        return lhs->address < rhs->address ? -1 : 1;
+    }
+
+    // functions before objects, then by name so duplicates from .symtab and .dynsym end up adjacent
+    if (lhs->type != rhs->type) {
+        return lhs->type == STT_FUNC ? -1 : 1;
+    }
+
+    return strcmp(g_tdb_sorting_builder->strings + lhs->name_offset,
+                  g_tdb_sorting_builder->strings + rhs->name_offset);
+}
+
+static void tdb_builder_sort_and_deduplicate(struct tdb_symbol_builder* builder)
+{
+    g_tdb_sorting_builder = builder;
+    qsort(builder->symbols, builder->symbol_count, sizeof(struct tdb_symbol), tdb_compare_symbols);
+    g_tdb_sorting_builder = NULL;
+
+    size_t unique_count = 0;
+    for (size_t i = 0; i < builder->symbol_count; i++) {
+        if (unique_count > 0) {
+            const struct tdb_symbol* previous = &builder->symbols[unique_count - 1];
+            const struct tdb_symbol* current = &builder->symbols[i];
+            if (previous->address == current->address &&
+                !strcmp(builder->strings + previous->name_offset, builder->strings + current->name_offset)) {
+                continue;
+            }
+        }
+
+        builder->symbols[unique_count++] = builder->symbols[i];
+    }
+
+    builder->symbol_count = unique_count;
+}
+
+uint32_t tdb_symbol_name_hash(const char* name)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (const unsigned char* c = (const unsigned char*)name; *c != '\0'; c++) {
+        hash ^= *c;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t* tdb_build_name_index(const struct tdb_symbol_builder* builder, size_t* bucket_count_out)
+{
+    size_t bucket_count = 16;
+    while (bucket_count < 2 * builder->symbol_count) {
+        bucket_count *= 2;
+    }
+
+    uint32_t* buckets = malloc(bucket_count * sizeof(uint32_t));
+    if (buckets == NULL) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < bucket_count; i++) {
+        buckets[i] = TDB_SYMBOL_NO_INDEX;
+    }
+
+    // insert global symbols first so they win over local symbols of the same name
+    for (int pass = 0; pass < 2; pass++) {
+        for (size_t i = 0; i < builder->symbol_count; i++) {
+            const struct tdb_symbol* symbol = &builder->symbols[i];
+            const bool is_local = symbol->binding == STB_LOCAL;
+            if (is_local != (pass == 1)) {
+                continue;
+            }
+
+            const char* name = builder->strings + symbol->name_offset;
+            size_t bucket = tdb_symbol_name_hash(name) & (bucket_count - 1);
+
+            while (buckets[bucket] != TDB_SYMBOL_NO_INDEX) {
+                const struct tdb_symbol* existing = &builder->symbols[buckets[bucket]];
+                if (!strcmp(builder->strings + existing->name_offset, name)) {
+                    break;
+                }
+                bucket = (bucket + 1) & (bucket_count - 1);
+            }
+
+            if (buckets[bucket] == TDB_SYMBOL_NO_INDEX) {
+                buckets[bucket] = (uint32_t)i;
+            }
+        }
+    }
+
+    *bucket_count_out = bucket_count;
+    return buckets;
+}
+
+void tdb_symbol_table_init(struct tdb_symbol_table* table)
+{
+    memset(table, 0, sizeof(*table));
+}
+
+static bool tdb_symbol_table_read(struct tdb_symbol_table* table, const char* elf_path)
+{
+    tdb_symbol_table_init(table);
+
+    if (elf_version(EV_CURRENT) == EV_NONE) {
+        fprintf(stderr, "Failed to initialize libelf: %s\n", elf_errmsg(-1));
+        return false;
+    }
+
+    int fd = open(elf_path, O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "Failed to open %s to load symbols\n", elf_path);
+        return false;
+    }
+
+    Elf* elf = elf_begin(fd, ELF_C_READ_MMAP, NULL);
+    if (elf == NULL || elf_kind(elf) != ELF_K_ELF) {
+        fprintf(stderr, "Failed to read ELF file %s: %s\n", elf_path, elf_errmsg(-1));
+        if (elf != NULL) {
+            elf_end(elf);
+        }
+        close(fd);
+        return false;
+    }
+
+    struct tdb_symbol_builder builder;
+    memset(&builder, 0, sizeof(builder));
+
+    bool success = true;
+    Elf_Scn* section = NULL;
+    while (success && (section = elf_nextscn(elf, section)) != NULL) {
+        GElf_Shdr header;
+        if (gelf_getshdr(section, &header) == NULL) {
+            continue;
+        }
+
+        if (header.sh_type == SHT_SYMTAB || header.sh_type == SHT_DYNSYM) {
+            success = tdb_builder_add_section(&builder, elf, section, &header);
+        }
+    }
+
+    elf_end(elf);
+    close(fd);
+
+    uint32_t* buckets = NULL;
+    size_t bucket_count = 0;
+
+    if (success) {
+        tdb_builder_sort_and_deduplicate(&builder);
+        buckets = tdb_build_name_index(&builder, &bucket_count);
+        success = buckets != NULL;
+    }
+
+    if (!success) {
+        free(builder.symbols);
+        free(builder.strings);
+        return false;
+    }
+
+    table->symbols = builder.symbols;
+    table->symbol_count = builder.symbol_count;
+    table->strings = builder.strings;
+    table->strings_size = builder.strings_size;
+    table->name_buckets = buckets;
+    table->bucket_count = bucket_count;
+    table->owns_memory = true;
+
+    return true;
+}
+
+bool tdb_symbol_table_load(struct tdb_symbol_table* table, const char* elf_path)
+{
+    const uint64_t start = tdb_stats_start();
+    const bool success = tdb_symbol_table_read(table, elf_path);
+    tdb_stats_record(TDB_STAT_SYMBOL_LOAD, start);
+    return success;
+}
+
+void tdb_symbol_table_free(struct tdb_symbol_table* table)
+{
+    if (table->owns_memory) {
+        free((void*)table->symbols);
+        free((void*)table->strings);
+        free((void*)table->name_buckets);
+    }
+
+    tdb_symbol_table_init(table);
+}
+
+const char* tdb_symbol_name(const struct tdb_symbol_table* table, const struct tdb_symbol* symbol)
+{
+    return table->strings + symbol->name_offset;
+}
+
+const struct tdb_symbol* tdb_symbol_lookup_address(const struct tdb_symbol_table* table, uint64_t address)
+{
+    // find the last symbol starting at or before the address
+    size_t low = 0;
+    size_t high = table->symbol_count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (table->symbols[middle].address <= address) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+
+    if (low == 0) {
+        return NULL;
+    }
+
+    // symbols sharing a start address are sorted functions first
+    size_t index = low - 1;
+    while (index > 0 && table->symbols[index - 1].address == table->symbols[index].address) {
+        index--;
+    }
+
+    const struct tdb_symbol* symbol = &table->symbols[index];
+    if (symbol->size != 0 && address >= symbol->address + symbol->size) {
+        return NULL;
+    }
+
+    return symbol;
+}
+
+const struct tdb_symbol* tdb_symbol_lookup_name(const struct tdb_symbol_table* table, const char* name)
+{
+    if (table->bucket_count == 0) {
+        return NULL;
+    }
+
+    size_t bucket = tdb_symbol_name_hash(name) & (table->bucket_count - 1);
+
+    while (table->name_buckets[bucket] != TDB_SYMBOL_NO_INDEX) {
+        const struct tdb_symbol* symbol = &table->symbols[table->name_buckets[bucket]];
+        if (!strcmp(tdb_symbol_name(table, symbol), name)) {
+            return symbol;
+        }
+        bucket = (bucket + 1) & (table->bucket_count - 1);
+    }
+
+    return NULL;
+}
+
+bool tdb_symbolize(const struct tdb_symbol_table* table, uint64_t address, char* buffer, size_t buffer_size)
+{
+    const struct tdb_symbol* symbol = tdb_symbol_lookup_address(table, address);
+    if (symbol == NULL) {
+        return false;
+    }
+
+    snprintf(buffer, buffer_size, "%s+0x%zx", tdb_symbol_name(table, symbol), address - symbol->address);
+    return true;
+}
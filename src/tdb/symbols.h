@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// One entry per function or data object found in .symtab/.dynsym. The layout is
+// deliberately pointer-free: names are offsets into a single string table.
+struct tdb_symbol {
+    uint64_t address;
+    uint64_t size;
+    uint32_t name_offset;
+    uint8_t type;     // STT_FUNC or STT_OBJECT
+    uint8_t binding;  // STB_LOCAL, STB_GLOBAL or STB_WEAK
+    uint8_t padding[2];
+};
+
+// Symbols are kept sorted by address for binary-search symbolization, and indexed by
+// name through an open-addressing hash table of symbol indices.
+struct tdb_symbol_table {
+    const struct tdb_symbol* symbols;
+    size_t symbol_count;
+
+    const char* strings;
+    size_t strings_size;
+
+    const uint32_t* name_buckets;  // TDB_SYMBOL_NO_INDEX marks an empty bucket
+    size_t bucket_count;           // power of two
+
+    bool owns_memory;
+};
+
+#define TDB_SYMBOL_NO_INDEX UINT32_MAX
+
+void tdb_symbol_table_init(struct tdb_symbol_table* table);
+bool tdb_symbol_table_load(struct tdb_symbol_table* table, const char* elf_path);
+void tdb_symbol_table_free(struct tdb_symbol_table* table);
+
+const char* tdb_symbol_name(const struct tdb_symbol_table* table, const struct tdb_symbol* symbol);
+
+// Returns the symbol containing the (unrelocated) address, or NULL.
+const struct tdb_symbol* tdb_symbol_lookup_address(const struct tdb_symbol_table* table, uint64_t address);
+const struct tdb_symbol* tdb_symbol_lookup_name(const struct tdb_symbol_table* table, const char* name);
+
+uint32_t tdb_symbol_name_hash(const char* name);
+
+// Formats an address as "name+0xoffset", or returns false if no symbol contains it.
+bool tdb_symbolize(const struct tdb_symbol_table* table, uint64_t address, char* buffer, size_t buffer_size);
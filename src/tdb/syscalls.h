@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// x86-64 system call names and argument counts, and sets of system call numbers.
+
+#define TDB_SYSCALL_MAX 512
+
+struct tdb_syscall_set {
+    uint64_t bits[TDB_SYSCALL_MAX / 64];
+};
+
+// NULL for numbers that aren't system calls.
+const char* tdb_syscall_name(long number);
+int tdb_syscall_argument_count(long number);
+
+// Returns -1 for unknown names.
+long tdb_syscall_number(const char* name);
+
+void tdb_syscall_set_clear(struct tdb_syscall_set* set);
+void tdb_syscall_set_add(struct tdb_syscall_set* set, long number);
+bool tdb_syscall_set_contains(const struct tdb_syscall_set* set, long number);
+bool tdb_syscall_set_is_empty(const struct tdb_syscall_set* set);
+
+// Adds a comma separated list of names (or numbers) to the set, or every system call for
+// "all". Returns false, leaving the set partially filled, at the first unknown name.
+bool tdb_syscall_set_parse(struct tdb_syscall_set* set, const char* list);
+
+// Formats a call as "write(1, 0x7ffd2c3e3a10, 13)" from its number and arguments.
+void tdb_format_syscall(long number, const uint64_t arguments[6], char* buffer, size_t buffer_size);
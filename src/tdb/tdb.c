@@ -1,14 +1,27 @@
 #include "tdb/tdb.h"
 
+#include <ctype.h>
+#include <elf.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <regex.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ptrace.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "linenoise.h"
 
+#include "tdb/breakpoint_batch.h"
+#include "tdb/condition.h"
+#include "tdb/core.h"
+#include "tdb/execution.h"
+#include "tdb/search.h"
+#include "tdb/stats.h"
 #include "tdb/utility.h"
 
 #define DEBUG true
@@ -36,244 +49,1653 @@ void tdb_context_init(struct tdb_context* context, pid_t _pid, const char* _targ
 {
     context->pid = _pid;
     strcpy(context->target_path, _target_path);
-    context->breakpoint_count = 0;
-    context->stack_addr = 0;
+    context->attached = false;
+    memset(&context->core, 0, sizeof(context->core));
+    tdb_breakpoint_table_init(&context->breakpoints);
+    context->next_breakpoint_id = 1;
+    tdb_hw_breakpoints_init(&context->hw_breakpoints);
+    tdb_instruction_cache_init(&context->instructions);
+    tdb_step_plan_init(&context->step);
+    tdb_calltrace_init(&context->calltrace);
+    tdb_snapshot_init(&context->snapshot);
+    tdb_process_maps_init(&context->maps);
+    tdb_unwinder_init(&context->unwinder);
+    tdb_syscall_set_clear(&context->traced_syscalls);
+    tdb_syscall_set_clear(&context->caught_syscalls);
+    tdb_syscall_set_clear(&context->filtered_syscalls);
+    context->syscall_stepping = false;
 
-    // {  // attempt to grab stack address from /proc/pid/maps file
-    //     msleep(250);
+    if (tdb_debug_cache_open(&context->debug_cache, _target_path) &&
+        tdb_debug_cache_load(&context->debug_cache, &context->symbols, &context->lines)) {
+        printf("loaded %zu symbols and %zu compile units from %s\n", context->symbols.symbol_count,
+               context->lines.unit_count, context->debug_cache.path);
 
-    //     char maps_path[128];
-    //     sprintf(maps_path, "/proc/%d/maps", _pid);
+        // units nobody looked up before the cache was written are still decoded on first use
+        tdb_line_table_resume(&context->lines, _target_path);
+    }
+    else {
+        if (tdb_symbol_table_load(&context->symbols, _target_path)) {
+            printf("loaded %zu symbols from %s\n", context->symbols.symbol_count, _target_path);
+        }
+
+        // line programs are decoded per compile unit on first use
+        if (tdb_line_table_load(&context->lines, _target_path)) {
+            printf("found %zu compile units with debug info\n", context->lines.unit_count);
+        }
+
+        // the symbols and unit ranges are cached straight away, decoded lines are added on exit
+        if (tdb_debug_cache_store(&context->debug_cache, &context->symbols, &context->lines)) {
+            printf("saved debug info cache to %s\n", context->debug_cache.path);
+        }
+    }
+
+    tdb_thread_table_init(&context->threads);
+    tdb_thread_table_add(&context->threads, _pid, TDB_THREAD_RUNNING);
+    context->current_tid = _pid;
+}
+
+void tdb_context_free(struct tdb_context* context)
+{
+    context->pid = -1;
+    context->target_path[0] = '\0';
+
+    size_t cursor = 0;
+    struct tdb_breakpoint* bp;
+    while ((bp = tdb_breakpoint_table_next(&context->breakpoints, &cursor)) != NULL) {
+        tdb_breakpoint_free(bp);
+    }
+    tdb_breakpoint_table_free(&context->breakpoints);
+    tdb_instruction_cache_free(&context->instructions);
+    tdb_step_plan_free(&context->step);
+    tdb_calltrace_free(&context->calltrace);
+    tdb_snapshot_free(&context->snapshot);
+    tdb_thread_table_free(&context->threads);
+    tdb_process_maps_free(&context->maps);
+    tdb_unwinder_free(&context->unwinder);
+
+    if (context->core.data != NULL) {
+        tdb_set_memory_reader(context->core.pid, NULL, NULL);
+        tdb_core_image_close(&context->core);
+    }
+
+    // only what this session decoded anyway is added, nothing is decoded just for the cache
+    if (tdb_line_table_decoded_count(&context->lines) > context->debug_cache.decoded_units &&
+        tdb_debug_cache_store(&context->debug_cache, &context->symbols, &context->lines)) {
+        printf("updated debug info cache %s\n", context->debug_cache.path);
+    }
+
+    tdb_symbol_table_free(&context->symbols);
+    tdb_line_table_free(&context->lines);
+    tdb_debug_cache_close(&context->debug_cache);
+}
+
+// Translates a runtime address into the main executable's link-time addresses, which
+// is what its symbol and line tables use. Returns false for addresses outside of it.
+static bool tdb_get_file_address(struct tdb_context* context, uint64_t address, uint64_t* file_address)
+{
+    const struct tdb_mapped_object* object = tdb_process_maps_find_object(&context->maps, address);
+    if (object == NULL || object != tdb_process_maps_main_object(&context->maps)) {
+        return false;
+    }
+
+    *file_address = address - object->load_bias;
+    return true;
+}
+
+void tdb_format_address(struct tdb_context* context, uint64_t address, char* buffer, size_t buffer_size)
+{
+    uint64_t file_address;
+    if (!tdb_get_file_address(context, address, &file_address)) {
+        const struct tdb_mapped_object* object = tdb_process_maps_find_object(&context->maps, address);
+        if (object != NULL) {
+            const char* object_name = strrchr(object->path, '/');
+            snprintf(buffer, buffer_size, "0x%zx in %s", address, object_name != NULL ? object_name + 1 : object->path);
+        }
+        else {
+            snprintf(buffer, buffer_size, "0x%zx", address);
+        }
+        return;
+    }
+
+    int length;
+    char symbolized[256];
+    if (tdb_symbolize(&context->symbols, file_address, symbolized, sizeof(symbolized))) {
+        length = snprintf(buffer, buffer_size, "0x%zx <%s>", address, symbolized);
+    }
+    else {
+        length = snprintf(buffer, buffer_size, "0x%zx", address);
+    }
+
+    struct tdb_source_location location;
+    if (length > 0 && (size_t)length < buffer_size &&
+        tdb_line_table_lookup_address(&context->lines, file_address, &location)) {
+        const char* file_name = strrchr(location.file, '/');
+        file_name = file_name != NULL ? file_name + 1 : location.file;
+        snprintf(buffer + length, buffer_size - (size_t)length, " at %s:%u", file_name, location.line);
+    }
+}
+
+bool tdb_lookup_source_location(struct tdb_context* context, uint64_t address, struct tdb_source_location* location)
+{
+    uint64_t file_address;
+    if (!tdb_get_file_address(context, address, &file_address) ||
+        !tdb_line_table_lookup_address(&context->lines, file_address, location)) {
+        return false;
+    }
+
+    location->low += address - file_address;
+    location->high += address - file_address;
+    return true;
+}
+
+void tdb_print_source_line(struct tdb_context* context, uint64_t address)
+{
+    struct tdb_source_location location;
+    if (!tdb_lookup_source_location(context, address, &location)) {
+        return;
+    }
+
+    FILE* source_file = fopen(location.file, "r");
+    if (source_file == NULL) {
+        return;
+    }
+
+    char* line_buffer = NULL;
+    size_t line_buffer_size = 0;
+    ssize_t line_length;
+    uint32_t line_number = 0;
+
+    while ((line_length = getline(&line_buffer, &line_buffer_size, source_file)) != -1) {
+        if (++line_number == location.line) {
+            printf("%u\t%s", line_number, line_buffer);
+            if (line_length == 0 || line_buffer[line_length - 1] != '\n') {
+                printf("\n");
+            }
+            break;
+        }
+    }
+
+    free(line_buffer);
+    fclose(source_file);
+}
+
+// On success the breakpoint takes ownership of the (optional) condition.
+static bool tdb_set_breakpoint_at_address(struct tdb_context* context, uintptr_t address,
+                                          struct tdb_condition* condition)
+{
+    struct tdb_breakpoint* existing = tdb_breakpoint_table_find(&context->breakpoints, context->pid, address);
+    if (existing != NULL && existing->id == 0 && !existing->internal) {
+        // one that calltrace planted, which now stops for the user as well
+        existing->id = context->next_breakpoint_id++;
+        existing->condition = condition;
+        printf("breakpoint %u at 0x%zx\n", existing->id, address);
+        return true;
+    }
+
+    if (existing != NULL) {
+        fprintf(stderr, "breakpoint already exists at address %zx\n", address);
+        return false;
+    }
+
+    struct tdb_breakpoint new_breakpoint;
+    tdb_breakpoint_init(&new_breakpoint, context->pid, address);
+    bool success = tdb_breakpoint_enable(&new_breakpoint);
+
+    if (!success) {
+        fprintf(stderr, "breakpoint not enabled at address %zx\n", address);
+        return false;
+    }
+
+    new_breakpoint.id = context->next_breakpoint_id;
+    new_breakpoint.condition = condition;
+
+    if (tdb_breakpoint_table_insert(&context->breakpoints, &new_breakpoint) == NULL) {
+        fprintf(stderr, "failed to record breakpoint at address %zx\n", address);
+        tdb_breakpoint_disable(&new_breakpoint);
+        return false;
+    }
+
+    context->next_breakpoint_id++;
+    printf("breakpoint %u at 0x%zx\n", new_breakpoint.id, address);
+
+    return true;
+}
+
+// The load address of the program interpreter from the auxiliary vector, 0 if the
+// program is statically linked.
+static uint64_t tdb_get_interpreter_base(pid_t pid)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/auxv", pid);
+
+    const uint64_t start = tdb_stats_start();
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        return 0;
+    }
+
+    uint64_t base = 0;
+    Elf64_auxv_t entry;
+    while (fread(&entry, sizeof(entry), 1, file) == 1 && entry.a_type != AT_NULL) {
+        if (entry.a_type == AT_BASE) {
+            base = entry.a_un.a_val;
+            break;
+        }
+    }
+
+    fclose(file);
+    tdb_stats_record(TDB_STAT_PROC_OTHER, start);
+    return base;
+}
+
+// The dynamic loader calls _dl_debug_state (the function r_debug.r_brk points to) after
+// every change to the list of loaded objects, which is when the maps need re-reading.
+static void tdb_set_loader_breakpoint(struct tdb_context* context)
+{
+    // found through the auxiliary vector rather than the PC, which is only in the loader
+    // right after exec and not when attaching
+    const uint64_t interpreter_base = tdb_get_interpreter_base(context->pid);
+    const struct tdb_mapped_object* loader =
+        interpreter_base != 0 ? tdb_process_maps_find_object(&context->maps, interpreter_base) : NULL;
+
+    if (loader == NULL || loader == tdb_process_maps_main_object(&context->maps)) {
+        return;  // statically linked
+    }
+
+    struct tdb_symbol_table loader_symbols;
+    if (!tdb_symbol_table_load(&loader_symbols, loader->path)) {
+        return;
+    }
+
+    const struct tdb_symbol* symbol = tdb_symbol_lookup_name(&loader_symbols, "_dl_debug_state");
+    if (symbol != NULL) {
+        struct tdb_breakpoint bp;
+        tdb_breakpoint_init(&bp, context->pid, loader->load_bias + symbol->address);
+        bp.internal = true;
+
+        if (tdb_breakpoint_table_find(&context->breakpoints, context->pid, bp.address) == NULL &&
+            tdb_breakpoint_enable(&bp) && tdb_breakpoint_table_insert(&context->breakpoints, &bp) == NULL) {
+            tdb_breakpoint_disable(&bp);
+        }
+    }
+
+    tdb_symbol_table_free(&loader_symbols);
+}
+
+void tdb_handle_exec(struct tdb_context* context)
+{
+    // the objects unwound through so far may not be part of the new program
+    tdb_unwinder_free(&context->unwinder);
+    tdb_instruction_cache_clear(&context->instructions);
+
+    tdb_process_maps_refresh(&context->maps, context->pid);
+    tdb_set_loader_breakpoint(context);
+}
+
+static uint64_t tdb_monotonic_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+void tdb_handle_calltrace_breakpoint(struct tdb_context* context, struct tdb_thread* thread, uint64_t address)
+{
+    const uint64_t now = tdb_monotonic_ns();
+
+    bool success;
+    const uint64_t stack_pointer = tdb_get_register_value(&thread->registers, x86_64_rsp, &success);
+    if (!success) {
+        return;
+    }
+
+    const struct tdb_breakpoint* bp = tdb_breakpoint_table_find(&context->breakpoints, context->pid, address);
+    const uint32_t function = bp->traced_function;
+
+    // a return lands before any call made from the same address
+    if (bp->call_return) {
+        tdb_calltrace_return(&context->calltrace, thread->tid, address, stack_pointer, now);
+    }
+
+    if (function == TDB_NO_TRACED_FUNCTION) {
+        return;
+    }
+
+    const uint64_t return_address = tdb_read_memory(context->pid, stack_pointer, &success);
+    if (!success) {
+        return;
+    }
+
+    tdb_calltrace_enter(&context->calltrace, thread->tid, function, return_address, stack_pointer, now);
+
+    struct tdb_breakpoint* return_bp = tdb_breakpoint_table_find(&context->breakpoints, context->pid, return_address);
+    if (return_bp != NULL) {
+        return_bp->call_return = true;
+        return;
+    }
+
+    struct tdb_breakpoint new_breakpoint;
+    tdb_breakpoint_init(&new_breakpoint, context->pid, return_address);
+    new_breakpoint.call_return = true;
+
+    if (tdb_breakpoint_enable(&new_breakpoint) &&
+        tdb_breakpoint_table_insert(&context->breakpoints, &new_breakpoint) == NULL) {
+        tdb_breakpoint_disable(&new_breakpoint);
+    }
+}
+
+static bool tdb_is_calltrace_only_breakpoint(const struct tdb_breakpoint* bp)
+{
+    return (bp->traced_function != TDB_NO_TRACED_FUNCTION || bp->call_return) && bp->id == 0 && !bp->internal;
+}
+
+// Takes the calltrace flags off every breakpoint, removing those only calltrace used.
+static void tdb_remove_calltrace_breakpoints(struct tdb_context* context)
+{
+    size_t cursor = 0;
+    struct tdb_breakpoint* bp;
+
+    if (context->threads.count > 0) {
+        struct tdb_breakpoint_batch batch;
+        tdb_breakpoint_batch_init(&batch, context->pid);
+        while ((bp = tdb_breakpoint_table_next(&context->breakpoints, &cursor)) != NULL) {
+            if (tdb_is_calltrace_only_breakpoint(bp)) {
+                tdb_breakpoint_batch_add(&batch, bp->address, false);
+            }
+        }
+        tdb_breakpoint_batch_apply(&batch, &context->breakpoints);
+        tdb_breakpoint_batch_free(&batch);
+    }
+
+    cursor = 0;
+    while ((bp = tdb_breakpoint_table_next(&context->breakpoints, &cursor)) != NULL) {
+        if (tdb_is_calltrace_only_breakpoint(bp)) {
+            tdb_breakpoint_table_remove(&context->breakpoints, bp->pid, bp->address);
+        }
+
+        bp->traced_function = TDB_NO_TRACED_FUNCTION;
+        bp->call_return = false;
+    }
+}
+
+static void tdb_handle_calltrace_command(struct tdb_context* context, char** args, size_t arg_count)
+{
+    if (arg_count != 1) {
+        printf("invalid calltrace command.\n");
+        return;
+    }
+
+    if (context->threads.count == 0) {
+        printf("The program is not being run.\n");
+        return;
+    }
+
+    regex_t pattern;
+    if (regcomp(&pattern, args[0], REG_EXTENDED | REG_NOSUB) != 0) {
+        printf("invalid regular expression: %s\n", args[0]);
+        return;
+    }
+
+    tdb_calltrace_free(&context->calltrace);
+
+    const uint64_t load_bias = tdb_process_maps_main_bias(&context->maps);
+    struct tdb_breakpoint_batch batch;
+    tdb_breakpoint_batch_init(&batch, context->pid);
+
+    for (size_t i = 0; i < context->symbols.symbol_count; i++) {
+        const struct tdb_symbol* symbol = &context->symbols.symbols[i];
+        const char* name = tdb_symbol_name(&context->symbols, symbol);
+
+        if (symbol->type != STT_FUNC || symbol->size == 0 || regexec(&pattern, name, 0, NULL, 0) != 0) {
+            continue;
+        }
+
+        const uint64_t address = load_bias + symbol->address;
+
+        // aliases share an entry breakpoint, the first name wins
+        struct tdb_breakpoint* bp = tdb_breakpoint_table_find(&context->breakpoints, context->pid, address);
+        if (bp != NULL && bp->traced_function != TDB_NO_TRACED_FUNCTION) {
+            continue;
+        }
+
+        const uint32_t function = tdb_calltrace_add_function(&context->calltrace, address, name);
+        if (function == TDB_NO_TRACED_FUNCTION) {
+            break;
+        }
+
+        if (bp != NULL) {
+            bp->traced_function = function;
+            continue;
+        }
+
+        // inserted disabled, and all enabled together below
+        struct tdb_breakpoint new_breakpoint;
+        tdb_breakpoint_init(&new_breakpoint, context->pid, address);
+        new_breakpoint.traced_function = function;
+
+        if (tdb_breakpoint_table_insert(&context->breakpoints, &new_breakpoint) != NULL) {
+            tdb_breakpoint_batch_add(&batch, address, true);
+        }
+    }
+
+    regfree(&pattern);
+
+    if (tdb_breakpoint_batch_apply(&batch, &context->breakpoints) > 0) {
+        fprintf(stderr, "some traced functions couldn't get a breakpoint\n");
+    }
+    tdb_breakpoint_batch_free(&batch);
+
+    if (context->calltrace.function_count == 0) {
+        printf("no function matches %s\n", args[0]);
+        return;
+    }
+
+    printf("tracing %zu functions, press Ctrl-C to stop\n", context->calltrace.function_count);
+
+    // runs until the program exits or something (a user breakpoint, a signal or Ctrl-C)
+    // stops it, the traced calls themselves never get here
+    tdb_continue(context);
+
+    tdb_remove_calltrace_breakpoints(context);
+    tdb_calltrace_report(&context->calltrace);
+}
+
+static struct tdb_breakpoint* tdb_find_breakpoint_by_id(struct tdb_context* context, uint32_t id)
+{
+    size_t cursor = 0;
+    struct tdb_breakpoint* bp;
+    while ((bp = tdb_breakpoint_table_next(&context->breakpoints, &cursor)) != NULL) {
+        if (bp->id == id && !bp->internal) {
+            return bp;
+        }
+    }
+
+    return NULL;
+}
+
+static void tdb_handle_continue_command(struct tdb_context* context)
+{
+    tdb_continue(context);
+}
+
+static void tdb_handle_register_command(struct tdb_context* context, char** args, size_t arg_count)
+{
+    struct tdb_thread* thread = tdb_current_thread(context);
+    if (thread == NULL) {
+        printf("The program is not being run.\n");
+        return;
+    }
+
+    if (arg_count == 1) {
+        if (!strcmp("dump", args[0])) {
+            tdb_dump_registers(&thread->registers);
+        }
+        else {
+            printf("invalid register argument: %s\n", args[0]);
+        }
+    }
+    else if (arg_count == 2) {
+        if (!strcmp("read", args[0])) {
+            enum x86_64_register reg = tdb_get_register_from_name(args[1]);
+
+            if (reg == x86_64_unknown) {
+                printf("unknown x86_64 register: %s\n", args[1]);
+            }
+            else {
+                bool success;
+                uint64_t value = tdb_get_register_value(&thread->registers, reg, &success);
+                if (success) {
+                    printf("0x%zx\n", value);
+                }
+                else {
+                    printf("error retrieving register value from memory\n");
+                }
+            }
+        }
+        else {
+            printf("invalid register arguments: %s %s\n", args[0], args[1]);
+        }
+    }
+    else if (arg_count == 3 && !strcmp("write", args[0])) {
+        enum x86_64_register reg = tdb_get_register_from_name(args[1]);
+
+        if (reg == x86_64_unknown) {
+            printf("unknown x86_64 register: %s\n", args[1]);
+        }
+        else if (context->core.data != NULL) {
+            printf("The registers of a core file can't be written.\n");
+        }
+        else if (!tdb_set_register_value(&thread->registers, reg, strtoull(args[2], NULL, 16))) {
+            printf("error writing register value\n");
+        }
+    }
+    else {
+        printf("invalid register command\n");
+    }
+}
+
+static void tdb_print_hexdump_line(uintptr_t address, const uint8_t* data, size_t length)
+{
+    printf("%016zx  ", address);
+
+    for (size_t i = 0; i < 16; i++) {
+        if (i < length) {
+            printf("%02x ", data[i]);
+        }
+        else {
+            printf("   ");
+        }
+
+        if (i == 7) {
+            printf(" ");
+        }
+    }
+
+    printf(" |");
+    for (size_t i = 0; i < length; i++) {
+        printf("%c", isprint(data[i]) ? data[i] : '.');
+    }
+    printf("|\n");
+}
+
+static void tdb_dump_memory(struct tdb_context* context, uintptr_t address, size_t length)
+{
+    // read in large chunks so that multi-megabyte dumps don't need a buffer of the same size
+    static const size_t CHUNK_SIZE = 64 * 1024;
+
+    uint8_t* chunk = malloc(CHUNK_SIZE);
+    if (chunk == NULL) {
+        fprintf(stderr, "Failed to allocate memory dump buffer\n");
+        return;
+    }
+
+    size_t offset = 0;
+
+    while (offset < length) {
+        size_t wanted = length - offset < CHUNK_SIZE ? length - offset : CHUNK_SIZE;
+        size_t received = tdb_read_memory_range(context->pid, address + offset, chunk, wanted);
+
+        // the program's bytes, not the int3s of its breakpoints
+        const uintptr_t chunk_address = address + offset;
+        size_t cursor = 0;
+        struct tdb_breakpoint* bp;
+        while ((bp = tdb_breakpoint_table_next(&context->breakpoints, &cursor)) != NULL) {
+            if (bp->enabled && bp->pid == context->pid && bp->address >= chunk_address &&
+                bp->address - chunk_address < received) {
+                chunk[bp->address - chunk_address] = bp->saved_data;
+            }
+        }
+
+        for (size_t i = 0; i < received; i += 16) {
+            size_t line_length = received - i < 16 ? received - i : 16;
+            tdb_print_hexdump_line(address + offset + i, chunk + i, line_length);
+        }
+
+        offset += received;
+
+        if (received < wanted) {
+            printf("Failed to read memory at address: 0x%zx\n", address + offset);
+            break;
+        }
+    }
+
+    free(chunk);
+}
+
+static void tdb_handle_memory_command(struct tdb_context* context, char** args, size_t arg_count)
+{
+    if (arg_count != 2 && arg_count != 3) {
+        printf("invalid memory command\n");
+        return;
+    }
+
+    uint64_t address = strtoull(args[1], NULL, 16);
+    if (address == 0) {
+        printf("Invalid address: %s\n", args[1]);
+        return;
+    }
+
+    if (!strcmp(args[0], "read")) {
+        if (arg_count == 3) {
+            uint64_t length = strtoull(args[2], NULL, 0);
+            if (length == 0) {
+                printf("Invalid length: %s\n", args[2]);
+                return;
+            }
+
+            tdb_dump_memory(context, address, length);
+            return;
+        }
+
+        bool read_success;
+        uint64_t data = tdb_read_memory(context->pid, address, &read_success);
+        if (!read_success) {
+            printf("Failed to read memory at address: 0x%zx\n", address);
+            return;
+        }
+        printf("0x%zx\n", data);
+    }
+    else if (!strcmp(args[0], "write")) {
+        if (arg_count != 3) {
+            printf("invalid memory write command\n");
+            return;
+        }
+
+        uint64_t value = strtoull(args[2], NULL, 16);
+
+        bool write_success;
+        tdb_write_memory(context->pid, address, value, &write_success);
+        if (!write_success) {
+            printf("Failed to write memory at address: 0x%zx\n", address);
+            return;
+        }
+        tdb_instruction_cache_clear(&context->instructions);
+    }
+    else {
+        printf("invalid memory command.\n");
+    }
+}
+
+// Like tdb_format_address, without the source line, as "0x401126 <main+0x4>".
+static void tdb_format_code_address(struct tdb_context* context, uint64_t address, char* buffer, size_t buffer_size)
+{
+    uint64_t file_address;
+    char symbolized[256];
+    if (tdb_get_file_address(context, address, &file_address) &&
+        tdb_symbolize(&context->symbols, file_address, symbolized, sizeof(symbolized))) {
+        snprintf(buffer, buffer_size, "0x%" PRIx64 " <%s>", address, symbolized);
+    }
+    else {
+        snprintf(buffer, buffer_size, "0x%" PRIx64, address);
+    }
+}
+
+static void tdb_handle_disassemble_command(struct tdb_context* context, char** args, size_t arg_count)
+{
+    if (arg_count > 2) {
+        printf("invalid disassemble command.\n");
+        return;
+    }
+    if (context->threads.count == 0) {
+        printf("The program is not being run.\n");
+        return;
+    }
+
+    // a whole function when given one by name, otherwise a number of instructions from
+    // an address, or from the PC
+    const uint64_t pc = tdb_get_pc(tdb_current_thread(context));
+    uint64_t address = pc;
+    uint64_t end = UINT64_MAX;
+    size_t count = 10;
+
+    if (arg_count > 0) {
+        const struct tdb_symbol* symbol = tdb_symbol_lookup_name(&context->symbols, args[0]);
+        if (symbol != NULL) {
+            address = tdb_process_maps_main_bias(&context->maps) + symbol->address;
+            if (arg_count == 1 && symbol->size != 0) {
+                end = address + symbol->size;
+                count = SIZE_MAX;
+            }
+        }
+        else {
+            address = strtoull(args[0], NULL, 16);
+            if (address == 0) {
+                fprintf(stderr, "invalid address or unknown function: %s\n", args[0]);
+                return;
+            }
+        }
+    }
+    if (arg_count == 2) {
+        count = strtoull(args[1], NULL, 0);
+        if (count == 0) {
+            printf("Invalid count: %s\n", args[1]);
+            return;
+        }
+    }
+
+    for (size_t i = 0; i < count && address < end; i++) {
+        const uint8_t* bytes;
+        const struct tdb_instruction* instruction = tdb_instruction_cache_decode(
+            &context->instructions, context->pid, &context->breakpoints, address, &bytes);
+        if (instruction == NULL) {
+            printf("Failed to read memory at address: 0x%" PRIx64 "\n", address);
+            return;
+        }
+
+        char location[320];
+        tdb_format_code_address(context, address, location, sizeof(location));
+
+        char encoding[3 * TDB_INSTRUCTION_MAX_LENGTH + 1];
+        int encoding_length = 0;
+        for (size_t j = 0; j < instruction->length; j++) {
+            encoding_length += snprintf(encoding + encoding_length, sizeof(encoding) - (size_t)encoding_length,
+                                        "%02x ", bytes[j]);
+        }
+
+        char text[128];
+        tdb_format_instruction(instruction, text, sizeof(text));
+
+        printf("%s%-36s %-24s %s", address == pc ? "=> " : "   ", location, encoding, text);
+
+        // what rip-relative operands refer to, and the symbols branches go to (their
+        // address is already in the operand)
+        if (instruction->rip_relative) {
+            char target[320];
+            tdb_format_code_address(context, instruction->target, target, sizeof(target));
+            printf("  # %s", target);
+        }
+        else if (instruction->kind == TDB_INSTRUCTION_CALL || instruction->kind == TDB_INSTRUCTION_JUMP ||
+                 instruction->kind == TDB_INSTRUCTION_BRANCH) {
+            char target[320];
+            tdb_format_code_address(context, instruction->target, target, sizeof(target));
+            const char* symbol = strchr(target, '<');
+            if (symbol != NULL) {
+                printf("  # %s", symbol);
+            }
+        }
+        printf("\n");
+
+        address += instruction->length;
+    }
+}
+
+// Glues the words of "if <expr>" back together and compiles the expression.
+static bool tdb_compile_breakpoint_condition(struct tdb_condition** condition, char** words, size_t word_count)
+{
+    size_t source_length = 0;
+    for (size_t i = 0; i < word_count; i++) {
+        source_length += strlen(words[i]) + 1;
+    }
+
+    char* source = malloc(source_length);
+    if (source == NULL) {
+        fprintf(stderr, "Failed to allocate breakpoint condition\n");
+        return false;
+    }
+
+    source[0] = '\0';
+    for (size_t i = 0; i < word_count; i++) {
+        strcat(source, words[i]);
+        if (i + 1 < word_count) {
+            strcat(source, " ");
+        }
+    }
+
+    *condition = malloc(sizeof(struct tdb_condition));
+    if (*condition == NULL) {
+        fprintf(stderr, "Failed to allocate breakpoint condition\n");
+        free(source);
+        return false;
+    }
+
+    bool compiled = tdb_condition_compile(*condition, source);
+    free(source);
+
+    if (!compiled) {
+        free(*condition);
+        *condition = NULL;
+    }
+
+    return compiled;
+}
+
+static void tdb_handle_break_command(struct tdb_context* context, char** args, size_t arg_count)
+{
+    if (arg_count == 0 || (arg_count > 1 && (strcmp(args[1], "if") || arg_count == 2))) {
+        printf("invalid breakpoint command.\n");
+        return;
+    }
+
+    // file:line or a symbol name in the executable, otherwise a hex runtime address
+    const uint64_t load_bias = tdb_process_maps_main_bias(&context->maps);
+    uint64_t addresses[16];
+    size_t address_count = 1;
+    const struct tdb_symbol* symbol = tdb_symbol_lookup_name(&context->symbols, args[0]);
+    const char* line_separator = strrchr(args[0], ':');
+
+    if (symbol != NULL) {
+        addresses[0] = load_bias + symbol->address;
+    }
+    else if (line_separator != NULL) {
+        char* file = strndup(args[0], (size_t)(line_separator - args[0]));
+        uint32_t line = (uint32_t)strtoul(line_separator + 1, NULL, 10);
+        uint32_t actual_line = 0;
+
+        address_count = line == 0 ? 0
+                                  : tdb_line_table_lookup_line(&context->lines, file, line, addresses,
+                                                               sizeof(addresses) / sizeof(addresses[0]), &actual_line);
+        if (address_count == 0) {
+            fprintf(stderr, "no code for source line %s\n", args[0]);
+            free(file);
+            return;
+        }
+        if (actual_line != line) {
+            printf("no code at %s, using line %u\n", args[0], actual_line);
+        }
+        for (size_t i = 0; i < address_count; i++) {
+            addresses[i] += load_bias;
+        }
+        free(file);
+    }
+    else {
+        addresses[0] = strtoull(args[0], NULL, 16);
+    }
+
+    debug_print("address given: %ld (0x%zx)\n", addresses[0], addresses[0]);
+    if (addresses[0] == 0) {
+        fprintf(stderr, "invalid address or unknown function: %s\n", args[0]);
+        return;
+    }
+
+    for (size_t i = 0; i < address_count; i++) {
+        struct tdb_condition* condition = NULL;
+        if (arg_count > 2 && !tdb_compile_breakpoint_condition(&condition, args + 2, arg_count - 2)) {
+            return;
+        }
+
+        if (!tdb_set_breakpoint_at_address(context, addresses[i], condition) && condition != NULL) {
+            tdb_condition_free(condition);
+            free(condition);
+        }
+    }
+}
+
+// Breakpoints on every function whose name matches, planted with one batch so that
+// thousands of them cost a read and a write per page of text.
+static void tdb_handle_rbreak_command(struct tdb_context* context, char** args, size_t arg_count)
+{
+    if (arg_count != 1) {
+        printf("invalid rbreak command.\n");
+        return;
+    }
+
+    if (context->threads.count == 0) {
+        printf("The program is not being run.\n");
+        return;
+    }
+
+    regex_t pattern;
+    if (regcomp(&pattern, args[0], REG_EXTENDED | REG_NOSUB) != 0) {
+        printf("invalid regular expression: %s\n", args[0]);
+        return;
+    }
+
+    const uint64_t load_bias = tdb_process_maps_main_bias(&context->maps);
+    const uint32_t first_id = context->next_breakpoint_id;
+    struct tdb_breakpoint_batch batch;
+    tdb_breakpoint_batch_init(&batch, context->pid);
+
+    for (size_t i = 0; i < context->symbols.symbol_count; i++) {
+        const struct tdb_symbol* symbol = &context->symbols.symbols[i];
+        if (symbol->type != STT_FUNC || symbol->size == 0 ||
+            regexec(&pattern, tdb_symbol_name(&context->symbols, symbol), 0, NULL, 0) != 0) {
+            continue;
+        }
+
+        const uint64_t address = load_bias + symbol->address;
+
+        // aliases share a breakpoint, and functions that already have one keep it
+        if (tdb_breakpoint_table_find(&context->breakpoints, context->pid, address) != NULL) {
+            continue;
+        }
+
+        struct tdb_breakpoint new_breakpoint;
+        tdb_breakpoint_init(&new_breakpoint, context->pid, address);
+        new_breakpoint.id = context->next_breakpoint_id;
+
+        if (tdb_breakpoint_table_insert(&context->breakpoints, &new_breakpoint) == NULL) {
+            break;
+        }
+
+        if (!tdb_breakpoint_batch_add(&batch, address, true)) {
+            tdb_breakpoint_table_remove(&context->breakpoints, context->pid, address);
+            break;
+        }
+
+        context->next_breakpoint_id++;
+    }
+
+    regfree(&pattern);
+
+    const size_t failed = tdb_breakpoint_batch_apply(&batch, &context->breakpoints);
+    tdb_breakpoint_batch_free(&batch);
+
+    // the ones that couldn't be planted aren't kept around disabled
+    if (failed > 0) {
+        size_t cursor = 0;
+        struct tdb_breakpoint* bp;
+        while ((bp = tdb_breakpoint_table_next(&context->breakpoints, &cursor)) != NULL) {
+            if (bp->id >= first_id && !bp->enabled) {
+                tdb_breakpoint_table_remove(&context->breakpoints, bp->pid, bp->address);
+            }
+        }
+        fprintf(stderr, "%zu breakpoints couldn't be planted\n", failed);
+    }
+
+    const size_t count = (size_t)(context->next_breakpoint_id - first_id) - failed;
+    if (count == 0) {
+        printf("no new breakpoint on a function matching %s\n", args[0]);
+        return;
+    }
+
+    printf("%zu breakpoints (%u-%u) on functions matching %s\n", count, first_id, context->next_breakpoint_id - 1,
+           args[0]);
+}
+
+static void tdb_handle_ignore_command(struct tdb_context* context, char** args, size_t arg_count)
+{
+    if (arg_count != 2) {
+        printf("invalid ignore command.\n");
+        return;
+    }
+
+    uint32_t id = (uint32_t)strtoul(args[0], NULL, 10);
+    struct tdb_breakpoint* bp = tdb_find_breakpoint_by_id(context, id);
+    if (bp == NULL) {
+        printf("no breakpoint number %s\n", args[0]);
+        return;
+    }
+
+    bp->ignore_count = strtoull(args[1], NULL, 10);
+    printf("will ignore next %zu crossings of breakpoint %u\n", bp->ignore_count, bp->id);
+}
+
+static void tdb_handle_hbreak_command(struct tdb_context* context, char** args, size_t arg_count)
+{
+    if (arg_count != 1) {
+        printf("invalid hbreak command.\n");
+        return;
+    }
+
+    uint64_t address = strtoull(args[0], NULL, 16);
+    if (address == 0) {
+        fprintf(stderr, "invalid address: %s\n", args[0]);
+        return;
+    }
+
+    int slot = tdb_hw_breakpoint_set(&context->hw_breakpoints, address, TDB_HW_BREAKPOINT_EXECUTE, 1);
+    if (slot != -1 && tdb_apply_hw_breakpoints(context)) {
+        printf("hardware breakpoint %d at 0x%zx\n", slot, address);
+    }
+}
+
+static void tdb_handle_watch_command(struct tdb_context* context, char** args, size_t arg_count,
+                                     enum tdb_hw_breakpoint_type type)
+{
+    if (arg_count != 1 && arg_count != 2) {
+        printf("invalid watch command.\n");
+        return;
+    }
+
+    uint64_t address = strtoull(args[0], NULL, 16);
+    if (address == 0) {
+        fprintf(stderr, "invalid address: %s\n", args[0]);
+        return;
+    }
+
+    uint64_t length = arg_count == 2 ? strtoull(args[1], NULL, 0) : 8;
+    if (length != 1 && length != 2 && length != 4 && length != 8) {
+        fprintf(stderr, "hardware watchpoint length must be 1, 2, 4 or 8 bytes\n");
+        return;
+    }
+
+    int slot = tdb_hw_breakpoint_set(&context->hw_breakpoints, address, type, (uint8_t)length);
+    if (slot != -1 && tdb_apply_hw_breakpoints(context)) {
+        printf("watchpoint %d at 0x%" PRIx64 " (%" PRIu64 " bytes)\n", slot, address, length);
+    }
+}
+
+static void tdb_handle_hdelete_command(struct tdb_context* context, char** args, size_t arg_count)
+{
+    if (arg_count != 1) {
+        printf("invalid hdelete command.\n");
+        return;
+    }
+
+    int slot = (int)strtol(args[0], NULL, 10);
+    if (!tdb_hw_breakpoint_clear(&context->hw_breakpoints, slot)) {
+        printf("no hardware breakpoint or watchpoint in slot %s\n", args[0]);
+        return;
+    }
+
+    tdb_apply_hw_breakpoints(context);
+}
+
+static void tdb_handle_threads_command(struct tdb_context* context)
+{
+    for (size_t i = 0; i < context->threads.count; i++) {
+        struct tdb_thread* thread = &context->threads.threads[i];
+        const char marker = thread->tid == context->current_tid ? '*' : ' ';
+        char location[320];
+        tdb_format_address(context, tdb_get_pc(thread), location, sizeof(location));
+        printf("%c thread %d\tPC = %s\n", marker, thread->tid, location);
+    }
+}
+
+static void tdb_handle_thread_command(struct tdb_context* context, char** args, size_t arg_count)
+{
+    if (arg_count == 0) {
+        printf("current thread is %d\n", context->current_tid);
+        return;
+    }
+
+    if (arg_count != 1) {
+        printf("invalid thread command.\n");
+        return;
+    }
+
+    pid_t tid = (pid_t)strtol(args[0], NULL, 10);
+    if (tdb_thread_table_find(&context->threads, tid) == NULL) {
+        printf("no thread %s\n", args[0]);
+        return;
+    }
+
+    context->current_tid = tid;
+}
+
+#define TDB_MAX_BACKTRACE_FRAMES 256
+
+static void tdb_handle_backtrace_command(struct tdb_context* context, char** args, size_t arg_count)
+{
+    if (arg_count > 1) {
+        printf("invalid backtrace command.\n");
+        return;
+    }
+
+    struct tdb_thread* thread = tdb_current_thread(context);
+    if (thread == NULL) {
+        printf("The program is not being run.\n");
+        return;
+    }
+
+    size_t max_frames = TDB_MAX_BACKTRACE_FRAMES;
+    if (arg_count == 1 && ((max_frames = strtoull(args[0], NULL, 10)) == 0 || max_frames > TDB_MAX_BACKTRACE_FRAMES)) {
+        printf("invalid frame count: %s\n", args[0]);
+        return;
+    }
+
+    struct tdb_frame frames[TDB_MAX_BACKTRACE_FRAMES];
+    const size_t frame_count =
+        tdb_unwind(&context->unwinder, &context->maps, context->pid, &thread->registers, frames, max_frames);
+
+    for (size_t i = 0; i < frame_count; i++) {
+        char location[320];
+        tdb_format_address(context, frames[i].pc, location, sizeof(location));
+        printf("#%-3zu %s\n", i, location);
+    }
+}
+
+#define TDB_DEFAULT_TRACE_PATH "trace.tdb"
+#define TDB_DEFAULT_TRACE_STEPS 1000000
+
+static void tdb_print_trace(struct tdb_context* context, const char* path)
+{
+    struct tdb_trace_reader reader;
+    if (!tdb_trace_reader_open(&reader, path)) {
+        return;
+    }
+
+    // the trace may come from an earlier run with the executable loaded elsewhere
+    const uint64_t relocation = tdb_process_maps_main_object(&context->maps) != NULL
+                                    ? tdb_process_maps_main_bias(&context->maps) - reader.header.load_bias
+                                    : 0;
+
+    uint64_t index = 0;
+    while (tdb_trace_reader_next(&reader)) {
+        char location[320];
+        tdb_format_address(context, reader.pc + relocation, location, sizeof(location));
+        printf("%zu\t%s", index++, location);
+
+        for (size_t i = 0; i < TDB_TRACE_REGISTER_WORDS; i++) {
+            const char* name = tdb_get_name_from_register_offset(i * sizeof(uint64_t));
+            if ((reader.changed_registers & (1u << i)) && name != NULL && strcmp(name, "rip")) {
+                printf(" %s=0x%zx", name, reader.registers[i]);
+            }
+        }
+        printf("\n");
+    }
+
+    if (index != reader.header.step_count) {
+        printf("trace is truncated, expected %zu steps\n", reader.header.step_count);
+    }
+
+    tdb_trace_reader_close(&reader);
+}
+
+static void tdb_handle_trace_command(struct tdb_context* context, char** args, size_t arg_count)
+{
+    if (arg_count > 0 && !strcmp(args[0], "print")) {
+        tdb_print_trace(context, arg_count > 1 ? args[1] : TDB_DEFAULT_TRACE_PATH);
+        return;
+    }
+
+    uint64_t max_steps = TDB_DEFAULT_TRACE_STEPS;
+    uint64_t until_address = 0;
+    bool record_registers = false;
+
+    for (size_t i = 0; i < arg_count; i++) {
+        if (!strcmp(args[i], "regs")) {
+            record_registers = true;
+        }
+        else if (!strcmp(args[i], "until") && i + 1 < arg_count) {
+            until_address = strtoull(args[++i], NULL, 16);
+            max_steps = UINT64_MAX;
+        }
+        else if ((max_steps = strtoull(args[i], NULL, 10)) == 0) {
+            printf("invalid trace command.\n");
+            return;
+        }
+    }
+
+    if (context->threads.count == 0) {
+        printf("The program is not being run.\n");
+        return;
+    }
+
+    struct tdb_trace_writer writer;
+    if (!tdb_trace_writer_start(&writer, TDB_DEFAULT_TRACE_PATH, record_registers,
+                                tdb_process_maps_main_bias(&context->maps))) {
+        return;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    const uint64_t steps = tdb_trace_thread(context, &writer, max_steps, until_address);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (!tdb_trace_writer_finish(&writer)) {
+        fprintf(stderr, "Failed to write trace file %s\n", TDB_DEFAULT_TRACE_PATH);
+    }
 
-    //     FILE* maps_file;
-    //     if ((maps_file = fopen(maps_path, "r")) == NULL) {
-    //         printf("couldn't find maps file!\n");
-    //     }
+    const double seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("traced %zu steps in %.3f s (%.0f steps/s) into %s\n", steps, seconds,
+           seconds > 0 ? (double)steps / seconds : 0.0, TDB_DEFAULT_TRACE_PATH);
 
-    //     char* line_buffer = NULL;
-    //     size_t line_buffer_size = 0;
-    //     ssize_t line_length;
+    struct tdb_thread* thread = tdb_current_thread(context);
+    if (thread != NULL) {
+        char location[320];
+        const uint64_t pc = tdb_get_pc(thread);
+        tdb_format_address(context, pc, location, sizeof(location));
+        printf("PC = %s\n", location);
+        tdb_print_source_line(context, pc);
+    }
+}
 
-    //     while ((line_length = getline(&line_buffer, &line_buffer_size, maps_file)) != -1) {
-    //         if (strstr(line_buffer, "[stack]") != NULL) {
-    //             char* stack_addr_str = strtok(line_buffer, "-");
-    //             uint64_t stack_addr = strtoull(stack_addr_str, NULL, 16);
-    //             printf("stack address = 0x%zx\n", stack_addr);
-    //             context->stack_addr = stack_addr;
-    //             break;
-    //         }
-    //     }
+#define TDB_DEFAULT_FOLDED_STACKS_PATH "profile.folded"
 
-    //     free(line_buffer);
-    //     fclose(maps_file);
-    // }  // finish grabbing stack address
-}
+// Symbol tables of the shared objects are only loaded once a sample lands in them.
+struct tdb_profile_symbols {
+    struct tdb_context* context;
+    struct tdb_symbol_table* tables;
+    bool* loaded;
+    char name[PATH_MAX + 2];
+};
 
-void tdb_context_free(struct tdb_context* context)
+static const char* tdb_profile_symbolize(void* data, uint64_t address)
 {
-    context->pid = -1;
-    context->target_path[0] = '\0';
-    context->breakpoint_count = 0;
+    struct tdb_profile_symbols* symbols = data;
+    struct tdb_process_maps* maps = &symbols->context->maps;
+
+    const struct tdb_mapping* mapping = tdb_process_maps_find(maps, address);
+    if (mapping == NULL || mapping->object_index == TDB_MAPPING_NO_OBJECT) {
+        return "[unknown]";
+    }
+
+    const struct tdb_mapped_object* object = &maps->objects[mapping->object_index];
+    const struct tdb_symbol_table* table = &symbols->context->symbols;
+
+    if (mapping->object_index != maps->main_object) {
+        table = &symbols->tables[mapping->object_index];
+        if (!symbols->loaded[mapping->object_index]) {
+            symbols->loaded[mapping->object_index] = true;
+            tdb_symbol_table_load(&symbols->tables[mapping->object_index], object->path);
+        }
+    }
+
+    const struct tdb_symbol* symbol = tdb_symbol_lookup_address(table, address - object->load_bias);
+    if (symbol != NULL) {
+        return tdb_symbol_name(table, symbol);
+    }
+
+    const char* object_name = strrchr(object->path, '/');
+    snprintf(symbols->name, sizeof(symbols->name), "[%s]", object_name != NULL ? object_name + 1 : object->path);
+    return symbols->name;
 }
 
-static void tdb_set_breakpoint_at_address(struct tdb_context* context, uintptr_t address_offset)
+// Samples the running process for duration_ms (until it exits if negative), then
+// reports the hottest functions and writes out the folded stacks.
+static void tdb_profile(struct tdb_context* context, int64_t duration_ms, unsigned frequency)
 {
-    const uintptr_t actual_address = context->stack_addr + address_offset;
+    struct tdb_profiler profiler;
+    tdb_profiler_init(&profiler, frequency);
 
-    for (size_t i = 0; i < context->breakpoint_count; i++) {
-        struct tdb_breakpoint* bp = &context->breakpoints[i];
-        if (bp->pid == context->pid && bp->address == actual_address) {
-            fprintf(stderr, "breakpoint already exists at address %zx\n", address_offset);
-            return;
+    const bool finished = tdb_continue_profiling(context, &profiler, duration_ms);
+    if (!finished) {
+        printf("profiling stopped early\n");
+    }
+
+    // samples may have landed in objects loaded since the last refresh
+    if (context->threads.count > 0) {
+        tdb_process_maps_refresh(&context->maps, context->pid);
+    }
+
+    struct tdb_profile_symbols symbols;
+    symbols.context = context;
+    symbols.tables = calloc(context->maps.object_count + 1, sizeof(struct tdb_symbol_table));
+    symbols.loaded = calloc(context->maps.object_count + 1, sizeof(bool));
+
+    if (symbols.tables != NULL && symbols.loaded != NULL) {
+        tdb_profiler_report(&profiler, tdb_profile_symbolize, &symbols, TDB_DEFAULT_FOLDED_STACKS_PATH);
+
+        for (size_t i = 0; i < context->maps.object_count; i++) {
+            if (symbols.loaded[i]) {
+                tdb_symbol_table_free(&symbols.tables[i]);
+            }
         }
     }
 
-    if (context->breakpoint_count == TDB_BREAKPOINTS_ALLOWED) {
-        fprintf(stderr,
-                "breakpoint capacity overflowed, consider redefining "
-                "TDB_BREAKPOINTS_ALLOWED");
+    free(symbols.tables);
+    free(symbols.loaded);
+    tdb_profiler_free(&profiler);
+}
+
+static void tdb_handle_profile_command(struct tdb_context* context, char** args, size_t arg_count)
+{
+    if (arg_count != 1 && arg_count != 2) {
+        printf("invalid profile command.\n");
         return;
     }
 
-    struct tdb_breakpoint new_breakpoint;
-    tdb_breakpoint_init(&new_breakpoint, context->pid, actual_address);
-    bool success = tdb_breakpoint_enable(&new_breakpoint);
+    const double seconds = strtod(args[0], NULL);
+    const unsigned long frequency = arg_count == 2 ? strtoul(args[1], NULL, 10) : TDB_PROFILE_DEFAULT_FREQUENCY;
 
-    if (success) {
-        context->breakpoints[context->breakpoint_count] = new_breakpoint;
-        context->breakpoint_count++;
-    }
-    else {
-        fprintf(stderr, "breakpoint not enabled at address %zx\n", address_offset);
+    if (seconds <= 0 || frequency == 0) {
+        printf("invalid profile command.\n");
+        return;
     }
+
+    tdb_profile(context, (int64_t)(seconds * 1000), (unsigned)frequency);
 }
 
-static uint64_t tdb_get_pc(struct tdb_context* context)
+static void tdb_handle_catch_command(struct tdb_context* context, char** args, size_t arg_count)
 {
-    bool success;
-    uint64_t value = tdb_get_register_value(context->pid, x86_64_rip, &success);
+    if (arg_count < 1 || strcmp(args[0], "syscall") != 0) {
+        printf("invalid catch command.\n");
+        return;
+    }
 
-    if (!success) {
-        fprintf(stderr, "failed to get program counter (PC).\n");
-        return 0;
+    if (arg_count == 1 || strcmp(args[1], "all") == 0) {
+        tdb_syscall_set_parse(&context->caught_syscalls, "all");
+    }
+    else if (strcmp(args[1], "none") == 0) {
+        tdb_syscall_set_clear(&context->caught_syscalls);
+    }
+    else {
+        for (size_t i = 1; i < arg_count; i++) {
+            if (!tdb_syscall_set_parse(&context->caught_syscalls, args[i])) {
+                return;
+            }
+        }
+    }
+
+    // the filter can't be widened once the program runs, so anything outside it has to
+    // be caught by stopping at every system call
+    context->syscall_stepping = false;
+    for (long number = 0; number < TDB_SYSCALL_MAX; number++) {
+        if (tdb_syscall_set_contains(&context->caught_syscalls, number) &&
+            !tdb_syscall_set_contains(&context->filtered_syscalls, number)) {
+            context->syscall_stepping = true;
+            break;
+        }
     }
 
-    return value;
+    if (context->syscall_stepping) {
+        printf("not all caught system calls are in the seccomp filter, stopping at every system call\n");
+    }
 }
 
-static bool tdb_set_pc(struct tdb_context* context, uint64_t value)
+static void tdb_handle_gcore_command(struct tdb_context* context, char** args, size_t arg_count)
 {
-    bool success = tdb_set_register_value(context->pid, x86_64_rip, value);
+    char default_path[64];
+    snprintf(default_path, sizeof(default_path), "core.%d", context->pid);
 
-    if (!success) {
-        fprintf(stderr, "failed to set program counter (PC).\n");
-        return false;
+    const char* path = default_path;
+    bool skip_file_backed_readonly = false;
+
+    for (size_t i = 0; i < arg_count; i++) {
+        if (!strcmp(args[i], "skip-readonly")) {
+            skip_file_backed_readonly = true;
+        }
+        else {
+            path = args[i];
+        }
     }
 
-    return true;
+    if (context->threads.count == 0) {
+        printf("The program is not being run.\n");
+        return;
+    }
+
+    tdb_write_core(context, path, skip_file_backed_readonly);
 }
 
-static void tdb_wait_for_signal(struct tdb_context* context)
+#define TDB_FIND_MAX_PATTERN 256
+#define TDB_FIND_MAX_PRINTED 64
+
+static int tdb_hex_digit(char c)
 {
-    int wait_status;
-    waitpid(context->pid, &wait_status, 0);
-    // TODO: check wait status
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c = (char)tolower(c);
+    return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
 }
 
-static void tdb_step_over_breakpoint(struct tdb_context* context)
+// The pattern of find is "text" (which can span several words), a 0x-prefixed 64-bit
+// value in the target's byte order, or hex bytes like deadbeef. Returns its length, or
+// 0 if it isn't valid, and sets *word_count to the number of words it took.
+static size_t tdb_parse_find_pattern(char** args, size_t arg_count, uint8_t* pattern, size_t* word_count)
 {
-    // if the breakpoint has been hit, the program counter will now hold the address
-    // of the program instruction immediately after the breakpoint, so subtract 1.
-    uint64_t maybe_breakpoint_addr = tdb_get_pc(context) - 1;
+    *word_count = 1;
+
+    if (args[0][0] == '"') {
+        size_t length = 0;
+        for (size_t i = 0; i < arg_count; i++) {
+            const char* word = i == 0 ? args[0] + 1 : args[i];
+            size_t word_length = strlen(word);
+            const bool last = word_length > 0 && word[word_length - 1] == '"';
+            word_length -= last ? 1 : 0;
+
+            if (length + (i > 0 ? 1 : 0) + word_length > TDB_FIND_MAX_PATTERN) {
+                return 0;
+            }
+            if (i > 0) {
+                pattern[length++] = ' ';
+            }
+            memcpy(pattern + length, word, word_length);
+            length += word_length;
 
-    printf("PC = 0x%zx\n", maybe_breakpoint_addr + 1);
+            if (last) {
+                *word_count = i + 1;
+                return length;
+            }
+        }
+        return 0;
+    }
 
-    for (size_t i = 0; i < context->breakpoint_count; i++) {
-        struct tdb_breakpoint* bp = &context->breakpoints[i];
-        if (bp->address == maybe_breakpoint_addr && bp->enabled) {
-            tdb_set_pc(context, maybe_breakpoint_addr);
+    if (args[0][0] == '0' && args[0][1] == 'x') {
+        char* end;
+        errno = 0;
+        const uint64_t value = strtoull(args[0], &end, 16);
+        if (errno != 0 || *end != '\0') {
+            return 0;
+        }
+        memcpy(pattern, &value, sizeof(value));
+        return sizeof(value);
+    }
 
-            tdb_breakpoint_disable(bp);
-            ptrace(PTRACE_SINGLESTEP, context->pid, NULL, NULL);
-            tdb_wait_for_signal(context);
-            tdb_breakpoint_enable(bp);
+    const size_t digits = strlen(args[0]);
+    if (digits % 2 != 0 || digits / 2 > TDB_FIND_MAX_PATTERN) {
+        return 0;
+    }
 
-            break;
+    for (size_t i = 0; i < digits; i += 2) {
+        const int high = tdb_hex_digit(args[0][i]);
+        const int low = tdb_hex_digit(args[0][i + 1]);
+        if (high < 0 || low < 0) {
+            return 0;
         }
+        pattern[i / 2] = (uint8_t)(high << 4 | low);
     }
-}
 
-static void tdb_handle_continue_command(struct tdb_context* context)
-{
-    tdb_step_over_breakpoint(context);
-    ptrace(PTRACE_CONT, context->pid, NULL, NULL);
-    tdb_wait_for_signal(context);
+    return digits / 2;
 }
 
-static void tdb_handle_register_command(struct tdb_context* context, char** args, size_t arg_count)
+// Collects the readable mappings find should look at: all of them, the anonymous ones
+// ("anon"), those of files whose path contains the filter, or the parts of them inside
+// an address range like 7f0000000000-7f0000100000.
+static size_t tdb_collect_find_regions(struct tdb_context* context, const char* filter,
+                                       struct tdb_search_region* regions)
 {
-    if (arg_count == 1) {
-        if (!strcmp("dump", args[0])) {
-            tdb_dump_registers(context->pid);
-        }
-        else {
-            printf("invalid register argument: %s\n", args[0]);
+    uint64_t range_start = 0;
+    uint64_t range_end = UINT64_MAX;
+    const bool is_range = filter != NULL && sscanf(filter, "%" SCNx64 "-%" SCNx64, &range_start, &range_end) == 2;
+
+    size_t region_count = 0;
+    for (size_t i = 0; i < context->maps.mapping_count; i++) {
+        const struct tdb_mapping* mapping = &context->maps.mappings[i];
+        if (!(mapping->permissions & TDB_MAPPING_READ)) {
+            continue;
         }
-    }
-    else if (arg_count == 2) {
-        if (!strcmp("read", args[0])) {
-            enum x86_64_register reg = tdb_get_register_from_name(args[1]);
 
-            if (reg == x86_64_unknown) {
-                printf("unknown x86_64 register: %s\n", args[1]);
-            }
-            else {
-                bool success;
-                uint64_t value = tdb_get_register_value(context->pid, reg, &success);
-                if (success) {
-                    printf("0x%zx\n", value);
-                }
-                else {
-                    printf("error retrieving register value from memory\n");
-                }
+        if (filter != NULL && !is_range) {
+            const bool anonymous = mapping->object_index == TDB_MAPPING_NO_OBJECT;
+            if (!strcmp(filter, "anon") ? !anonymous
+                                        : anonymous || !strstr(context->maps.objects[mapping->object_index].path, filter)) {
+                continue;
             }
         }
-        else if (!strcmp("write", args[0])) {
+
+        struct tdb_search_region region = {.start = mapping->start, .end = mapping->end, .data = NULL};
+
+        // the maps of a core are its segments, and only what is in the file is searched
+        if (context->core.data != NULL) {
+            const struct tdb_core_segment* segment = &context->core.segments[i];
+            region.end = segment->start + segment->data_size;
+            region.data = segment->data;
+        }
+
+        if (range_start > region.start) {
+            region.data = region.data != NULL ? region.data + (range_start - region.start) : NULL;
+            region.start = range_start;
         }
-        else {
-            printf("invalid register arguments: %s %s\n", args[0], args[1]);
+        if (range_end < region.end) {
+            region.end = range_end;
+        }
+
+        if (region.start < region.end) {
+            regions[region_count++] = region;
         }
     }
-    else {
-        printf("invalid register command\n");
+
+    return region_count;
+}
+
+static void tdb_handle_find_command(struct tdb_context* context, char** args, size_t arg_count)
+{
+    uint8_t pattern[TDB_FIND_MAX_PATTERN];
+    size_t word_count = 0;
+    const size_t pattern_length = arg_count > 0 ? tdb_parse_find_pattern(args, arg_count, pattern, &word_count) : 0;
+
+    if (pattern_length == 0 || arg_count > word_count + 1) {
+        printf("invalid find command.\n");
+        return;
+    }
+
+    if (context->threads.count == 0) {
+        printf("The program is not being run.\n");
+        return;
+    }
+
+    // anything mapped since the last time shared objects changed is only seen this way
+    if (context->core.data == NULL && !tdb_process_maps_refresh(&context->maps, context->pid)) {
+        return;
+    }
+
+    struct tdb_search_region* regions = malloc((context->maps.mapping_count + 1) * sizeof(struct tdb_search_region));
+    if (regions == NULL) {
+        return;
+    }
+
+    const size_t region_count =
+        tdb_collect_find_regions(context, arg_count > word_count ? args[word_count] : NULL, regions);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    struct tdb_search_result result;
+    const bool success = tdb_search_memory(context->pid, regions, region_count, pattern, pattern_length, &result);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    free(regions);
+
+    if (!success) {
+        return;
+    }
+
+    for (size_t i = 0; i < result.stored_count && i < TDB_FIND_MAX_PRINTED; i++) {
+        char formatted[512];
+        tdb_format_address(context, result.matches[i], formatted, sizeof(formatted));
+        printf("%s\n", formatted);
+    }
+
+    if (result.match_count > TDB_FIND_MAX_PRINTED) {
+        printf("...\n");
     }
+
+    const double seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%zu matches in %.1f MiB of %zu regions, %.3f s (%.2f GiB/s) with %u threads\n", result.match_count,
+           (double)result.bytes_searched / (1024 * 1024), region_count, seconds,
+           seconds > 0 ? (double)result.bytes_searched / seconds / (1024 * 1024 * 1024) : 0.0, result.worker_count);
+
+    tdb_search_result_free(&result);
 }
 
-static void tdb_handle_memory_command(struct tdb_context* context, char** args, size_t arg_count)
+static void tdb_handle_snapshot_command(struct tdb_context* context)
 {
-    if (arg_count != 2 && arg_count != 3) {
-        printf("invalid memory command\n");
+    if (context->threads.count == 0) {
+        printf("The program is not being run.\n");
         return;
     }
 
-    uint64_t address_offset = strtoull(args[1], NULL, 16);
-    if (address_offset == 0) {
-        printf("Invalid address: %s\n", args[1]);
+    if (!tdb_process_maps_refresh(&context->maps, context->pid)) {
         return;
     }
 
-    if (!strcmp(args[0], "read")) {
-        if (arg_count != 2) {
-            printf("invalid memory read command\n");
-            return;
-        }
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    const bool success = tdb_snapshot_take(&context->snapshot, context->pid, &context->maps);
+    clock_gettime(CLOCK_MONOTONIC, &end);
 
-        bool read_success;
-        uint64_t data = tdb_read_memory(context->pid, context->stack_addr + address_offset, &read_success);
-        if (!read_success) {
-            printf("Failed to read memory at address: 0x%zx\n", address_offset);
+    if (success) {
+        const double seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+        printf("snapshot of %zu writable regions, %" PRIu64 " pages read in %.3f s%s\n",
+               context->snapshot.region_count, context->snapshot.pages_read, seconds,
+               context->snapshot.soft_dirty ? "" : " (no soft-dirty tracking, diff compares every page)");
+    }
+}
+
+#define TDB_DIFF_MAX_SYMBOLS 4
+
+// Prints the data symbols of the executable a changed range overlaps, or the object it
+// is in if it is elsewhere. The end of .bss is usually in an anonymous mapping after
+// the executable's, so anonymous memory is also looked up in its symbols.
+static void tdb_print_changed_range_symbols(struct tdb_context* context, uint64_t start, uint64_t end)
+{
+    uint64_t file_start;
+    if (!tdb_get_file_address(context, start, &file_start)) {
+        const struct tdb_mapped_object* object = tdb_process_maps_find_object(&context->maps, start);
+        if (object != NULL) {
+            const char* object_name = strrchr(object->path, '/');
+            printf(" in %s", object_name != NULL ? object_name + 1 : object->path);
             return;
         }
-        printf("0x%zx\n", data);
+
+        file_start = start - tdb_process_maps_main_bias(&context->maps);
     }
-    else if (!strcmp(args[0], "write")) {
-        if (arg_count != 3) {
-            printf("invalid memory write command\n");
-            return;
+
+    const uint64_t file_end = file_start + (end - start);
+    const struct tdb_symbol* symbols = context->symbols.symbols;
+
+    // find the first symbol starting at or after the range, then step back over any that
+    // reach into it
+    size_t low = 0;
+    size_t high = context->symbols.symbol_count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (symbols[middle].address < file_start) {
+            low = middle + 1;
         }
+        else {
+            high = middle;
+        }
+    }
+    while (low > 0 && symbols[low - 1].address + symbols[low - 1].size > file_start) {
+        low--;
+    }
 
-        uint64_t value = strtoull(args[2], NULL, 16);
+    size_t printed = 0;
+    for (size_t i = low; i < context->symbols.symbol_count && symbols[i].address < file_end; i++) {
+        if (symbols[i].type != STT_OBJECT || symbols[i].size == 0 || symbols[i].address + symbols[i].size <= file_start) {
+            continue;
+        }
 
-        bool write_success;
-        tdb_write_memory(context->pid, context->stack_addr + address_offset, value, &write_success);
-        if (!write_success) {
-            printf("Failed to write memory at address: 0x%zx\n", address_offset);
-            return;
+        if (printed == TDB_DIFF_MAX_SYMBOLS) {
+            printf(", ...");
+            break;
         }
+        printf("%s%s", printed == 0 ? " " : ", ", tdb_symbol_name(&context->symbols, &symbols[i]));
+        printed++;
     }
-    else {
-        printf("invalid memory command.\n");
+}
+
+static void tdb_handle_diff_command(struct tdb_context* context)
+{
+    if (context->threads.count == 0) {
+        printf("The program is not being run.\n");
+        return;
     }
+
+    if (!context->snapshot.taken) {
+        printf("No snapshot to compare with, take one with snapshot.\n");
+        return;
+    }
+
+    if (!tdb_process_maps_refresh(&context->maps, context->pid)) {
+        return;
+    }
+
+    struct tdb_snapshot_diff diff;
+    if (!tdb_snapshot_diff(&context->snapshot, context->pid, &context->maps, &diff)) {
+        return;
+    }
+
+    static const char* const KIND_NAMES[] = {
+        [TDB_SNAPSHOT_CHANGED] = "changed",
+        [TDB_SNAPSHOT_MAPPED] = "mapped",
+        [TDB_SNAPSHOT_UNMAPPED] = "unmapped",
+    };
+
+    for (size_t i = 0; i < diff.change_count; i++) {
+        const struct tdb_snapshot_change* change = &diff.changes[i];
+        printf("%-8s 0x%" PRIx64 "-0x%" PRIx64 " %6" PRIu64 " KiB", KIND_NAMES[change->kind], change->start, change->end,
+               (change->end - change->start) / 1024);
+        tdb_print_changed_range_symbols(context, change->start, change->end);
+        printf("\n");
+    }
+
+    printf("%zu changes, %" PRIu64 " of %" PRIu64 " pages read\n", diff.change_count, diff.pages_read,
+           diff.pages_total);
+    tdb_snapshot_diff_free(&diff);
 }
 
-static void tdb_handle_break_command(struct tdb_context* context, char** args, size_t arg_count)
+static void tdb_handle_stats_command(char** args, size_t arg_count)
 {
-    if (arg_count == 1) {
-        uint64_t address = strtoull(args[0], NULL, 16);
-        debug_print("address given: %ld (0x%zx)\n", address, address);
-        if (address != 0) {
-            tdb_set_breakpoint_at_address(context, address);
-        }
-        else {
-            fprintf(stderr, "invalid address: %s\n", args[0]);
-        }
+    if (arg_count == 0) {
+        tdb_stats_print(stdout, false);
+    }
+    else if (arg_count == 1 && strcmp(args[0], "json") == 0) {
+        tdb_stats_print(stdout, true);
+    }
+    else if (arg_count == 1 && strcmp(args[0], "reset") == 0) {
+        tdb_stats_reset();
     }
     else {
-        printf("invalid breakpoint command.\n");
+        printf("invalid stats command.\n");
     }
 }
 
-static void tdb_handle_command(struct tdb_context* context, char* line)
+void tdb_handle_command(struct tdb_context* context, const char* line)
 {
     // duplicate the line, because linenoise doesn't like it when we modify it directly
     char* line_copy = strdup(line);
@@ -321,39 +1743,182 @@ static void tdb_handle_command(struct tdb_context* context, char* line)
     }
 
     const char* CONTINUE_CMDS[] = {"continue", "c", "cont"};
+    const char* STEP_CMDS[] = {"step", "s"};
+    const char* NEXT_CMDS[] = {"next", "n"};
+    const char* STEPI_CMDS[] = {"stepi", "si"};
+    const char* NEXTI_CMDS[] = {"nexti", "ni"};
+    const char* FINISH_CMDS[] = {"finish", "fin"};
     const char* BREAK_CMDS[] = {"breakpoint", "break", "b", "bp"};
+    const char* RBREAK_CMDS[] = {"rbreak", "rb"};
     const char* REGISTER_CMDS[] = {"register", "r", "reg"};
     const char* MEMORY_CMDS[] = {"memory", "m", "mem"};
+    const char* DISASSEMBLE_CMDS[] = {"disassemble", "disas"};
+    const char* IGNORE_CMDS[] = {"ignore"};
+    const char* HBREAK_CMDS[] = {"hbreak", "hb"};
+    const char* WATCH_CMDS[] = {"watch", "w"};
+    const char* RWATCH_CMDS[] = {"rwatch", "rw"};
+    const char* HDELETE_CMDS[] = {"hdelete", "hd"};
+    const char* THREADS_CMDS[] = {"threads"};
+    const char* THREAD_CMDS[] = {"thread", "t"};
+    const char* BACKTRACE_CMDS[] = {"backtrace", "bt"};
+    const char* CALLTRACE_CMDS[] = {"calltrace"};
+    const char* TRACE_CMDS[] = {"trace"};
+    const char* PROFILE_CMDS[] = {"profile"};
+    const char* CATCH_CMDS[] = {"catch"};
+    const char* STATS_CMDS[] = {"stats"};
+    const char* GCORE_CMDS[] = {"gcore"};
+    const char* FIND_CMDS[] = {"find"};
+    const char* SNAPSHOT_CMDS[] = {"snapshot"};
+    const char* DIFF_CMDS[] = {"diff"};
+
+    tdb_stats_begin_command(line);
 
 #define __TDB_USER_COMMAND_IS_ONE_OF(X) is_one_of(command, X, sizeof(X) / sizeof(char*))
     // now dispatch on the main command
-    if (__TDB_USER_COMMAND_IS_ONE_OF(CONTINUE_CMDS)) {
+    if (context->core.data != NULL &&
+        (__TDB_USER_COMMAND_IS_ONE_OF(CONTINUE_CMDS) || __TDB_USER_COMMAND_IS_ONE_OF(STEP_CMDS) ||
+         __TDB_USER_COMMAND_IS_ONE_OF(NEXT_CMDS) || __TDB_USER_COMMAND_IS_ONE_OF(STEPI_CMDS) ||
+         __TDB_USER_COMMAND_IS_ONE_OF(NEXTI_CMDS) || __TDB_USER_COMMAND_IS_ONE_OF(FINISH_CMDS) ||
+         __TDB_USER_COMMAND_IS_ONE_OF(BREAK_CMDS) || __TDB_USER_COMMAND_IS_ONE_OF(RBREAK_CMDS) ||
+         __TDB_USER_COMMAND_IS_ONE_OF(IGNORE_CMDS) || __TDB_USER_COMMAND_IS_ONE_OF(HBREAK_CMDS) ||
+         __TDB_USER_COMMAND_IS_ONE_OF(WATCH_CMDS) || __TDB_USER_COMMAND_IS_ONE_OF(RWATCH_CMDS) ||
+         __TDB_USER_COMMAND_IS_ONE_OF(HDELETE_CMDS) || __TDB_USER_COMMAND_IS_ONE_OF(CALLTRACE_CMDS) ||
+         __TDB_USER_COMMAND_IS_ONE_OF(TRACE_CMDS) || __TDB_USER_COMMAND_IS_ONE_OF(PROFILE_CMDS) ||
+         __TDB_USER_COMMAND_IS_ONE_OF(CATCH_CMDS) || __TDB_USER_COMMAND_IS_ONE_OF(GCORE_CMDS) ||
+         __TDB_USER_COMMAND_IS_ONE_OF(SNAPSHOT_CMDS) || __TDB_USER_COMMAND_IS_ONE_OF(DIFF_CMDS))) {
+        printf("%s needs a running process, this is a core file.\n", command);
+    }
+    else if (__TDB_USER_COMMAND_IS_ONE_OF(CONTINUE_CMDS)) {
         tdb_handle_continue_command(context);
     }
+    else if (__TDB_USER_COMMAND_IS_ONE_OF(STEP_CMDS)) {
+        tdb_step_line(context, true);
+    }
+    else if (__TDB_USER_COMMAND_IS_ONE_OF(NEXT_CMDS)) {
+        tdb_step_line(context, false);
+    }
+    else if (__TDB_USER_COMMAND_IS_ONE_OF(STEPI_CMDS)) {
+        tdb_step_instruction(context, false);
+    }
+    else if (__TDB_USER_COMMAND_IS_ONE_OF(NEXTI_CMDS)) {
+        tdb_step_instruction(context, true);
+    }
+    else if (__TDB_USER_COMMAND_IS_ONE_OF(FINISH_CMDS)) {
+        tdb_finish(context);
+    }
     else if (__TDB_USER_COMMAND_IS_ONE_OF(BREAK_CMDS)) {
         tdb_handle_break_command(context, args, arg_count);
     }
+    else if (__TDB_USER_COMMAND_IS_ONE_OF(RBREAK_CMDS)) {
+        tdb_handle_rbreak_command(context, args, arg_count);
+    }
     else if (__TDB_USER_COMMAND_IS_ONE_OF(REGISTER_CMDS)) {
         tdb_handle_register_command(context, args, arg_count);
     }
     else if (__TDB_USER_COMMAND_IS_ONE_OF(MEMORY_CMDS)) {
         tdb_handle_memory_command(context, args, arg_count);
     }
+    else if (__TDB_USER_COMMAND_IS_ONE_OF(DISASSEMBLE_CMDS)) {
+        tdb_handle_disassemble_command(context, args, arg_count);
+    }
+    else if (__TDB_USER_COMMAND_IS_ONE_OF(IGNORE_CMDS)) {
+        tdb_handle_ignore_command(context, args, arg_count);
+    }
+    else if (__TDB_USER_COMMAND_IS_ONE_OF(HBREAK_CMDS)) {
+        tdb_handle_hbreak_command(context, args, arg_count);
+    }
+    else if (__TDB_USER_COMMAND_IS_ONE_OF(WATCH_CMDS)) {
+        tdb_handle_watch_command(context, args, arg_count, TDB_HW_BREAKPOINT_WRITE);
+    }
+    else if (__TDB_USER_COMMAND_IS_ONE_OF(RWATCH_CMDS)) {
+        // x86 can't trap on reads alone, so this also triggers on writes
+        tdb_handle_watch_command(context, args, arg_count, TDB_HW_BREAKPOINT_READ_WRITE);
+    }
+    else if (__TDB_USER_COMMAND_IS_ONE_OF(HDELETE_CMDS)) {
+        tdb_handle_hdelete_command(context, args, arg_count);
+    }
+    else if (__TDB_USER_COMMAND_IS_ONE_OF(THREADS_CMDS)) {
+        tdb_handle_threads_command(context);
+    }
+    else if (__TDB_USER_COMMAND_IS_ONE_OF(THREAD_CMDS)) {
+        tdb_handle_thread_command(context, args, arg_count);
+    }
+    else if (__TDB_USER_COMMAND_IS_ONE_OF(BACKTRACE_CMDS)) {
+        tdb_handle_backtrace_command(context, args, arg_count);
+    }
+    else if (__TDB_USER_COMMAND_IS_ONE_OF(CALLTRACE_CMDS)) {
+        tdb_handle_calltrace_command(context, args, arg_count);
+    }
+    else if (__TDB_USER_COMMAND_IS_ONE_OF(TRACE_CMDS)) {
+        tdb_handle_trace_command(context, args, arg_count);
+    }
+    else if (__TDB_USER_COMMAND_IS_ONE_OF(PROFILE_CMDS)) {
+        tdb_handle_profile_command(context, args, arg_count);
+    }
+    else if (__TDB_USER_COMMAND_IS_ONE_OF(CATCH_CMDS)) {
+        tdb_handle_catch_command(context, args, arg_count);
+    }
+    else if (__TDB_USER_COMMAND_IS_ONE_OF(STATS_CMDS)) {
+        tdb_handle_stats_command(args, arg_count);
+    }
+    else if (__TDB_USER_COMMAND_IS_ONE_OF(GCORE_CMDS)) {
+        tdb_handle_gcore_command(context, args, arg_count);
+    }
+    else if (__TDB_USER_COMMAND_IS_ONE_OF(FIND_CMDS)) {
+        tdb_handle_find_command(context, args, arg_count);
+    }
+    else if (__TDB_USER_COMMAND_IS_ONE_OF(SNAPSHOT_CMDS)) {
+        tdb_handle_snapshot_command(context);
+    }
+    else if (__TDB_USER_COMMAND_IS_ONE_OF(DIFF_CMDS)) {
+        tdb_handle_diff_command(context);
+    }
     else {
         // TODO: add 'help' command/message
         fprintf(stderr, "Unknown command\n");
     }
 #undef __TDB_USER_COMMAND_IS_ONE_OF
 
+    tdb_stats_end_command();
+
     free(args);
     free(line_copy);
 }
 
-void tdb_run(struct tdb_context* context)
+static bool tdb_start(struct tdb_context* context)
 {
-    int wait_status;
-    waitpid(context->pid, &wait_status, 0);
+    if (context->core.data != NULL) {
+        const int signal = context->core.threads[0].signal;
+        printf("core of process %d with %zu threads%s%s\n", context->pid, context->threads.count,
+               signal != 0 ? ", stopped by " : "", signal != 0 ? strsignal(signal) : "");
+        return true;
+    }
+
+    tdb_install_interrupt_handler();
+
+    if (context->attached) {
+        // the debug info was loaded before this, so the process is only paused from here
+        tdb_stop_all_threads(context);
+        if (context->threads.count == 0) {
+            return false;
+        }
+
+        tdb_handle_exec(context);
+        printf("attached to process %d with %zu threads\n", context->pid, context->threads.count);
+        return true;
+    }
+
+    // the first stop is the exec of the target
+    if (tdb_wait_for_stop(context) == NULL) {
+        return false;
+    }
+
+    tdb_handle_exec(context);
+    return true;
+}
 
+static void tdb_prompt(struct tdb_context* context)
+{
     char* line = NULL;
 
     while ((line = linenoise("tdb> "))) {
@@ -363,4 +1928,36 @@ void tdb_run(struct tdb_context* context)
             linenoiseFree(line);
         }
     }
+
+    if (context->attached && context->threads.count > 0) {
+        tdb_detach(context);
+    }
+}
+
+void tdb_run(struct tdb_context* context, bool resume)
+{
+    if (!tdb_start(context)) {
+        return;
+    }
+
+    if (resume) {
+        tdb_continue(context);
+    }
+
+    if (context->threads.count > 0) {
+        tdb_prompt(context);
+    }
+}
+
+void tdb_run_profile(struct tdb_context* context, double seconds, unsigned frequency)
+{
+    if (!tdb_start(context)) {
+        return;
+    }
+
+    tdb_profile(context, seconds > 0 ? (int64_t)(seconds * 1000) : -1, frequency);
+
+    if (context->threads.count > 0) {
+        tdb_prompt(context);
+    }
 }
@@ -3,22 +3,94 @@
 #include <linux/limits.h>
 
 #include "tdb/breakpoint.h"
+#include "tdb/breakpoint_table.h"
+#include "tdb/calltrace.h"
+#include "tdb/core.h"
+#include "tdb/debug_cache.h"
+#include "tdb/hw_breakpoint.h"
+#include "tdb/instruction_cache.h"
+#include "tdb/line_table.h"
+#include "tdb/maps.h"
 #include "tdb/register.h"
-
-#ifndef TDB_BREAKPOINTS_ALLOWED
-#define TDB_BREAKPOINTS_ALLOWED 1024
-#endif
+#include "tdb/snapshot.h"
+#include "tdb/step.h"
+#include "tdb/symbols.h"
+#include "tdb/syscalls.h"
+#include "tdb/thread.h"
+#include "tdb/unwind.h"
 
 struct tdb_context {
     pid_t pid;
     char target_path[PATH_MAX];
-    uint64_t stack_addr;
+    bool attached;  // the process was already running, so it is detached from at the end
+
+    // open when debugging a core file instead of a process, which then can't be run
+    struct tdb_core_image core;
+
+    struct tdb_process_maps maps;
+
+    struct tdb_symbol_table symbols;
+    struct tdb_line_table lines;
+    struct tdb_debug_cache debug_cache;
+    struct tdb_unwinder unwinder;
+
+    struct tdb_thread_table threads;
+    pid_t current_tid;
+
+    struct tdb_breakpoint_table breakpoints;
+    uint32_t next_breakpoint_id;
+    struct tdb_hw_breakpoints hw_breakpoints;
+
+    // cleared whenever code may have changed under it
+    struct tdb_instruction_cache instructions;
+
+    // the temporary breakpoints of a step, next or finish in progress
+    struct tdb_step_plan step;
+
+    struct tdb_calltrace calltrace;
 
-    struct tdb_breakpoint breakpoints[TDB_BREAKPOINTS_ALLOWED];
-    size_t breakpoint_count;
+    struct tdb_snapshot snapshot;
+
+    // Traced system calls are printed as they return, caught ones stop the program.
+    // Only those in the seccomp filter the target was launched with stop it by
+    // themselves; catching any other means resuming with PTRACE_SYSCALL.
+    struct tdb_syscall_set traced_syscalls;
+    struct tdb_syscall_set caught_syscalls;
+    struct tdb_syscall_set filtered_syscalls;
+    bool syscall_stepping;
 };
 
 void tdb_context_init(struct tdb_context* context, pid_t _pid, const char* _target_path);
 void tdb_context_free(struct tdb_context* context);
-void tdb_run(struct tdb_context* context);
+
+// Gives the prompt to the user at the first instruction of the target (or wherever it
+// was when attached to), or once it first stops if resume is set.
+void tdb_run(struct tdb_context* context, bool resume);
+
+// Profiles the target from its start, for the given number of seconds or until it exits
+// if that is 0, and then gives the prompt to the user if it is still running.
+void tdb_run_profile(struct tdb_context* context, double seconds, unsigned frequency);
+
+// Runs one line as if it was typed at the prompt.
+void tdb_handle_command(struct tdb_context* context, const char* line);
+
+// Re-reads the memory map of the process after it has exec'd and hooks the dynamic
+// loader, so the maps get refreshed whenever shared objects are loaded or unloaded.
+void tdb_handle_exec(struct tdb_context* context);
+
+// Formats a runtime address as "0x401126 <main+0x0> at test.c:5", leaving out the
+// symbol or source location when the target has none for it. Addresses in shared
+// objects are formatted as "0x7ffff7e4a000 in libc.so.6".
+void tdb_format_address(struct tdb_context* context, uint64_t address, char* buffer, size_t buffer_size);
+
+// Records the traced call or return a thread stopped at, planting a breakpoint on the
+// return address of a call the first time it is seen.
+void tdb_handle_calltrace_breakpoint(struct tdb_context* context, struct tdb_thread* thread, uint64_t address);
+
+// Maps a runtime address in the executable to its source line, with the line's address
+// range around it relocated to runtime addresses too.
+bool tdb_lookup_source_location(struct tdb_context* context, uint64_t address, struct tdb_source_location* location);
+
+// Prints the source line a runtime address belongs to, if the source file is readable.
+void tdb_print_source_line(struct tdb_context* context, uint64_t address);
 
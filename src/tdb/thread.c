@@ -0,0 +1,68 @@
+#include "thread.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+void tdb_thread_table_init(struct tdb_thread_table* table)
+{
+    table->threads = NULL;
+    table->count = 0;
+    table->capacity = 0;
+}
+
+void tdb_thread_table_free(struct tdb_thread_table* table)
+{
+    free(table->threads);
+    tdb_thread_table_init(table);
+}
+
+struct tdb_thread* tdb_thread_table_add(struct tdb_thread_table* table, pid_t tid, enum tdb_thread_state state)
+{
+    if (table->count == table->capacity) {
+        size_t new_capacity = table->capacity == 0 ? 8 : 2 * table->capacity;
+        struct tdb_thread* threads = realloc(table->threads, new_capacity * sizeof(struct tdb_thread));
+        if (threads == NULL) {
+            fprintf(stderr, "Failed to grow thread table to %zu threads\n", new_capacity);
+            return NULL;
+        }
+
+        table->threads = threads;
+        table->capacity = new_capacity;
+    }
+
+    struct tdb_thread* thread = &table->threads[table->count++];
+    thread->tid = tid;
+    thread->state = state;
+    tdb_register_cache_init(&thread->registers, tid);
+    thread->has_pending_status = false;
+    thread->wait_status = 0;
+    thread->pending_signal = 0;
+    thread->stopped_at_breakpoint = false;
+    thread->interrupted_breakpoint = 0;
+    thread->trace_syscall_exit = false;
+    thread->syscall_number = -1;
+
+    return thread;
+}
+
+struct tdb_thread* tdb_thread_table_find(struct tdb_thread_table* table, pid_t tid)
+{
+    for (size_t i = 0; i < table->count; i++) {
+        if (table->threads[i].tid == tid) {
+            return &table->threads[i];
+        }
+    }
+
+    return NULL;
+}
+
+void tdb_thread_table_remove(struct tdb_thread_table* table, pid_t tid)
+{
+    for (size_t i = 0; i < table->count; i++) {
+        if (table->threads[i].tid == tid) {
+            table->threads[i] = table->threads[table->count - 1];
+            table->count--;
+            return;
+        }
+    }
+}
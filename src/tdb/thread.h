@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "tdb/register.h"
+
+enum tdb_thread_state {
+    TDB_THREAD_NEW,  // reported by a clone event, initial stop not yet collected
+    TDB_THREAD_RUNNING,
+    TDB_THREAD_STOPPED,
+};
+
+struct tdb_thread {
+    pid_t tid;
+    enum tdb_thread_state state;
+    struct tdb_register_cache registers;
+
+    // a stop that was collected (e.g. while stopping all threads) but not yet handled
+    bool has_pending_status;
+    int wait_status;
+
+    // signal to deliver to the thread when it is next resumed
+    int pending_signal;
+
+    bool stopped_at_breakpoint;
+
+    // the breakpoint a signal interrupted stepping the thread off, 0 if none: the thread
+    // goes back to it once the signal is handled, and hitting it then isn't a new hit
+    uintptr_t interrupted_breakpoint;
+
+    // the last system call the thread stopped on entry to, kept for printing it on exit,
+    // which only stops if the thread is resumed with PTRACE_SYSCALL
+    bool trace_syscall_exit;
+    long syscall_number;
+    uint64_t syscall_arguments[6];
+};
+
+struct tdb_thread_table {
+    struct tdb_thread* threads;
+    size_t count;
+    size_t capacity;
+};
+
+void tdb_thread_table_init(struct tdb_thread_table* table);
+void tdb_thread_table_free(struct tdb_thread_table* table);
+
+// Pointers returned by add/find are invalidated by the next add or remove.
+struct tdb_thread* tdb_thread_table_add(struct tdb_thread_table* table, pid_t tid, enum tdb_thread_state state);
+struct tdb_thread* tdb_thread_table_find(struct tdb_thread_table* table, pid_t tid);
+void tdb_thread_table_remove(struct tdb_thread_table* table, pid_t tid);
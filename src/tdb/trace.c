@@ -0,0 +1,264 @@
+#include "trace.h"
+
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TDB_TRACE_MAGIC "TDBTRACE"
+#define TDB_TRACE_VERSION 1
+
+// 8 MiB of steps in flight, enough to ride out a slow disk for a while
+#define TDB_TRACE_RING_WORDS (1u << 20)
+
+#define TDB_TRACE_OUTPUT_BUFFER_SIZE (256 * 1024)
+
+// the longest encoding of a record: a pc, a mask and every register, 10 bytes each
+#define TDB_TRACE_MAX_RECORD_SIZE (10 * (2 + TDB_TRACE_REGISTER_WORDS))
+
+static size_t tdb_encode_varint(uint8_t* buffer, uint64_t value)
+{
+    size_t length = 0;
+    while (value >= 0x80) {
+        buffer[length++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    buffer[length++] = (uint8_t)value;
+    return length;
+}
+
+static uint64_t tdb_zigzag_encode(int64_t value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static int64_t tdb_zigzag_decode(uint64_t value)
+{
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static void* tdb_trace_writer_thread(void* argument)
+{
+    struct tdb_trace_writer* writer = argument;
+
+    uint8_t* output = writer->output;
+    size_t output_size = 0;
+
+    uint64_t previous_pc = 0;
+    uint64_t previous_registers[TDB_TRACE_REGISTER_WORDS] = {0};
+
+    size_t tail = atomic_load_explicit(&writer->tail, memory_order_relaxed);
+
+    for (;;) {
+        const bool finished = atomic_load_explicit(&writer->finished, memory_order_acquire);
+        const size_t head = atomic_load_explicit(&writer->head, memory_order_acquire);
+
+        if (tail == head) {
+            if (finished) {
+                break;
+            }
+
+            usleep(200);
+            continue;
+        }
+
+        // the producer only publishes whole records
+        while (tail != head) {
+            const uint64_t pc = writer->ring[tail++ & writer->ring_mask];
+            output_size += tdb_encode_varint(output + output_size, tdb_zigzag_encode((int64_t)(pc - previous_pc)));
+            previous_pc = pc;
+
+            if (writer->record_registers) {
+                const uint64_t mask = writer->ring[tail++ & writer->ring_mask];
+                output_size += tdb_encode_varint(output + output_size, mask);
+
+                for (size_t i = 0; i < TDB_TRACE_REGISTER_WORDS; i++) {
+                    if (mask & (1ull << i)) {
+                        const uint64_t value = writer->ring[tail++ & writer->ring_mask];
+                        const int64_t delta = (int64_t)(value - previous_registers[i]);
+                        output_size += tdb_encode_varint(output + output_size, tdb_zigzag_encode(delta));
+                        previous_registers[i] = value;
+                    }
+                }
+            }
+
+            if (output_size + TDB_TRACE_MAX_RECORD_SIZE > TDB_TRACE_OUTPUT_BUFFER_SIZE) {
+                writer->write_failed |= fwrite(output, 1, output_size, writer->file) != output_size;
+                output_size = 0;
+            }
+        }
+
+        atomic_store_explicit(&writer->tail, tail, memory_order_release);
+    }
+
+    writer->write_failed |= fwrite(output, 1, output_size, writer->file) != output_size;
+
+    return NULL;
+}
+
+bool tdb_trace_writer_start(struct tdb_trace_writer* writer, const char* path, bool record_registers,
+                            uint64_t load_bias)
+{
+    memset(writer, 0, sizeof(*writer));
+    writer->record_registers = record_registers;
+
+    writer->file = fopen(path, "wb");
+    if (writer->file == NULL) {
+        fprintf(stderr, "Failed to create trace file %s\n", path);
+        return false;
+    }
+
+    struct tdb_trace_file_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TDB_TRACE_MAGIC, sizeof(header.magic));
+    header.version = TDB_TRACE_VERSION;
+    header.flags = record_registers ? TDB_TRACE_FLAG_REGISTERS : 0;
+    header.load_bias = load_bias;
+
+    writer->ring = malloc(TDB_TRACE_RING_WORDS * sizeof(uint64_t));
+    writer->ring_mask = TDB_TRACE_RING_WORDS - 1;
+    writer->output = malloc(TDB_TRACE_OUTPUT_BUFFER_SIZE);
+
+    if (writer->ring == NULL || writer->output == NULL || fwrite(&header, sizeof(header), 1, writer->file) != 1 ||
+        pthread_create(&writer->thread, NULL, tdb_trace_writer_thread, writer) != 0) {
+        fprintf(stderr, "Failed to start trace writer for %s\n", path);
+        free(writer->ring);
+        free(writer->output);
+        fclose(writer->file);
+        return false;
+    }
+
+    return true;
+}
+
+void tdb_trace_writer_push(struct tdb_trace_writer* writer, uint64_t pc, const uint64_t* registers,
+                           const uint64_t* previous_registers)
+{
+    const size_t needed = writer->record_registers ? 2 + TDB_TRACE_REGISTER_WORDS : 1;
+    size_t head = atomic_load_explicit(&writer->head, memory_order_relaxed);
+
+    // back off while the writer thread catches up
+    while (head + needed - atomic_load_explicit(&writer->tail, memory_order_acquire) > writer->ring_mask + 1) {
+        sched_yield();
+    }
+
+    writer->ring[head++ & writer->ring_mask] = pc;
+
+    if (writer->record_registers) {
+        const size_t mask_index = head++;
+        uint64_t mask = 0;
+
+        for (size_t i = 0; i < TDB_TRACE_REGISTER_WORDS; i++) {
+            if (registers[i] != previous_registers[i] || writer->step_count == 0) {
+                mask |= 1ull << i;
+                writer->ring[head++ & writer->ring_mask] = registers[i];
+            }
+        }
+
+        writer->ring[mask_index & writer->ring_mask] = mask;
+    }
+
+    writer->step_count++;
+    atomic_store_explicit(&writer->head, head, memory_order_release);
+}
+
+bool tdb_trace_writer_finish(struct tdb_trace_writer* writer)
+{
+    atomic_store_explicit(&writer->finished, true, memory_order_release);
+    pthread_join(writer->thread, NULL);
+
+    // the step count is only known now
+    bool success = !writer->write_failed && fseek(writer->file, offsetof(struct tdb_trace_file_header, step_count),
+                                                  SEEK_SET) == 0 &&
+                   fwrite(&writer->step_count, sizeof(writer->step_count), 1, writer->file) == 1;
+    success = fclose(writer->file) == 0 && success;
+
+    free(writer->ring);
+    free(writer->output);
+    writer->ring = NULL;
+    writer->output = NULL;
+    writer->file = NULL;
+
+    return success;
+}
+
+bool tdb_trace_reader_open(struct tdb_trace_reader* reader, const char* path)
+{
+    memset(reader, 0, sizeof(*reader));
+
+    reader->file = fopen(path, "rb");
+    if (reader->file == NULL) {
+        fprintf(stderr, "Failed to open trace file %s\n", path);
+        return false;
+    }
+
+    if (fread(&reader->header, sizeof(reader->header), 1, reader->file) != 1 ||
+        memcmp(reader->header.magic, TDB_TRACE_MAGIC, sizeof(reader->header.magic)) ||
+        reader->header.version != TDB_TRACE_VERSION) {
+        fprintf(stderr, "%s is not a tdb trace file\n", path);
+        fclose(reader->file);
+        reader->file = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+static bool tdb_trace_read_varint(FILE* file, uint64_t* value)
+{
+    *value = 0;
+
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        const int byte = getc_unlocked(file);
+        if (byte == EOF) {
+            return false;
+        }
+
+        *value |= (uint64_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool tdb_trace_reader_next(struct tdb_trace_reader* reader)
+{
+    uint64_t encoded;
+    if (!tdb_trace_read_varint(reader->file, &encoded)) {
+        return false;
+    }
+
+    reader->pc += (uint64_t)tdb_zigzag_decode(encoded);
+    reader->changed_registers = 0;
+
+    if (reader->header.flags & TDB_TRACE_FLAG_REGISTERS) {
+        uint64_t mask;
+        if (!tdb_trace_read_varint(reader->file, &mask)) {
+            return false;
+        }
+
+        for (size_t i = 0; i < TDB_TRACE_REGISTER_WORDS; i++) {
+            if (mask & (1ull << i)) {
+                if (!tdb_trace_read_varint(reader->file, &encoded)) {
+                    return false;
+                }
+                reader->registers[i] += (uint64_t)tdb_zigzag_decode(encoded);
+            }
+        }
+
+        reader->changed_registers = (uint32_t)mask;
+    }
+
+    return true;
+}
+
+void tdb_trace_reader_close(struct tdb_trace_reader* reader)
+{
+    if (reader->file != NULL) {
+        fclose(reader->file);
+    }
+
+    memset(reader, 0, sizeof(*reader));
+}
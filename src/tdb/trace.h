@@ -0,0 +1,79 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/user.h>
+
+// Instruction traces are recorded by the stepping loop into a preallocated ring buffer
+// of 64-bit words and written out by a background thread, so that the loop itself
+// never formats, allocates or blocks on file I/O. Each step is one record:
+//
+//     pc                      always
+//     changed register mask   only when registers are recorded
+//     value of each changed   ...one word per bit set in the mask
+//
+// The file is a tdb_trace_file_header followed by the records, with the pc stored as a
+// zigzag varint of the delta to the previous pc, and register values as zigzag varints
+// of the delta to their previous value. Mask bits are word indices into
+// struct user_regs_struct.
+
+#define TDB_TRACE_REGISTER_WORDS (sizeof(struct user_regs_struct) / sizeof(uint64_t))
+
+#define TDB_TRACE_FLAG_REGISTERS 0x1
+
+struct tdb_trace_file_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t load_bias;  // of the main executable while recording
+    uint64_t step_count;
+};
+
+struct tdb_trace_writer {
+    uint64_t* ring;
+    size_t ring_mask;  // capacity - 1, the capacity is a power of two
+
+    // the producer only writes head and the writer thread only writes tail; both count
+    // words and are reduced modulo the capacity when indexing
+    _Atomic size_t head;
+    _Atomic size_t tail;
+    _Atomic bool finished;
+
+    bool record_registers;
+    uint64_t step_count;  // owned by the producer
+
+    FILE* file;
+    uint8_t* output;  // the writer thread's encoding buffer, allocated up front so it can't fail
+    bool write_failed;
+    pthread_t thread;
+};
+
+bool tdb_trace_writer_start(struct tdb_trace_writer* writer, const char* path, bool record_registers,
+                            uint64_t load_bias);
+
+// Called once per step. registers is only read when recording registers; the previous
+// registers are kept by the caller so only the changed ones are queued.
+void tdb_trace_writer_push(struct tdb_trace_writer* writer, uint64_t pc, const uint64_t* registers,
+                           const uint64_t* previous_registers);
+
+// Waits for everything to be written and closes the file.
+bool tdb_trace_writer_finish(struct tdb_trace_writer* writer);
+
+struct tdb_trace_reader {
+    FILE* file;
+    struct tdb_trace_file_header header;
+
+    uint64_t pc;
+    uint64_t registers[TDB_TRACE_REGISTER_WORDS];
+    uint32_t changed_registers;  // mask of the registers changed by the last step read
+};
+
+bool tdb_trace_reader_open(struct tdb_trace_reader* reader, const char* path);
+
+// Decodes the next step into reader->pc (and reader->registers), false at the end.
+bool tdb_trace_reader_next(struct tdb_trace_reader* reader);
+void tdb_trace_reader_close(struct tdb_trace_reader* reader);
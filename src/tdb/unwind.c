@@ -0,0 +1,494 @@
+#include "unwind.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tdb/stats.h"
+#include "tdb/utility.h"
+
+// DWARF register numbers on x86-64
+#define TDB_DWARF_RBP 6
+#define TDB_DWARF_RSP 7
+#define TDB_DWARF_RETURN_ADDRESS 16
+#define TDB_DWARF_REGISTER_COUNT 17
+
+static const uint8_t g_tdb_unwind_registers[TDB_UNWIND_REGISTER_COUNT] = {3, 6, 12, 13, 14, 15, 16};
+
+#define TDB_UNWIND_RBP_INDEX 1
+#define TDB_UNWIND_RETURN_ADDRESS_INDEX 6
+
+// enough stack for a few dozen typical frames in one read
+#define TDB_STACK_WINDOW_SIZE (16 * 1024)
+
+static void tdb_dwarf_error_free(Dwarf_Debug dbg, Dwarf_Error* error)
+{
+    if (*error != NULL) {
+        dwarf_dealloc(dbg, *error, DW_DLA_ERROR);
+        *error = NULL;
+    }
+}
+
+void tdb_unwinder_init(struct tdb_unwinder* unwinder)
+{
+    memset(unwinder, 0, sizeof(*unwinder));
+}
+
+void tdb_unwinder_free(struct tdb_unwinder* unwinder)
+{
+    for (size_t i = 0; i < unwinder->object_count; i++) {
+        struct tdb_unwind_object* object = &unwinder->objects[i];
+
+        for (size_t j = 0; j < object->fde_count_used; j++) {
+            free(object->fdes[j].rows);
+        }
+        free(object->fdes);
+
+        if (object->dbg != NULL) {
+            dwarf_fde_cie_list_dealloc(object->dbg, object->cie_data, object->cie_count, object->fde_data,
+                                       object->fde_count);
+            Dwarf_Error error = NULL;
+            dwarf_finish(object->dbg, &error);
+        }
+        if (object->fd != -1) {
+            close(object->fd);
+        }
+        free(object->path);
+    }
+
+    free(unwinder->objects);
+    tdb_unwinder_init(unwinder);
+}
+
+static void tdb_unwind_object_read(struct tdb_unwind_object* object)
+{
+    object->fd = open(object->path, O_RDONLY);
+    if (object->fd == -1) {
+        return;
+    }
+
+    Dwarf_Error error = NULL;
+    if (dwarf_init(object->fd, DW_DLC_READ, NULL, NULL, &object->dbg, &error) != DW_DLV_OK) {
+        object->dbg = NULL;
+        return;
+    }
+
+    dwarf_set_frame_rule_initial_value(object->dbg, DW_FRAME_SAME_VAL);
+    dwarf_set_frame_same_value(object->dbg, DW_FRAME_SAME_VAL);
+    dwarf_set_frame_undefined_value(object->dbg, DW_FRAME_UNDEFINED_VAL);
+    dwarf_set_frame_cfa_value(object->dbg, DW_FRAME_CFA_COL3);
+
+    // .eh_frame is what's there at run time, .debug_frame is for the rare object
+    // built without it
+    if (dwarf_get_fde_list_eh(object->dbg, &object->cie_data, &object->cie_count, &object->fde_data,
+                              &object->fde_count, &error) == DW_DLV_OK) {
+        return;
+    }
+    tdb_dwarf_error_free(object->dbg, &error);
+
+    if (dwarf_get_fde_list(object->dbg, &object->cie_data, &object->cie_count, &object->fde_data,
+                           &object->fde_count, &error) == DW_DLV_OK) {
+        return;
+    }
+    tdb_dwarf_error_free(object->dbg, &error);
+
+    dwarf_finish(object->dbg, &error);
+    object->dbg = NULL;
+}
+
+static void tdb_unwind_object_open(struct tdb_unwind_object* object)
+{
+    const uint64_t start = tdb_stats_start();
+    tdb_unwind_object_read(object);
+    tdb_stats_record(TDB_STAT_CFI_DECODE, start);
+}
+
+static struct tdb_unwind_object* tdb_unwinder_get_object(struct tdb_unwinder* unwinder, const char* path)
+{
+    for (size_t i = 0; i < unwinder->object_count; i++) {
+        if (!strcmp(unwinder->objects[i].path, path)) {
+            return &unwinder->objects[i];
+        }
+    }
+
+    if (unwinder->object_count == unwinder->object_capacity) {
+        size_t new_capacity = unwinder->object_capacity == 0 ? 8 : 2 * unwinder->object_capacity;
+
+        struct tdb_unwind_object* objects =
+            realloc(unwinder->objects, new_capacity * sizeof(struct tdb_unwind_object));
+        if (objects == NULL) {
+            return NULL;
+        }
+        unwinder->objects = objects;
+        unwinder->object_capacity = new_capacity;
+    }
+
+    struct tdb_unwind_object* object = &unwinder->objects[unwinder->object_count];
+    memset(object, 0, sizeof(*object));
+    object->fd = -1;
+
+    if ((object->path = strdup(path)) == NULL) {
+        return NULL;
+    }
+
+    tdb_unwind_object_open(object);
+    unwinder->object_count++;
+
+    return object;
+}
+
+static struct tdb_unwind_fde* tdb_unwind_object_get_fde(struct tdb_unwind_object* object, uint64_t pc)
+{
+    // the last FDE starting at or before the pc
+    size_t low = 0;
+    size_t high = object->fde_count_used;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (object->fdes[middle].low <= pc) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+
+    if (low > 0 && pc < object->fdes[low - 1].high) {
+        return &object->fdes[low - 1];
+    }
+
+    Dwarf_Fde fde;
+    Dwarf_Addr fde_low, fde_high;
+    Dwarf_Error error = NULL;
+    if (dwarf_get_fde_at_pc(object->fde_data, pc, &fde, &fde_low, &fde_high, &error) != DW_DLV_OK) {
+        tdb_dwarf_error_free(object->dbg, &error);
+        return NULL;
+    }
+
+    if (object->fde_count_used == object->fde_capacity) {
+        size_t new_capacity = object->fde_capacity == 0 ? 64 : 2 * object->fde_capacity;
+
+        struct tdb_unwind_fde* fdes = realloc(object->fdes, new_capacity * sizeof(struct tdb_unwind_fde));
+        if (fdes == NULL) {
+            return NULL;
+        }
+        object->fdes = fdes;
+        object->fde_capacity = new_capacity;
+    }
+
+    memmove(&object->fdes[low + 1], &object->fdes[low], (object->fde_count_used - low) * sizeof(struct tdb_unwind_fde));
+    object->fde_count_used++;
+
+    struct tdb_unwind_fde* entry = &object->fdes[low];
+    memset(entry, 0, sizeof(*entry));
+    entry->low = fde_low;
+    entry->high = fde_high + 1;  // libdwarf's high pc is the last byte covered
+    entry->fde = fde;
+
+    return entry;
+}
+
+static bool tdb_unwind_convert_rule(struct tdb_unwind_rule* rule, Dwarf_Small value_type, Dwarf_Signed offset_relevant,
+                                    Dwarf_Signed register_number, Dwarf_Signed offset)
+{
+    rule->offset = offset;
+
+    if (value_type == DW_EXPR_VAL_OFFSET) {
+        rule->type = TDB_UNWIND_CFA_OFFSET;
+        return true;
+    }
+
+    if (value_type != DW_EXPR_OFFSET) {
+        return false;
+    }
+
+    if (offset_relevant && register_number == DW_FRAME_CFA_COL3) {
+        rule->type = TDB_UNWIND_AT_CFA_OFFSET;
+    }
+    else if (register_number == DW_FRAME_SAME_VAL) {
+        rule->type = TDB_UNWIND_SAME_VALUE;
+    }
+    else if (register_number == DW_FRAME_UNDEFINED_VAL) {
+        rule->type = TDB_UNWIND_UNDEFINED;
+    }
+    else if (!offset_relevant && register_number >= 0 && register_number < TDB_DWARF_REGISTER_COUNT) {
+        rule->type = TDB_UNWIND_REGISTER;
+        rule->dwarf_register = (uint8_t)register_number;
+    }
+    else {
+        return false;
+    }
+
+    return true;
+}
+
+// Runs the CIE and FDE instructions up to the pc, the slow path the cache is there for.
+static bool tdb_unwind_read_row(struct tdb_unwind_object* object, struct tdb_unwind_fde* fde, uint64_t pc,
+                                struct tdb_unwind_row* row)
+{
+    Dwarf_Small value_type;
+    Dwarf_Signed offset_relevant, register_number, offset;
+    Dwarf_Ptr block;
+    Dwarf_Addr row_pc;
+    Dwarf_Error error = NULL;
+
+    memset(row, 0, sizeof(*row));
+
+    if (dwarf_get_fde_info_for_cfa_reg3(fde->fde, pc, &value_type, &offset_relevant, &register_number, &offset,
+                                        &block, &row_pc, &error) != DW_DLV_OK) {
+        tdb_dwarf_error_free(object->dbg, &error);
+        return false;
+    }
+
+    row->start = row_pc;
+    row->known_end = pc;
+    row->supported = value_type == DW_EXPR_OFFSET && register_number >= 0 &&
+                     register_number < TDB_DWARF_REGISTER_COUNT;
+    row->cfa_register = (uint8_t)register_number;
+    row->cfa_offset = offset_relevant ? offset : 0;
+
+    for (size_t i = 0; i < TDB_UNWIND_REGISTER_COUNT && row->supported; i++) {
+        if (dwarf_get_fde_info_for_reg3(fde->fde, g_tdb_unwind_registers[i], pc, &value_type, &offset_relevant,
+                                        &register_number, &offset, &block, &row_pc, &error) != DW_DLV_OK) {
+            tdb_dwarf_error_free(object->dbg, &error);
+            return false;
+        }
+
+        row->supported = tdb_unwind_convert_rule(&row->rules[i], value_type, offset_relevant, register_number, offset);
+    }
+
+    return true;
+}
+
+static bool tdb_unwind_compute_row(struct tdb_unwind_object* object, struct tdb_unwind_fde* fde, uint64_t pc,
+                                   struct tdb_unwind_row* row)
+{
+    const uint64_t start = tdb_stats_start();
+    const bool success = tdb_unwind_read_row(object, fde, pc, row);
+    tdb_stats_record(TDB_STAT_CFI_DECODE, start);
+    return success;
+}
+
+static const struct tdb_unwind_row* tdb_unwind_fde_get_row(struct tdb_unwind_object* object,
+                                                           struct tdb_unwind_fde* fde, uint64_t pc)
+{
+    // the last row starting at or before the pc
+    size_t low = 0;
+    size_t high = fde->row_count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (fde->rows[middle].start <= pc) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+
+    if (low > 0 && pc <= fde->rows[low - 1].known_end) {
+        return &fde->rows[low - 1];
+    }
+
+    struct tdb_unwind_row row;
+    if (!tdb_unwind_compute_row(object, fde, pc, &row)) {
+        return NULL;
+    }
+
+    // the pc may just be further into a row that is already known
+    if (low > 0 && fde->rows[low - 1].start == row.start) {
+        fde->rows[low - 1].known_end = pc;
+        return &fde->rows[low - 1];
+    }
+
+    if (fde->row_count == fde->row_capacity) {
+        size_t new_capacity = fde->row_capacity == 0 ? 4 : 2 * fde->row_capacity;
+
+        struct tdb_unwind_row* rows = realloc(fde->rows, new_capacity * sizeof(struct tdb_unwind_row));
+        if (rows == NULL) {
+            return NULL;
+        }
+        fde->rows = rows;
+        fde->row_capacity = new_capacity;
+    }
+
+    memmove(&fde->rows[low + 1], &fde->rows[low], (fde->row_count - low) * sizeof(struct tdb_unwind_row));
+    fde->rows[low] = row;
+    fde->row_count++;
+
+    return &fde->rows[low];
+}
+
+// Finds the unwind row for a pc, or NULL if there is no usable CFI for it.
+static const struct tdb_unwind_row* tdb_unwinder_find_row(struct tdb_unwinder* unwinder,
+                                                          const struct tdb_process_maps* maps, uint64_t pc)
+{
+    const struct tdb_mapped_object* mapped = tdb_process_maps_find_object(maps, pc);
+    if (mapped == NULL || !mapped->is_elf) {
+        return NULL;
+    }
+
+    struct tdb_unwind_object* object = tdb_unwinder_get_object(unwinder, mapped->path);
+    if (object == NULL || object->dbg == NULL) {
+        return NULL;
+    }
+
+    const uint64_t file_pc = pc - mapped->load_bias;
+
+    struct tdb_unwind_fde* fde = tdb_unwind_object_get_fde(object, file_pc);
+    if (fde == NULL) {
+        return NULL;
+    }
+
+    const struct tdb_unwind_row* row = tdb_unwind_fde_get_row(object, fde, file_pc);
+    return row != NULL && row->supported ? row : NULL;
+}
+
+// Reads the stack in large blocks instead of a word at a time. Frames move towards
+// higher addresses, so blocks are read upwards from the first word that was missing.
+struct tdb_stack_reader {
+    pid_t pid;
+    uint64_t base;
+    size_t size;
+    uint8_t data[TDB_STACK_WINDOW_SIZE];
+};
+
+static bool tdb_stack_read_word(struct tdb_stack_reader* reader, uint64_t address, uint64_t* value)
+{
+    if (address < reader->base || address + sizeof(uint64_t) > reader->base + reader->size) {
+        reader->base = address;
+        reader->size = tdb_read_memory_range(reader->pid, address, reader->data, sizeof(reader->data));
+
+        if (reader->size < sizeof(uint64_t)) {
+            return false;
+        }
+    }
+
+    memcpy(value, reader->data + (address - reader->base), sizeof(*value));
+    return true;
+}
+
+struct tdb_unwind_state {
+    uint64_t values[TDB_DWARF_REGISTER_COUNT];
+    uint32_t valid;  // bit per DWARF register number
+};
+
+static void tdb_unwind_state_from_registers(struct tdb_unwind_state* state, struct tdb_register_cache* registers)
+{
+    state->valid = 0;
+
+    for (int dwarf_register = 0; dwarf_register < TDB_DWARF_RETURN_ADDRESS; dwarf_register++) {
+        bool success;
+        state->values[dwarf_register] =
+            tdb_get_register_value_from_dwarf_register(registers, dwarf_register, &success);
+        state->valid |= (uint32_t)success << dwarf_register;
+    }
+
+    // the innermost frame "returns" to the current pc
+    bool success;
+    state->values[TDB_DWARF_RETURN_ADDRESS] = tdb_get_register_value(registers, x86_64_rip, &success);
+    state->valid |= (uint32_t)success << TDB_DWARF_RETURN_ADDRESS;
+}
+
+// The rules used when there is no CFI: the caller's frame pointer was pushed right after
+// the return address. Every other register keeps its value (TDB_UNWIND_SAME_VALUE is 0).
+static const struct tdb_unwind_row g_tdb_frame_pointer_row = {
+    .cfa_register = TDB_DWARF_RBP,
+    .supported = true,
+    .cfa_offset = 16,
+    .rules =
+        {
+            [TDB_UNWIND_RBP_INDEX] = {.type = TDB_UNWIND_AT_CFA_OFFSET, .offset = -16},
+            [TDB_UNWIND_RETURN_ADDRESS_INDEX] = {.type = TDB_UNWIND_AT_CFA_OFFSET, .offset = -8},
+        },
+};
+
+size_t tdb_unwind(struct tdb_unwinder* unwinder, const struct tdb_process_maps* maps, pid_t pid,
+                  struct tdb_register_cache* registers, struct tdb_frame* frames, size_t max_frames)
+{
+    struct tdb_stack_reader reader;
+    reader.pid = pid;
+    reader.base = 0;
+    reader.size = 0;
+
+    struct tdb_unwind_state state;
+    tdb_unwind_state_from_registers(&state, registers);
+
+    size_t frame_count = 0;
+
+    while (frame_count < max_frames) {
+        const uint64_t pc = state.values[TDB_DWARF_RETURN_ADDRESS];
+        if (!(state.valid & (1u << TDB_DWARF_RETURN_ADDRESS)) || pc == 0) {
+            break;
+        }
+
+        // the pc of an outer frame is a return address, which may already belong to the
+        // next function (or the next row) if the call was the last instruction
+        const uint64_t lookup_pc = frame_count == 0 ? pc : pc - 1;
+
+        const struct tdb_unwind_row* row = tdb_unwinder_find_row(unwinder, maps, lookup_pc);
+        if (row == NULL) {
+            row = &g_tdb_frame_pointer_row;
+        }
+
+        if (!(state.valid & (1u << row->cfa_register))) {
+            break;
+        }
+
+        const uint64_t cfa = state.values[row->cfa_register] + (uint64_t)row->cfa_offset;
+
+        frames[frame_count].pc = pc;
+        frames[frame_count].cfa = cfa;
+        frame_count++;
+
+        // a stack that doesn't move towards its base is garbage (or a loop)
+        if ((state.valid & (1u << TDB_DWARF_RSP)) && cfa <= state.values[TDB_DWARF_RSP]) {
+            break;
+        }
+
+        struct tdb_unwind_state caller;
+        caller.valid = 1u << TDB_DWARF_RSP;
+        caller.values[TDB_DWARF_RSP] = cfa;
+
+        for (size_t i = 0; i < TDB_UNWIND_REGISTER_COUNT; i++) {
+            const struct tdb_unwind_rule* rule = &row->rules[i];
+            const uint8_t dwarf_register = g_tdb_unwind_registers[i];
+            uint64_t value = 0;
+            bool known = false;
+
+            switch (rule->type) {
+            case TDB_UNWIND_SAME_VALUE:
+                value = state.values[dwarf_register];
+                known = state.valid & (1u << dwarf_register);
+                break;
+            case TDB_UNWIND_AT_CFA_OFFSET:
+                known = tdb_stack_read_word(&reader, cfa + (uint64_t)rule->offset, &value);
+                break;
+            case TDB_UNWIND_CFA_OFFSET:
+                value = cfa + (uint64_t)rule->offset;
+                known = true;
+                break;
+            case TDB_UNWIND_REGISTER:
+                value = state.values[rule->dwarf_register];
+                known = state.valid & (1u << rule->dwarf_register);
+                break;
+            default:
+                break;
+            }
+
+            if (known) {
+                caller.values[dwarf_register] = value;
+                caller.valid |= 1u << dwarf_register;
+            }
+        }
+
+        // an undefined return address marks the outermost frame
+        if (!(caller.valid & (1u << TDB_DWARF_RETURN_ADDRESS))) {
+            break;
+        }
+
+        state = caller;
+    }
+
+    return frame_count;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <libdwarf.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "tdb/maps.h"
+#include "tdb/register.h"
+
+// Stack unwinding from the call frame information in .eh_frame (or .debug_frame).
+// Asking libdwarf for the rules at a pc means re-running the CIE and FDE instructions,
+// so every row that was needed once is cached per FDE, in the object's link-time
+// addresses so the cache survives the object moving between runs. Functions without
+// CFI are unwound through their frame pointer.
+
+// the registers a caller can still see after a call: rbx, rbp, r12-r15 and the
+// return address column
+#define TDB_UNWIND_REGISTER_COUNT 7
+
+enum tdb_unwind_rule_type {
+    TDB_UNWIND_SAME_VALUE,
+    TDB_UNWIND_UNDEFINED,
+    TDB_UNWIND_AT_CFA_OFFSET,  // saved in memory at CFA + offset
+    TDB_UNWIND_CFA_OFFSET,     // the value is CFA + offset
+    TDB_UNWIND_REGISTER,       // held in another register
+};
+
+struct tdb_unwind_rule {
+    uint8_t type;
+    uint8_t dwarf_register;  // for TDB_UNWIND_REGISTER
+    uint8_t padding[6];
+    int64_t offset;
+};
+
+// A row applies to [start, next row), but libdwarf only tells us where a row starts,
+// so the end is the highest pc seen to resolve to it so far.
+struct tdb_unwind_row {
+    uint64_t start;
+    uint64_t known_end;
+    uint8_t cfa_register;  // DWARF register number
+    bool supported;        // false for DWARF expressions, which fall back to the frame pointer
+    uint8_t padding[6];
+    int64_t cfa_offset;
+    struct tdb_unwind_rule rules[TDB_UNWIND_REGISTER_COUNT];
+};
+
+struct tdb_unwind_fde {
+    uint64_t low;
+    uint64_t high;
+    Dwarf_Fde fde;
+
+    struct tdb_unwind_row* rows;  // sorted by start
+    size_t row_count;
+    size_t row_capacity;
+};
+
+struct tdb_unwind_object {
+    char* path;
+    int fd;
+    Dwarf_Debug dbg;  // NULL if the object has no CFI
+
+    Dwarf_Cie* cie_data;
+    Dwarf_Signed cie_count;
+    Dwarf_Fde* fde_data;
+    Dwarf_Signed fde_count;
+
+    struct tdb_unwind_fde* fdes;  // FDEs used so far, sorted by low
+    size_t fde_count_used;
+    size_t fde_capacity;
+};
+
+struct tdb_unwinder {
+    struct tdb_unwind_object* objects;
+    size_t object_count;
+    size_t object_capacity;
+};
+
+struct tdb_frame {
+    uint64_t pc;
+    uint64_t cfa;  // the stack pointer just before the call into this frame
+};
+
+void tdb_unwinder_init(struct tdb_unwinder* unwinder);
+void tdb_unwinder_free(struct tdb_unwinder* unwinder);
+
+// Walks the stack of a stopped thread from its registers, storing up to max_frames
+// frames, innermost first. Returns the number of frames found.
+size_t tdb_unwind(struct tdb_unwinder* unwinder, const struct tdb_process_maps* maps, pid_t pid,
+                  struct tdb_register_cache* registers, struct tdb_frame* frames, size_t max_frames);
@@ -1,19 +1,51 @@
+#define _GNU_SOURCE
+
 #include "utility.h"
 
 #include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/ptrace.h>
+#include <sys/uio.h>
 #include <time.h>
+#include <unistd.h>
+
+#include "tdb/stats.h"
+
+static pid_t g_tdb_memory_reader_pid = 0;
+static tdb_memory_reader g_tdb_memory_reader = NULL;
+static void* g_tdb_memory_reader_source = NULL;
+
+void tdb_set_memory_reader(pid_t pid, tdb_memory_reader reader, void* source)
+{
+    g_tdb_memory_reader_pid = reader != NULL ? pid : 0;
+    g_tdb_memory_reader = reader;
+    g_tdb_memory_reader_source = source;
+}
+
+static bool tdb_has_memory_reader(pid_t pid)
+{
+    return g_tdb_memory_reader != NULL && pid == g_tdb_memory_reader_pid;
+}
 
 uint64_t tdb_read_memory(pid_t pid, uintptr_t address, bool* success)
 {
+    if (tdb_has_memory_reader(pid)) {
+        uint64_t data = 0;
+        *success = g_tdb_memory_reader(g_tdb_memory_reader_source, address, &data, sizeof(data)) == sizeof(data);
+        if (!*success) {
+            fprintf(stderr, "Failed to read memory at address: 0x%" PRIXPTR ".\n", address);
+        }
+        return data;
+    }
+
     errno = 0;
-    uint64_t data = ptrace(PTRACE_PEEKDATA, pid, address, NULL);
+    uint64_t data = tdb_ptrace(PTRACE_PEEKDATA, pid, (void*)address, NULL);
     *success = errno == 0;
-    if (!success) {
+    if (!*success) {
 	fprintf(stderr,
 		"Failed to peek instruction data at address: 0x%" PRIXPTR
 		".\n"
@@ -25,11 +57,183 @@ uint64_t tdb_read_memory(pid_t pid, uintptr_t address, bool* success)
 
 void tdb_write_memory(pid_t pid, uintptr_t address, uint64_t value, bool* success)
 {
+    if (tdb_has_memory_reader(pid)) {
+        *success = false;
+        return;
+    }
+
     errno = 0;
-    ptrace(PTRACE_POKEDATA, pid, address, value);
+    tdb_ptrace(PTRACE_POKEDATA, pid, (void*)address, (void*)value);
     *success = errno == 0;
 }
 
+static size_t tdb_transfer_with_vm(pid_t pid, uintptr_t address, void* buffer, size_t length, bool write)
+{
+    size_t transferred = 0;
+
+    while (transferred < length) {
+        struct iovec local = {.iov_base = (uint8_t*)buffer + transferred, .iov_len = length - transferred};
+        struct iovec remote = {.iov_base = (void*)(address + transferred), .iov_len = length - transferred};
+
+        const uint64_t start = tdb_stats_start();
+        ssize_t count = write ? process_vm_writev(pid, &local, 1, &remote, 1, 0)
+                              : process_vm_readv(pid, &local, 1, &remote, 1, 0);
+        tdb_stats_record(TDB_STAT_PROCESS_VM, start);
+        if (count <= 0) {
+            break;
+        }
+
+        transferred += (size_t)count;
+    }
+
+    return transferred;
+}
+
+static size_t tdb_transfer_with_proc_mem(pid_t pid, uintptr_t address, void* buffer, size_t length, bool write)
+{
+    const uint64_t start = tdb_stats_start();
+
+    char mem_path[64];
+    snprintf(mem_path, sizeof(mem_path), "/proc/%d/mem", pid);
+
+    int fd = open(mem_path, write ? O_RDWR : O_RDONLY);
+    if (fd == -1) {
+        tdb_stats_record(TDB_STAT_PROC_MEM, start);
+        return 0;
+    }
+
+    size_t transferred = 0;
+
+    while (transferred < length) {
+        uint8_t* local = (uint8_t*)buffer + transferred;
+        off_t remote = (off_t)(address + transferred);
+
+        ssize_t count = write ? pwrite(fd, local, length - transferred, remote)
+                              : pread(fd, local, length - transferred, remote);
+        if (count <= 0) {
+            break;
+        }
+
+        transferred += (size_t)count;
+    }
+
+    close(fd);
+    tdb_stats_record(TDB_STAT_PROC_MEM, start);
+    return transferred;
+}
+
+static size_t tdb_read_with_peekdata(pid_t pid, uintptr_t address, uint8_t* buffer, size_t length)
+{
+    size_t transferred = 0;
+
+    while (transferred < length) {
+        const uintptr_t current = address + transferred;
+        const uintptr_t word_address = current & ~(uintptr_t)(sizeof(uint64_t) - 1);
+        const size_t skip = current - word_address;
+
+        errno = 0;
+        uint64_t word = tdb_ptrace(PTRACE_PEEKDATA, pid, (void*)word_address, NULL);
+        if (errno != 0) {
+            break;
+        }
+
+        size_t count = sizeof(uint64_t) - skip;
+        if (count > length - transferred) {
+            count = length - transferred;
+        }
+
+        memcpy(buffer + transferred, (uint8_t*)&word + skip, count);
+        transferred += count;
+    }
+
+    return transferred;
+}
+
+static size_t tdb_write_with_pokedata(pid_t pid, uintptr_t address, const uint8_t* buffer, size_t length)
+{
+    size_t transferred = 0;
+
+    while (transferred < length) {
+        const uintptr_t current = address + transferred;
+        const uintptr_t word_address = current & ~(uintptr_t)(sizeof(uint64_t) - 1);
+        const size_t skip = current - word_address;
+
+        size_t count = sizeof(uint64_t) - skip;
+        if (count > length - transferred) {
+            count = length - transferred;
+        }
+
+        uint64_t word = 0;
+        if (count != sizeof(uint64_t)) {  // partial word, preserve the surrounding bytes
+            errno = 0;
+            word = tdb_ptrace(PTRACE_PEEKDATA, pid, (void*)word_address, NULL);
+            if (errno != 0) {
+                break;
+            }
+        }
+
+        memcpy((uint8_t*)&word + skip, buffer + transferred, count);
+
+        errno = 0;
+        tdb_ptrace(PTRACE_POKEDATA, pid, (void*)word_address, (void*)word);
+        if (errno != 0) {
+            break;
+        }
+
+        transferred += count;
+    }
+
+    return transferred;
+}
+
+size_t tdb_read_memory_range(pid_t pid, uintptr_t address, void* buffer, size_t length)
+{
+    if (tdb_has_memory_reader(pid)) {
+        return g_tdb_memory_reader(g_tdb_memory_reader_source, address, buffer, length);
+    }
+
+    uint8_t* bytes = (uint8_t*)buffer;
+
+    size_t transferred = tdb_transfer_with_vm(pid, address, bytes, length, false);
+
+    if (transferred < length) {
+        transferred += tdb_transfer_with_proc_mem(pid, address + transferred, bytes + transferred,
+                                                  length - transferred, false);
+    }
+
+    if (transferred < length) {
+        transferred += tdb_read_with_peekdata(pid, address + transferred, bytes + transferred,
+                                              length - transferred);
+    }
+
+    return transferred;
+}
+
+size_t tdb_write_memory_range(pid_t pid, uintptr_t address, const void* buffer, size_t length)
+{
+    if (tdb_has_memory_reader(pid)) {
+        return 0;
+    }
+
+    uint8_t* bytes = (uint8_t*)buffer;
+
+    // process_vm_writev respects page protections, so writes into text pages will
+    // stop short here and get picked up by /proc/pid/mem below.
+    size_t transferred = tdb_transfer_with_vm(pid, address, bytes, length, true);
+
+    if (transferred < length) {
+        transferred += tdb_transfer_with_proc_mem(pid, address + transferred, bytes + transferred,
+                                                  length - transferred, true);
+    }
+
+    if (transferred < length) {
+        transferred += tdb_write_with_pokedata(pid, address + transferred, bytes + transferred,
+                                               length - transferred);
+    }
+
+    return transferred;
+}
+
 int msleep(long msec)
 {
     struct timespec ts;
@@ -1,10 +1,24 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <sys/types.h>
 
 uint64_t tdb_read_memory(pid_t pid, uintptr_t addr, bool* success);
 void tdb_write_memory(pid_t pid, uintptr_t addr, uint64_t value, bool* success);
 
+// Ranged transfers of arbitrary length and alignment. These go through
+// process_vm_readv/writev first, then /proc/pid/mem (which can also write to
+// read-only text pages), and only fall back to word-sized PEEK/POKEDATA when
+// both of those fail. Returns the number of bytes actually transferred, which
+// is less than length if the range runs into unmapped memory.
+size_t tdb_read_memory_range(pid_t pid, uintptr_t addr, void* buffer, size_t length);
+size_t tdb_write_memory_range(pid_t pid, uintptr_t addr, const void* buffer, size_t length);
+
+// Memory of a pid that isn't a live process (the one a core file was taken of) is read
+// through reader instead, and writes to it fail. A NULL reader removes it again.
+typedef size_t (*tdb_memory_reader)(void* source, uintptr_t addr, void* buffer, size_t length);
+void tdb_set_memory_reader(pid_t pid, tdb_memory_reader reader, void* source);
+
 int msleep(long msec);